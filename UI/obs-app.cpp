@@ -95,6 +95,8 @@ bool disable_shutdown_check = false;
 static bool multi = false;
 static bool log_verbose = false;
 static bool unfiltered_log = false;
+static bool profiler_trace = false;
+static struct bmem_snapshot startup_mem = {};
 bool opt_start_streaming = false;
 bool opt_start_recording = false;
 bool opt_studio_mode = false;
@@ -2281,28 +2283,70 @@ ProfilerSnapshot GetSnapshot()
 	return ProfilerSnapshot{profile_snapshot_create(), SnapshotRelease};
 }
 
-static void SaveProfilerData(const ProfilerSnapshot &snap)
+static BPtr<char> GetProfilerDataPath(const char *extension)
 {
 	if (currentLogFile.empty())
-		return;
+		return nullptr;
 
 	auto pos = currentLogFile.rfind('.');
 	if (pos == currentLogFile.npos)
-		return;
+		return nullptr;
 
 #define LITERAL_SIZE(x) x, (sizeof(x) - 1)
 	ostringstream dst;
 	dst.write(LITERAL_SIZE("obs-studio/profiler_data/"));
 	dst.write(currentLogFile.c_str(), pos);
-	dst.write(LITERAL_SIZE(".csv.gz"));
+	dst << extension;
 #undef LITERAL_SIZE
 
-	BPtr<char> path = GetConfigPathPtr(dst.str().c_str());
+	return GetConfigPathPtr(dst.str().c_str());
+}
+
+static void SaveProfilerData(const ProfilerSnapshot &snap)
+{
+	BPtr<char> path = GetProfilerDataPath(".csv.gz");
+	if (!path)
+		return;
+
 	if (!profiler_snapshot_dump_csv_gz(snap.get(), path))
 		blog(LOG_WARNING, "Could not save profiler data to '%s'",
 		     static_cast<const char *>(path));
 }
 
+static void SaveProfilerTrace()
+{
+	if (!profiler_trace)
+		return;
+
+	profiler_trace_stop();
+
+	BPtr<char> path = GetProfilerDataPath(".trace.json.gz");
+	if (!path)
+		return;
+
+	if (!profiler_trace_dump_json_gz(path))
+		blog(LOG_WARNING, "Could not save profiler trace to '%s'",
+		     static_cast<const char *>(path));
+}
+
+static void SaveMemoryData()
+{
+	if (!bmem_tags_enabled())
+		return;
+
+	struct bmem_snapshot mem;
+	bmem_snapshot(&mem);
+	bmem_snapshot_print(&mem, &startup_mem);
+
+	BPtr<char> path = GetProfilerDataPath(".memory.csv");
+	if (!path)
+		return;
+
+	if (!bmem_snapshot_dump_csv(&mem, &startup_mem, path))
+		blog(LOG_WARNING, "Could not save memory data to '%s'",
+		     static_cast<const char *>(path));
+}
+
 static auto ProfilerFree = [](void *) {
 	profiler_stop();
 
@@ -2312,6 +2356,8 @@ static auto ProfilerFree = [](void *) {
 	profiler_print_time_between_calls(snap.get());
 
 	SaveProfilerData(snap);
+	SaveProfilerTrace();
+	SaveMemoryData();
 
 	profiler_free();
 };
@@ -2339,6 +2385,7 @@ static int run_program(fstream &logFile, int argc, char *argv[])
 
 	profiler_start();
 	profile_register_root(run_program_init, 0);
+	bmem_snapshot(&startup_mem);
 
 	ScopeProfiler prof{run_program_init};
 
@@ -3347,6 +3394,10 @@ int main(int argc, char *argv[])
 		} else if (arg_is(argv[i], "--unfiltered_log", nullptr)) {
 			unfiltered_log = true;
 
+		} else if (arg_is(argv[i], "--profiler-trace", nullptr)) {
+			profiler_trace = true;
+			profiler_trace_start();
+
 		} else if (arg_is(argv[i], "--startstreaming", nullptr)) {
 			opt_start_streaming = true;
 
@@ -3413,6 +3464,7 @@ int main(int argc, char *argv[])
 				"--verbose: Make log more verbose.\n"
 				"--always-on-top: Start in 'always on top' mode.\n\n"
 				"--unfiltered_log: Make log unfiltered.\n\n"
+				"--profiler-trace: Record a timeline of the profiler and save it with the profiler data on exit.\n\n"
 				"--disable-updater: Disable built-in updater (Windows/Mac only)\n\n"
 				"--disable-missing-files-check: Disable the missing files dialog which can appear on startup.\n\n";
 
@@ -46,6 +46,13 @@ static QString MakeTimeLeftText(int hours, int minutes)
 				 Str("Minutes"));
 }
 
+static QString MakePacingText(int64_t a, int64_t b)
+{
+	return QString("%1 / %2 ms")
+		.arg(QString::number((double)a / 1000000.0, 'f', 2),
+		     QString::number((double)b / 1000000.0, 'f', 2));
+}
+
 static QString MakeMissedFramesText(uint32_t total_lagged,
 				    uint32_t total_rendered, long double num)
 {
@@ -97,6 +104,9 @@ OBSBasicStats::OBSBasicStats(QWidget *parent, bool closable)
 	newStat("DiskFullIn", recordTimeLeft, 0);
 	newStat("MemoryUsage", memUsage, 0);
 
+	wakeupError = new QLabel(this);
+	newStat("WakeupError", wakeupError, 0);
+
 	fps = new QLabel(this);
 	renderTime = new QLabel(this);
 	skippedFrames = new QLabel(this);
@@ -113,6 +123,9 @@ OBSBasicStats::OBSBasicStats(QWidget *parent, bool closable)
 	newStat("MissedFrames", missedFrames, 2);
 	newStat("SkippedFrames", skippedFrames, 2);
 
+	frameSlack = new QLabel(this);
+	newStat("FrameSlack", frameSlack, 2);
+
 	/* --------------------------------------------- */
 	QPushButton *closeButton = nullptr;
 	if (closable)
@@ -429,6 +442,32 @@ void OBSBasicStats::Update()
 	else
 		setThemeID(missedFrames, "");
 
+	/* ------------------ */
+
+	struct obs_frame_pacing_stats pacing;
+
+	if (obs_get_frame_pacing_stats(OBS_FRAME_PACING_WAKE_ERROR, &pacing)) {
+		wakeupError->setText(MakePacingText(pacing.p50, pacing.p99));
+
+		if (pacing.p99 > (int64_t)(fpsFrameTime * 500000.0l))
+			setThemeID(wakeupError, "error");
+		else if (pacing.p99 > (int64_t)(fpsFrameTime * 100000.0l))
+			setThemeID(wakeupError, "warning");
+		else
+			setThemeID(wakeupError, "");
+	}
+
+	if (obs_get_frame_pacing_stats(OBS_FRAME_PACING_SLACK, &pacing)) {
+		frameSlack->setText(MakePacingText(pacing.p50, pacing.p1));
+
+		if (pacing.p1 < 0)
+			setThemeID(frameSlack, "error");
+		else if (pacing.p1 < (int64_t)(fpsFrameTime * 100000.0l))
+			setThemeID(frameSlack, "warning");
+		else
+			setThemeID(frameSlack, "");
+	}
+
 	/* ------------------------------------------- */
 	/* recording/streaming stats                   */
 
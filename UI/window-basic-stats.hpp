@@ -24,6 +24,8 @@ class OBSBasicStats : public QFrame {
 	QLabel *renderTime = nullptr;
 	QLabel *skippedFrames = nullptr;
 	QLabel *missedFrames = nullptr;
+	QLabel *wakeupError = nullptr;
+	QLabel *frameSlack = nullptr;
 
 	QGridLayout *outputLayout = nullptr;
 
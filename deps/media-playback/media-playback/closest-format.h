@@ -119,3 +119,21 @@ static enum AVPixelFormat closest_format(enum AVPixelFormat fmt)
 
 	return AV_PIX_FMT_BGRA;
 }
+
+/* the jpeg formats are laid out exactly like the plain ones and only imply
+ * full range, so their planes can be passed on without converting them */
+static enum AVPixelFormat passthrough_format(enum AVPixelFormat fmt)
+{
+	switch (fmt) {
+	case AV_PIX_FMT_YUVJ420P:
+		return AV_PIX_FMT_YUV420P;
+	case AV_PIX_FMT_YUVJ422P:
+		return AV_PIX_FMT_YUV422P;
+	case AV_PIX_FMT_YUVJ444P:
+		return AV_PIX_FMT_YUV444P;
+	default:
+		break;
+	}
+
+	return fmt;
+}
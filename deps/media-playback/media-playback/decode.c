@@ -14,11 +14,14 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <util/platform.h>
+
 #include "decode.h"
 
 #include "media-playback.h"
 #include "media.h"
 #include <libavutil/mastering_display_metadata.h>
+#include <libavutil/imgutils.h>
 
 enum AVHWDeviceType hw_priority[] = {
 	AV_HWDEVICE_TYPE_D3D11VA,      AV_HWDEVICE_TYPE_DXVA2,
@@ -90,12 +93,24 @@ static int mp_open_codec(struct mp_decode *d, bool hw)
 	if (hw)
 		init_hw_decoder(d, c);
 
-	if (c->thread_count == 1 && c->codec_id != AV_CODEC_ID_PNG &&
-	    c->codec_id != AV_CODEC_ID_TIFF &&
-	    c->codec_id != AV_CODEC_ID_JPEG2000 &&
-	    c->codec_id != AV_CODEC_ID_MPEG4 && c->codec_id != AV_CODEC_ID_WEBP)
+	if (!d->audio && d->m->decode_threads > 0)
+		c->thread_count = d->m->decode_threads;
+	else if (c->thread_count == 1 && c->codec_id != AV_CODEC_ID_PNG &&
+		 c->codec_id != AV_CODEC_ID_TIFF &&
+		 c->codec_id != AV_CODEC_ID_JPEG2000 &&
+		 c->codec_id != AV_CODEC_ID_MPEG4 &&
+		 c->codec_id != AV_CODEC_ID_WEBP)
 		c->thread_count = 0;
 
+	/* frame threading decodes several frames at once, which is faster but
+	 * holds each frame back by one frame per thread.  slice threading
+	 * only splits up each frame, if the stream has slices to split. */
+	if (!d->audio && d->m->decode_threading == MP_DECODE_THREADING_FRAME)
+		c->thread_type = FF_THREAD_FRAME;
+	else if (!d->audio &&
+		 d->m->decode_threading == MP_DECODE_THREADING_SLICE)
+		c->thread_type = FF_THREAD_SLICE;
+
 	ret = avcodec_open2(c, d->codec, NULL);
 	if (ret < 0)
 		goto fail;
@@ -244,11 +259,32 @@ void mp_decode_clear_packets(struct mp_decode *d)
 	}
 }
 
+static void clear_frames(struct mp_decode *d)
+{
+	while (d->frames.size) {
+		struct mp_decoded_frame df;
+		circlebuf_pop_front(&d->frames, &df, sizeof(df));
+		av_frame_unref(df.frame);
+		da_push_back(d->frame_pool, &df.frame);
+	}
+
+	if (d->out_frame)
+		av_frame_unref(d->out_frame);
+	d->done = false;
+}
+
 void mp_decode_free(struct mp_decode *d)
 {
 	mp_decode_clear_packets(d);
 	circlebuf_free(&d->packets);
 
+	clear_frames(d);
+	circlebuf_free(&d->frames);
+	for (size_t i = 0; i < d->frame_pool.num; i++)
+		av_frame_free(&d->frame_pool.array[i]);
+	da_free(d->frame_pool);
+	av_frame_free(&d->out_frame);
+
 	av_packet_free(&d->pkt);
 	av_packet_free(&d->orig_pkt);
 
@@ -269,6 +305,9 @@ void mp_decode_free(struct mp_decode *d)
 		av_buffer_unref(&d->hw_ctx);
 	}
 
+	av_buffer_pool_uninit(&d->sw_pool);
+	av_buffer_unref(&d->sw_pool_ctx);
+
 	memset(d, 0, sizeof(*d));
 }
 
@@ -286,10 +325,10 @@ static inline int64_t get_estimated_duration(struct mp_decode *d,
 				    (AVRational){1, 1000000000});
 	} else {
 		if (last_pts)
-			return d->frame_pts - last_pts;
+			return d->dec_pts - last_pts;
 
-		if (d->last_duration)
-			return d->last_duration;
+		if (d->dec_duration)
+			return d->dec_duration;
 
 		return av_rescale_q(d->decoder->time_base.num,
 				    d->decoder->time_base,
@@ -297,6 +336,63 @@ static inline int64_t get_estimated_duration(struct mp_decode *d,
 	}
 }
 
+/* frames copied back from the gpu get their buffers from a pool rather
+ * than a new allocation for each frame, since decoded frames are held in
+ * the frame queue.  if this fails, av_hwframe_transfer_data allocates the
+ * buffers itself. */
+static void get_transfer_buffer(struct mp_decode *d)
+{
+	const AVFrame *hw = d->hw_frame;
+	AVFrame *sw = d->sw_frame;
+
+	if (!hw->hw_frames_ctx)
+		return;
+
+	bool changed = !d->sw_pool_ctx ||
+		       d->sw_pool_ctx->data != hw->hw_frames_ctx->data ||
+		       d->sw_pool_width != hw->width ||
+		       d->sw_pool_height != hw->height;
+
+	if (changed) {
+		enum AVPixelFormat *formats = NULL;
+		int size = -1;
+
+		av_buffer_pool_uninit(&d->sw_pool);
+		av_buffer_unref(&d->sw_pool_ctx);
+		d->sw_pool_ctx = av_buffer_ref(hw->hw_frames_ctx);
+		d->sw_pool_width = hw->width;
+		d->sw_pool_height = hw->height;
+		d->sw_pool_format = AV_PIX_FMT_NONE;
+
+		int ret = av_hwframe_transfer_get_formats(
+			hw->hw_frames_ctx, AV_HWFRAME_TRANSFER_DIRECTION_FROM,
+			&formats, 0);
+		if (ret == 0) {
+			d->sw_pool_format = formats[0];
+			av_freep(&formats);
+		}
+		if (d->sw_pool_format != AV_PIX_FMT_NONE)
+			size = av_image_get_buffer_size(d->sw_pool_format,
+							hw->width, hw->height,
+							32);
+		if (size > 0)
+			d->sw_pool = av_buffer_pool_init(size, NULL);
+	}
+
+	if (!d->sw_pool)
+		return;
+
+	sw->buf[0] = av_buffer_pool_get(d->sw_pool);
+	if (!sw->buf[0])
+		return;
+
+	av_image_fill_arrays(sw->data, sw->linesize, sw->buf[0]->data,
+			     d->sw_pool_format, hw->width, hw->height, 32);
+	sw->format = d->sw_pool_format;
+	sw->width = hw->width;
+	sw->height = hw->height;
+}
+
 static int decode_packet(struct mp_decode *d, int *got_frame)
 {
 	int ret;
@@ -333,10 +429,13 @@ static int decode_packet(struct mp_decode *d, int *got_frame)
 
 	if (*got_frame && d->hw) {
 		if (d->hw_frame->format != d->hw_format) {
-			d->frame = d->hw_frame;
+			d->dec_frame = d->hw_frame;
 			return ret;
 		}
 
+		av_frame_unref(d->sw_frame);
+		get_transfer_buffer(d);
+
 		int err = av_hwframe_transfer_data(d->sw_frame, d->hw_frame, 0);
 		if (err) {
 			ret = 0;
@@ -350,44 +449,58 @@ static int decode_packet(struct mp_decode *d, int *got_frame)
 		}
 	}
 
-	d->frame = d->sw_frame;
+	d->dec_frame = d->sw_frame;
 	return ret;
 }
 
-bool mp_decode_next(struct mp_decode *d)
+/* takes the next packet off the queue, which is shared with the demux
+ * thread when decoding on a thread of its own */
+static bool next_packet(struct mp_decode *d)
+{
+	struct mp_media *m = d->m;
+	AVPacket *pkt = NULL;
+
+	if (d->thread_valid)
+		pthread_mutex_lock(&m->pipe_mutex);
+	if (d->packets.size) {
+		circlebuf_pop_front(&d->packets, &pkt, sizeof(pkt));
+		if (d->thread_valid)
+			m->queued_bytes -= pkt->size;
+	}
+	if (d->thread_valid)
+		pthread_mutex_unlock(&m->pipe_mutex);
+
+	if (!pkt)
+		return false;
+
+	mp_media_free_packet(m, d->orig_pkt);
+	d->orig_pkt = pkt;
+	av_packet_ref(d->pkt, d->orig_pkt);
+	d->packet_pending = true;
+	return true;
+}
+
+static void decode_next(struct mp_decode *d, bool eof)
 {
-	bool eof = d->m->eof;
 	int got_frame;
 	int ret;
 
-	d->frame_ready = false;
+	d->dec_ready = false;
 
-	if (!eof && !d->packets.size)
-		return true;
+	while (!d->dec_ready) {
+		if (!d->packet_pending && !next_packet(d)) {
+			if (!eof)
+				return;
 
-	while (!d->frame_ready) {
-		if (!d->packet_pending) {
-			if (!d->packets.size) {
-				if (eof) {
-					d->pkt->data = NULL;
-					d->pkt->size = 0;
-				} else {
-					return true;
-				}
-			} else {
-				mp_media_free_packet(d->m, d->orig_pkt);
-				circlebuf_pop_front(&d->packets, &d->orig_pkt,
-						    sizeof(d->orig_pkt));
-				av_packet_ref(d->pkt, d->orig_pkt);
-				d->packet_pending = true;
-			}
+			d->pkt->data = NULL;
+			d->pkt->size = 0;
 		}
 
 		ret = decode_packet(d, &got_frame);
 
 		if (!got_frame && ret == 0) {
-			d->eof = true;
-			return true;
+			d->dec_eof = true;
+			return;
 		}
 		if (ret < 0) {
 #ifdef DETAILED_DEBUG_INFO
@@ -400,10 +513,10 @@ bool mp_decode_next(struct mp_decode *d)
 				av_packet_unref(d->pkt);
 				d->packet_pending = false;
 			}
-			return true;
+			return;
 		}
 
-		d->frame_ready = !!got_frame;
+		d->dec_ready = !!got_frame;
 
 		if (d->packet_pending) {
 			if (d->pkt->size) {
@@ -419,40 +532,84 @@ bool mp_decode_next(struct mp_decode *d)
 		}
 	}
 
-	if (d->frame_ready) {
-		int64_t last_pts = d->frame_pts;
+	int64_t last_pts = d->dec_pts;
 
-		if (d->in_frame->best_effort_timestamp == AV_NOPTS_VALUE)
-			d->frame_pts = d->next_pts;
-		else
-			d->frame_pts =
-				av_rescale_q(d->in_frame->best_effort_timestamp,
-					     d->stream->time_base,
-					     (AVRational){1, 1000000000});
+	if (d->in_frame->best_effort_timestamp == AV_NOPTS_VALUE)
+		d->dec_pts = d->dec_next_pts;
+	else
+		d->dec_pts = av_rescale_q(d->in_frame->best_effort_timestamp,
+					  d->stream->time_base,
+					  (AVRational){1, 1000000000});
 #if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 30, 100)
-		int64_t duration = d->in_frame->duration;
+	int64_t duration = d->in_frame->duration;
 #else
-		int64_t duration = d->in_frame->pkt_duration;
+	int64_t duration = d->in_frame->pkt_duration;
 #endif
-		if (!duration)
-			duration = get_estimated_duration(d, last_pts);
-		else
-			duration = av_rescale_q(duration, d->stream->time_base,
-						(AVRational){1, 1000000000});
-
-		if (d->m->speed != 100) {
-			d->frame_pts = av_rescale_q(
-				d->frame_pts, (AVRational){1, d->m->speed},
-				(AVRational){1, 100});
-			duration = av_rescale_q(duration,
-						(AVRational){1, d->m->speed},
-						(AVRational){1, 100});
-		}
+	if (!duration)
+		duration = get_estimated_duration(d, last_pts);
+	else
+		duration = av_rescale_q(duration, d->stream->time_base,
+					(AVRational){1, 1000000000});
+
+	if (d->m->speed != 100) {
+		d->dec_pts = av_rescale_q(d->dec_pts,
+					  (AVRational){1, d->m->speed},
+					  (AVRational){1, 100});
+		duration = av_rescale_q(duration, (AVRational){1, d->m->speed},
+					(AVRational){1, 100});
+	}
+
+	d->dec_duration = duration;
+	d->dec_next_pts = d->dec_pts + duration;
+}
+
+/* takes the next frame the decode thread has ready, without waiting */
+static bool next_decoded_frame(struct mp_decode *d)
+{
+	struct mp_media *m = d->m;
+	struct mp_decoded_frame df;
+
+	d->frame_ready = false;
+	if (d->out_frame)
+		av_frame_unref(d->out_frame);
 
-		d->last_duration = duration;
-		d->next_pts = d->frame_pts + duration;
+	pthread_mutex_lock(&m->pipe_mutex);
+	if (!d->frames.size) {
+		d->eof = d->done;
+		pthread_mutex_unlock(&m->pipe_mutex);
+		return true;
 	}
 
+	circlebuf_pop_front(&d->frames, &df, sizeof(df));
+	if (d->out_frame)
+		da_push_back(d->frame_pool, &d->out_frame);
+	pthread_cond_broadcast(&m->pipe_cond);
+	pthread_mutex_unlock(&m->pipe_mutex);
+
+	d->out_frame = df.frame;
+	d->frame = df.frame;
+	d->frame_pts = df.pts;
+	d->last_duration = df.duration;
+	d->next_pts = df.pts + df.duration;
+	d->frame_ready = true;
+	return true;
+}
+
+bool mp_decode_next(struct mp_decode *d)
+{
+	if (d->thread_valid)
+		return next_decoded_frame(d);
+
+	decode_next(d, d->m->eof);
+
+	d->frame_ready = d->dec_ready;
+	d->eof = d->dec_eof;
+	if (d->dec_ready) {
+		d->frame = d->dec_frame;
+		d->frame_pts = d->dec_pts;
+		d->last_duration = d->dec_duration;
+		d->next_pts = d->dec_next_pts;
+	}
 	return true;
 }
 
@@ -460,8 +617,102 @@ void mp_decode_flush(struct mp_decode *d)
 {
 	avcodec_flush_buffers(d->decoder);
 	mp_decode_clear_packets(d);
+	clear_frames(d);
 	d->eof = false;
 	d->frame_pts = 0;
 	d->frame_ready = false;
 	d->next_pts = 0;
+	d->dec_eof = false;
+	d->dec_pts = 0;
+	d->dec_ready = false;
+	d->dec_next_pts = 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static inline bool decode_thread_can_run(struct mp_decode *d)
+{
+	struct mp_media *m = d->m;
+
+	/* nothing else may be looked at while the pipeline is held */
+	if (m->pipe_hold || d->done)
+		return false;
+	if (d->frames.size >= d->max_frames * sizeof(struct mp_decoded_frame))
+		return false;
+	return d->packet_pending || d->packets.size || m->demux_eof;
+}
+
+static void push_decoded_frame(struct mp_decode *d)
+{
+	struct mp_decoded_frame df = {.pts = d->dec_pts,
+				      .duration = d->dec_duration};
+
+	AVFrame **const cached = da_end(d->frame_pool);
+	if (cached) {
+		df.frame = *cached;
+		da_pop_back(d->frame_pool);
+	} else {
+		df.frame = av_frame_alloc();
+	}
+
+	av_frame_move_ref(df.frame, d->dec_frame);
+	circlebuf_push_back(&d->frames, &df, sizeof(df));
+}
+
+static void *mp_decode_thread(void *opaque)
+{
+	struct mp_decode *d = opaque;
+	struct mp_media *m = d->m;
+
+	os_set_thread_name(d->audio ? "mp_audio_decode" : "mp_video_decode");
+
+	pthread_mutex_lock(&m->pipe_mutex);
+
+	for (;;) {
+		while (!m->pipe_stop && !decode_thread_can_run(d)) {
+			d->idle = true;
+			pthread_cond_broadcast(&m->pipe_cond);
+			pthread_cond_wait(&m->pipe_cond, &m->pipe_mutex);
+		}
+		if (m->pipe_stop)
+			break;
+
+		bool eof = m->demux_eof;
+		d->idle = false;
+		pthread_mutex_unlock(&m->pipe_mutex);
+
+		decode_next(d, eof);
+
+		pthread_mutex_lock(&m->pipe_mutex);
+		if (d->dec_ready)
+			push_decoded_frame(d);
+		else if (d->dec_eof)
+			d->done = true;
+		pthread_cond_broadcast(&m->pipe_cond);
+	}
+
+	d->idle = true;
+	pthread_cond_broadcast(&m->pipe_cond);
+	pthread_mutex_unlock(&m->pipe_mutex);
+	return NULL;
+}
+
+bool mp_decode_start_thread(struct mp_decode *d, size_t max_frames)
+{
+	d->max_frames = max_frames;
+	d->thread_valid =
+		pthread_create(&d->thread, NULL, mp_decode_thread, d) == 0;
+	if (!d->thread_valid)
+		blog(LOG_WARNING, "MP: Could not create %s decode thread",
+		     d->audio ? "audio" : "video");
+	return d->thread_valid;
+}
+
+/* the media's pipe_stop must be set first */
+void mp_decode_join_thread(struct mp_decode *d)
+{
+	if (d->thread_valid) {
+		pthread_join(d->thread, NULL);
+		d->thread_valid = false;
+	}
 }
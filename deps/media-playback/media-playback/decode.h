@@ -21,6 +21,7 @@ extern "C" {
 #endif
 
 #include <util/circlebuf.h>
+#include <util/darray.h>
 
 #ifdef _MSC_VER
 #pragma warning(push)
@@ -43,6 +44,12 @@ extern "C" {
 
 struct mp_media;
 
+struct mp_decoded_frame {
+	AVFrame *frame;
+	int64_t pts;
+	int64_t duration;
+};
+
 struct mp_decode {
 	struct mp_media *m;
 	AVStream *stream;
@@ -61,6 +68,13 @@ struct mp_decode {
 	AVFrame *frame;
 	enum AVPixelFormat hw_format;
 	bool got_first_keyframe;
+
+	/* buffers for frames copied back from the gpu */
+	AVBufferPool *sw_pool;
+	AVBufferRef *sw_pool_ctx;
+	enum AVPixelFormat sw_pool_format;
+	int sw_pool_width;
+	int sw_pool_height;
 	bool frame_ready;
 	bool eof;
 	bool hw;
@@ -70,6 +84,26 @@ struct mp_decode {
 	AVPacket *pkt;
 	bool packet_pending;
 	struct circlebuf packets;
+
+	/* timing of the last frame out of the decoder, which is ahead of the
+	 * frame being played when decoding on its own thread */
+	AVFrame *dec_frame;
+	int64_t dec_pts;
+	int64_t dec_next_pts;
+	int64_t dec_duration;
+	bool dec_ready;
+	bool dec_eof;
+
+	/* decoding on its own thread, frames are handed over through a short
+	 * queue guarded by the media's pipe_mutex */
+	pthread_t thread;
+	bool thread_valid;
+	struct circlebuf frames;
+	DARRAY(AVFrame *) frame_pool;
+	AVFrame *out_frame;
+	size_t max_frames;
+	bool idle;
+	bool done;
 };
 
 extern bool mp_decode_init(struct mp_media *media, enum AVMediaType type,
@@ -82,6 +116,10 @@ extern void mp_decode_push_packet(struct mp_decode *decode, AVPacket *pkt);
 extern bool mp_decode_next(struct mp_decode *decode);
 extern void mp_decode_flush(struct mp_decode *decode);
 
+extern bool mp_decode_start_thread(struct mp_decode *decode,
+				   size_t max_frames);
+extern void mp_decode_join_thread(struct mp_decode *decode);
+
 #ifdef __cplusplus
 }
 #endif
@@ -175,3 +175,13 @@ bool media_playback_has_audio(media_playback_t *mp)
 	else
 		return mp->media.has_audio;
 }
+
+bool media_playback_get_stats(media_playback_t *mp,
+			      struct mp_media_stats *stats)
+{
+	if (!mp || mp->is_cached)
+		return false;
+
+	mp_media_get_stats(&mp->media, stats);
+	return true;
+}
@@ -25,6 +25,12 @@ typedef void (*mp_video_cb)(void *opaque, struct obs_source_frame *frame);
 typedef void (*mp_audio_cb)(void *opaque, struct obs_source_audio *audio);
 typedef void (*mp_stop_cb)(void *opaque);
 
+enum mp_decode_threading {
+	MP_DECODE_THREADING_AUTO,
+	MP_DECODE_THREADING_FRAME,
+	MP_DECODE_THREADING_SLICE,
+};
+
 struct mp_media_info {
 	void *opaque;
 
@@ -39,6 +45,9 @@ struct mp_media_info {
 	char *ffmpeg_options;
 	int buffering;
 	int speed;
+	int seek_cache_mb;
+	int decode_threads;
+	enum mp_decode_threading decode_threading;
 	enum video_range_type force_range;
 	bool is_linear_alpha;
 	bool hardware_decoding;
@@ -48,6 +57,21 @@ struct mp_media_info {
 	bool full_decode;
 };
 
+struct mp_media_stats {
+	/* packets read ahead of the decoders */
+	uint64_t queued_bytes;
+	uint64_t max_queued_bytes;
+
+	/* frames decoded ahead of playback */
+	uint32_t queued_video_frames;
+	uint32_t queued_audio_frames;
+
+	/* video frames shown more than a frame late, and the times playback
+	 * had to wait for the decoders */
+	uint64_t late_frames;
+	uint64_t underruns;
+};
+
 extern media_playback_t *
 media_playback_create(const struct mp_media_info *info);
 extern void media_playback_destroy(media_playback_t *mp);
@@ -66,3 +90,5 @@ extern int64_t media_playback_get_frames(media_playback_t *mp);
 extern int64_t media_playback_get_duration(media_playback_t *mp);
 extern bool media_playback_has_video(media_playback_t *mp);
 extern bool media_playback_has_audio(media_playback_t *mp);
+extern bool media_playback_get_stats(media_playback_t *mp,
+				     struct mp_media_stats *stats);
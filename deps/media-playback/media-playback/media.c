@@ -17,6 +17,7 @@
 #include <util/platform.h>
 
 #include <assert.h>
+#include <inttypes.h>
 
 #include "media-playback.h"
 #include "media.h"
@@ -155,6 +156,14 @@ static inline enum video_range_type convert_color_range(enum AVColorRange r)
 	return r == AVCOL_RANGE_JPEG ? VIDEO_RANGE_FULL : VIDEO_RANGE_DEFAULT;
 }
 
+static inline enum video_range_type get_frame_range(const AVFrame *f)
+{
+	if (f->color_range == AVCOL_RANGE_UNSPECIFIED &&
+	    passthrough_format(f->format) != f->format)
+		return VIDEO_RANGE_FULL;
+	return convert_color_range(f->color_range);
+}
+
 static inline struct mp_decode *get_packet_decoder(mp_media_t *media,
 						   const AVPacket *pkt)
 {
@@ -169,7 +178,24 @@ static inline struct mp_decode *get_packet_decoder(mp_media_t *media,
 void mp_media_free_packet(struct mp_media *media, AVPacket *pkt)
 {
 	av_packet_unref(pkt);
+
+	if (media->pipelined)
+		pthread_mutex_lock(&media->pipe_mutex);
 	da_push_back(media->packet_pool, &pkt);
+	if (media->pipelined)
+		pthread_mutex_unlock(&media->pipe_mutex);
+}
+
+static inline void index_packet(mp_media_t *media, struct mp_decode *d,
+				const AVPacket *pkt)
+{
+	if (d == &media->v && media->use_seek_cache) {
+		int64_t pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+		if (pts != AV_NOPTS_VALUE)
+			mp_seek_cache_index_packet(
+				&media->seek_cache, pts,
+				(pkt->flags & AV_PKT_FLAG_KEY) != 0);
+	}
 }
 
 static int mp_media_next_packet(mp_media_t *media)
@@ -192,6 +218,8 @@ static int mp_media_next_packet(mp_media_t *media)
 	}
 
 	struct mp_decode *d = get_packet_decoder(media, pkt);
+	index_packet(media, d, pkt);
+
 	if (d && pkt->size) {
 		mp_decode_push_packet(d, pkt);
 	} else {
@@ -201,6 +229,221 @@ static int mp_media_next_packet(mp_media_t *media)
 	return ret;
 }
 
+/* ------------------------------------------------------------------------- */
+/* read-ahead
+ *
+ *   Packets are read on a demux thread of their own and queued for each
+ * stream's decode thread, and decoded frames wait in a short queue for the
+ * media thread, so a slow read or a slow frame to decode doesn't hold up
+ * presenting the frames that are already decoded.
+ *
+ *   Reading stops once READ_AHEAD_SIZE bytes are queued, unless one of the
+ * decoders has nothing left to decode, so a badly interleaved file can't
+ * leave a decoder waiting on packets stuck behind a full queue.  Seeking
+ * and flushing hold the whole pipeline first. */
+
+#define READ_AHEAD_SIZE (16 * 1024 * 1024)
+#define VIDEO_DECODE_AHEAD 3
+#define AUDIO_DECODE_AHEAD 16
+
+static inline bool decoder_starving(struct mp_decode *d)
+{
+	return d->idle && !d->done && !d->packets.size &&
+	       d->frames.size < d->max_frames * sizeof(struct mp_decoded_frame);
+}
+
+static inline bool demux_can_read(mp_media_t *m)
+{
+	/* nothing else may be looked at while the pipeline is held */
+	if (m->pipe_hold || m->demux_eof)
+		return false;
+	if (m->queued_bytes < READ_AHEAD_SIZE)
+		return true;
+	return (m->has_video && decoder_starving(&m->v)) ||
+	       (m->has_audio && decoder_starving(&m->a));
+}
+
+static void *mp_media_demux_thread(void *opaque)
+{
+	mp_media_t *m = opaque;
+
+	os_set_thread_name("mp_media_demux");
+
+	pthread_mutex_lock(&m->pipe_mutex);
+
+	for (;;) {
+		while (!m->pipe_stop && !demux_can_read(m)) {
+			m->demux_idle = true;
+			pthread_cond_broadcast(&m->pipe_cond);
+			pthread_cond_wait(&m->pipe_cond, &m->pipe_mutex);
+		}
+		if (m->pipe_stop)
+			break;
+
+		AVPacket *pkt;
+		AVPacket **const cached = da_end(m->packet_pool);
+		if (cached) {
+			pkt = *cached;
+			da_pop_back(m->packet_pool);
+		} else {
+			pkt = av_packet_alloc();
+		}
+
+		m->demux_idle = false;
+		pthread_mutex_unlock(&m->pipe_mutex);
+
+		struct mp_decode *d = NULL;
+		int ret = av_read_frame(m->fmt, pkt);
+		if (ret < 0) {
+			if (ret != AVERROR_EOF && ret != AVERROR_EXIT)
+				blog(LOG_WARNING,
+				     "MP: av_read_frame failed: %s (%d)",
+				     av_err2str(ret), ret);
+		} else {
+			d = get_packet_decoder(m, pkt);
+			index_packet(m, d, pkt);
+		}
+
+		pthread_mutex_lock(&m->pipe_mutex);
+
+		if (ret < 0) {
+			m->demux_eof = true;
+			m->demux_failed = ret != AVERROR_EOF &&
+					  ret != AVERROR_EXIT;
+		}
+
+		if (d && pkt->size) {
+			circlebuf_push_back(&d->packets, &pkt, sizeof(pkt));
+			m->queued_bytes += pkt->size;
+			if (m->queued_bytes > m->max_queued_bytes)
+				m->max_queued_bytes = m->queued_bytes;
+		} else {
+			av_packet_unref(pkt);
+			da_push_back(m->packet_pool, &pkt);
+		}
+
+		pthread_cond_broadcast(&m->pipe_cond);
+	}
+
+	m->demux_idle = true;
+	pthread_cond_broadcast(&m->pipe_cond);
+	pthread_mutex_unlock(&m->pipe_mutex);
+	return NULL;
+}
+
+static void mp_media_stop_pipeline(mp_media_t *m)
+{
+	pthread_mutex_lock(&m->pipe_mutex);
+	m->pipe_stop = true;
+	pthread_cond_broadcast(&m->pipe_cond);
+	pthread_mutex_unlock(&m->pipe_mutex);
+
+	if (m->demux_thread_valid) {
+		pthread_join(m->demux_thread, NULL);
+		m->demux_thread_valid = false;
+	}
+	mp_decode_join_thread(&m->v);
+	mp_decode_join_thread(&m->a);
+
+	if (m->pipelined && (m->late_frames || m->underruns))
+		blog(LOG_INFO,
+		     "MP: '%s': %" PRIu64 " late frames, %" PRIu64
+		     " decoder underruns, up to %zu KB read ahead",
+		     m->path, m->late_frames, m->underruns,
+		     m->max_queued_bytes / 1024);
+
+	m->pipelined = false;
+}
+
+static bool mp_media_start_pipeline(mp_media_t *m)
+{
+	m->pipe_stop = false;
+	m->pipelined = true;
+
+	if ((m->has_video &&
+	     !mp_decode_start_thread(&m->v, VIDEO_DECODE_AHEAD)) ||
+	    (m->has_audio &&
+	     !mp_decode_start_thread(&m->a, AUDIO_DECODE_AHEAD)))
+		goto fail;
+
+	if (pthread_create(&m->demux_thread, NULL, mp_media_demux_thread, m) !=
+	    0) {
+		blog(LOG_WARNING, "MP: Could not create demux thread");
+		goto fail;
+	}
+
+	m->demux_thread_valid = true;
+	return true;
+
+fail:
+	mp_media_stop_pipeline(m);
+	return false;
+}
+
+/* waits for the demux thread and the decode threads to finish what they're
+ * doing, after which the format context, the decoders and all the queues
+ * belong to the media thread until the pipeline is released */
+static void mp_media_hold_pipeline(mp_media_t *m)
+{
+	pthread_mutex_lock(&m->pipe_mutex);
+	m->pipe_hold = true;
+	pthread_cond_broadcast(&m->pipe_cond);
+
+	while (!m->demux_idle || (m->v.thread_valid && !m->v.idle) ||
+	       (m->a.thread_valid && !m->a.idle))
+		pthread_cond_wait(&m->pipe_cond, &m->pipe_mutex);
+
+	pthread_mutex_unlock(&m->pipe_mutex);
+}
+
+static void mp_media_release_pipeline(mp_media_t *m)
+{
+	pthread_mutex_lock(&m->pipe_mutex);
+	m->pipe_hold = false;
+	m->demux_eof = false;
+	m->demux_failed = false;
+	m->queued_bytes = 0;
+	pthread_cond_broadcast(&m->pipe_cond);
+	pthread_mutex_unlock(&m->pipe_mutex);
+}
+
+static inline bool has_decoded_output(struct mp_decode *d)
+{
+	return d->frames.size || d->done;
+}
+
+/* waits until a stream that has no frame ready gets one, or ends */
+static bool mp_media_wait_frames(mp_media_t *m)
+{
+	bool success = true;
+	bool waited = false;
+
+	pthread_mutex_lock(&m->pipe_mutex);
+
+	for (;;) {
+		bool need_v = m->has_video && !m->v.eof && !m->v.frame_ready;
+		bool need_a = m->has_audio && !m->a.eof && !m->a.frame_ready;
+
+		if ((need_v && has_decoded_output(&m->v)) ||
+		    (need_a && has_decoded_output(&m->a)) ||
+		    (!need_v && !need_a))
+			break;
+		if (m->demux_failed || m->pipe_stop) {
+			success = false;
+			break;
+		}
+
+		if (!waited) {
+			m->underruns++;
+			waited = true;
+		}
+		pthread_cond_wait(&m->pipe_cond, &m->pipe_mutex);
+	}
+
+	pthread_mutex_unlock(&m->pipe_mutex);
+	return success;
+}
+
 static inline bool mp_media_ready_to_start(mp_media_t *m)
 {
 	if (m->has_audio && !m->a.eof && !m->a.frame_ready)
@@ -246,15 +489,15 @@ static inline int get_sws_range(enum AVColorRange r)
 
 static bool mp_media_init_scaling(mp_media_t *m)
 {
-	int space = get_sws_colorspace(m->v.decoder->colorspace);
-	int range = get_sws_range(m->v.decoder->color_range);
+	/* the decoder context belongs to the decode thread, so go by the
+	 * frame instead */
+	const AVFrame *f = m->v.frame;
+	int space = get_sws_colorspace(f->colorspace);
+	int range = get_sws_range(f->color_range);
 	const int *coeff = sws_getCoefficients(space);
 
-	m->swscale = sws_getCachedContext(NULL, m->v.decoder->width,
-					  m->v.decoder->height,
-					  m->v.decoder->pix_fmt,
-					  m->v.decoder->width,
-					  m->v.decoder->height, m->scale_format,
+	m->swscale = sws_getCachedContext(NULL, f->width, f->height, f->format,
+					  f->width, f->height, m->scale_format,
 					  SWS_POINT, NULL, NULL, NULL);
 	if (!m->swscale) {
 		blog(LOG_WARNING, "MP: Failed to initialize scaler");
@@ -264,9 +507,8 @@ static bool mp_media_init_scaling(mp_media_t *m)
 	sws_setColorspaceDetails(m->swscale, coeff, range, coeff, range, 0,
 				 FIXED_1_0, FIXED_1_0);
 
-	int ret = av_image_alloc(m->scale_pic, m->scale_linesizes,
-				 m->v.decoder->width, m->v.decoder->height,
-				 m->scale_format, 32);
+	int ret = av_image_alloc(m->scale_pic, m->scale_linesizes, f->width,
+				 f->height, m->scale_format, 32);
 	if (ret < 0) {
 		blog(LOG_WARNING, "MP: Failed to create scale pic data");
 		return false;
@@ -275,12 +517,129 @@ static bool mp_media_init_scaling(mp_media_t *m)
 	return true;
 }
 
+static bool mp_media_fill_frame(mp_media_t *m, AVFrame *f)
+{
+	struct mp_decode *d = &m->v;
+	struct obs_source_frame *frame = &m->obsframe;
+	enum video_format new_format;
+	enum video_colorspace new_space;
+	enum video_range_type new_range;
+
+	bool flip = false;
+	if (m->swscale) {
+		int ret = sws_scale(m->swscale, (const uint8_t *const *)f->data,
+				    f->linesize, 0, f->height, m->scale_pic,
+				    m->scale_linesizes);
+		if (ret < 0)
+			return false;
+
+		flip = m->scale_linesizes[0] < 0 && m->scale_linesizes[1] == 0;
+		for (size_t i = 0; i < 4; i++) {
+			frame->data[i] = m->scale_pic[i];
+			frame->linesize[i] = abs(m->scale_linesizes[i]);
+		}
+
+	} else {
+		flip = f->linesize[0] < 0 && f->linesize[1] == 0;
+
+		for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+			frame->data[i] = f->data[i];
+			frame->linesize[i] = abs(f->linesize[i]);
+		}
+	}
+
+	if (flip)
+		frame->data[0] -= frame->linesize[0] * ((size_t)f->height - 1);
+
+	new_format = convert_pixel_format(m->scale_format);
+	new_space = convert_color_space(f->colorspace, f->color_trc,
+					f->color_primaries);
+	new_range = m->force_range == VIDEO_RANGE_DEFAULT
+			    ? get_frame_range(f)
+			    : m->force_range;
+
+	if (new_format != frame->format || new_space != m->cur_space ||
+	    new_range != m->cur_range) {
+		bool success;
+
+		frame->format = new_format;
+		frame->full_range = new_range == VIDEO_RANGE_FULL;
+
+		success = video_format_get_parameters_for_format(
+			new_space, new_range, new_format, frame->color_matrix,
+			frame->color_range_min, frame->color_range_max);
+
+		frame->format = new_format;
+		m->cur_space = new_space;
+		m->cur_range = new_range;
+
+		if (!success) {
+			frame->format = VIDEO_FORMAT_NONE;
+			return false;
+		}
+	}
+
+	if (frame->format == VIDEO_FORMAT_NONE)
+		return false;
+
+	frame->width = f->width;
+	frame->height = f->height;
+	frame->max_luminance = d->max_luminance;
+	frame->flip = flip;
+	frame->flags = m->is_linear_alpha ? OBS_SOURCE_FRAME_LINEAR_ALPHA : 0;
+	switch (f->color_trc) {
+	case AVCOL_TRC_BT709:
+	case AVCOL_TRC_GAMMA22:
+	case AVCOL_TRC_GAMMA28:
+	case AVCOL_TRC_SMPTE170M:
+	case AVCOL_TRC_SMPTE240M:
+	case AVCOL_TRC_IEC61966_2_1:
+		frame->trc = VIDEO_TRC_SRGB;
+		break;
+	case AVCOL_TRC_SMPTE2084:
+		frame->trc = VIDEO_TRC_PQ;
+		break;
+	case AVCOL_TRC_ARIB_STD_B67:
+		frame->trc = VIDEO_TRC_HLG;
+		break;
+	default:
+		frame->trc = VIDEO_TRC_DEFAULT;
+	}
+
+	return true;
+}
+
+/* after a seek, frames before the target are decoded but not played, so the
+ * seek lands on the exact frame rather than the keyframe before it */
+static void mp_media_skip_frames(mp_media_t *m)
+{
+	struct mp_decode *v = &m->v;
+	struct mp_decode *a = &m->a;
+
+	if (m->has_video && v->frame_ready && v->next_pts <= m->seek_skip_ns) {
+		bool can_convert = m->swscale ||
+				   m->scale_format ==
+					   passthrough_format(v->frame->format);
+		if (can_convert && mp_media_fill_frame(m, v->frame))
+			mp_seek_cache_add_frame(&m->seek_cache, &m->obsframe,
+						v->frame_pts, v->last_duration);
+
+		m->obsframe.data[0] = NULL;
+		v->frame_ready = false;
+	}
+	if (m->has_audio && a->frame_ready && a->next_pts <= m->seek_skip_ns)
+		a->frame_ready = false;
+}
+
 bool mp_media_prepare_frames(mp_media_t *m)
 {
 	bool actively_seeking = m->seek_next_ts && m->pause;
 
 	while (!mp_media_ready_to_start(m)) {
-		if (!m->eof) {
+		if (m->pipelined) {
+			if (!mp_media_wait_frames(m))
+				return false;
+		} else if (!m->eof) {
 			int ret = mp_media_next_packet(m);
 			if (ret == AVERROR_EOF || ret == AVERROR_EXIT) {
 				if (!actively_seeking) {
@@ -305,11 +664,19 @@ bool mp_media_prepare_frames(mp_media_t *m)
 			return false;
 		if (m->has_audio && !mp_decode_frame(&m->a))
 			return false;
+
+		if (m->seek_skip_ns)
+			mp_media_skip_frames(m);
 	}
 
+	m->seek_skip_ns = 0;
+
 	if (m->has_video && m->v.frame_ready && !m->swscale) {
-		m->scale_format = closest_format(m->v.frame->format);
-		if (m->scale_format != m->v.frame->format) {
+		enum AVPixelFormat format =
+			passthrough_format(m->v.frame->format);
+
+		m->scale_format = closest_format(format);
+		if (m->scale_format != format) {
 			if (!mp_media_init_scaling(m)) {
 				return false;
 			}
@@ -400,9 +767,6 @@ void mp_media_next_video(mp_media_t *m, bool preload)
 {
 	struct mp_decode *d = &m->v;
 	struct obs_source_frame *frame = &m->obsframe;
-	enum video_format new_format;
-	enum video_colorspace new_space;
-	enum video_range_type new_range;
 	AVFrame *f = d->frame;
 
 	if (!preload) {
@@ -417,61 +781,7 @@ void mp_media_next_video(mp_media_t *m, bool preload)
 		return;
 	}
 
-	bool flip = false;
-	if (m->swscale) {
-		int ret = sws_scale(m->swscale, (const uint8_t *const *)f->data,
-				    f->linesize, 0, f->height, m->scale_pic,
-				    m->scale_linesizes);
-		if (ret < 0)
-			return;
-
-		flip = m->scale_linesizes[0] < 0 && m->scale_linesizes[1] == 0;
-		for (size_t i = 0; i < 4; i++) {
-			frame->data[i] = m->scale_pic[i];
-			frame->linesize[i] = abs(m->scale_linesizes[i]);
-		}
-
-	} else {
-		flip = f->linesize[0] < 0 && f->linesize[1] == 0;
-
-		for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-			frame->data[i] = f->data[i];
-			frame->linesize[i] = abs(f->linesize[i]);
-		}
-	}
-
-	if (flip)
-		frame->data[0] -= frame->linesize[0] * ((size_t)f->height - 1);
-
-	new_format = convert_pixel_format(m->scale_format);
-	new_space = convert_color_space(f->colorspace, f->color_trc,
-					f->color_primaries);
-	new_range = m->force_range == VIDEO_RANGE_DEFAULT
-			    ? convert_color_range(f->color_range)
-			    : m->force_range;
-
-	if (new_format != frame->format || new_space != m->cur_space ||
-	    new_range != m->cur_range) {
-		bool success;
-
-		frame->format = new_format;
-		frame->full_range = new_range == VIDEO_RANGE_FULL;
-
-		success = video_format_get_parameters_for_format(
-			new_space, new_range, new_format, frame->color_matrix,
-			frame->color_range_min, frame->color_range_max);
-
-		frame->format = new_format;
-		m->cur_space = new_space;
-		m->cur_range = new_range;
-
-		if (!success) {
-			frame->format = VIDEO_FORMAT_NONE;
-			return;
-		}
-	}
-
-	if (frame->format == VIDEO_FORMAT_NONE)
+	if (!mp_media_fill_frame(m, f))
 		return;
 
 	frame->timestamp = m->full_decode
@@ -479,30 +789,6 @@ void mp_media_next_video(mp_media_t *m, bool preload)
 				   : (m->base_ts + d->frame_pts - m->start_ts +
 				      m->play_sys_ts - base_sys_ts);
 
-	frame->width = f->width;
-	frame->height = f->height;
-	frame->max_luminance = d->max_luminance;
-	frame->flip = flip;
-	frame->flags = m->is_linear_alpha ? OBS_SOURCE_FRAME_LINEAR_ALPHA : 0;
-	switch (f->color_trc) {
-	case AVCOL_TRC_BT709:
-	case AVCOL_TRC_GAMMA22:
-	case AVCOL_TRC_GAMMA28:
-	case AVCOL_TRC_SMPTE170M:
-	case AVCOL_TRC_SMPTE240M:
-	case AVCOL_TRC_IEC61966_2_1:
-		frame->trc = VIDEO_TRC_SRGB;
-		break;
-	case AVCOL_TRC_SMPTE2084:
-		frame->trc = VIDEO_TRC_PQ;
-		break;
-	case AVCOL_TRC_ARIB_STD_B67:
-		frame->trc = VIDEO_TRC_HLG;
-		break;
-	default:
-		frame->trc = VIDEO_TRC_DEFAULT;
-	}
-
 	if (!m->is_local_file && !d->got_first_keyframe) {
 
 #if LIBAVUTIL_VERSION_INT < AV_VERSION_INT(58, 29, 100)
@@ -515,6 +801,10 @@ void mp_media_next_video(mp_media_t *m, bool preload)
 		d->got_first_keyframe = true;
 	}
 
+	if (m->use_seek_cache)
+		mp_seek_cache_add_frame(&m->seek_cache, frame, d->frame_pts,
+					d->last_duration);
+
 	if (preload) {
 		if (m->seek_next_ts && m->v_seek_cb) {
 			m->v_seek_cb(m->opaque, frame);
@@ -564,22 +854,82 @@ static void seek_to(mp_media_t *m, int64_t pos)
 						     stream->time_base)
 				      : seek_pos;
 
+	bool accurate = m->use_seek_cache && m->has_video &&
+			seek_flags == AVSEEK_FLAG_BACKWARD;
+	m->cached_seek = false;
+
 	if (m->is_local_file) {
-		int ret = av_seek_frame(m->fmt, 0, seek_target, seek_flags);
+		AVStream *v_stream = m->v.stream;
+		int64_t keyframe;
+		int ret;
+
+		if (m->pipelined)
+			mp_media_hold_pipeline(m);
+
+		if (accurate &&
+		    mp_seek_cache_find_keyframe(
+			    &m->seek_cache,
+			    av_rescale_q(seek_pos, AV_TIME_BASE_Q,
+					 v_stream->time_base),
+			    &keyframe))
+			ret = av_seek_frame(m->fmt, v_stream->index, keyframe,
+					    AVSEEK_FLAG_BACKWARD);
+		else
+			ret = av_seek_frame(m->fmt, 0, seek_target,
+					    seek_flags);
 		if (ret < 0) {
 			blog(LOG_WARNING, "MP: Failed to seek: %s",
 			     av_err2str(ret));
 		}
-	}
 
-	if (m->has_video && m->is_local_file) {
-		mp_decode_flush(&m->v);
-		if (m->seek_next_ts && m->pause && m->v_preload_cb &&
-		    mp_media_prepare_frames(m))
+		if (accurate)
+			m->seek_skip_ns =
+				av_rescale(seek_pos, 100000, m->speed);
+
+		if (m->has_video)
+			mp_decode_flush(&m->v);
+		if (m->has_audio)
+			mp_decode_flush(&m->a);
+		if (m->pipelined)
+			mp_media_release_pipeline(m);
+
+		if (m->has_video && m->seek_next_ts && m->pause &&
+		    m->v_preload_cb && mp_media_prepare_frames(m))
 			mp_media_next_video(m, true);
 	}
-	if (m->has_audio && m->is_local_file)
-		mp_decode_flush(&m->a);
+}
+
+/* while paused, a frame that's still in the cache is shown straight away,
+ * and the decoder only seeks once playback resumes */
+static bool seek_to_cached_frame(mp_media_t *m, int64_t pos)
+{
+	if (!m->use_seek_cache || !m->pause || !m->v_seek_cb ||
+	    m->fmt->duration == AV_NOPTS_VALUE)
+		return false;
+
+	int64_t pts = av_rescale(pos, 100000, m->speed);
+	struct mp_cached_frame *cached =
+		mp_seek_cache_get_frame(&m->seek_cache, pts);
+	if (!cached)
+		return false;
+
+	m->cached_seek = true;
+	m->cached_seek_pos = pos;
+	m->v.next_pts = cached->pts + cached->duration;
+	if (m->has_audio)
+		m->a.next_pts = m->v.next_pts;
+
+	struct obs_source_frame frame = cached->frame;
+	frame.timestamp = m->base_ts + cached->pts - m->start_ts +
+			  m->play_sys_ts - base_sys_ts;
+	m->v_seek_cb(m->opaque, &frame);
+	return true;
+}
+
+static void finish_cached_seek(mp_media_t *m)
+{
+	seek_to(m, m->cached_seek_pos);
+	mp_media_prepare_frames(m);
 }
 
 bool mp_media_reset(mp_media_t *m)
@@ -766,6 +1116,19 @@ static bool init_avformat(mp_media_t *m)
 	return true;
 }
 
+static void mp_media_count_late_frame(mp_media_t *m)
+{
+	if (!m->pipelined || !m->has_video || !m->v.frame_ready ||
+	    !mp_media_can_play_frame(m, &m->v))
+		return;
+
+	if (os_gettime_ns() > m->next_ns + (uint64_t)m->v.last_duration) {
+		pthread_mutex_lock(&m->pipe_mutex);
+		m->late_frames++;
+		pthread_mutex_unlock(&m->pipe_mutex);
+	}
+}
+
 static void reset_ts(mp_media_t *m)
 {
 	m->base_ts += mp_media_get_base_pts(m);
@@ -789,6 +1152,9 @@ static inline bool mp_media_thread(mp_media_t *m)
 	if (!mp_media_init2(m)) {
 		return false;
 	}
+	if (!mp_media_start_pipeline(m)) {
+		return false;
+	}
 	if (!mp_media_reset(m)) {
 		return false;
 	}
@@ -841,11 +1207,14 @@ static inline bool mp_media_thread(mp_media_t *m)
 
 		if (seek) {
 			m->seek_next_ts = true;
-			seek_to(m, seek_pos);
+			if (!seek_to_cached_frame(m, seek_pos))
+				seek_to(m, seek_pos);
 			continue;
 		}
 
 		if (reset_time) {
+			if (m->cached_seek)
+				finish_cached_seek(m);
 			reset_ts(m);
 			continue;
 		}
@@ -861,6 +1230,8 @@ static inline bool mp_media_thread(mp_media_t *m)
 
 		/* frames are ready */
 		if (is_active && !timeout) {
+			mp_media_count_late_frame(m);
+
 			if (m->has_video)
 				mp_media_next_video(m, false);
 			if (m->has_audio)
@@ -881,8 +1252,11 @@ static inline bool mp_media_thread(mp_media_t *m)
 static void *mp_media_thread_start(void *opaque)
 {
 	mp_media_t *m = opaque;
+	bool success = mp_media_thread(m);
+
+	mp_media_stop_pipeline(m);
 
-	if (!mp_media_thread(m)) {
+	if (!success) {
 		if (m->stop_cb) {
 			m->stop_cb(m->opaque);
 		}
@@ -902,6 +1276,14 @@ static inline bool mp_media_init_internal(mp_media_t *m,
 		blog(LOG_WARNING, "MP: Failed to init semaphore");
 		return false;
 	}
+	if (pthread_mutex_init(&m->pipe_mutex, NULL) != 0) {
+		blog(LOG_WARNING, "MP: Failed to init mutex");
+		return false;
+	}
+	if (pthread_cond_init(&m->pipe_cond, NULL) != 0) {
+		blog(LOG_WARNING, "MP: Failed to init condition variable");
+		return false;
+	}
 
 	m->path = info->path ? bstrdup(info->path) : NULL;
 	m->format_name = info->format ? bstrdup(info->format) : NULL;
@@ -923,6 +1305,7 @@ bool mp_media_init(mp_media_t *media, const struct mp_media_info *info)
 {
 	memset(media, 0, sizeof(*media));
 	pthread_mutex_init_value(&media->mutex);
+	pthread_mutex_init_value(&media->pipe_mutex);
 	media->opaque = info->opaque;
 	media->v_cb = info->v_cb;
 	media->a_cb = info->a_cb;
@@ -934,10 +1317,18 @@ bool mp_media_init(mp_media_t *media, const struct mp_media_info *info)
 	media->is_linear_alpha = info->is_linear_alpha;
 	media->buffering = info->buffering;
 	media->speed = info->speed;
+	media->decode_threads = info->decode_threads;
+	media->decode_threading = info->decode_threading;
 	media->request_preload = info->request_preload;
 	media->is_local_file = info->is_local_file;
+	media->use_seek_cache = info->is_local_file && !info->full_decode &&
+				info->seek_cache_mb > 0;
 	da_init(media->packet_pool);
 
+	if (media->use_seek_cache)
+		mp_seek_cache_init(&media->seek_cache,
+				   (size_t)info->seek_cache_mb * 1024 * 1024);
+
 	if (!info->is_local_file || media->speed < 1 || media->speed > 200)
 		media->speed = 100;
 
@@ -983,8 +1374,11 @@ void mp_media_free(mp_media_t *media)
 	for (size_t i = 0; i < media->packet_pool.num; i++)
 		av_packet_free(&media->packet_pool.array[i]);
 	da_free(media->packet_pool);
+	mp_seek_cache_free(&media->seek_cache);
 	avformat_close_input(&media->fmt);
 	pthread_mutex_destroy(&media->mutex);
+	pthread_mutex_destroy(&media->pipe_mutex);
+	pthread_cond_destroy(&media->pipe_cond);
 	os_sem_destroy(media->sem);
 	sws_freeContext(media->swscale);
 	av_freep(&media->scale_pic[0]);
@@ -992,6 +1386,7 @@ void mp_media_free(mp_media_t *media)
 	bfree(media->format_name);
 	memset(media, 0, sizeof(*media));
 	pthread_mutex_init_value(&media->mutex);
+	pthread_mutex_init_value(&media->pipe_mutex);
 }
 
 void mp_media_play(mp_media_t *m, bool loop, bool reconnecting)
@@ -1100,3 +1495,17 @@ void mp_media_seek(mp_media_t *m, int64_t pos)
 
 	os_sem_post(m->sem);
 }
+
+void mp_media_get_stats(mp_media_t *m, struct mp_media_stats *stats)
+{
+	const size_t frame_size = sizeof(struct mp_decoded_frame);
+
+	pthread_mutex_lock(&m->pipe_mutex);
+	stats->queued_bytes = m->queued_bytes;
+	stats->max_queued_bytes = m->max_queued_bytes;
+	stats->queued_video_frames = (uint32_t)(m->v.frames.size / frame_size);
+	stats->queued_audio_frames = (uint32_t)(m->a.frames.size / frame_size);
+	stats->late_frames = m->late_frames;
+	stats->underruns = m->underruns;
+	pthread_mutex_unlock(&m->pipe_mutex);
+}
@@ -17,7 +17,9 @@
 #pragma once
 
 #include <obs.h>
+#include "media-playback.h"
 #include "decode.h"
+#include "seek-cache.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -70,6 +72,8 @@ struct mp_media {
 	bool is_file;
 	bool eof;
 	bool hw;
+	int decode_threads;
+	enum mp_decode_threading decode_threading;
 
 	struct obs_source_frame obsframe;
 	enum video_colorspace cur_space;
@@ -84,6 +88,13 @@ struct mp_media {
 	int64_t base_ts;
 	bool full_decode;
 
+	/* keyframe index and frame cache, see seek-cache.h */
+	struct mp_seek_cache seek_cache;
+	bool use_seek_cache;
+	int64_t seek_skip_ns;
+	bool cached_seek;
+	int64_t cached_seek_pos;
+
 	uint64_t interrupt_poll_ts;
 
 	pthread_mutex_t mutex;
@@ -98,6 +109,23 @@ struct mp_media {
 	bool thread_valid;
 	pthread_t thread;
 
+	/* read-ahead, see mp_media_demux_thread().  The demux thread and the
+	 * decode threads share pipe_mutex and pipe_cond. */
+	pthread_mutex_t pipe_mutex;
+	pthread_cond_t pipe_cond;
+	pthread_t demux_thread;
+	bool demux_thread_valid;
+	bool pipelined;
+	bool pipe_stop;
+	bool pipe_hold;
+	bool demux_idle;
+	bool demux_eof;
+	bool demux_failed;
+	size_t queued_bytes;
+	size_t max_queued_bytes;
+	uint64_t late_frames;
+	uint64_t underruns;
+
 	bool pause;
 	bool reset_ts;
 	bool seek;
@@ -118,6 +146,7 @@ extern int64_t mp_media_get_current_time(mp_media_t *m);
 extern int64_t mp_media_get_frames(mp_media_t *m);
 extern int64_t mp_media_get_duration(mp_media_t *m);
 extern void mp_media_seek(mp_media_t *m, int64_t pos);
+extern void mp_media_get_stats(mp_media_t *m, struct mp_media_stats *stats);
 
 /* #define DETAILED_DEBUG_INFO */
 
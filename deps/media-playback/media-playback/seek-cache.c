@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2023 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "seek-cache.h"
+
+void mp_seek_cache_init(struct mp_seek_cache *sc, size_t max_size)
+{
+	memset(sc, 0, sizeof(*sc));
+	sc->max_size = max_size;
+	sc->index_end = INT64_MIN;
+	sc->indexing = true;
+}
+
+void mp_seek_cache_free(struct mp_seek_cache *sc)
+{
+	for (size_t i = 0; i < sc->frames.num; i++)
+		obs_source_frame_free(&sc->frames.array[i].frame);
+
+	da_free(sc->frames);
+	da_free(sc->keyframes);
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* index of the first keyframe after pts */
+static size_t keyframe_upper_bound(struct mp_seek_cache *sc, int64_t pts)
+{
+	size_t lo = 0;
+	size_t hi = sc->keyframes.num;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (sc->keyframes.array[mid] <= pts)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+void mp_seek_cache_index_packet(struct mp_seek_cache *sc, int64_t pts,
+				bool keyframe)
+{
+	if (!sc->indexing)
+		return;
+
+	if (keyframe) {
+		size_t idx = keyframe_upper_bound(sc, pts);
+		if (idx == 0 || sc->keyframes.array[idx - 1] != pts)
+			da_insert(sc->keyframes, idx, &pts);
+	}
+
+	if (pts > sc->index_end)
+		sc->index_end = pts;
+}
+
+bool mp_seek_cache_find_keyframe(struct mp_seek_cache *sc, int64_t target,
+				 int64_t *keyframe)
+{
+	/* a seek past the indexed part of the file leaves a gap in the index,
+	 * so stop indexing until playback gets back to the indexed part */
+	if (sc->keyframes.num)
+		sc->indexing = target <= sc->index_end;
+	if (!sc->indexing)
+		return false;
+
+	size_t idx = keyframe_upper_bound(sc, target);
+	if (idx == 0)
+		return false;
+
+	*keyframe = sc->keyframes.array[idx - 1];
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static inline bool half_height_plane(enum video_format format, size_t plane)
+{
+	switch (format) {
+	case VIDEO_FORMAT_I420:
+	case VIDEO_FORMAT_I010:
+	case VIDEO_FORMAT_NV12:
+	case VIDEO_FORMAT_P010:
+	case VIDEO_FORMAT_I40A:
+		return plane == 1 || plane == 2;
+	default:
+		return false;
+	}
+}
+
+static size_t get_frame_size(const struct obs_source_frame *frame)
+{
+	size_t size = 0;
+
+	for (size_t i = 0; i < MAX_AV_PLANES && frame->data[i]; i++) {
+		size_t height = half_height_plane(frame->format, i)
+					? (frame->height + 1) / 2
+					: frame->height;
+		size += frame->linesize[i] * height;
+	}
+
+	return size;
+}
+
+/* index of the first cached frame after pts */
+static size_t frame_upper_bound(struct mp_seek_cache *sc, int64_t pts)
+{
+	size_t lo = 0;
+	size_t hi = sc->frames.num;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (sc->frames.array[mid].pts <= pts)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void evict_frame(struct mp_seek_cache *sc)
+{
+	size_t oldest = 0;
+
+	for (size_t i = 1; i < sc->frames.num; i++) {
+		if (sc->frames.array[i].last_used <
+		    sc->frames.array[oldest].last_used)
+			oldest = i;
+	}
+
+	sc->size -= sc->frames.array[oldest].size;
+	obs_source_frame_free(&sc->frames.array[oldest].frame);
+	da_erase(sc->frames, oldest);
+}
+
+void mp_seek_cache_add_frame(struct mp_seek_cache *sc,
+			     const struct obs_source_frame *frame, int64_t pts,
+			     int64_t duration)
+{
+	size_t idx = frame_upper_bound(sc, pts);
+	if (idx > 0 && sc->frames.array[idx - 1].pts == pts) {
+		sc->frames.array[idx - 1].last_used = ++sc->use_count;
+		return;
+	}
+
+	struct mp_cached_frame cached = {.pts = pts, .duration = duration};
+
+	obs_source_frame_init(&cached.frame, frame->format, frame->width,
+			      frame->height);
+	cached.size = get_frame_size(&cached.frame);
+	if (!cached.size || cached.size > sc->max_size) {
+		obs_source_frame_free(&cached.frame);
+		return;
+	}
+
+	obs_source_frame_copy(&cached.frame, frame);
+	cached.last_used = ++sc->use_count;
+
+	while (sc->size + cached.size > sc->max_size)
+		evict_frame(sc);
+
+	sc->size += cached.size;
+	idx = frame_upper_bound(sc, pts);
+	da_insert(sc->frames, idx, &cached);
+}
+
+struct mp_cached_frame *mp_seek_cache_get_frame(struct mp_seek_cache *sc,
+						int64_t pts)
+{
+	size_t idx = frame_upper_bound(sc, pts);
+	if (idx == 0)
+		return NULL;
+
+	struct mp_cached_frame *cached = &sc->frames.array[idx - 1];
+	if (pts >= cached->pts + cached->duration)
+		return NULL;
+
+	cached->last_used = ++sc->use_count;
+	return cached;
+}
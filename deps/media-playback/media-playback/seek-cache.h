@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2023 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+/*
+ * Keyframe index and decoded frame cache for local files, which makes
+ * seeking and looping cheap without decoding the whole file up front the
+ * way mp_cache does.
+ *
+ *   The keyframe index holds the timestamp of every video keyframe read
+ * while playing through the file, in the stream's time base, so a seek can
+ * jump straight to the last keyframe before the target and decode forward
+ * to the exact frame from there.
+ *
+ *   Converted frames are kept in a least recently used cache bounded by a
+ * byte budget, keyed by their presentation time in nanoseconds, so scrubbing
+ * back over frames that were already shown doesn't need the decoder at all.
+ */
+
+#include <util/darray.h>
+#include <obs.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mp_cached_frame {
+	struct obs_source_frame frame;
+	int64_t pts;
+	int64_t duration;
+	size_t size;
+	uint64_t last_used;
+};
+
+struct mp_seek_cache {
+	DARRAY(int64_t) keyframes;
+	int64_t index_end;
+	bool indexing;
+
+	/* sorted by pts */
+	DARRAY(struct mp_cached_frame) frames;
+	size_t size;
+	size_t max_size;
+	uint64_t use_count;
+};
+
+extern void mp_seek_cache_init(struct mp_seek_cache *sc, size_t max_size);
+extern void mp_seek_cache_free(struct mp_seek_cache *sc);
+
+/* records a video packet read from the file, only while reading on from
+ * the part of the file that's already indexed */
+extern void mp_seek_cache_index_packet(struct mp_seek_cache *sc, int64_t pts,
+				       bool keyframe);
+
+/* finds the last keyframe at or before the target, returns false if that
+ * part of the file hasn't been indexed yet */
+extern bool mp_seek_cache_find_keyframe(struct mp_seek_cache *sc,
+					int64_t target, int64_t *keyframe);
+
+/* copies a converted frame into the cache, evicting the least recently
+ * used frames to stay within the budget */
+extern void mp_seek_cache_add_frame(struct mp_seek_cache *sc,
+				    const struct obs_source_frame *frame,
+				    int64_t pts, int64_t duration);
+
+/* returns the cached frame shown at pts, if any.  Only valid until the
+ * next frame is added. */
+extern struct mp_cached_frame *
+mp_seek_cache_get_frame(struct mp_seek_cache *sc, int64_t pts);
+
+#ifdef __cplusplus
+}
+#endif
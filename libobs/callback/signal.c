@@ -16,6 +16,7 @@
 
 #include "../util/darray.h"
 #include "../util/threading.h"
+#include "../util/uthash.h"
 
 #include "decl.h"
 #include "signal.h"
@@ -23,54 +24,110 @@
 struct signal_callback {
 	signal_callback_t callback;
 	void *data;
-	bool remove;
+	size_t id;
+	volatile bool remove;
 	bool keep_ref;
 };
 
+/*
+ * Callback arrays are copy-on-write.  Emitting a signal takes a reference to
+ * the current array and calls out without holding any lock, (dis)connecting
+ * replaces the array.  A replaced ("retired") array stays around until the
+ * emissions using it are done, and disconnecting waits for those so a
+ * callback is never called after signal_handler_disconnect returns.
+ *
+ *   Disconnecting from inside an emission of the same signal doesn't wait,
+ * another thread could be doing the same thing the other way around.  The
+ * callback is flagged in every array instead, so only an emission that is
+ * calling it at that moment can still be in it.
+ */
+struct callback_array {
+	DARRAY(struct signal_callback) callbacks;
+	long refs;
+	bool retired;
+};
+
 struct signal_info {
 	struct decl_info func;
-	DARRAY(struct signal_callback) callbacks;
+	size_t id;
+
+	struct callback_array *callbacks;
+	DARRAY(struct callback_array *) retired;
+	size_t next_callback_id;
+	long retired_refs;
 	pthread_mutex_t mutex;
-	bool signalling;
+	pthread_cond_t retired_cond;
 
-	struct signal_info *next;
+	UT_hash_handle hh;
 };
 
+/* signal emissions in progress on the current thread */
+struct signal_emit {
+	struct signal_info *sig;
+	struct callback_array *callbacks;
+	struct signal_emit *prev;
+};
+
+static THREAD_LOCAL struct signal_emit *current_emit = NULL;
+
+static inline struct callback_array *
+callback_array_create(const struct callback_array *src)
+{
+	struct callback_array *ca = bzalloc(sizeof(struct callback_array));
+	if (src)
+		da_copy(ca->callbacks, src->callbacks);
+	return ca;
+}
+
+static inline void callback_array_destroy(struct callback_array *ca)
+{
+	da_free(ca->callbacks);
+	bfree(ca);
+}
+
 static inline struct signal_info *signal_info_create(struct decl_info *info)
 {
-	struct signal_info *si = bmalloc(sizeof(struct signal_info));
+	struct signal_info *si = bzalloc(sizeof(struct signal_info));
 	si->func = *info;
-	si->next = NULL;
-	si->signalling = false;
-	da_init(si->callbacks);
 
-	if (pthread_mutex_init_recursive(&si->mutex) != 0) {
+	if (pthread_mutex_init(&si->mutex, NULL) != 0) {
 		blog(LOG_ERROR, "Could not create signal");
 
 		decl_info_free(&si->func);
 		bfree(si);
 		return NULL;
 	}
+	if (pthread_cond_init(&si->retired_cond, NULL) != 0) {
+		blog(LOG_ERROR, "Could not create signal");
 
+		pthread_mutex_destroy(&si->mutex);
+		decl_info_free(&si->func);
+		bfree(si);
+		return NULL;
+	}
+
+	si->callbacks = callback_array_create(NULL);
 	return si;
 }
 
 static inline void signal_info_destroy(struct signal_info *si)
 {
 	if (si) {
+		pthread_cond_destroy(&si->retired_cond);
 		pthread_mutex_destroy(&si->mutex);
 		decl_info_free(&si->func);
-		da_free(si->callbacks);
+		callback_array_destroy(si->callbacks);
+		da_free(si->retired);
 		bfree(si);
 	}
 }
 
-static inline size_t signal_get_callback_idx(struct signal_info *si,
+static inline size_t signal_get_callback_idx(struct callback_array *ca,
 					     signal_callback_t callback,
 					     void *data)
 {
-	for (size_t i = 0; i < si->callbacks.num; i++) {
-		struct signal_callback *sc = si->callbacks.array + i;
+	for (size_t i = 0; i < ca->callbacks.num; i++) {
+		struct signal_callback *sc = ca->callbacks.array + i;
 
 		if (sc->callback == callback && sc->data == data)
 			return i;
@@ -79,6 +136,66 @@ static inline size_t signal_get_callback_idx(struct signal_info *si,
 	return DARRAY_INVALID;
 }
 
+static inline size_t signal_get_callback_idx_by_id(struct callback_array *ca,
+						   size_t id)
+{
+	for (size_t i = 0; i < ca->callbacks.num; i++) {
+		if (ca->callbacks.array[i].id == id)
+			return i;
+	}
+
+	return DARRAY_INVALID;
+}
+
+/* call with sig->mutex held */
+static void signal_set_callbacks(struct signal_info *sig,
+				 struct callback_array *ca)
+{
+	struct callback_array *prev = sig->callbacks;
+	sig->callbacks = ca;
+
+	if (prev->refs) {
+		prev->retired = true;
+		sig->retired_refs += prev->refs;
+		da_push_back(sig->retired, &prev);
+	} else {
+		callback_array_destroy(prev);
+	}
+}
+
+/* call with sig->mutex held */
+static void signal_release_callbacks(struct signal_info *sig,
+				     struct callback_array *ca)
+{
+	ca->refs--;
+
+	if (ca->retired) {
+		sig->retired_refs--;
+		if (!ca->refs) {
+			da_erase_item(sig->retired, &ca);
+			callback_array_destroy(ca);
+		}
+		pthread_cond_broadcast(&sig->retired_cond);
+	}
+}
+
+static bool signal_emitting(struct signal_info *sig)
+{
+	for (struct signal_emit *emit = current_emit; emit; emit = emit->prev) {
+		if (emit->sig == sig)
+			return true;
+	}
+
+	return false;
+}
+
+static inline void flag_callback(struct callback_array *ca, size_t id)
+{
+	size_t idx = signal_get_callback_idx_by_id(ca, id);
+	if (idx != DARRAY_INVALID)
+		os_atomic_set_bool(&ca->callbacks.array[idx].remove, true);
+}
+
 struct global_callback_info {
 	global_signal_callback_t callback;
 	void *data;
@@ -87,7 +204,9 @@ struct global_callback_info {
 };
 
 struct signal_handler {
-	struct signal_info *first;
+	/* indexed by signal id */
+	DARRAY(struct signal_info *) signals;
+	struct signal_info *signals_by_name;
 	pthread_mutex_t mutex;
 	volatile long refs;
 
@@ -95,23 +214,12 @@ struct signal_handler {
 	pthread_mutex_t global_callbacks_mutex;
 };
 
-static struct signal_info *getsignal(signal_handler_t *handler,
-				     const char *name,
-				     struct signal_info **p_last)
+static inline struct signal_info *getsignal(signal_handler_t *handler,
+					    const char *name)
 {
-	struct signal_info *signal, *last = NULL;
-
-	signal = handler->first;
-	while (signal != NULL) {
-		if (strcmp(signal->func.name, name) == 0)
-			break;
+	struct signal_info *signal;
 
-		last = signal;
-		signal = signal->next;
-	}
-
-	if (p_last)
-		*p_last = last;
+	HASH_FIND_STR(handler->signals_by_name, name, signal);
 	return signal;
 }
 
@@ -120,7 +228,6 @@ static struct signal_info *getsignal(signal_handler_t *handler,
 signal_handler_t *signal_handler_create(void)
 {
 	struct signal_handler *handler = bzalloc(sizeof(struct signal_handler));
-	handler->first = NULL;
 	handler->refs = 1;
 
 	if (pthread_mutex_init(&handler->mutex, NULL) != 0) {
@@ -142,13 +249,12 @@ signal_handler_t *signal_handler_create(void)
 
 static void signal_handler_actually_destroy(signal_handler_t *handler)
 {
-	struct signal_info *sig = handler->first;
-	while (sig != NULL) {
-		struct signal_info *next = sig->next;
-		signal_info_destroy(sig);
-		sig = next;
-	}
+	HASH_CLEAR(hh, handler->signals_by_name);
 
+	for (size_t i = 0; i < handler->signals.num; i++)
+		signal_info_destroy(handler->signals.array[i]);
+
+	da_free(handler->signals);
 	da_free(handler->global_callbacks);
 	pthread_mutex_destroy(&handler->global_callbacks_mutex);
 	pthread_mutex_destroy(&handler->mutex);
@@ -165,7 +271,7 @@ void signal_handler_destroy(signal_handler_t *handler)
 bool signal_handler_add(signal_handler_t *handler, const char *signal_decl)
 {
 	struct decl_info func = {0};
-	struct signal_info *sig, *last;
+	struct signal_info *sig;
 	bool success = true;
 
 	if (!parse_decl_string(&func, signal_decl)) {
@@ -175,17 +281,21 @@ bool signal_handler_add(signal_handler_t *handler, const char *signal_decl)
 
 	pthread_mutex_lock(&handler->mutex);
 
-	sig = getsignal(handler, func.name, &last);
+	sig = getsignal(handler, func.name);
 	if (sig) {
 		blog(LOG_WARNING, "Signal declaration '%s' exists", func.name);
 		decl_info_free(&func);
 		success = false;
 	} else {
 		sig = signal_info_create(&func);
-		if (!last)
-			handler->first = sig;
-		else
-			last->next = sig;
+		if (sig) {
+			sig->id = da_push_back(handler->signals, &sig);
+			HASH_ADD_KEYPTR(hh, handler->signals_by_name,
+					sig->func.name,
+					strlen(sig->func.name), sig);
+		} else {
+			success = false;
+		}
 	}
 
 	pthread_mutex_unlock(&handler->mutex);
@@ -193,22 +303,33 @@ bool signal_handler_add(signal_handler_t *handler, const char *signal_decl)
 	return success;
 }
 
+static inline struct signal_info *getsignal_locked(signal_handler_t *handler,
+						   const char *name)
+{
+	struct signal_info *sig;
+
+	if (!handler)
+		return NULL;
+
+	pthread_mutex_lock(&handler->mutex);
+	sig = getsignal(handler, name);
+	pthread_mutex_unlock(&handler->mutex);
+
+	return sig;
+}
+
 static void signal_handler_connect_internal(signal_handler_t *handler,
 					    const char *signal,
 					    signal_callback_t callback,
 					    void *data, bool keep_ref)
 {
-	struct signal_info *sig, *last;
-	struct signal_callback cb_data = {callback, data, false, keep_ref};
+	struct signal_info *sig = getsignal_locked(handler, signal);
+	struct signal_callback cb_data = {callback, data, 0, false, keep_ref};
 	size_t idx;
 
 	if (!handler)
 		return;
 
-	pthread_mutex_lock(&handler->mutex);
-	sig = getsignal(handler, signal, &last);
-	pthread_mutex_unlock(&handler->mutex);
-
 	if (!sig) {
 		blog(LOG_WARNING,
 		     "signal_handler_connect: "
@@ -224,9 +345,15 @@ static void signal_handler_connect_internal(signal_handler_t *handler,
 	if (keep_ref)
 		os_atomic_inc_long(&handler->refs);
 
-	idx = signal_get_callback_idx(sig, callback, data);
-	if (keep_ref || idx == DARRAY_INVALID)
-		da_push_back(sig->callbacks, &cb_data);
+	idx = signal_get_callback_idx(sig->callbacks, callback, data);
+	if (keep_ref || idx == DARRAY_INVALID) {
+		struct callback_array *ca =
+			callback_array_create(sig->callbacks);
+
+		cb_data.id = sig->next_callback_id++;
+		da_push_back(ca->callbacks, &cb_data);
+		signal_set_callbacks(sig, ca);
+	}
 
 	pthread_mutex_unlock(&sig->mutex);
 }
@@ -243,21 +370,6 @@ void signal_handler_connect_ref(signal_handler_t *handler, const char *signal,
 	signal_handler_connect_internal(handler, signal, callback, data, true);
 }
 
-static inline struct signal_info *getsignal_locked(signal_handler_t *handler,
-						   const char *name)
-{
-	struct signal_info *sig;
-
-	if (!handler)
-		return NULL;
-
-	pthread_mutex_lock(&handler->mutex);
-	sig = getsignal(handler, name, NULL);
-	pthread_mutex_unlock(&handler->mutex);
-
-	return sig;
-}
-
 void signal_handler_disconnect(signal_handler_t *handler, const char *signal,
 			       signal_callback_t callback, void *data)
 {
@@ -270,13 +382,28 @@ void signal_handler_disconnect(signal_handler_t *handler, const char *signal,
 
 	pthread_mutex_lock(&sig->mutex);
 
-	idx = signal_get_callback_idx(sig, callback, data);
+	idx = signal_get_callback_idx(sig->callbacks, callback, data);
 	if (idx != DARRAY_INVALID) {
-		if (sig->signalling) {
-			sig->callbacks.array[idx].remove = true;
-		} else {
-			keep_ref = sig->callbacks.array[idx].keep_ref;
-			da_erase(sig->callbacks, idx);
+		struct signal_callback *cb = sig->callbacks->callbacks.array +
+					     idx;
+		struct callback_array *ca;
+		size_t id = cb->id;
+
+		keep_ref = cb->keep_ref;
+
+		/* skip it in emissions that haven't gotten to it yet */
+		os_atomic_set_bool(&cb->remove, true);
+		for (size_t i = 0; i < sig->retired.num; i++)
+			flag_callback(sig->retired.array[i], id);
+
+		ca = callback_array_create(sig->callbacks);
+		da_erase(ca->callbacks, idx);
+		signal_set_callbacks(sig, ca);
+
+		if (!signal_emitting(sig)) {
+			while (sig->retired_refs)
+				pthread_cond_wait(&sig->retired_cond,
+						  &sig->mutex);
 		}
 	}
 
@@ -293,44 +420,80 @@ static THREAD_LOCAL struct global_callback_info *current_global_cb = NULL;
 void signal_handler_remove_current(void)
 {
 	if (current_signal_cb)
-		current_signal_cb->remove = true;
+		os_atomic_set_bool(&current_signal_cb->remove, true);
 	else if (current_global_cb)
 		current_global_cb->remove = true;
 }
 
-void signal_handler_signal(signal_handler_t *handler, const char *signal,
-			   calldata_t *params)
+/* removes callbacks that removed themselves during an emission, returns the
+ * number of handler references they held.  Call with sig->mutex held. */
+static long signal_remove_flagged(struct signal_info *sig,
+				  struct callback_array *emitted)
 {
-	struct signal_info *sig = getsignal_locked(handler, signal);
+	struct callback_array *ca = NULL;
 	long remove_refs = 0;
 
-	if (!sig)
-		return;
+	for (size_t i = 0; i < emitted->callbacks.num; i++) {
+		struct signal_callback *cb = emitted->callbacks.array + i;
+		size_t idx;
+
+		if (!os_atomic_load_bool(&cb->remove))
+			continue;
+
+		/* already gone if it was disconnected */
+		idx = signal_get_callback_idx_by_id(ca ? ca : sig->callbacks,
+						    cb->id);
+		if (idx == DARRAY_INVALID)
+			continue;
+
+		if (!ca)
+			ca = callback_array_create(sig->callbacks);
+		if (cb->keep_ref)
+			remove_refs++;
+
+		da_erase(ca->callbacks, idx);
+	}
+
+	if (ca)
+		signal_set_callbacks(sig, ca);
+
+	return remove_refs;
+}
+
+static void signal_handler_emit(signal_handler_t *handler,
+				struct signal_info *sig, calldata_t *params)
+{
+	struct signal_emit emit = {sig, NULL, current_emit};
+	long remove_refs = 0;
 
 	pthread_mutex_lock(&sig->mutex);
-	sig->signalling = true;
-
-	for (size_t i = 0; i < sig->callbacks.num; i++) {
-		struct signal_callback *cb = sig->callbacks.array + i;
-		if (!cb->remove) {
-			current_signal_cb = cb;
-			cb->callback(cb->data, params);
-			current_signal_cb = NULL;
-		}
+	if (sig->callbacks->callbacks.num) {
+		emit.callbacks = sig->callbacks;
+		emit.callbacks->refs++;
 	}
+	pthread_mutex_unlock(&sig->mutex);
+
+	if (emit.callbacks) {
+		struct callback_array *ca = emit.callbacks;
 
-	for (size_t i = sig->callbacks.num; i > 0; i--) {
-		struct signal_callback *cb = sig->callbacks.array + i - 1;
-		if (cb->remove) {
-			if (cb->keep_ref)
-				remove_refs++;
+		current_emit = &emit;
 
-			da_erase(sig->callbacks, i - 1);
+		for (size_t i = 0; i < ca->callbacks.num; i++) {
+			struct signal_callback *cb = ca->callbacks.array + i;
+			if (!os_atomic_load_bool(&cb->remove)) {
+				current_signal_cb = cb;
+				cb->callback(cb->data, params);
+				current_signal_cb = NULL;
+			}
 		}
-	}
 
-	sig->signalling = false;
-	pthread_mutex_unlock(&sig->mutex);
+		current_emit = emit.prev;
+
+		pthread_mutex_lock(&sig->mutex);
+		remove_refs = signal_remove_flagged(sig, ca);
+		signal_release_callbacks(sig, ca);
+		pthread_mutex_unlock(&sig->mutex);
+	}
 
 	pthread_mutex_lock(&handler->global_callbacks_mutex);
 
@@ -342,7 +505,7 @@ void signal_handler_signal(signal_handler_t *handler, const char *signal,
 			if (!cb->remove) {
 				cb->signaling++;
 				current_global_cb = cb;
-				cb->callback(cb->data, signal, params);
+				cb->callback(cb->data, sig->func.name, params);
 				current_global_cb = NULL;
 				cb->signaling--;
 			}
@@ -366,6 +529,38 @@ void signal_handler_signal(signal_handler_t *handler, const char *signal,
 	}
 }
 
+void signal_handler_signal(signal_handler_t *handler, const char *signal,
+			   calldata_t *params)
+{
+	struct signal_info *sig = getsignal_locked(handler, signal);
+
+	if (sig)
+		signal_handler_emit(handler, sig, params);
+}
+
+size_t signal_handler_get_id(signal_handler_t *handler, const char *signal)
+{
+	struct signal_info *sig = getsignal_locked(handler, signal);
+	return sig ? sig->id : SIGNAL_ID_INVALID;
+}
+
+void signal_handler_signal_id(signal_handler_t *handler, size_t id,
+			      calldata_t *params)
+{
+	struct signal_info *sig = NULL;
+
+	if (!handler)
+		return;
+
+	pthread_mutex_lock(&handler->mutex);
+	if (id < handler->signals.num)
+		sig = handler->signals.array[id];
+	pthread_mutex_unlock(&handler->mutex);
+
+	if (sig)
+		signal_handler_emit(handler, sig, params);
+}
+
 void signal_handler_connect_global(signal_handler_t *handler,
 				   global_signal_callback_t callback,
 				   void *data)
@@ -29,6 +29,10 @@ extern "C" {
  *
  *   This is used to create a signal handler which can broadcast events
  * to one or more callbacks connected to a signal.
+ *
+ *   Signals are also numbered in the order they were added, starting at 0.
+ * Signals that are emitted often can be emitted by id to skip the name
+ * lookup.
  */
 
 struct signal_handler;
@@ -36,6 +40,8 @@ typedef struct signal_handler signal_handler_t;
 typedef void (*global_signal_callback_t)(void *, const char *, calldata_t *);
 typedef void (*signal_callback_t)(void *, calldata_t *);
 
+#define SIGNAL_ID_INVALID ((size_t)-1)
+
 EXPORT signal_handler_t *signal_handler_create(void);
 EXPORT void signal_handler_destroy(signal_handler_t *handler);
 
@@ -78,6 +84,11 @@ EXPORT void signal_handler_remove_current(void);
 EXPORT void signal_handler_signal(signal_handler_t *handler, const char *signal,
 				  calldata_t *params);
 
+EXPORT size_t signal_handler_get_id(signal_handler_t *handler,
+				    const char *signal);
+EXPORT void signal_handler_signal_id(signal_handler_t *handler, size_t id,
+				     calldata_t *params);
+
 #ifdef __cplusplus
 }
 #endif
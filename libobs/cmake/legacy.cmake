@@ -4,6 +4,8 @@ endif()
 
 project(libobs)
 
+option(ENABLE_BMEM_TAGS "Count libobs allocations by subsystem tag" OFF)
+
 # cmake-format: off
 add_library(libobs-version STATIC EXCLUDE_FROM_ALL)
 add_library(OBS::libobs-version ALIAS libobs-version)
@@ -42,6 +44,7 @@ target_sources(
           obs-display.c
           obs-encoder.c
           obs-encoder.h
+          obs-frame-pacing.c
           obs-ffmpeg-compat.h
           obs-hotkey.c
           obs-hotkey.h
@@ -52,12 +55,14 @@ target_sources(
           obs-nal.h
           obs-hotkey-name-map.c
           obs-interaction.h
+          obs-interleave.h
           obs-internal.h
           obs-module.c
           obs-module.h
           obs-output.c
           obs-output.h
           obs-output-delay.c
+          obs-packet-pool.c
           obs-properties.c
           obs-properties.h
           obs-service.c
@@ -148,6 +153,8 @@ target_sources(
   PRIVATE media-io/audio-io.c
           media-io/audio-io.h
           media-io/audio-math.h
+          media-io/audio-mix.c
+          media-io/audio-mix.h
           media-io/audio-resampler.h
           media-io/audio-resampler-ffmpeg.c
           media-io/format-conversion.c
@@ -163,7 +170,9 @@ target_sources(
           media-io/media-io-defs.h
           media-io/video-matrices.c
           media-io/video-scaler-ffmpeg.c
-          media-io/video-scaler.h)
+          media-io/video-scaler.h
+          media-io/video-slices.c
+          media-io/video-slices.h)
 
 target_sources(
   libobs
@@ -209,6 +218,8 @@ target_sources(
           util/uthash.h
           util/util_uint64.h
           util/util_uint128.h
+          util/work-pool.c
+          util/work-pool.h
           util/curl/curl-helper.h
           util/darray.h
           util/util.hpp)
@@ -268,7 +279,7 @@ set_target_properties(
 target_compile_definitions(
   libobs
   PUBLIC ${ARCH_SIMD_DEFINES}
-  PRIVATE IS_LIBOBS)
+  PRIVATE IS_LIBOBS $<$<BOOL:${ENABLE_BMEM_TAGS}>:BMEM_TAGS>)
 
 target_compile_features(libobs PRIVATE cxx_alias_templates)
 
@@ -23,9 +23,11 @@
 #include "../util/circlebuf.h"
 #include "../util/platform.h"
 #include "../util/profiler.h"
+#include "../util/task.h"
 #include "../util/util_uint64.h"
 
 #include "audio-io.h"
+#include "audio-mix.h"
 #include "audio-resampler.h"
 
 #ifdef _WIN32
@@ -43,6 +45,21 @@ extern profiler_name_store_t *obs_get_profiler_name_store(void);
 		int invalid = 0; \
 	} while (0)
 
+/*
+ * Parallel output.
+ *
+ *   By default the inputs of every mix are resampled and handed their data
+ * one after another on the audio thread.  In parallel mode each input is a
+ * job of a work batch on the shared task pool instead, and the audio thread
+ * waits for the whole batch before starting the next tick.  Inputs on the
+ * same mix can then run at the same time and read the same mix buffers,
+ * which are not written to until the batch is done.
+ *
+ *   Connecting or disconnecting from inside a callback while a batch runs
+ * can't touch the input arrays, as other jobs are using them.  It is queued
+ * and done by the audio thread once the batch is done instead.
+ */
+
 struct audio_input {
 	struct audio_convert_info conversion;
 	audio_resampler_t *resampler;
@@ -56,6 +73,20 @@ static inline void audio_input_free(struct audio_input *input)
 	audio_resampler_destroy(input->resampler);
 }
 
+struct audio_job {
+	struct audio_output *audio;
+	struct audio_input *input;
+	size_t mix_idx;
+	uint64_t timestamp;
+	uint32_t frames;
+};
+
+struct audio_pending {
+	size_t mix_idx;
+	bool connect;
+	struct audio_input input;
+};
+
 struct audio_mix {
 	DARRAY(struct audio_input) inputs;
 	float buffer[MAX_AUDIO_CHANNELS][AUDIO_OUTPUT_FRAMES];
@@ -77,8 +108,20 @@ struct audio_output {
 	void *input_param;
 	pthread_mutex_t input_mutex;
 	struct audio_mix mixes[MAX_AUDIO_MIXES];
+
+	volatile bool parallel;
+	os_work_pool_t *pool;
+	os_work_batch_t *batch;
+	const char *mix_profile_names[MAX_AUDIO_MIXES];
+	DARRAY(struct audio_job) jobs;
+
+	pthread_mutex_t pending_mutex;
+	DARRAY(struct audio_pending) pending;
 };
 
+/* set on the threads running the jobs of an audio output's batch */
+static THREAD_LOCAL struct audio_output *cur_output = NULL;
+
 /* ------------------------------------------------------------------------- */
 
 static bool resample_audio_output(struct audio_input *input,
@@ -106,34 +149,136 @@ static bool resample_audio_output(struct audio_input *input,
 	return success;
 }
 
+static void output_input(struct audio_output *audio, size_t mix_idx,
+			 struct audio_input *input, uint64_t timestamp,
+			 uint32_t frames)
+{
+	struct audio_mix *mix = &audio->mixes[mix_idx];
+	struct audio_data data;
+
+	float(*buf)[AUDIO_OUTPUT_FRAMES] = input->conversion.allow_clipping
+						   ? mix->buffer_unclamped
+						   : mix->buffer;
+
+	memset(&data, 0, sizeof(data));
+	for (size_t i = 0; i < audio->planes; i++)
+		data.data[i] = (uint8_t *)buf[i];
+
+	data.frames = frames;
+	data.timestamp = timestamp;
+
+	if (resample_audio_output(input, &data))
+		input->callback(input->param, mix_idx, &data);
+}
+
 static inline void do_audio_output(struct audio_output *audio, size_t mix_idx,
 				   uint64_t timestamp, uint32_t frames)
 {
 	struct audio_mix *mix = &audio->mixes[mix_idx];
-	struct audio_data data;
 
 	pthread_mutex_lock(&audio->input_mutex);
 
-	for (size_t i = mix->inputs.num; i > 0; i--) {
-		struct audio_input *input = mix->inputs.array + (i - 1);
+	for (size_t i = mix->inputs.num; i > 0; i--)
+		output_input(audio, mix_idx, mix->inputs.array + (i - 1),
+			     timestamp, frames);
+
+	pthread_mutex_unlock(&audio->input_mutex);
+}
+
+static void run_audio_job(void *param)
+{
+	struct audio_job *job = param;
+	struct audio_output *prev = cur_output;
+	const char *name = job->audio->mix_profile_names[job->mix_idx];
+
+	cur_output = job->audio;
+	profile_start(name);
+	output_input(job->audio, job->mix_idx, job->input, job->timestamp,
+		     job->frames);
+	profile_end(name);
+	cur_output = prev;
+}
+
+static size_t audio_get_input_idx(const audio_t *audio, size_t mix_idx,
+				  audio_output_callback_t callback,
+				  void *param);
+
+/* connects and disconnects that were made from inside the batch */
+static void apply_pending(struct audio_output *audio)
+{
+	pthread_mutex_lock(&audio->pending_mutex);
+
+	for (size_t i = 0; i < audio->pending.num; i++) {
+		struct audio_pending *pending = audio->pending.array + i;
+		struct audio_mix *mix = &audio->mixes[pending->mix_idx];
+		size_t idx = audio_get_input_idx(audio, pending->mix_idx,
+						 pending->input.callback,
+						 pending->input.param);
+
+		if (pending->connect && idx == DARRAY_INVALID) {
+			da_push_back(mix->inputs, &pending->input);
+			continue;
+		}
+
+		if (pending->connect) {
+			audio_input_free(&pending->input);
+		} else if (idx != DARRAY_INVALID) {
+			audio_input_free(mix->inputs.array + idx);
+			da_erase(mix->inputs, idx);
+		}
+	}
+
+	da_resize(audio->pending, 0);
+	pthread_mutex_unlock(&audio->pending_mutex);
+}
+
+static void do_audio_output_parallel(struct audio_output *audio,
+				     uint32_t active_mixes, uint64_t timestamp,
+				     uint32_t frames)
+{
+	if (!audio->pool) {
+		audio->pool = os_task_pool_acquire();
+		audio->batch = os_work_batch_create(NULL);
+
+		for (size_t i = 0; i < MAX_AUDIO_MIXES; i++)
+			audio->mix_profile_names[i] = profile_store_name(
+				obs_get_profiler_name_store(),
+				"audio_input(%s: mix %d)", audio->info.name,
+				(int)i);
+	}
+
+	pthread_mutex_lock(&audio->input_mutex);
 
-		float(*buf)[AUDIO_OUTPUT_FRAMES] =
-			input->conversion.allow_clipping ? mix->buffer_unclamped
-							 : mix->buffer;
-		for (size_t i = 0; i < audio->planes; i++)
-			data.data[i] = (uint8_t *)buf[i];
+	da_resize(audio->jobs, 0);
+	for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
+		struct audio_mix *mix = &audio->mixes[mix_idx];
 
-		data.frames = frames;
-		data.timestamp = timestamp;
+		if ((active_mixes & (1 << mix_idx)) == 0)
+			continue;
 
-		if (resample_audio_output(input, &data))
-			input->callback(input->param, mix_idx, &data);
+		for (size_t i = mix->inputs.num; i > 0; i--) {
+			struct audio_job *job = da_push_back_new(audio->jobs);
+			job->audio = audio;
+			job->input = mix->inputs.array + (i - 1);
+			job->mix_idx = mix_idx;
+			job->timestamp = timestamp;
+			job->frames = frames;
+		}
 	}
 
+	os_work_batch_clear(audio->batch);
+	for (size_t i = 0; i < audio->jobs.num; i++)
+		os_work_batch_add(audio->batch, run_audio_job,
+				  audio->jobs.array + i);
+	os_work_batch_run(audio->pool, audio->batch);
+
+	apply_pending(audio);
+
 	pthread_mutex_unlock(&audio->input_mutex);
 }
 
-static inline void clamp_audio_output(struct audio_output *audio, size_t bytes)
+static inline void clamp_audio_output(struct audio_output *audio, size_t bytes,
+				      uint32_t active_mixes)
 {
 	size_t float_size = bytes / sizeof(float);
 
@@ -141,23 +286,14 @@ static inline void clamp_audio_output(struct audio_output *audio, size_t bytes)
 		struct audio_mix *mix = &audio->mixes[mix_idx];
 
 		/* do not process mixing if a specific mix is inactive */
-		if (!mix->inputs.num)
+		if ((active_mixes & (1 << mix_idx)) == 0)
 			continue;
 
-		for (size_t plane = 0; plane < audio->planes; plane++) {
-			float *mix_data = mix->buffer[plane];
-			float *mix_end = &mix_data[float_size];
-			/* Unclamped mix is copied directly. */
-			memcpy(mix->buffer_unclamped[plane], mix_data, bytes);
-
-			while (mix_data < mix_end) {
-				float val = *mix_data;
-				val = (val == val) ? val : 0.0f;
-				val = (val > 1.0f) ? 1.0f : val;
-				val = (val < -1.0f) ? -1.0f : val;
-				*(mix_data++) = val;
-			}
-		}
+		/* unclamped mix is copied while clamping */
+		for (size_t plane = 0; plane < audio->planes; plane++)
+			audio_mix_clamp(mix->buffer[plane],
+					mix->buffer_unclamped[plane],
+					float_size);
 	}
 }
 
@@ -185,14 +321,18 @@ static void input_and_output(struct audio_output *audio, uint64_t audio_time,
 	}
 	pthread_mutex_unlock(&audio->input_mutex);
 
-	/* clear mix buffers */
+	/* clear mix buffers, inactive mixes are left untouched and their
+	 * data pointers stay NULL */
 	for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
 		struct audio_mix *mix = &audio->mixes[mix_idx];
 
-		memset(mix->buffer, 0, sizeof(mix->buffer));
+		if ((active_mixes & (1 << mix_idx)) == 0)
+			continue;
 
-		for (size_t i = 0; i < audio->planes; i++)
+		for (size_t i = 0; i < audio->planes; i++) {
+			memset(mix->buffer[i], 0, bytes);
 			data[mix_idx].data[i] = mix->buffer[i];
+		}
 	}
 
 	/* get new audio data */
@@ -202,11 +342,19 @@ static void input_and_output(struct audio_output *audio, uint64_t audio_time,
 		return;
 
 	/* clamps audio data to -1.0..1.0 */
-	clamp_audio_output(audio, bytes);
+	clamp_audio_output(audio, bytes, active_mixes);
 
 	/* output */
-	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++)
-		do_audio_output(audio, i, new_ts, AUDIO_OUTPUT_FRAMES);
+	if (os_atomic_load_bool(&audio->parallel)) {
+		do_audio_output_parallel(audio, active_mixes, new_ts,
+					 AUDIO_OUTPUT_FRAMES);
+		return;
+	}
+
+	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++) {
+		if (active_mixes & (1 << i))
+			do_audio_output(audio, i, new_ts, AUDIO_OUTPUT_FRAMES);
+	}
 }
 
 static void *audio_thread(void *param)
@@ -299,6 +447,52 @@ static inline bool audio_input_init(struct audio_input *input,
 	return true;
 }
 
+static void init_conversion(struct audio_output *audio,
+			    struct audio_convert_info *out,
+			    const struct audio_convert_info *conversion)
+{
+	if (conversion) {
+		*out = *conversion;
+	} else {
+		out->format = audio->info.format;
+		out->speakers = audio->info.speakers;
+		out->samples_per_sec = audio->info.samples_per_sec;
+	}
+
+	if (out->format == AUDIO_FORMAT_UNKNOWN)
+		out->format = audio->info.format;
+	if (out->speakers == SPEAKERS_UNKNOWN)
+		out->speakers = audio->info.speakers;
+	if (out->samples_per_sec == 0)
+		out->samples_per_sec = audio->info.samples_per_sec;
+}
+
+/* called from inside a parallel batch, the audio thread holds input_mutex
+ * and applies the change once every job is done */
+static bool queue_pending(struct audio_output *audio, size_t mix_idx,
+			  bool connect,
+			  const struct audio_convert_info *conversion,
+			  audio_output_callback_t callback, void *param)
+{
+	struct audio_pending pending = {0};
+
+	pending.mix_idx = mix_idx;
+	pending.connect = connect;
+	pending.input.callback = callback;
+	pending.input.param = param;
+
+	if (connect) {
+		init_conversion(audio, &pending.input.conversion, conversion);
+		if (!audio_input_init(&pending.input, audio))
+			return false;
+	}
+
+	pthread_mutex_lock(&audio->pending_mutex);
+	da_push_back(audio->pending, &pending);
+	pthread_mutex_unlock(&audio->pending_mutex);
+	return true;
+}
+
 bool audio_output_connect(audio_t *audio, size_t mi,
 			  const struct audio_convert_info *conversion,
 			  audio_output_callback_t callback, void *param)
@@ -308,30 +502,19 @@ bool audio_output_connect(audio_t *audio, size_t mi,
 	if (!audio || mi >= MAX_AUDIO_MIXES)
 		return false;
 
+	if (cur_output == audio)
+		return queue_pending(audio, mi, true, conversion, callback,
+				     param);
+
 	pthread_mutex_lock(&audio->input_mutex);
 
 	if (audio_get_input_idx(audio, mi, callback, param) == DARRAY_INVALID) {
 		struct audio_mix *mix = &audio->mixes[mi];
-		struct audio_input input;
+		struct audio_input input = {0};
 		input.callback = callback;
 		input.param = param;
 
-		if (conversion) {
-			input.conversion = *conversion;
-		} else {
-			input.conversion.format = audio->info.format;
-			input.conversion.speakers = audio->info.speakers;
-			input.conversion.samples_per_sec =
-				audio->info.samples_per_sec;
-		}
-
-		if (input.conversion.format == AUDIO_FORMAT_UNKNOWN)
-			input.conversion.format = audio->info.format;
-		if (input.conversion.speakers == SPEAKERS_UNKNOWN)
-			input.conversion.speakers = audio->info.speakers;
-		if (input.conversion.samples_per_sec == 0)
-			input.conversion.samples_per_sec =
-				audio->info.samples_per_sec;
+		init_conversion(audio, &input.conversion, conversion);
 
 		success = audio_input_init(&input, audio);
 		if (success)
@@ -349,6 +532,11 @@ void audio_output_disconnect(audio_t *audio, size_t mix_idx,
 	if (!audio || mix_idx >= MAX_AUDIO_MIXES)
 		return;
 
+	if (cur_output == audio) {
+		queue_pending(audio, mix_idx, false, NULL, callback, param);
+		return;
+	}
+
 	pthread_mutex_lock(&audio->input_mutex);
 
 	size_t idx = audio_get_input_idx(audio, mix_idx, callback, param);
@@ -389,17 +577,21 @@ int audio_output_open(audio_t **audio, struct audio_output_info *info)
 
 	if (pthread_mutex_init_recursive(&out->input_mutex) != 0)
 		goto fail0;
-	if (os_event_init(&out->stop_event, OS_EVENT_TYPE_MANUAL) != 0)
+	if (pthread_mutex_init(&out->pending_mutex, NULL) != 0)
 		goto fail1;
-	if (pthread_create(&out->thread, NULL, audio_thread, out) != 0)
+	if (os_event_init(&out->stop_event, OS_EVENT_TYPE_MANUAL) != 0)
 		goto fail2;
+	if (pthread_create(&out->thread, NULL, audio_thread, out) != 0)
+		goto fail3;
 
 	out->initialized = true;
 	*audio = out;
 	return AUDIO_OUTPUT_SUCCESS;
 
-fail2:
+fail3:
 	os_event_destroy(out->stop_event);
+fail2:
+	pthread_mutex_destroy(&out->pending_mutex);
 fail1:
 	pthread_mutex_destroy(&out->input_mutex);
 fail0:
@@ -419,6 +611,17 @@ void audio_output_close(audio_t *audio)
 		pthread_join(audio->thread, &thread_ret);
 		os_event_destroy(audio->stop_event);
 		pthread_mutex_destroy(&audio->input_mutex);
+		pthread_mutex_destroy(&audio->pending_mutex);
+	}
+
+	if (audio->pool) {
+		os_work_batch_destroy(audio->batch);
+		os_task_pool_release();
+	}
+
+	for (size_t i = 0; i < audio->pending.num; i++) {
+		if (audio->pending.array[i].connect)
+			audio_input_free(&audio->pending.array[i].input);
 	}
 
 	for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
@@ -429,6 +632,9 @@ void audio_output_close(audio_t *audio)
 
 		da_free(mix->inputs);
 	}
+
+	da_free(audio->jobs);
+	da_free(audio->pending);
 	bfree(audio);
 }
 
@@ -471,3 +677,14 @@ uint32_t audio_output_get_sample_rate(const audio_t *audio)
 {
 	return audio->info.samples_per_sec;
 }
+
+void audio_output_set_parallel(audio_t *audio, bool parallel)
+{
+	if (audio)
+		os_atomic_set_bool(&audio->parallel, parallel);
+}
+
+bool audio_output_parallel(const audio_t *audio)
+{
+	return audio ? os_atomic_load_bool(&audio->parallel) : false;
+}
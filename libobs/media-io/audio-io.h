@@ -239,6 +239,13 @@ EXPORT uint32_t audio_output_get_sample_rate(const audio_t *audio);
 EXPORT const struct audio_output_info *
 audio_output_get_info(const audio_t *audio);
 
+/* Resamples and outputs to every connected callback in parallel on the
+ * shared task pool, rather than one after another on the audio thread.
+ * Callbacks must then be safe to run at the same time as the other
+ * callbacks, including ones on the same mix.  Off by default. */
+EXPORT void audio_output_set_parallel(audio_t *audio, bool parallel);
+EXPORT bool audio_output_parallel(const audio_t *audio);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,297 @@
+/******************************************************************************
+    Copyright (C) 2023 by Lain Bailey <lain@obsproject.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <string.h>
+
+#if (defined(_M_X64) && !defined(_M_ARM64EC)) || defined(_M_IX86) || \
+	defined(__x86_64__) || defined(__i386__)
+#define AUDIO_MIX_X86
+
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX_FUNC
+#else
+#define AVX_FUNC __attribute__((target("avx")))
+#endif
+#else
+#include "../util/sse-intrin.h"
+#endif
+
+#include "../util/threading.h"
+#include "audio-mix.h"
+
+/* ------------------------------------------------------------------------- */
+/* C */
+
+static void add_c(float *dst, const float *src, size_t count)
+{
+	float *end = dst + count;
+
+	while (dst < end)
+		*(dst++) += *(src++);
+}
+
+static void clamp_c(float *data, float *unclamped, size_t count)
+{
+	float *end = data + count;
+
+	if (unclamped)
+		memcpy(unclamped, data, count * sizeof(float));
+
+	while (data < end) {
+		float val = *data;
+		val = (val == val) ? val : 0.0f;
+		val = (val > 1.0f) ? 1.0f : val;
+		val = (val < -1.0f) ? -1.0f : val;
+		*(data++) = val;
+	}
+}
+
+static bool silent_c(const float *data, size_t count)
+{
+	const float *end = data + count;
+
+	while (data < end) {
+		if (*(data++) != 0.0f)
+			return false;
+	}
+
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+/* SSE2, or NEON through simde */
+
+static void add_simd128(float *dst, const float *src, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128 a0 = _mm_loadu_ps(dst + i);
+		__m128 a1 = _mm_loadu_ps(dst + i + 4);
+		__m128 b0 = _mm_loadu_ps(src + i);
+		__m128 b1 = _mm_loadu_ps(src + i + 4);
+		_mm_storeu_ps(dst + i, _mm_add_ps(a0, b0));
+		_mm_storeu_ps(dst + i + 4, _mm_add_ps(a1, b1));
+	}
+
+	add_c(dst + i, src + i, count - i);
+}
+
+static void clamp_simd128(float *data, float *unclamped, size_t count)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 neg_one = _mm_set1_ps(-1.0f);
+	size_t i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		__m128 val = _mm_loadu_ps(data + i);
+		if (unclamped)
+			_mm_storeu_ps(unclamped + i, val);
+
+		/* NaNs compare unordered with themselves, mask them to 0 */
+		val = _mm_and_ps(val, _mm_cmpord_ps(val, val));
+		val = _mm_max_ps(_mm_min_ps(val, one), neg_one);
+		_mm_storeu_ps(data + i, val);
+	}
+
+	clamp_c(data + i, unclamped ? unclamped + i : NULL, count - i);
+}
+
+static bool silent_simd128(const float *data, size_t count)
+{
+	const __m128 zero = _mm_setzero_ps();
+	size_t i = 0;
+
+	/* NaNs are never equal, so they don't count as silence either */
+	for (; i + 8 <= count; i += 8) {
+		__m128 ne0 = _mm_cmpneq_ps(_mm_loadu_ps(data + i), zero);
+		__m128 ne1 = _mm_cmpneq_ps(_mm_loadu_ps(data + i + 4), zero);
+		if (_mm_movemask_ps(_mm_or_ps(ne0, ne1)))
+			return false;
+	}
+
+	return silent_c(data + i, count - i);
+}
+
+/* ------------------------------------------------------------------------- */
+/* AVX */
+
+#ifdef AUDIO_MIX_X86
+AVX_FUNC static void add_avx(float *dst, const float *src, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m256 a0 = _mm256_loadu_ps(dst + i);
+		__m256 a1 = _mm256_loadu_ps(dst + i + 8);
+		__m256 b0 = _mm256_loadu_ps(src + i);
+		__m256 b1 = _mm256_loadu_ps(src + i + 8);
+		_mm256_storeu_ps(dst + i, _mm256_add_ps(a0, b0));
+		_mm256_storeu_ps(dst + i + 8, _mm256_add_ps(a1, b1));
+	}
+
+	add_c(dst + i, src + i, count - i);
+}
+
+AVX_FUNC static void clamp_avx(float *data, float *unclamped, size_t count)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 neg_one = _mm256_set1_ps(-1.0f);
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m256 val = _mm256_loadu_ps(data + i);
+		if (unclamped)
+			_mm256_storeu_ps(unclamped + i, val);
+
+		val = _mm256_and_ps(val, _mm256_cmp_ps(val, val, _CMP_ORD_Q));
+		val = _mm256_max_ps(_mm256_min_ps(val, one), neg_one);
+		_mm256_storeu_ps(data + i, val);
+	}
+
+	clamp_c(data + i, unclamped ? unclamped + i : NULL, count - i);
+}
+
+AVX_FUNC static bool silent_avx(const float *data, size_t count)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m256 ne0 = _mm256_cmp_ps(_mm256_loadu_ps(data + i), zero,
+					   _CMP_NEQ_UQ);
+		__m256 ne1 = _mm256_cmp_ps(_mm256_loadu_ps(data + i + 8), zero,
+					   _CMP_NEQ_UQ);
+		if (_mm256_movemask_ps(_mm256_or_ps(ne0, ne1)))
+			return false;
+	}
+
+	return silent_c(data + i, count - i);
+}
+
+static bool cpu_has_avx(void)
+{
+#ifdef _MSC_VER
+	int regs[4];
+
+	__cpuid(regs, 1);
+
+	/* OSXSAVE and AVX, and the OS saves the YMM registers */
+	if ((regs[2] & (1 << 27)) == 0 || (regs[2] & (1 << 28)) == 0)
+		return false;
+	return (_xgetbv(0) & 0x6) == 0x6;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx");
+#endif
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+struct audio_mix_funcs {
+	void (*add)(float *dst, const float *src, size_t count);
+	void (*clamp)(float *data, float *unclamped, size_t count);
+	bool (*silent)(const float *data, size_t count);
+};
+
+static const struct audio_mix_funcs impls[] = {
+	[AUDIO_MIX_IMPL_C] = {add_c, clamp_c, silent_c},
+	[AUDIO_MIX_IMPL_SIMD128] = {add_simd128, clamp_simd128,
+				    silent_simd128},
+#ifdef AUDIO_MIX_X86
+	[AUDIO_MIX_IMPL_AVX] = {add_avx, clamp_avx, silent_avx},
+#endif
+};
+
+static pthread_once_t detect_once = PTHREAD_ONCE_INIT;
+static enum audio_mix_impl best_impl = AUDIO_MIX_IMPL_C;
+static enum audio_mix_impl cur_impl = AUDIO_MIX_IMPL_C;
+static const struct audio_mix_funcs *funcs = &impls[AUDIO_MIX_IMPL_C];
+
+static void detect_impl(void)
+{
+	best_impl = AUDIO_MIX_IMPL_SIMD128;
+#ifdef AUDIO_MIX_X86
+	if (cpu_has_avx())
+		best_impl = AUDIO_MIX_IMPL_AVX;
+#endif
+
+	cur_impl = best_impl;
+	funcs = &impls[best_impl];
+}
+
+static inline const struct audio_mix_funcs *get_funcs(void)
+{
+	pthread_once(&detect_once, detect_impl);
+	return funcs;
+}
+
+void audio_mix_add(float *dst, const float *src, size_t count)
+{
+	get_funcs()->add(dst, src, count);
+}
+
+void audio_mix_clamp(float *data, float *unclamped, size_t count)
+{
+	get_funcs()->clamp(data, unclamped, count);
+}
+
+bool audio_mix_is_silent(const float *data, size_t count)
+{
+	return get_funcs()->silent(data, count);
+}
+
+enum audio_mix_impl audio_mix_get_impl(void)
+{
+	pthread_once(&detect_once, detect_impl);
+	return cur_impl;
+}
+
+const char *audio_mix_get_impl_name(enum audio_mix_impl impl)
+{
+	switch (impl) {
+	case AUDIO_MIX_IMPL_C:
+		return "C";
+	case AUDIO_MIX_IMPL_SIMD128:
+#ifdef AUDIO_MIX_X86
+		return "SSE2";
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+		return "NEON";
+#else
+		return "SIMDe";
+#endif
+	case AUDIO_MIX_IMPL_AVX:
+		return "AVX";
+	}
+
+	return "Unknown";
+}
+
+bool audio_mix_set_impl(enum audio_mix_impl impl)
+{
+	pthread_once(&detect_once, detect_impl);
+
+	if (impl > best_impl)
+		return false;
+
+	cur_impl = impl;
+	funcs = &impls[impl];
+	return true;
+}
@@ -0,0 +1,61 @@
+/******************************************************************************
+    Copyright (C) 2023 by Lain Bailey <lain@obsproject.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "../util/c99defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Sample kernels used by the audio mixer.  The implementation is picked once
+ * at runtime from what the CPU supports; the 128-bit kernels are written
+ * against SSE2 and go through simde on other architectures (NEON on ARM).
+ */
+
+enum audio_mix_impl {
+	AUDIO_MIX_IMPL_C,
+	AUDIO_MIX_IMPL_SIMD128,
+	AUDIO_MIX_IMPL_AVX,
+};
+
+/** dst[i] += src[i] */
+EXPORT void audio_mix_add(float *dst, const float *src, size_t count);
+
+/**
+ * Copies data to unclamped (if not NULL), then clamps data in place to
+ * -1.0..1.0, replacing NaNs with 0.0.
+ */
+EXPORT void audio_mix_clamp(float *data, float *unclamped, size_t count);
+
+/** Returns true if every sample is zero (digital silence) */
+EXPORT bool audio_mix_is_silent(const float *data, size_t count);
+
+EXPORT enum audio_mix_impl audio_mix_get_impl(void);
+EXPORT const char *audio_mix_get_impl_name(enum audio_mix_impl impl);
+
+/**
+ * Forces a specific implementation, mainly for testing and benchmarking.
+ * Returns false if the CPU doesn't support it.
+ */
+EXPORT bool audio_mix_set_impl(enum audio_mix_impl impl);
+
+#ifdef __cplusplus
+}
+#endif
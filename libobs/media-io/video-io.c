@@ -22,6 +22,7 @@
 #include "../util/profiler.h"
 #include "../util/threading.h"
 #include "../util/darray.h"
+#include "../util/circlebuf.h"
 #include "../util/util_uint64.h"
 
 #include "format-conversion.h"
@@ -34,10 +35,46 @@ extern profiler_name_store_t *obs_get_profiler_name_store(void);
 #define MAX_CONVERT_BUFFERS 3
 #define MAX_CACHE_SIZE 16
 
+/* frames an input can have waiting before it starts repeating frames */
+#define MAX_INPUT_QUEUE 2
+
+/*
+ * Each input has its own queue and thread, so scaling and encoding for one
+ * input don't hold up the others.  Inputs get the cached frame data itself,
+ * not a copy: frame data lives in refcounted buffers that cache entries point
+ * to, and an entry gets a fresh buffer each time it is filled.  A buffer goes
+ * back to the pool once the cache and every input it was queued for are done
+ * with it.  An input that falls behind gets the last frame in its queue once
+ * more instead of a new frame when its queue is full, rather than holding on
+ * to more buffers, and the pool has room for every input to hold as many as
+ * it can, so one slow input never keeps frames from the others.  It still
+ * gets one frame per frame of the output, raw encoders count frames for their
+ * timestamps.
+ *
+ *   Inputs are stopped and joined without input_mutex held, as their
+ * callbacks can call back into video-io.  An input disconnected from its own
+ * callback can't join itself, so it's kept until the output is closed.
+ */
+
+struct frame_buffer {
+	struct video_frame frame;
+
+	/* under data_mutex */
+	long refs;
+};
+
 struct cached_frame_info {
 	struct video_data frame;
 	int skipped;
 	int count;
+	struct frame_buffer *buffer;
+};
+
+/* count is how many times the frame is given to the input */
+struct queued_frame {
+	struct video_data frame;
+	struct frame_buffer *buffer;
+	int count;
 };
 
 struct video_input {
@@ -55,17 +92,23 @@ struct video_input {
 	// the total frame count at the time the encoder was started
 	uint32_t frame_rate_divisor;
 	uint32_t frame_rate_divisor_counter;
+	uint64_t frame_time;
 
 	void (*callback)(void *param, struct video_data *frame);
 	void *param;
-};
 
-static inline void video_input_free(struct video_input *input)
-{
-	for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
-		video_frame_free(&input->frame[i]);
-	video_scaler_destroy(input->scaler);
-}
+	struct video_output *video;
+
+	pthread_t thread;
+	os_sem_t *semaphore;
+	pthread_mutex_t mutex;
+	struct circlebuf queue;
+	bool stop;
+	bool detached;
+
+	volatile long total_frames;
+	volatile long skipped_frames;
+};
 
 struct video_output {
 	struct video_output_info info;
@@ -80,12 +123,20 @@ struct video_output {
 	volatile long total_frames;
 
 	pthread_mutex_t input_mutex;
-	DARRAY(struct video_input) inputs;
+	DARRAY(struct video_input *) inputs;
+	const char *input_thread_name;
+
+	/* inputs that disconnected themselves, joined on close */
+	DARRAY(struct video_input *) stopped_inputs;
 
 	size_t available_frames;
 	size_t first_added;
 	size_t last_added;
 	struct cached_frame_info cache[MAX_CACHE_SIZE];
+	DARRAY(struct frame_buffer *) buffers;
+
+	/* under data_mutex, buffers that inputs can hold at most */
+	size_t input_buffers;
 
 	struct video_output *parent;
 
@@ -126,6 +177,44 @@ static inline bool scale_video_output(struct video_input *input,
 	return success;
 }
 
+static void release_buffer(struct video_output *video,
+			   struct frame_buffer *buffer)
+{
+	pthread_mutex_lock(&video->data_mutex);
+	buffer->refs--;
+	pthread_mutex_unlock(&video->data_mutex);
+}
+
+static void queue_input_frame(struct video_output *video,
+			      struct video_input *input,
+			      struct cached_frame_info *frame_info)
+{
+	struct queued_frame qf = {frame_info->frame, frame_info->buffer, 1};
+
+	pthread_mutex_lock(&input->mutex);
+
+	if (input->queue.size >= MAX_INPUT_QUEUE * sizeof(qf)) {
+		struct queued_frame *last = circlebuf_data(
+			&input->queue, input->queue.size - sizeof(qf));
+		last->count++;
+		pthread_mutex_unlock(&input->mutex);
+
+		os_atomic_inc_long(&input->skipped_frames);
+		os_atomic_inc_long(&video->skipped_frames);
+		os_sem_post(input->semaphore);
+		return;
+	}
+
+	pthread_mutex_lock(&video->data_mutex);
+	qf.buffer->refs++;
+	pthread_mutex_unlock(&video->data_mutex);
+
+	circlebuf_push_back(&input->queue, &qf, sizeof(qf));
+	pthread_mutex_unlock(&input->mutex);
+
+	os_sem_post(input->semaphore);
+}
+
 static inline bool video_output_cur_frame(struct video_output *video)
 {
 	struct cached_frame_info *frame_info;
@@ -145,8 +234,7 @@ static inline bool video_output_cur_frame(struct video_output *video)
 	pthread_mutex_lock(&video->input_mutex);
 
 	for (size_t i = 0; i < video->inputs.num; i++) {
-		struct video_input *input = video->inputs.array + i;
-		struct video_data frame = frame_info->frame;
+		struct video_input *input = video->inputs.array[i];
 
 		// an explicit counter is used instead of remainder calculation
 		// to allow multiple encoders started at the same time to start on
@@ -159,8 +247,7 @@ static inline bool video_output_cur_frame(struct video_output *video)
 		if (skip)
 			continue;
 
-		if (scale_video_output(input, &frame))
-			input->callback(input->param, &frame);
+		queue_input_frame(video, input, frame_info);
 	}
 
 	pthread_mutex_unlock(&video->input_mutex);
@@ -174,6 +261,9 @@ static inline bool video_output_cur_frame(struct video_output *video)
 	skipped = frame_info->skipped > 0;
 
 	if (complete) {
+		frame_info->buffer->refs--;
+		frame_info->buffer = NULL;
+
 		if (++video->first_added == video->info.cache_size)
 			video->first_added = 0;
 
@@ -191,6 +281,94 @@ static inline bool video_output_cur_frame(struct video_output *video)
 	return complete;
 }
 
+/* ------------------------------------------------------------------------- */
+
+static void video_input_free(struct video_input *input)
+{
+	struct queued_frame qf;
+
+	while (input->queue.size) {
+		circlebuf_pop_front(&input->queue, &qf, sizeof(qf));
+		release_buffer(input->video, qf.buffer);
+	}
+
+	pthread_mutex_lock(&input->video->data_mutex);
+	input->video->input_buffers -= MAX_INPUT_QUEUE + 1;
+	pthread_mutex_unlock(&input->video->data_mutex);
+
+	for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
+		video_frame_free(&input->frame[i]);
+	video_scaler_destroy(input->scaler);
+
+	circlebuf_free(&input->queue);
+	os_sem_destroy(input->semaphore);
+	pthread_mutex_destroy(&input->mutex);
+	bfree(input);
+}
+
+static void *input_thread(void *param)
+{
+	struct video_input *input = param;
+	struct queued_frame *front;
+	struct queued_frame qf;
+	bool done;
+
+	os_set_thread_name("video-io: input thread");
+
+	while (os_sem_wait(input->semaphore) == 0) {
+		pthread_mutex_lock(&input->mutex);
+		if (input->stop) {
+			pthread_mutex_unlock(&input->mutex);
+			break;
+		}
+
+		/* a repeated frame stays queued, one frame time later */
+		front = circlebuf_data(&input->queue, 0);
+		qf = *front;
+		done = --front->count == 0;
+		if (done)
+			circlebuf_pop_front(&input->queue, NULL, sizeof(qf));
+		else
+			front->frame.timestamp += input->frame_time;
+		pthread_mutex_unlock(&input->mutex);
+
+		profile_start(input->video->input_thread_name);
+		if (scale_video_output(input, &qf.frame))
+			input->callback(input->param, &qf.frame);
+		profile_end(input->video->input_thread_name);
+
+		if (done)
+			release_buffer(input->video, qf.buffer);
+		os_atomic_inc_long(&input->total_frames);
+
+		profile_reenable_thread();
+
+		/* disconnected from inside its own callback */
+		if (input->detached)
+			break;
+	}
+
+	return NULL;
+}
+
+static void video_input_join(struct video_input *input)
+{
+	pthread_join(input->thread, NULL);
+	video_input_free(input);
+}
+
+/* call without input_mutex held, waits for the input's current frame to
+ * finish */
+static void video_input_stop(struct video_input *input)
+{
+	pthread_mutex_lock(&input->mutex);
+	input->stop = true;
+	pthread_mutex_unlock(&input->mutex);
+
+	os_sem_post(input->semaphore);
+	video_input_join(input);
+}
+
 static void *video_thread(void *param)
 {
 	struct video_output *video = param;
@@ -227,18 +405,43 @@ static inline bool valid_video_params(const struct video_output_info *info)
 	       info->fps_num != 0;
 }
 
+static struct frame_buffer *create_buffer(struct video_output *video)
+{
+	/* the frames rendered output is downloaded into */
+	enum bmem_tag prev_tag = bmem_set_tag(BMEM_TAG_GRAPHICS_STAGING);
+	struct frame_buffer *buffer = bzalloc(sizeof(*buffer));
+
+	video_frame_init(&buffer->frame, video->info.format, video->info.width,
+			 video->info.height);
+	da_push_back(video->buffers, &buffer);
+
+	bmem_set_tag(prev_tag);
+	return buffer;
+}
+
+/* call with data_mutex held.  Each input holds at most its queue and the
+ * frame it's working on, so there are never more buffers than the cache and
+ * those need. */
+static struct frame_buffer *get_free_buffer(struct video_output *video)
+{
+	for (size_t i = 0; i < video->buffers.num; i++) {
+		if (!video->buffers.array[i]->refs)
+			return video->buffers.array[i];
+	}
+
+	if (video->buffers.num >= video->info.cache_size + video->input_buffers)
+		return NULL;
+
+	return create_buffer(video);
+}
+
 static inline void init_cache(struct video_output *video)
 {
 	if (video->info.cache_size > MAX_CACHE_SIZE)
 		video->info.cache_size = MAX_CACHE_SIZE;
 
-	for (size_t i = 0; i < video->info.cache_size; i++) {
-		struct video_frame *frame;
-		frame = (struct video_frame *)&video->cache[i];
-
-		video_frame_init(frame, video->info.format, video->info.width,
-				 video->info.height);
-	}
+	for (size_t i = 0; i < video->info.cache_size; i++)
+		create_buffer(video);
 
 	video->available_frames = video->info.cache_size;
 }
@@ -257,6 +460,9 @@ int video_output_open(video_t **video, struct video_output_info *info)
 	memcpy(&out->info, info, sizeof(struct video_output_info));
 	out->frame_time =
 		util_mul_div64(1000000000ULL, info->fps_den, info->fps_num);
+	out->input_thread_name =
+		profile_store_name(obs_get_profiler_name_store(),
+				   "video_input_thread(%s)", info->name);
 
 	if (pthread_mutex_init_recursive(&out->data_mutex) != 0)
 		goto fail0;
@@ -288,18 +494,29 @@ void video_output_close(video_t *video)
 	if (!video)
 		return;
 
+	DARRAY(struct video_input *) inputs;
+
 	video_output_stop(video);
 
+	da_init(inputs);
 	pthread_mutex_lock(&video->input_mutex);
+	da_move(inputs, video->inputs);
+	pthread_mutex_unlock(&video->input_mutex);
 
-	for (size_t i = 0; i < video->inputs.num; i++)
-		video_input_free(&video->inputs.array[i]);
-	da_free(video->inputs);
+	for (size_t i = 0; i < inputs.num; i++)
+		video_input_stop(inputs.array[i]);
+	da_free(inputs);
 
-	for (size_t i = 0; i < video->info.cache_size; i++)
-		video_frame_free((struct video_frame *)&video->cache[i]);
+	for (size_t i = 0; i < video->stopped_inputs.num; i++)
+		video_input_join(video->stopped_inputs.array[i]);
+	da_free(video->stopped_inputs);
+
+	for (size_t i = 0; i < video->buffers.num; i++) {
+		video_frame_free(&video->buffers.array[i]->frame);
+		bfree(video->buffers.array[i]);
+	}
+	da_free(video->buffers);
 
-	pthread_mutex_unlock(&video->input_mutex);
 	os_sem_destroy(video->update_semaphore);
 	pthread_mutex_destroy(&video->data_mutex);
 	pthread_mutex_destroy(&video->input_mutex);
@@ -313,7 +530,7 @@ static size_t video_get_input_idx(const video_t *video,
 				  void *param)
 {
 	for (size_t i = 0; i < video->inputs.num; i++) {
-		struct video_input *input = video->inputs.array + i;
+		struct video_input *input = video->inputs.array[i];
 		if (input->callback == callback && input->param == param)
 			return i;
 	}
@@ -385,7 +602,26 @@ static inline bool video_input_init(struct video_input *input,
 					 input->conversion.height);
 	}
 
+	if (pthread_mutex_init(&input->mutex, NULL) != 0)
+		goto fail0;
+	if (os_sem_init(&input->semaphore, 0) != 0)
+		goto fail1;
+	if (pthread_create(&input->thread, NULL, input_thread, input) != 0)
+		goto fail2;
+
 	return true;
+
+fail2:
+	os_sem_destroy(input->semaphore);
+fail1:
+	pthread_mutex_destroy(&input->mutex);
+fail0:
+	for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
+		video_frame_free(&input->frame[i]);
+	video_scaler_destroy(input->scaler);
+
+	blog(LOG_ERROR, "video_input_init: Failed to create input thread");
+	return false;
 }
 
 static inline void reset_frames(video_t *video)
@@ -430,31 +666,36 @@ bool video_output_connect2(
 	pthread_mutex_lock(&video->input_mutex);
 
 	if (video_get_input_idx(video, callback, param) == DARRAY_INVALID) {
-		struct video_input input;
-		memset(&input, 0, sizeof(input));
+		struct video_input *input = bzalloc(sizeof(*input));
 
-		input.callback = callback;
-		input.param = param;
+		input->callback = callback;
+		input->param = param;
+		input->video = video;
 
-		input.frame_rate_divisor = frame_rate_divisor;
+		input->frame_rate_divisor = frame_rate_divisor;
+		input->frame_time = video->frame_time * frame_rate_divisor;
 
 		if (conversion) {
-			input.conversion = *conversion;
+			input->conversion = *conversion;
 		} else {
-			input.conversion.format = video->info.format;
-			input.conversion.width = video->info.width;
-			input.conversion.height = video->info.height;
-			input.conversion.range = video->info.range;
-			input.conversion.colorspace = video->info.colorspace;
+			input->conversion.format = video->info.format;
+			input->conversion.width = video->info.width;
+			input->conversion.height = video->info.height;
+			input->conversion.range = video->info.range;
+			input->conversion.colorspace = video->info.colorspace;
 		}
 
-		if (input.conversion.width == 0)
-			input.conversion.width = video->info.width;
-		if (input.conversion.height == 0)
-			input.conversion.height = video->info.height;
+		if (input->conversion.width == 0)
+			input->conversion.width = video->info.width;
+		if (input->conversion.height == 0)
+			input->conversion.height = video->info.height;
 
-		success = video_input_init(&input, video);
+		success = video_input_init(input, video);
 		if (success) {
+			pthread_mutex_lock(&video->data_mutex);
+			video->input_buffers += MAX_INPUT_QUEUE + 1;
+			pthread_mutex_unlock(&video->data_mutex);
+
 			if (video->inputs.num == 0) {
 				if (!os_atomic_load_long(&video->gpu_refs)) {
 					reset_frames(video);
@@ -462,6 +703,8 @@ bool video_output_connect2(
 				os_atomic_set_bool(&video->raw_active, true);
 			}
 			da_push_back(video->inputs, &input);
+		} else {
+			bfree(input);
 		}
 	}
 
@@ -497,22 +740,41 @@ void video_output_disconnect(video_t *video,
 
 	video = get_root(video);
 
+	struct video_input *input = NULL;
+
 	pthread_mutex_lock(&video->input_mutex);
 
 	size_t idx = video_get_input_idx(video, callback, param);
 	if (idx != DARRAY_INVALID) {
-		video_input_free(video->inputs.array + idx);
+		input = video->inputs.array[idx];
 		da_erase(video->inputs, idx);
 
+		if (os_atomic_load_long(&input->skipped_frames))
+			blog(LOG_INFO,
+			     "Video input stopped, number of frames repeated "
+			     "due to encoding lag: %ld/%ld",
+			     os_atomic_load_long(&input->skipped_frames),
+			     os_atomic_load_long(&input->total_frames));
+
 		if (video->inputs.num == 0) {
 			os_atomic_set_bool(&video->raw_active, false);
 			if (!os_atomic_load_long(&video->gpu_refs)) {
 				log_skipped(video);
 			}
 		}
+
+		/* can't join itself, so it's joined on close instead */
+		if (pthread_equal(pthread_self(), input->thread)) {
+			input->detached = true;
+			da_push_back(video->stopped_inputs, &input);
+			input = NULL;
+		}
 	}
 
 	pthread_mutex_unlock(&video->input_mutex);
+
+	if (input)
+		video_input_stop(input);
 }
 
 bool video_output_active(const video_t *video)
@@ -527,10 +789,28 @@ const struct video_output_info *video_output_get_info(const video_t *video)
 	return video ? &video->info : NULL;
 }
 
+/* call with data_mutex held */
+static void skip_frames(struct video_output *video, int count)
+{
+	if (video->available_frames != video->info.cache_size) {
+		/* output the last frame again instead */
+		video->cache[video->last_added].count += count;
+		video->cache[video->last_added].skipped += count;
+	} else {
+		/* nothing left to repeat, inputs are still busy with every
+		 * frame buffer */
+		for (int i = 0; i < count; i++) {
+			os_atomic_inc_long(&video->skipped_frames);
+			os_atomic_inc_long(&video->total_frames);
+		}
+	}
+}
+
 bool video_output_lock_frame(video_t *video, struct video_frame *frame,
 			     int count, uint64_t timestamp)
 {
 	struct cached_frame_info *cfi;
+	struct frame_buffer *buffer;
 	bool locked;
 
 	if (!video)
@@ -540,9 +820,10 @@ bool video_output_lock_frame(video_t *video, struct video_frame *frame,
 
 	pthread_mutex_lock(&video->data_mutex);
 
-	if (video->available_frames == 0) {
-		video->cache[video->last_added].count += count;
-		video->cache[video->last_added].skipped += count;
+	buffer = video->available_frames ? get_free_buffer(video) : NULL;
+
+	if (!buffer) {
+		skip_frames(video, count);
 		locked = false;
 
 	} else {
@@ -552,6 +833,12 @@ bool video_output_lock_frame(video_t *video, struct video_frame *frame,
 		}
 
 		cfi = &video->cache[video->last_added];
+		cfi->buffer = buffer;
+		cfi->buffer->refs = 1;
+		for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+			cfi->frame.data[i] = buffer->frame.data[i];
+			cfi->frame.linesize[i] = buffer->frame.linesize[i];
+		}
 		cfi->frame.timestamp = timestamp;
 		cfi->count = count;
 		cfi->skipped = 0;
@@ -647,6 +934,74 @@ uint32_t video_output_get_total_frames(const video_t *video)
 		&get_const_root(video)->total_frames);
 }
 
+static struct video_input *
+lock_input(video_t *video,
+	   void (*callback)(void *param, struct video_data *frame),
+	   void *param)
+{
+	size_t idx;
+
+	pthread_mutex_lock(&video->input_mutex);
+	idx = video_get_input_idx(video, callback, param);
+	if (idx != DARRAY_INVALID)
+		return video->inputs.array[idx];
+
+	pthread_mutex_unlock(&video->input_mutex);
+	return NULL;
+}
+
+uint32_t video_output_get_input_skipped_frames(
+	video_t *video, void (*callback)(void *param, struct video_data *frame),
+	void *param)
+{
+	struct video_input *input;
+	uint32_t skipped;
+
+	if (!video || !(input = lock_input(get_root(video), callback, param)))
+		return 0;
+
+	skipped = (uint32_t)os_atomic_load_long(&input->skipped_frames);
+	pthread_mutex_unlock(&get_root(video)->input_mutex);
+	return skipped;
+}
+
+uint32_t video_output_get_input_total_frames(
+	video_t *video, void (*callback)(void *param, struct video_data *frame),
+	void *param)
+{
+	struct video_input *input;
+	uint32_t total;
+
+	if (!video || !(input = lock_input(get_root(video), callback, param)))
+		return 0;
+
+	total = (uint32_t)os_atomic_load_long(&input->total_frames);
+	pthread_mutex_unlock(&get_root(video)->input_mutex);
+	return total;
+}
+
+uint32_t video_output_get_input_queued_frames(
+	video_t *video, void (*callback)(void *param, struct video_data *frame),
+	void *param)
+{
+	struct video_input *input;
+	struct queued_frame *qf;
+	uint32_t queued = 0;
+
+	if (!video || !(input = lock_input(get_root(video), callback, param)))
+		return 0;
+
+	pthread_mutex_lock(&input->mutex);
+	for (size_t i = 0; i < input->queue.size; i += sizeof(*qf)) {
+		qf = circlebuf_data(&input->queue, i);
+		queued += (uint32_t)qf->count;
+	}
+	pthread_mutex_unlock(&input->mutex);
+
+	pthread_mutex_unlock(&get_root(video)->input_mutex);
+	return queued;
+}
+
 /* Note: These four functions below are a very slight bit of a hack.  If the
  * texture encoder thread is active while the raw encoder thread is active, the
  * total frame count will just be doubled while they're both active.  Which is
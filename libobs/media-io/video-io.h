@@ -337,6 +337,20 @@ EXPORT double video_output_get_frame_rate(const video_t *video);
 EXPORT uint32_t video_output_get_skipped_frames(const video_t *video);
 EXPORT uint32_t video_output_get_total_frames(const video_t *video);
 
+/* Every connected callback runs on its own thread with a short queue of
+ * frames.  These get the frames a callback was given, the frames it was
+ * given the previous frame again for because its queue was full, and the
+ * frames currently in its queue. */
+EXPORT uint32_t video_output_get_input_total_frames(
+	video_t *video, void (*callback)(void *param, struct video_data *frame),
+	void *param);
+EXPORT uint32_t video_output_get_input_skipped_frames(
+	video_t *video, void (*callback)(void *param, struct video_data *frame),
+	void *param);
+EXPORT uint32_t video_output_get_input_queued_frames(
+	video_t *video, void (*callback)(void *param, struct video_data *frame),
+	void *param);
+
 extern void video_output_inc_texture_encoders(video_t *video);
 extern void video_output_dec_texture_encoders(video_t *video);
 extern void video_output_inc_texture_frames(video_t *video);
@@ -0,0 +1,174 @@
+/******************************************************************************
+    Copyright (C) 2023 by Lain Bailey <lain@obsproject.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <string.h>
+
+#include "video-slices.h"
+#include "../util/bmem.h"
+#include "../util/darray.h"
+#include "../util/task.h"
+
+/* below this a band costs more to hand out than it saves */
+#define MIN_SLICE_BYTES (256 * 1024)
+
+struct slice_copy {
+	uint8_t *dst;
+	const uint8_t *src;
+	uint32_t dst_linesize;
+	uint32_t src_linesize;
+	uint32_t row_bytes;
+	uint32_t rows;
+};
+
+/* the pool is only acquired once a plane is big enough to be split, so a
+ * context that only ever sees small planes never starts its threads */
+struct video_slices {
+	os_work_pool_t *pool;
+	os_work_batch_t *batch;
+	uint32_t max_slices;
+	bool pool_failed;
+
+	DARRAY(struct slice_copy) copies;
+};
+
+static void copy_rows(const struct slice_copy *copy)
+{
+	const uint8_t *src = copy->src;
+	uint8_t *dst = copy->dst;
+
+	if (copy->row_bytes == copy->src_linesize &&
+	    copy->row_bytes == copy->dst_linesize) {
+		memcpy(dst, src, (size_t)copy->row_bytes * copy->rows);
+		return;
+	}
+
+	for (uint32_t y = 0; y < copy->rows; y++) {
+		memcpy(dst, src, copy->row_bytes);
+		dst += copy->dst_linesize;
+		src += copy->src_linesize;
+	}
+}
+
+static void run_copy(void *param)
+{
+	copy_rows(param);
+}
+
+static bool acquire_pool(struct video_slices *vs)
+{
+	if (vs->pool)
+		return true;
+	if (vs->pool_failed)
+		return false;
+
+	vs->pool = os_task_pool_acquire();
+	if (!vs->pool) {
+		vs->pool_failed = true;
+		return false;
+	}
+
+	if (!vs->max_slices)
+		vs->max_slices =
+			(uint32_t)os_work_pool_get_thread_count(vs->pool) + 1;
+	vs->batch = os_work_batch_create(NULL);
+	return true;
+}
+
+static uint32_t get_slice_count(struct video_slices *vs, uint32_t rows,
+				size_t row_bytes)
+{
+	size_t count = (size_t)rows * row_bytes / MIN_SLICE_BYTES;
+
+	if (count <= 1 || !acquire_pool(vs))
+		return 1;
+
+	if (count > vs->max_slices)
+		count = vs->max_slices;
+	if (count > rows)
+		count = rows;
+	return count ? (uint32_t)count : 1;
+}
+
+video_slices_t *video_slices_create(uint32_t max_slices)
+{
+	struct video_slices *vs = bzalloc(sizeof(struct video_slices));
+	vs->max_slices = max_slices;
+	return vs;
+}
+
+void video_slices_destroy(video_slices_t *vs)
+{
+	if (!vs)
+		return;
+
+	if (vs->pool) {
+		os_work_batch_destroy(vs->batch);
+		os_task_pool_release();
+	}
+
+	da_free(vs->copies);
+	bfree(vs);
+}
+
+void video_slices_add_copy(video_slices_t *vs, uint8_t *dst,
+			   uint32_t dst_linesize, const uint8_t *src,
+			   uint32_t src_linesize, uint32_t row_bytes,
+			   uint32_t rows)
+{
+	uint32_t count;
+	uint32_t slice_rows;
+
+	if (!vs) {
+		struct slice_copy copy = {dst,       src,  dst_linesize,
+					  src_linesize, row_bytes, rows};
+		copy_rows(&copy);
+		return;
+	}
+
+	count = get_slice_count(vs, rows, row_bytes);
+	slice_rows = (rows + count - 1) / count;
+
+	for (uint32_t y = 0; y < rows; y += slice_rows) {
+		struct slice_copy *copy = da_push_back_new(vs->copies);
+		copy->dst = dst + (size_t)y * dst_linesize;
+		copy->src = src + (size_t)y * src_linesize;
+		copy->dst_linesize = dst_linesize;
+		copy->src_linesize = src_linesize;
+		copy->row_bytes = row_bytes;
+		copy->rows = rows - y < slice_rows ? rows - y : slice_rows;
+	}
+}
+
+void video_slices_run(video_slices_t *vs)
+{
+	if (!vs || !vs->copies.num)
+		return;
+
+	/* only small planes so far, which stay on this thread */
+	if (vs->copies.num == 1 || !vs->pool) {
+		for (size_t i = 0; i < vs->copies.num; i++)
+			copy_rows(&vs->copies.array[i]);
+	} else {
+		os_work_batch_clear(vs->batch);
+		for (size_t i = 0; i < vs->copies.num; i++)
+			os_work_batch_add(vs->batch, run_copy,
+					  &vs->copies.array[i]);
+		os_work_batch_run(vs->pool, vs->batch);
+	}
+
+	da_resize(vs->copies, 0);
+}
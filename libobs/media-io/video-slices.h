@@ -0,0 +1,58 @@
+/******************************************************************************
+    Copyright (C) 2023 by Lain Bailey <lain@obsproject.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "../util/c99defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Slice-parallel plane copies.
+ *
+ *   Planes are split into bands of rows which run on the thread pool shared
+ * with the task queues, the calling thread works on bands as well.  Planes
+ * that are too small to be worth splitting are handled on the calling thread
+ * only, and the pool isn't acquired until a plane is big enough.  A slice
+ * context is not thread safe, use one per thread.
+ *
+ *   All functions accept a NULL context, in which case everything runs on
+ * the calling thread right away.
+ */
+
+struct video_slices;
+typedef struct video_slices video_slices_t;
+
+/* 0 max_slices uses every pool thread plus the calling thread */
+EXPORT video_slices_t *video_slices_create(uint32_t max_slices);
+EXPORT void video_slices_destroy(video_slices_t *vs);
+
+/* queues a copy of rows * row_bytes bytes, the copy happens on the next
+ * video_slices_run call */
+EXPORT void video_slices_add_copy(video_slices_t *vs, uint8_t *dst,
+				  uint32_t dst_linesize, const uint8_t *src,
+				  uint32_t src_linesize, uint32_t row_bytes,
+				  uint32_t rows);
+
+/* runs every queued copy and returns once they are done */
+EXPORT void video_slices_run(video_slices_t *vs);
+
+#ifdef __cplusplus
+}
+#endif
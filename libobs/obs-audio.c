@@ -18,6 +18,7 @@
 #include <inttypes.h>
 #include "obs-internal.h"
 #include "util/util_uint64.h"
+#include "media-io/audio-mix.h"
 
 struct ts_info {
 	uint64_t start;
@@ -37,7 +38,10 @@ static void push_audio_tree(obs_source_t *parent, obs_source_t *source, void *p)
 			da_push_back(audio->render_order, &s);
 	}
 
-	UNUSED_PARAMETER(parent);
+	if (audio->render_parallel && parent) {
+		da_push_back(audio->render_edges, &source);
+		da_push_back(audio->render_edges, &parent);
+	}
 }
 
 static inline size_t convert_time_to_frames(size_t sample_rate, uint64_t t)
@@ -46,8 +50,9 @@ static inline size_t convert_time_to_frames(size_t sample_rate, uint64_t t)
 }
 
 static inline void mix_audio(struct audio_output_data *mixes,
-			     obs_source_t *source, size_t channels,
-			     size_t sample_rate, struct ts_info *ts)
+			     obs_source_t *source, uint32_t mixers,
+			     size_t channels, size_t sample_rate,
+			     struct ts_info *ts)
 {
 	size_t total_floats = AUDIO_OUTPUT_FRAMES;
 	size_t start_point = 0;
@@ -55,6 +60,10 @@ static inline void mix_audio(struct audio_output_data *mixes,
 	if (source->audio_ts < ts->start || ts->end <= source->audio_ts)
 		return;
 
+	/* adding digital silence is a no-op */
+	if (source->audio_silent_since)
+		return;
+
 	if (source->audio_ts != ts->start) {
 		start_point = convert_time_to_frames(
 			sample_rate, source->audio_ts - ts->start);
@@ -65,17 +74,14 @@ static inline void mix_audio(struct audio_output_data *mixes,
 	}
 
 	for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
-		for (size_t ch = 0; ch < channels; ch++) {
-			register float *mix = mixes[mix_idx].data[ch];
-			register float *aud =
-				source->audio_output_buf[mix_idx][ch];
-			register float *end;
-
-			mix += start_point;
-			end = aud + total_floats;
+		/* inactive mixes aren't cleared or output */
+		if ((mixers & (1 << mix_idx)) == 0)
+			continue;
 
-			while (aud < end)
-				*(mix++) += *(aud++);
+		for (size_t ch = 0; ch < channels; ch++) {
+			audio_mix_add(mixes[mix_idx].data[ch] + start_point,
+				      source->audio_output_buf[mix_idx][ch],
+				      total_floats);
 		}
 	}
 }
@@ -515,6 +521,94 @@ static inline void execute_audio_tasks(void)
 	}
 }
 
+static void render_audio_source(struct obs_core_audio *audio,
+				obs_source_t *source, uint32_t mixers,
+				size_t channels, size_t sample_rate,
+				size_t audio_size, uint64_t start_ts)
+{
+	obs_source_audio_render(source, mixers, channels, sample_rate,
+				audio_size);
+
+	/* if a source has gone backward in time and we can no
+	 * longer buffer, drop some or all of its audio */
+	if (audio_buffering_maxed(audio) && source->audio_ts != 0 &&
+	    source->audio_ts < start_ts) {
+		if (source->info.audio_render) {
+			blog(LOG_DEBUG,
+			     "render audio source %s timestamp has "
+			     "gone backwards",
+			     obs_source_get_name(source));
+
+			/* just avoid further damage */
+			source->audio_pending = true;
+#if DEBUG_AUDIO == 1
+			/* this should really be fixed */
+			assert(false);
+#endif
+		} else {
+			pthread_mutex_lock(&source->audio_buf_mutex);
+			bool rerender = ignore_audio(source, channels,
+						     sample_rate, start_ts);
+			pthread_mutex_unlock(&source->audio_buf_mutex);
+
+			/* if we (potentially) recovered, re-render */
+			if (rerender)
+				obs_source_audio_render(source, mixers,
+							channels, sample_rate,
+							audio_size);
+		}
+	}
+}
+
+static void render_audio_job(void *param)
+{
+	struct obs_core_audio *audio = &obs->audio;
+
+	render_audio_source(audio, param, audio->render_mixers,
+			    audio->render_channels, audio->render_sample_rate,
+			    audio->render_size, audio->render_start_ts);
+}
+
+static const char *render_audio_parallel_name = "render_audio_parallel";
+static const char *render_audio_worker_name = "render_audio_worker";
+
+/* sources that mix other sources (scenes, transitions) render after them */
+static void render_audio_parallel(struct obs_core_audio *audio)
+{
+	os_work_batch_t *batch = audio->render_batch;
+
+	profile_start(render_audio_parallel_name);
+
+	if (!batch)
+		batch = audio->render_batch =
+			os_work_batch_create(render_audio_worker_name);
+
+	os_work_batch_clear(batch);
+
+	for (size_t i = 0; i < audio->render_order.num; i++) {
+		obs_source_t *source = audio->render_order.array[i];
+		source->audio_render_job =
+			os_work_batch_add(batch, render_audio_job, source) + 1;
+	}
+
+	for (size_t i = 0; i + 1 < audio->render_edges.num; i += 2) {
+		obs_source_t *child = audio->render_edges.array[i];
+		obs_source_t *parent = audio->render_edges.array[i + 1];
+
+		if (child->audio_render_job && parent->audio_render_job)
+			os_work_batch_add_dependency(
+				batch, parent->audio_render_job - 1,
+				child->audio_render_job - 1);
+	}
+
+	os_work_batch_run(obs->work_pool, batch);
+
+	for (size_t i = 0; i < audio->render_order.num; i++)
+		audio->render_order.array[i]->audio_render_job = 0;
+
+	profile_end(render_audio_parallel_name);
+}
+
 bool audio_callback(void *param, uint64_t start_ts_in, uint64_t end_ts_in,
 		    uint64_t *out_ts, uint32_t mixers,
 		    struct audio_output_data *mixes)
@@ -530,6 +624,9 @@ bool audio_callback(void *param, uint64_t start_ts_in, uint64_t end_ts_in,
 
 	da_resize(audio->render_order, 0);
 	da_resize(audio->root_nodes, 0);
+	da_resize(audio->render_edges, 0);
+
+	audio->render_parallel = os_atomic_load_bool(&obs->parallel_sources);
 
 	circlebuf_push_back(&audio->buffered_timestamps, &ts, sizeof(ts));
 	circlebuf_peek_front(&audio->buffered_timestamps, &ts, sizeof(ts));
@@ -583,41 +680,19 @@ bool audio_callback(void *param, uint64_t start_ts_in, uint64_t end_ts_in,
 
 	/* ------------------------------------------------ */
 	/* render audio data */
-	for (size_t i = 0; i < audio->render_order.num; i++) {
-		obs_source_t *source = audio->render_order.array[i];
-		obs_source_audio_render(source, mixers, channels, sample_rate,
-					audio_size);
-
-		/* if a source has gone backward in time and we can no
-		 * longer buffer, drop some or all of its audio */
-		if (audio_buffering_maxed(audio) && source->audio_ts != 0 &&
-		    source->audio_ts < ts.start) {
-			if (source->info.audio_render) {
-				blog(LOG_DEBUG,
-				     "render audio source %s timestamp has "
-				     "gone backwards",
-				     obs_source_get_name(source));
-
-				/* just avoid further damage */
-				source->audio_pending = true;
-#if DEBUG_AUDIO == 1
-				/* this should really be fixed */
-				assert(false);
-#endif
-			} else {
-				pthread_mutex_lock(&source->audio_buf_mutex);
-				bool rerender = ignore_audio(source, channels,
-							     sample_rate,
-							     ts.start);
-				pthread_mutex_unlock(&source->audio_buf_mutex);
-
-				/* if we (potentially) recovered, re-render */
-				if (rerender)
-					obs_source_audio_render(source, mixers,
-								channels,
-								sample_rate,
-								audio_size);
-			}
+	if (audio->render_parallel) {
+		audio->render_mixers = mixers;
+		audio->render_channels = channels;
+		audio->render_sample_rate = sample_rate;
+		audio->render_size = audio_size;
+		audio->render_start_ts = ts.start;
+
+		render_audio_parallel(audio);
+	} else {
+		for (size_t i = 0; i < audio->render_order.num; i++) {
+			obs_source_t *source = audio->render_order.array[i];
+			render_audio_source(audio, source, mixers, channels,
+					    sample_rate, audio_size, ts.start);
 		}
 	}
 
@@ -650,8 +725,8 @@ bool audio_callback(void *param, uint64_t start_ts_in, uint64_t end_ts_in,
 			pthread_mutex_lock(&source->audio_buf_mutex);
 
 			if (source->audio_output_buf[0][0] && source->audio_ts)
-				mix_audio(mixes, source, channels, sample_rate,
-					  &ts);
+				mix_audio(mixes, source, mixers, channels,
+					  sample_rate, &ts);
 
 			pthread_mutex_unlock(&source->audio_buf_mutex);
 		}
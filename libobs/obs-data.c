@@ -28,13 +28,19 @@
 #include "obs-data.h"
 
 #include <jansson.h>
+#include <limits.h>
+#include <math.h>
+
+struct obs_data_arena;
 
 struct obs_data_item {
 	volatile long ref;
 	const char *name;
 	struct obs_data *parent;
+	struct obs_data_arena *arena;
 	UT_hash_handle hh;
 	enum obs_data_type type;
+	bool arena_mem;
 	size_t name_len;
 	size_t data_len;
 	size_t data_size;
@@ -48,11 +54,13 @@ struct obs_data {
 	volatile long ref;
 	char *json;
 	struct obs_data_item *items;
+	struct obs_data_arena *arena;
 };
 
 struct obs_data_array {
 	volatile long ref;
 	DARRAY(obs_data_t *) objects;
+	struct obs_data_arena *arena;
 };
 
 struct obs_data_number {
@@ -85,6 +93,143 @@ static inline size_t get_name_align_size(const char *name)
 	return total_size - sizeof(struct obs_data_item);
 }
 
+/* items, objects and arrays are counted as data in memory snapshots.  items
+ * keep the tag when reallocated. */
+static inline void *data_zalloc(size_t size)
+{
+	enum bmem_tag prev_tag = bmem_set_tag(BMEM_TAG_DATA);
+	void *ptr = bzalloc(size);
+	bmem_set_tag(prev_tag);
+	return ptr;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Arena for data loaded from json
+ *
+ *   Objects, arrays and items of a tree loaded from json are bump-allocated
+ * out of large blocks, and the names of its items point to key strings that
+ * are stored once per tree.  The arena holds a reference for everything
+ * allocated out of it, and for every item still using one of its names, and
+ * frees all of its blocks once the last of them is released.
+ *
+ *   Items in the arena have no room to grow.  When one has to, it's moved to
+ * the heap but keeps using its name from the arena.
+ */
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+};
+
+struct arena_key {
+	UT_hash_handle hh;
+	size_t len;
+};
+
+struct obs_data_arena {
+	volatile long ref;
+	struct arena_block *blocks;
+
+	/* only kept while loading */
+	struct arena_key *keys;
+};
+
+static inline uint8_t *get_block_data(struct arena_block *block)
+{
+	return (uint8_t *)block + get_align_size(sizeof(struct arena_block));
+}
+
+static struct arena_block *arena_add_block(struct obs_data_arena *arena,
+					   size_t size)
+{
+	struct arena_block *block = data_zalloc(
+		get_align_size(sizeof(struct arena_block)) + size);
+	block->size = size;
+
+	/* blocks made for a single large allocation go after the current
+	 * block, so that what's left of it still gets used */
+	if (arena->blocks && size > ARENA_BLOCK_SIZE) {
+		block->next = arena->blocks->next;
+		arena->blocks->next = block;
+	} else {
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+
+	return block;
+}
+
+/* returns zeroed memory with the same alignment as bmalloc */
+static void *arena_alloc(struct obs_data_arena *arena, size_t size)
+{
+	struct arena_block *block = arena->blocks;
+	uint8_t *ptr;
+
+	size = get_align_size(size);
+
+	if (!block || block->size - block->used < size) {
+		block = arena_add_block(arena, size > ARENA_BLOCK_SIZE / 4
+						       ? size
+						       : ARENA_BLOCK_SIZE);
+	}
+
+	ptr = get_block_data(block) + block->used;
+	block->used += size;
+	return ptr;
+}
+
+static struct obs_data_arena *arena_create(void)
+{
+	struct obs_data_arena *arena = data_zalloc(sizeof(*arena));
+	arena->ref = 1;
+	return arena;
+}
+
+static inline void arena_release(struct obs_data_arena *arena)
+{
+	if (!arena || os_atomic_dec_long(&arena->ref) != 0)
+		return;
+
+	struct arena_block *block = arena->blocks;
+	while (block) {
+		struct arena_block *next = block->next;
+		bfree(block);
+		block = next;
+	}
+
+	bfree(arena);
+}
+
+static inline const char *get_arena_key_str(struct arena_key *key)
+{
+	return (const char *)(key + 1);
+}
+
+/* returns the arena's copy of a key, adding it if it's not there yet */
+static const char *arena_intern_key(struct obs_data_arena *arena,
+				    const char *str, size_t len,
+				    unsigned hashv)
+{
+	struct arena_key *key;
+
+	HASH_FIND_BYHASHVALUE(hh, arena->keys, str, len, hashv, key);
+	if (key)
+		return get_arena_key_str(key);
+
+	key = arena_alloc(arena, sizeof(*key) + len + 1);
+	key->len = len;
+	memcpy(key + 1, str, len);
+
+	HASH_ADD_KEYPTR_BYHASHVALUE(hh, arena->keys, get_arena_key_str(key),
+				    len, hashv, key);
+	return get_arena_key_str(key);
+}
+
+/* ------------------------------------------------------------------------- */
+
 static inline char *get_item_name(struct obs_data_item *item)
 {
 	return (char *)item + sizeof(struct obs_data_item);
@@ -278,7 +423,7 @@ static struct obs_data_item *obs_data_item_create(const char *name,
 	name_size = get_name_align_size(name);
 	total_size = name_size + sizeof(struct obs_data_item) + size;
 
-	item = bzalloc(total_size);
+	item = data_zalloc(total_size);
 
 	item->capacity = total_size;
 	item->type = type;
@@ -319,7 +464,10 @@ static inline void obs_data_item_reattach(struct obs_data *parent,
 					  struct obs_data_item *item)
 {
 	if (parent) {
-		HASH_ADD_STR(parent->items, name, item);
+		/* the name and its hash haven't changed since it was added */
+		HASH_ADD_KEYPTR_BYHASHVALUE(hh, parent->items, item->name,
+					    item->hh.keylen, item->hh.hashv,
+					    item);
 		item->parent = parent;
 	}
 }
@@ -336,9 +484,19 @@ obs_data_item_ensure_capacity(struct obs_data_item *item)
 	struct obs_data *parent = item->parent;
 	obs_data_item_detach(item);
 
-	new_item = brealloc(item, new_size);
+	if (item->arena_mem) {
+		/* the reference the item holds on the arena is now held for
+		 * its name */
+		new_item = data_zalloc(new_size);
+		memcpy(new_item, item, item->capacity);
+		new_item->arena_mem = false;
+	} else {
+		new_item = brealloc(item, new_size);
+	}
+
 	new_item->capacity = new_size;
-	new_item->name = get_item_name(new_item);
+	if (!new_item->arena)
+		new_item->name = get_item_name(new_item);
 
 	obs_data_item_reattach(parent, new_item);
 
@@ -354,7 +512,11 @@ static inline void obs_data_item_destroy(struct obs_data_item *item)
 	item_default_data_release(item);
 	item_autoselect_data_release(item);
 	obs_data_item_detach(item);
-	bfree(item);
+
+	struct obs_data_arena *arena = item->arena;
+	if (!item->arena_mem)
+		bfree(item);
+	arena_release(arena);
 }
 
 static inline void move_data(obs_data_item_t *old_item, void *old_data,
@@ -524,6 +686,657 @@ static void obs_data_add_json_item(obs_data_t *data, const char *key,
 		obs_data_set_bool(data, key, false);
 }
 
+/* ------------------------------------------------------------------------- */
+/* Direct json loader
+ *
+ *   Loads json text straight into an arena-backed tree without building a
+ * jansson tree first.  It only accepts what jansson accepts when loading with
+ * JSON_REJECT_DUPLICATES, and gives up on anything else, or anything it
+ * doesn't handle, such as a root that isn't an object.  The text is then
+ * loaded through jansson instead, which also reports any errors.
+ */
+
+#define JSON_MAX_DEPTH 1024
+
+struct json_loader {
+	const char *p;
+	struct obs_data_arena *arena;
+	int depth;
+
+	/* unescaped strings */
+	DARRAY(char) buf;
+
+	/* objects of the arrays being loaded */
+	DARRAY(obs_data_t *) objects;
+
+	/* keys of null values in the objects being loaded.  they don't get
+	 * items, but jansson still rejects them as duplicates. */
+	DARRAY(const char *) null_keys;
+};
+
+struct json_str {
+	const char *str;
+	size_t len;
+};
+
+struct json_value {
+	enum obs_data_type type;
+	union {
+		struct json_str str;
+		struct obs_data_number num;
+		bool boolean;
+		obs_data_t *obj;
+		obs_data_array_t *array;
+	};
+};
+
+static bool json_load_object(struct json_loader *jl, obs_data_t **p_obj);
+static bool json_load_array(struct json_loader *jl,
+			    obs_data_array_t **p_array);
+
+/* only the loading thread knows about the arena until it's done, so adding
+ * references needs no atomics */
+static obs_data_t *arena_data_create(struct obs_data_arena *arena)
+{
+	struct obs_data *data = arena_alloc(arena, sizeof(struct obs_data));
+	data->ref = 1;
+	data->arena = arena;
+	arena->ref++;
+	return data;
+}
+
+static obs_data_array_t *arena_array_create(struct obs_data_arena *arena)
+{
+	struct obs_data_array *array =
+		arena_alloc(arena, sizeof(struct obs_data_array));
+	array->ref = 1;
+	array->arena = arena;
+	arena->ref++;
+	return array;
+}
+
+static struct obs_data_item *
+arena_item_create(struct obs_data_arena *arena, struct obs_data *parent,
+		  const char *name, size_t name_len, unsigned hashv,
+		  enum obs_data_type type, size_t size)
+{
+	struct obs_data_item *item;
+	size_t pad_size, total_size;
+
+	/* the name isn't stored in the item, but the data still has to be
+	 * aligned */
+	pad_size = get_align_size(sizeof(struct obs_data_item)) -
+		   sizeof(struct obs_data_item);
+	total_size = get_align_size(sizeof(struct obs_data_item) + pad_size +
+				    size);
+
+	item = arena_alloc(arena, total_size);
+	item->ref = 1;
+	item->name = name;
+	item->arena = arena;
+	item->arena_mem = true;
+	item->type = type;
+	item->name_len = pad_size;
+	item->data_len = size;
+	item->data_size = size;
+	item->capacity = total_size;
+	arena->ref++;
+
+	item->parent = parent;
+	HASH_ADD_KEYPTR_BYHASHVALUE(hh, parent->items, name, (unsigned)name_len,
+				    hashv, item);
+	return item;
+}
+
+static inline void json_skip_ws(struct json_loader *jl)
+{
+	while (*jl->p == ' ' || *jl->p == '\t' || *jl->p == '\n' ||
+	       *jl->p == '\r')
+		jl->p++;
+}
+
+static inline bool json_is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+/* returns the length of the UTF-8 sequence, or 0 if it's one jansson would
+ * reject: overlong forms, surrogates and code points past U+10FFFF */
+static size_t json_utf8_len(const char *str)
+{
+	const uint8_t *s = (const uint8_t *)str;
+	uint32_t cp;
+	size_t len;
+
+	if (s[0] < 0x80)
+		return 1;
+	else if (s[0] >= 0xC2 && s[0] <= 0xDF)
+		len = 2;
+	else if (s[0] >= 0xE0 && s[0] <= 0xEF)
+		len = 3;
+	else if (s[0] >= 0xF0 && s[0] <= 0xF4)
+		len = 4;
+	else
+		return 0;
+
+	cp = s[0] & (0x7F >> len);
+	for (size_t i = 1; i < len; i++) {
+		if ((s[i] & 0xC0) != 0x80)
+			return 0;
+		cp = (cp << 6) | (s[i] & 0x3F);
+	}
+
+	if ((len == 3 && cp < 0x800) || (len == 4 && cp < 0x10000) ||
+	    cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+		return 0;
+
+	return len;
+}
+
+static bool json_hex4(const char *p, uint32_t *val)
+{
+	uint32_t v = 0;
+
+	for (size_t i = 0; i < 4; i++) {
+		char c = p[i];
+
+		v <<= 4;
+		if (c >= '0' && c <= '9')
+			v |= c - '0';
+		else if (c >= 'a' && c <= 'f')
+			v |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			v |= c - 'A' + 10;
+		else
+			return false;
+	}
+
+	*val = v;
+	return true;
+}
+
+static void json_buf_push_cp(struct json_loader *jl, uint32_t cp)
+{
+	char out[4];
+	size_t len;
+
+	if (cp < 0x80) {
+		out[0] = (char)cp;
+		len = 1;
+	} else if (cp < 0x800) {
+		out[0] = (char)(0xC0 | (cp >> 6));
+		out[1] = (char)(0x80 | (cp & 0x3F));
+		len = 2;
+	} else if (cp < 0x10000) {
+		out[0] = (char)(0xE0 | (cp >> 12));
+		out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+		out[2] = (char)(0x80 | (cp & 0x3F));
+		len = 3;
+	} else {
+		out[0] = (char)(0xF0 | (cp >> 18));
+		out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+		out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+		out[3] = (char)(0x80 | (cp & 0x3F));
+		len = 4;
+	}
+
+	da_push_back_array(jl->buf, out, len);
+}
+
+/* skips characters that need no unescaping, returns NULL on invalid UTF-8 */
+static const char *json_skip_plain(const char *p)
+{
+	for (;;) {
+		uint8_t c = (uint8_t)*p;
+
+		if (c == '"' || c == '\\' || c < 0x20) {
+			return p;
+		} else if (c < 0x80) {
+			p++;
+		} else {
+			size_t len = json_utf8_len(p);
+			if (!len)
+				return NULL;
+			p += len;
+		}
+	}
+}
+
+static const char *json_unescape(struct json_loader *jl, const char *p)
+{
+	uint32_t cp;
+
+	switch (*p) {
+	case '"':
+	case '\\':
+	case '/':
+		da_push_back(jl->buf, p);
+		return p + 1;
+	case 'b':
+		cp = '\b';
+		break;
+	case 'f':
+		cp = '\f';
+		break;
+	case 'n':
+		cp = '\n';
+		break;
+	case 'r':
+		cp = '\r';
+		break;
+	case 't':
+		cp = '\t';
+		break;
+	case 'u':
+		if (!json_hex4(p + 1, &cp))
+			return NULL;
+		p += 4;
+
+		if (cp >= 0xD800 && cp <= 0xDBFF) {
+			uint32_t low;
+			if (p[1] != '\\' || p[2] != 'u' ||
+			    !json_hex4(p + 3, &low) || low < 0xDC00 ||
+			    low > 0xDFFF)
+				return NULL;
+
+			cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+			p += 6;
+
+		} else if ((cp >= 0xDC00 && cp <= 0xDFFF) || cp == 0) {
+			return NULL;
+		}
+		break;
+	default:
+		return NULL;
+	}
+
+	json_buf_push_cp(jl, cp);
+	return p + 1;
+}
+
+/* the string points either into the json text or into the loader's buffer,
+ * and is only valid until the next string is loaded */
+static bool json_load_string(struct json_loader *jl, struct json_str *out)
+{
+	const char *start = jl->p + 1;
+	const char *p = json_skip_plain(start);
+
+	if (!p)
+		return false;
+
+	/* most strings have nothing to unescape and are used in place */
+	if (*p == '"') {
+		out->str = start;
+		out->len = p - start;
+		jl->p = p + 1;
+		return true;
+	}
+
+	jl->buf.num = 0;
+	da_push_back_array(jl->buf, start, p - start);
+
+	while (*p != '"') {
+		if (*p != '\\')
+			return false;
+
+		p = json_unescape(jl, p + 1);
+		if (!p)
+			return false;
+
+		start = p;
+		p = json_skip_plain(start);
+		if (!p)
+			return false;
+
+		da_push_back_array(jl->buf, start, p - start);
+	}
+
+	out->str = jl->buf.array;
+	out->len = jl->buf.num;
+	jl->p = p + 1;
+	return true;
+}
+
+static bool json_load_number(struct json_loader *jl,
+			     struct obs_data_number *num)
+{
+	const char *start = jl->p;
+	const char *p = start;
+	bool negative = *p == '-';
+	bool real = false;
+
+	if (negative)
+		p++;
+
+	if (*p == '0') {
+		p++;
+	} else if (json_is_digit(*p)) {
+		while (json_is_digit(*p))
+			p++;
+	} else {
+		return false;
+	}
+
+	if (*p == '.') {
+		real = true;
+		if (!json_is_digit(*++p))
+			return false;
+		while (json_is_digit(*p))
+			p++;
+	}
+
+	if (*p == 'e' || *p == 'E') {
+		real = true;
+		p++;
+		if (*p == '+' || *p == '-')
+			p++;
+		if (!json_is_digit(*p))
+			return false;
+		while (json_is_digit(*p))
+			p++;
+	}
+
+	jl->p = p;
+
+	if (real) {
+		/* os_strtod only looks at the first 63 characters, and jansson
+		 * rejects numbers that overflow */
+		if (p - start > 63)
+			return false;
+
+		num->type = OBS_DATA_NUM_DOUBLE;
+		num->double_val = os_strtod(start);
+		return isfinite(num->double_val);
+	}
+
+	uint64_t max = negative ? (uint64_t)LLONG_MAX + 1 : LLONG_MAX;
+	uint64_t val = 0;
+
+	for (const char *digit = start + negative; digit < p; digit++) {
+		uint64_t d = *digit - '0';
+		if (val > (max - d) / 10)
+			return false;
+		val = val * 10 + d;
+	}
+
+	num->type = OBS_DATA_NUM_INT;
+	num->int_val = negative && val ? -(long long)(val - 1) - 1
+				       : (long long)val;
+	return true;
+}
+
+static inline bool json_load_literal(struct json_loader *jl, const char *lit,
+				     size_t len)
+{
+	if (strncmp(jl->p, lit, len) != 0)
+		return false;
+
+	jl->p += len;
+	return true;
+}
+
+static bool json_load_value(struct json_loader *jl, struct json_value *val)
+{
+	switch (*jl->p) {
+	case '{':
+		val->type = OBS_DATA_OBJECT;
+		return json_load_object(jl, &val->obj);
+	case '[':
+		val->type = OBS_DATA_ARRAY;
+		return json_load_array(jl, &val->array);
+	case '"':
+		val->type = OBS_DATA_STRING;
+		return json_load_string(jl, &val->str);
+	case 't':
+		val->type = OBS_DATA_BOOLEAN;
+		val->boolean = true;
+		return json_load_literal(jl, "true", 4);
+	case 'f':
+		val->type = OBS_DATA_BOOLEAN;
+		val->boolean = false;
+		return json_load_literal(jl, "false", 5);
+	case 'n':
+		val->type = OBS_DATA_NULL;
+		return json_load_literal(jl, "null", 4);
+	default:
+		val->type = OBS_DATA_NUMBER;
+		return json_load_number(jl, &val->num);
+	}
+}
+
+static void json_value_free(struct json_value *val)
+{
+	if (val->type == OBS_DATA_OBJECT)
+		obs_data_release(val->obj);
+	else if (val->type == OBS_DATA_ARRAY)
+		obs_data_array_release(val->array);
+}
+
+static bool json_has_key(struct json_loader *jl, struct obs_data *obj,
+			 size_t null_keys_start, const char *key,
+			 size_t key_len, unsigned hashv)
+{
+	struct obs_data_item *item;
+
+	HASH_FIND_BYHASHVALUE(hh, obj->items, key, (unsigned)key_len, hashv,
+			      item);
+	if (item)
+		return true;
+
+	/* keys are interned, so the same key is always the same pointer */
+	for (size_t i = null_keys_start; i < jl->null_keys.num; i++) {
+		if (jl->null_keys.array[i] == key)
+			return true;
+	}
+
+	return false;
+}
+
+/* objects and arrays are owned by the item afterwards */
+static void json_add_item(struct json_loader *jl, struct obs_data *obj,
+			  const char *key, size_t key_len, unsigned hashv,
+			  struct json_value *val)
+{
+	struct obs_data_item *item;
+	const void *data;
+	size_t size;
+
+	/* arena memory is zeroed, so strings are terminated without copying
+	 * the terminator */
+	switch (val->type) {
+	case OBS_DATA_NULL:
+		da_push_back(jl->null_keys, &key);
+		return;
+	case OBS_DATA_STRING:
+		data = val->str.str;
+		size = val->str.len + 1;
+		break;
+	case OBS_DATA_NUMBER:
+		data = &val->num;
+		size = sizeof(struct obs_data_number);
+		break;
+	case OBS_DATA_BOOLEAN:
+		data = &val->boolean;
+		size = sizeof(bool);
+		break;
+	case OBS_DATA_OBJECT:
+		data = &val->obj;
+		size = sizeof(obs_data_t *);
+		break;
+	case OBS_DATA_ARRAY:
+		data = &val->array;
+		size = sizeof(obs_data_array_t *);
+		break;
+	default:
+		return;
+	}
+
+	item = arena_item_create(jl->arena, obj, key, key_len, hashv,
+				 val->type, size);
+	memcpy(get_item_data(item), data,
+	       val->type == OBS_DATA_STRING ? val->str.len : size);
+}
+
+static bool json_load_object(struct json_loader *jl, obs_data_t **p_obj)
+{
+	size_t null_keys_start = jl->null_keys.num;
+	obs_data_t *obj;
+
+	if (++jl->depth > JSON_MAX_DEPTH)
+		return false;
+
+	obj = arena_data_create(jl->arena);
+
+	jl->p++;
+	json_skip_ws(jl);
+
+	if (*jl->p == '}') {
+		jl->p++;
+		goto done;
+	}
+
+	for (;;) {
+		struct json_value val;
+		struct json_str str;
+		const char *key;
+		unsigned hashv;
+
+		if (*jl->p != '"' || !json_load_string(jl, &str))
+			goto fail;
+
+		HASH_VALUE(str.str, (unsigned)str.len, hashv);
+		key = arena_intern_key(jl->arena, str.str, str.len, hashv);
+
+		if (json_has_key(jl, obj, null_keys_start, key, str.len, hashv))
+			goto fail;
+
+		json_skip_ws(jl);
+		if (*jl->p != ':')
+			goto fail;
+		jl->p++;
+		json_skip_ws(jl);
+
+		if (!json_load_value(jl, &val))
+			goto fail;
+
+		json_add_item(jl, obj, key, str.len, hashv, &val);
+
+		json_skip_ws(jl);
+		if (*jl->p == '}') {
+			jl->p++;
+			break;
+		}
+		if (*jl->p != ',')
+			goto fail;
+		jl->p++;
+		json_skip_ws(jl);
+	}
+
+done:
+	jl->null_keys.num = null_keys_start;
+	jl->depth--;
+	*p_obj = obj;
+	return true;
+
+fail:
+	jl->null_keys.num = null_keys_start;
+	obs_data_release(obj);
+	return false;
+}
+
+static bool json_load_array(struct json_loader *jl, obs_data_array_t **p_array)
+{
+	size_t start = jl->objects.num;
+	obs_data_array_t *array;
+	size_t count;
+
+	if (++jl->depth > JSON_MAX_DEPTH)
+		return false;
+
+	jl->p++;
+	json_skip_ws(jl);
+
+	if (*jl->p == ']') {
+		jl->p++;
+		goto done;
+	}
+
+	for (;;) {
+		struct json_value val;
+
+		if (!json_load_value(jl, &val))
+			goto fail;
+
+		/* like obs_data_add_json_array, only objects are kept */
+		if (val.type == OBS_DATA_OBJECT)
+			da_push_back(jl->objects, &val.obj);
+		else
+			json_value_free(&val);
+
+		json_skip_ws(jl);
+		if (*jl->p == ']') {
+			jl->p++;
+			break;
+		}
+		if (*jl->p != ',')
+			goto fail;
+		jl->p++;
+		json_skip_ws(jl);
+	}
+
+done:
+	array = arena_array_create(jl->arena);
+	count = jl->objects.num - start;
+
+	if (count) {
+		da_reserve(array->objects, count);
+		memcpy(array->objects.array, jl->objects.array + start,
+		       count * sizeof(obs_data_t *));
+		array->objects.num = count;
+	}
+
+	jl->objects.num = start;
+	jl->depth--;
+	*p_array = array;
+	return true;
+
+fail:
+	for (size_t i = start; i < jl->objects.num; i++)
+		obs_data_release(jl->objects.array[i]);
+	jl->objects.num = start;
+	return false;
+}
+
+/* returns NULL if the text has to be loaded through jansson */
+static obs_data_t *obs_data_load_json(const char *json_string)
+{
+	struct json_loader jl = {0};
+	obs_data_t *data = NULL;
+
+	jl.p = json_string;
+	json_skip_ws(&jl);
+	if (*jl.p != '{')
+		return NULL;
+
+	jl.arena = arena_create();
+
+	if (json_load_object(&jl, &data)) {
+		json_skip_ws(&jl);
+		if (*jl.p) {
+			obs_data_release(data);
+			data = NULL;
+		}
+	}
+
+	HASH_CLEAR(hh, jl.arena->keys);
+	arena_release(jl.arena);
+
+	da_free(jl.buf);
+	da_free(jl.objects);
+	da_free(jl.null_keys);
+	return data;
+}
+
 /* ------------------------------------------------------------------------- */
 
 static inline void set_json_string(json_t *json, const char *name,
@@ -591,7 +1404,7 @@ static json_t *obs_data_to_json(obs_data_t *data)
 
 	HASH_ITER (hh, data->items, item, temp) {
 		enum obs_data_type type = obs_data_item_gettype(item);
-		const char *name = get_item_name(item);
+		const char *name = item->name;
 
 		if (!obs_data_item_has_user_value(item))
 			continue;
@@ -615,7 +1428,7 @@ static json_t *obs_data_to_json(obs_data_t *data)
 
 obs_data_t *obs_data_create()
 {
-	struct obs_data *data = bzalloc(sizeof(struct obs_data));
+	struct obs_data *data = data_zalloc(sizeof(struct obs_data));
 	data->ref = 1;
 
 	return data;
@@ -623,7 +1436,12 @@ obs_data_t *obs_data_create()
 
 obs_data_t *obs_data_create_from_json(const char *json_string)
 {
-	obs_data_t *data = obs_data_create();
+	obs_data_t *data = json_string ? obs_data_load_json(json_string)
+				       : NULL;
+	if (data)
+		return data;
+
+	data = obs_data_create();
 
 	json_error_t error;
 	json_t *root = json_loads(json_string, JSON_REJECT_DUPLICATES, &error);
@@ -704,7 +1522,11 @@ static inline void obs_data_destroy(struct obs_data *data)
 
 	/* NOTE: don't use bfree for json text, allocated by json */
 	free(data->json);
-	bfree(data);
+
+	struct obs_data_arena *arena = data->arena;
+	if (!arena)
+		bfree(data);
+	arena_release(arena);
 }
 
 void obs_data_release(obs_data_t *data)
@@ -812,7 +1634,7 @@ obs_data_t *obs_data_get_defaults(obs_data_t *data)
 	struct obs_data_item *item, *temp;
 
 	HASH_ITER (hh, data->items, item, temp) {
-		const char *name = get_item_name(item);
+		const char *name = item->name;
 		switch (item->type) {
 		case OBS_DATA_NULL:
 			break;
@@ -1006,7 +1828,7 @@ static void copy_array(struct obs_data *data, const char *name,
 
 static inline void copy_item(struct obs_data *data, struct obs_data_item *item)
 {
-	const char *name = get_item_name(item);
+	const char *name = item->name;
 	void *ptr = get_item_data(item);
 
 	if (item->type == OBS_DATA_OBJECT) {
@@ -1346,7 +2168,8 @@ obs_data_array_t *obs_data_get_autoselect_array(obs_data_t *data,
 
 obs_data_array_t *obs_data_array_create()
 {
-	struct obs_data_array *array = bzalloc(sizeof(struct obs_data_array));
+	struct obs_data_array *array =
+		data_zalloc(sizeof(struct obs_data_array));
 	array->ref = 1;
 
 	return array;
@@ -1364,7 +2187,11 @@ static inline void obs_data_array_destroy(obs_data_array_t *array)
 		for (size_t i = 0; i < array->objects.num; i++)
 			obs_data_release(array->objects.array[i]);
 		da_free(array->objects);
-		bfree(array);
+
+		struct obs_data_arena *arena = array->arena;
+		if (!arena)
+			bfree(array);
+		arena_release(arena);
 	}
 }
 
@@ -551,11 +551,15 @@ obs_data_t *obs_encoder_get_settings(const obs_encoder_t *encoder)
 
 static inline void reset_audio_buffers(struct obs_encoder *encoder)
 {
+	enum bmem_tag prev_tag = bmem_set_tag(BMEM_TAG_ENCODER);
+
 	free_audio_buffers(encoder);
 
 	for (size_t i = 0; i < encoder->planes; i++)
 		encoder->audio_output_buffer[i] =
 			bmalloc(encoder->framesize_bytes);
+
+	bmem_set_tag(prev_tag);
 }
 
 static void intitialize_audio_encoder(struct obs_encoder *encoder)
@@ -1671,12 +1675,8 @@ void obs_encoder_remove_output(struct obs_encoder *encoder,
 void obs_encoder_packet_create_instance(struct encoder_packet *dst,
 					const struct encoder_packet *src)
 {
-	long *p_refs;
-
 	*dst = *src;
-	p_refs = bmalloc(src->size + sizeof(long));
-	dst->data = (void *)(p_refs + 1);
-	*p_refs = 1;
+	dst->data = obs_encoder_packet_data_alloc(src->size);
 	memcpy(dst->data, src->data, src->size);
 }
 
@@ -1699,10 +1699,8 @@ void obs_encoder_packet_ref(struct encoder_packet *dst,
 	if (!src)
 		return;
 
-	if (src->data) {
-		long *p_refs = ((long *)src->data) - 1;
-		os_atomic_inc_long(p_refs);
-	}
+	if (src->data)
+		obs_encoder_packet_data_addref(src->data);
 
 	*dst = *src;
 }
@@ -1712,11 +1710,8 @@ void obs_encoder_packet_release(struct encoder_packet *pkt)
 	if (!pkt)
 		return;
 
-	if (pkt->data) {
-		long *p_refs = ((long *)pkt->data) - 1;
-		if (os_atomic_dec_long(p_refs) == 0)
-			bfree(p_refs);
-	}
+	if (pkt->data)
+		obs_encoder_packet_data_release(pkt->data);
 
 	memset(pkt, 0, sizeof(struct encoder_packet));
 }
@@ -0,0 +1,230 @@
+/******************************************************************************
+    Copyright (C) 2023 by Lain Bailey <lain@obsproject.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <stdlib.h>
+
+#include "obs-internal.h"
+
+/*
+ * Frame pacing telemetry.
+ *
+ *   The graphics thread is the only writer: it fills the next slot of the
+ * sample ring and then bumps the free running count.  Readers copy the ring
+ * without locking and check the count again afterwards, any slot the writer
+ * may have touched in the meantime is thrown away.
+ */
+
+#define DEFAULT_SPIN_MARGIN 1000000ULL
+#define MIN_SPIN_MARGIN 100000ULL
+#define MAX_SPIN_MARGIN 4000000ULL
+
+void frame_pacing_record(struct obs_frame_pacing *pacing, int64_t wake_error,
+			 int64_t render_time, int64_t slack)
+{
+	unsigned long count = (unsigned long)pacing->count;
+	struct frame_pacing_sample *sample =
+		&pacing->samples[count % FRAME_PACING_SAMPLES];
+
+	sample->wake_error = wake_error;
+	sample->render_time = render_time;
+	sample->slack = slack;
+
+	os_atomic_store_long(&pacing->count, (long)(count + 1));
+}
+
+/* the spin margin follows the sleep overshoot up quickly and comes back
+ * down slowly, so a single late wake up doesn't get repeated right away */
+static void update_spin_margin(struct obs_frame_pacing *pacing,
+			       uint64_t overshoot)
+{
+	uint64_t target = overshoot * 2 + MIN_SPIN_MARGIN;
+	uint64_t margin = pacing->spin_margin;
+
+	if (target > margin)
+		margin += (target - margin) / 2;
+	else
+		margin -= (margin - target) / 16;
+
+	if (margin < MIN_SPIN_MARGIN)
+		margin = MIN_SPIN_MARGIN;
+	else if (margin > MAX_SPIN_MARGIN)
+		margin = MAX_SPIN_MARGIN;
+
+	pacing->spin_margin = margin;
+}
+
+bool frame_pacing_sleepto(struct obs_frame_pacing *pacing,
+			  uint64_t time_target)
+{
+	uint64_t cur_time;
+
+	if (os_atomic_load_long(&pacing->sleep_mode) != OBS_VIDEO_SLEEP_HYBRID)
+		return os_sleepto_ns(time_target);
+
+	if (!pacing->spin_margin)
+		pacing->spin_margin = DEFAULT_SPIN_MARGIN;
+
+	cur_time = os_gettime_ns();
+	if (cur_time >= time_target)
+		return false;
+
+	if (time_target - cur_time > pacing->spin_margin) {
+		uint64_t sleep_target = time_target - pacing->spin_margin;
+
+		os_sleepto_ns_fast(sleep_target);
+
+		cur_time = os_gettime_ns();
+		update_spin_margin(pacing, cur_time > sleep_target
+						   ? cur_time - sleep_target
+						   : 0);
+	}
+
+	while (cur_time < time_target)
+		cur_time = os_gettime_ns();
+
+	return true;
+}
+
+static inline int64_t get_metric(const struct frame_pacing_sample *sample,
+				 enum obs_frame_pacing_metric metric)
+{
+	switch (metric) {
+	case OBS_FRAME_PACING_WAKE_ERROR:
+		return sample->wake_error;
+	case OBS_FRAME_PACING_RENDER_TIME:
+		return sample->render_time;
+	case OBS_FRAME_PACING_SLACK:
+		return sample->slack;
+	}
+
+	return 0;
+}
+
+/* copies the values of a metric out of the ring, returns how many there are */
+static uint32_t copy_samples(struct obs_frame_pacing *pacing,
+			     enum obs_frame_pacing_metric metric,
+			     int64_t *values)
+{
+	unsigned long end = (unsigned long)os_atomic_load_long(&pacing->count);
+	unsigned long num = end < FRAME_PACING_SAMPLES ? end
+						       : FRAME_PACING_SAMPLES;
+	unsigned long start = end - num;
+	unsigned long new_end;
+	unsigned long overwritten;
+
+	for (unsigned long i = 0; i < num; i++) {
+		const struct frame_pacing_sample *sample =
+			&pacing->samples[(start + i) % FRAME_PACING_SAMPLES];
+		values[i] = get_metric(sample, metric);
+	}
+
+	/* the slots of everything written since, plus the one that may be
+	 * being written right now, can't be trusted */
+	new_end = (unsigned long)os_atomic_load_long(&pacing->count);
+	overwritten = new_end - end + 1;
+	if (overwritten <= FRAME_PACING_SAMPLES - num)
+		return (uint32_t)num;
+
+	overwritten -= FRAME_PACING_SAMPLES - num;
+	if (overwritten >= num)
+		return 0;
+
+	memmove(values, values + overwritten,
+		(num - overwritten) * sizeof(*values));
+	return (uint32_t)(num - overwritten);
+}
+
+static int compare_values(const void *a, const void *b)
+{
+	int64_t val_a = *(const int64_t *)a;
+	int64_t val_b = *(const int64_t *)b;
+	return (val_a > val_b) - (val_a < val_b);
+}
+
+static inline int64_t percentile(const int64_t *sorted, uint32_t num,
+				 uint32_t pct)
+{
+	return sorted[(uint64_t)(num - 1) * pct / 100];
+}
+
+bool obs_get_frame_pacing_stats(enum obs_frame_pacing_metric metric,
+				struct obs_frame_pacing_stats *stats)
+{
+	int64_t values[FRAME_PACING_SAMPLES];
+	uint32_t num;
+
+	if (!obs || !stats)
+		return false;
+
+	memset(stats, 0, sizeof(*stats));
+
+	num = copy_samples(&obs->video.pacing, metric, values);
+	if (!num)
+		return false;
+
+	qsort(values, num, sizeof(*values), compare_values);
+
+	stats->samples = num;
+	stats->min = values[0];
+	stats->p1 = percentile(values, num, 1);
+	stats->p50 = percentile(values, num, 50);
+	stats->p90 = percentile(values, num, 90);
+	stats->p99 = percentile(values, num, 99);
+	stats->max = values[num - 1];
+	return true;
+}
+
+uint32_t obs_get_frame_pacing_histogram(enum obs_frame_pacing_metric metric,
+					int64_t min_ns, int64_t bucket_ns,
+					uint32_t *buckets, size_t num_buckets)
+{
+	int64_t values[FRAME_PACING_SAMPLES];
+	uint32_t num;
+
+	if (!obs || !buckets || !num_buckets || bucket_ns <= 0)
+		return 0;
+
+	memset(buckets, 0, num_buckets * sizeof(*buckets));
+
+	num = copy_samples(&obs->video.pacing, metric, values);
+
+	for (uint32_t i = 0; i < num; i++) {
+		int64_t bucket = values[i] < min_ns
+					 ? 0
+					 : (values[i] - min_ns) / bucket_ns;
+		if (bucket >= (int64_t)num_buckets)
+			bucket = (int64_t)num_buckets - 1;
+		buckets[bucket]++;
+	}
+
+	return num;
+}
+
+void obs_set_video_sleep_mode(enum obs_video_sleep_mode mode)
+{
+	if (!obs)
+		return;
+
+	os_atomic_store_long(&obs->video.pacing.sleep_mode, (long)mode);
+}
+
+enum obs_video_sleep_mode obs_get_video_sleep_mode(void)
+{
+	return obs ? (enum obs_video_sleep_mode)os_atomic_load_long(
+			     &obs->video.pacing.sleep_mode)
+		   : OBS_VIDEO_SLEEP_DEFAULT;
+}
@@ -0,0 +1,267 @@
+/******************************************************************************
+    Copyright (C) 2023 by Lain Bailey <lain@obsproject.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "util/circlebuf.h"
+#include "obs.h"
+
+/*
+ * Interleave queue used by outputs.
+ *
+ *   Encoders emit packets of a track in increasing dts order, so instead of
+ * keeping one big sorted array the queue keeps a FIFO per track and merges
+ * them on the fly.  Pushing a packet is O(1) (unless an encoder goes
+ * backwards, in which case it is sorted into its own track), and getting the
+ * next packet to send compares only the track heads.  Changing the timestamp
+ * offsets of whole tracks keeps each FIFO sorted, so no resort is needed.
+ *
+ *   The merged order is the same one the output used to maintain by sorted
+ * insertion: by dts_usec, video before audio at equal dts, video tracks at
+ * equal dts by ascending track index, and audio at equal dts in the order
+ * the packets were received.
+ */
+
+#define MAX_INTERLEAVE_TRACKS \
+	(MAX_OUTPUT_VIDEO_ENCODERS + MAX_OUTPUT_AUDIO_ENCODERS)
+
+struct interleave_entry {
+	struct encoder_packet packet;
+	uint64_t seq;
+};
+
+struct interleave_queue {
+	struct circlebuf tracks[MAX_INTERLEAVE_TRACKS];
+	size_t num;
+	uint64_t next_seq;
+};
+
+struct interleave_iter {
+	size_t pos[MAX_INTERLEAVE_TRACKS];
+};
+
+static inline size_t interleave_track(enum obs_encoder_type type,
+				      size_t track_idx)
+{
+	return type == OBS_ENCODER_VIDEO ? track_idx
+					 : MAX_OUTPUT_VIDEO_ENCODERS + track_idx;
+}
+
+static inline size_t interleave_track_size(struct interleave_queue *q,
+					   size_t track)
+{
+	return q->tracks[track].size / sizeof(struct interleave_entry);
+}
+
+static inline struct interleave_entry *
+interleave_track_entry(struct interleave_queue *q, size_t track, size_t idx)
+{
+	return (struct interleave_entry *)circlebuf_data(
+		&q->tracks[track], idx * sizeof(struct interleave_entry));
+}
+
+/* returns true if a has to be sent before b */
+static inline bool interleave_before(const struct interleave_entry *a,
+				     const struct interleave_entry *b)
+{
+	const struct encoder_packet *pa = &a->packet;
+	const struct encoder_packet *pb = &b->packet;
+
+	if (pa->dts_usec != pb->dts_usec)
+		return pa->dts_usec < pb->dts_usec;
+
+	if (pa->type != pb->type)
+		return pa->type == OBS_ENCODER_VIDEO;
+
+	if (pa->type == OBS_ENCODER_VIDEO) {
+		if (pa->track_idx != pb->track_idx)
+			return pa->track_idx < pb->track_idx;
+		return a->seq > b->seq;
+	}
+
+	return a->seq < b->seq;
+}
+
+static inline void interleave_queue_free(struct interleave_queue *q)
+{
+	for (size_t i = 0; i < MAX_INTERLEAVE_TRACKS; i++) {
+		size_t count = interleave_track_size(q, i);
+
+		for (size_t j = 0; j < count; j++) {
+			struct interleave_entry *entry =
+				interleave_track_entry(q, i, j);
+			obs_encoder_packet_release(&entry->packet);
+		}
+
+		circlebuf_free(&q->tracks[i]);
+	}
+
+	q->num = 0;
+}
+
+static inline void interleave_queue_push(struct interleave_queue *q,
+					 const struct encoder_packet *packet)
+{
+	size_t track = interleave_track(packet->type, packet->track_idx);
+	struct circlebuf *cb = &q->tracks[track];
+	struct interleave_entry entry = {*packet, q->next_seq++};
+	size_t count = interleave_track_size(q, track);
+	size_t idx = count;
+
+	while (idx > 0 &&
+	       interleave_before(&entry,
+				 interleave_track_entry(q, track, idx - 1)))
+		idx--;
+
+	if (idx == count) {
+		circlebuf_push_back(cb, &entry, sizeof(entry));
+	} else {
+		/* out of order within its own track, shift the tail up */
+		circlebuf_push_back_zero(cb, sizeof(entry));
+		for (size_t i = count; i > idx; i--)
+			*interleave_track_entry(q, track, i) =
+				*interleave_track_entry(q, track, i - 1);
+		*interleave_track_entry(q, track, idx) = entry;
+	}
+
+	q->num++;
+}
+
+static inline struct interleave_entry *
+interleave_iter_peek(struct interleave_queue *q, struct interleave_iter *it,
+		     size_t *track_out)
+{
+	struct interleave_entry *first = NULL;
+	size_t first_track = 0;
+
+	for (size_t i = 0; i < MAX_INTERLEAVE_TRACKS; i++) {
+		struct interleave_entry *entry;
+
+		if (it->pos[i] >= interleave_track_size(q, i))
+			continue;
+
+		entry = interleave_track_entry(q, i, it->pos[i]);
+		if (!first || interleave_before(entry, first)) {
+			first = entry;
+			first_track = i;
+		}
+	}
+
+	if (track_out)
+		*track_out = first_track;
+	return first;
+}
+
+/* walks the queue in send order without removing anything */
+static inline struct encoder_packet *
+interleave_iter_next(struct interleave_queue *q, struct interleave_iter *it)
+{
+	size_t track;
+	struct interleave_entry *entry = interleave_iter_peek(q, it, &track);
+	if (!entry)
+		return NULL;
+
+	it->pos[track]++;
+	return &entry->packet;
+}
+
+static inline struct encoder_packet *
+interleave_queue_first(struct interleave_queue *q)
+{
+	struct interleave_iter it = {0};
+	struct interleave_entry *entry = interleave_iter_peek(q, &it, NULL);
+	return entry ? &entry->packet : NULL;
+}
+
+static inline bool interleave_queue_pop(struct interleave_queue *q,
+					struct encoder_packet *packet)
+{
+	struct interleave_iter it = {0};
+	struct interleave_entry entry;
+	size_t track;
+
+	if (!interleave_iter_peek(q, &it, &track))
+		return false;
+
+	circlebuf_pop_front(&q->tracks[track], &entry, sizeof(entry));
+	*packet = entry.packet;
+	q->num--;
+	return true;
+}
+
+/* releases the first count packets in send order */
+static inline void interleave_queue_discard(struct interleave_queue *q,
+					    size_t count)
+{
+	struct encoder_packet packet;
+
+	while (count-- && interleave_queue_pop(q, &packet))
+		obs_encoder_packet_release(&packet);
+}
+
+static inline struct encoder_packet *
+interleave_queue_track_first(struct interleave_queue *q,
+			     enum obs_encoder_type type, size_t track_idx)
+{
+	size_t track = interleave_track(type, track_idx);
+	struct interleave_entry *entry = interleave_track_entry(q, track, 0);
+	return entry ? &entry->packet : NULL;
+}
+
+static inline struct encoder_packet *
+interleave_queue_track_last(struct interleave_queue *q,
+			    enum obs_encoder_type type, size_t track_idx)
+{
+	size_t track = interleave_track(type, track_idx);
+	size_t count = interleave_track_size(q, track);
+	struct interleave_entry *entry;
+
+	if (!count)
+		return NULL;
+
+	entry = interleave_track_entry(q, track, count - 1);
+	return &entry->packet;
+}
+
+/* returns the send order position of the first packet of a track, or -1 */
+static inline int interleave_queue_track_first_idx(struct interleave_queue *q,
+						   enum obs_encoder_type type,
+						   size_t track_idx)
+{
+	size_t track = interleave_track(type, track_idx);
+	struct interleave_entry *first = interleave_track_entry(q, track, 0);
+	size_t idx = 0;
+
+	if (!first)
+		return -1;
+
+	for (size_t i = 0; i < MAX_INTERLEAVE_TRACKS; i++) {
+		size_t count = interleave_track_size(q, i);
+
+		if (i == track)
+			continue;
+
+		for (size_t j = 0; j < count; j++) {
+			if (!interleave_before(interleave_track_entry(q, i, j),
+					       first))
+				break;
+			idx++;
+		}
+	}
+
+	return (int)idx;
+}
@@ -25,6 +25,7 @@
 #include "util/platform.h"
 #include "util/profiler.h"
 #include "util/task.h"
+#include "util/work-pool.h"
 #include "util/uthash.h"
 #include "callback/signal.h"
 #include "callback/proc.h"
@@ -35,8 +36,10 @@
 #include "media-io/audio-resampler.h"
 #include "media-io/video-io.h"
 #include "media-io/audio-io.h"
+#include "media-io/video-slices.h"
 
 #include "obs.h"
+#include "obs-interleave.h"
 
 #include <obsversion.h>
 #include <caption/caption.h>
@@ -319,6 +322,29 @@ extern struct obs_core_video_mix *
 obs_create_video_mix(struct obs_video_info *ovi);
 extern void obs_free_video_mix(struct obs_core_video_mix *video);
 
+/* per frame timings of the graphics thread, see obs-frame-pacing.c */
+#define FRAME_PACING_SAMPLES 512
+
+struct frame_pacing_sample {
+	int64_t wake_error;
+	int64_t render_time;
+	int64_t slack;
+};
+
+struct obs_frame_pacing {
+	struct frame_pacing_sample samples[FRAME_PACING_SAMPLES];
+	volatile long count;
+
+	volatile long sleep_mode;
+	uint64_t spin_margin;
+};
+
+extern void frame_pacing_record(struct obs_frame_pacing *pacing,
+				int64_t wake_error, int64_t render_time,
+				int64_t slack);
+extern bool frame_pacing_sleepto(struct obs_frame_pacing *pacing,
+				 uint64_t time_target);
+
 struct obs_core_video {
 	graphics_t *graphics;
 	gs_effect_t *default_effect;
@@ -344,6 +370,11 @@ struct obs_core_video {
 	uint32_t lagged_frames;
 	bool thread_initialized;
 
+	/* splits the raw output copies of the graphics thread into bands */
+	video_slices_t *slices;
+
+	struct obs_frame_pacing pacing;
+
 	gs_texture_t *transparent_texture;
 
 	gs_effect_t *deinterlace_discard_effect;
@@ -374,6 +405,16 @@ struct obs_core_audio {
 	DARRAY(struct obs_source *) render_order;
 	DARRAY(struct obs_source *) root_nodes;
 
+	/* parallel audio rendering, (child, parent) pairs of render_order */
+	bool render_parallel;
+	DARRAY(struct obs_source *) render_edges;
+	os_work_batch_t *render_batch;
+	uint64_t render_start_ts;
+	uint32_t render_mixers;
+	size_t render_channels;
+	size_t render_sample_rate;
+	size_t render_size;
+
 	uint64_t buffered_ts;
 	struct circlebuf buffered_timestamps;
 	uint64_t buffering_wait_ticks;
@@ -424,6 +465,10 @@ struct obs_core_data {
 
 	DARRAY(char *) protocols;
 	DARRAY(obs_source_t *) sources_to_tick;
+
+	/* parallel source ticks */
+	os_work_batch_t *tick_batch;
+	float tick_seconds;
 };
 
 /* user hotkeys */
@@ -493,6 +538,11 @@ struct obs_core {
 
 	os_task_queue_t *destruction_task_thread;
 
+	/* shared by the graphics and audio threads for parallel sources */
+	pthread_mutex_t work_pool_mutex;
+	os_work_pool_t *work_pool;
+	volatile bool parallel_sources;
+
 	obs_task_handler_t ui_task_handler;
 };
 
@@ -692,6 +742,12 @@ struct obs_source {
 	struct obs_context_data context;
 	struct obs_source_info info;
 
+	/* ids of the signals that are emitted often */
+	size_t mute_signal;
+	size_t volume_signal;
+	size_t audio_sync_signal;
+	size_t audio_balance_signal;
+
 	/* general exposed flags that can be set for the source */
 	uint32_t flags;
 	uint32_t default_flags;
@@ -740,6 +796,10 @@ struct obs_source {
 	uint64_t last_sys_timestamp;
 	bool async_rendered;
 
+	/* job index + 1 in the parallel tick and audio render batches */
+	size_t tick_job;
+	size_t audio_render_job;
+
 	/* audio */
 	bool audio_failed;
 	bool audio_pending;
@@ -750,6 +810,9 @@ struct obs_source {
 	struct obs_source *next_audio_source;
 	struct obs_source **prev_next_audio_source;
 	uint64_t audio_ts;
+	/* audio_ts at which the output went digitally silent, 0 while it
+	 * isn't; silent sources are left out of mixing */
+	uint64_t audio_silent_since;
 	struct circlebuf audio_input_buf[MAX_AUDIO_CHANNELS];
 	size_t last_audio_input_buf_size;
 	DARRAY(struct audio_action) audio_actions;
@@ -794,6 +857,7 @@ struct obs_source {
 	struct obs_source_frame *async_preload_frame;
 	DARRAY(struct async_frame) async_cache;
 	DARRAY(struct obs_source_frame *) async_frames;
+	struct obs_source_async_stats async_stats;
 	pthread_mutex_t async_mutex;
 	uint32_t async_width;
 	uint32_t async_height;
@@ -1083,7 +1147,7 @@ struct obs_output {
 	pthread_t end_data_capture_thread;
 	os_event_t *stopping_event;
 	pthread_mutex_t interleaved_mutex;
-	DARRAY(struct encoder_packet) interleaved_packets;
+	struct interleave_queue interleaved_packets;
 	int stop_code;
 
 	int reconnect_retry_sec;
@@ -1178,6 +1242,12 @@ extern void obs_output_remove_encoder(struct obs_output *output,
 extern void
 obs_encoder_packet_create_instance(struct encoder_packet *dst,
 				   const struct encoder_packet *src);
+
+/* refcounted packet data, see obs-packet-pool.c */
+extern void *obs_encoder_packet_data_alloc(size_t size);
+extern void obs_encoder_packet_data_addref(void *data);
+extern void obs_encoder_packet_data_release(void *data);
+extern void obs_encoder_packet_pool_free(void);
 void obs_output_destroy(obs_output_t *output);
 
 /* ------------------------------------------------------------------------- */
@@ -240,10 +240,7 @@ fail:
 
 static inline void free_packets(struct obs_output *output)
 {
-	for (size_t i = 0; i < output->interleaved_packets.num; i++)
-		obs_encoder_packet_release(output->interleaved_packets.array +
-					   i);
-	da_free(output->interleaved_packets);
+	interleave_queue_free(&output->interleaved_packets);
 }
 
 static inline void clear_raw_audio_buffers(obs_output_t *output)
@@ -1561,17 +1558,20 @@ static bool add_caption(struct obs_output *output, struct encoder_packet *out)
 
 double last_caption_timestamp = 0;
 
+static const char *output_packet_name = "output_packet";
 static inline void send_interleaved(struct obs_output *output)
 {
-	struct encoder_packet out = output->interleaved_packets.array[0];
+	struct encoder_packet *first =
+		interleave_queue_first(&output->interleaved_packets);
+	struct encoder_packet out;
 
 	/* do not send an interleaved packet if there's no packet of the
 	 * opposing type of a higher timestamp in the interleave buffer.
 	 * this ensures that the timestamps are monotonic */
-	if (!has_higher_opposing_ts(output, &out))
+	if (!first || !has_higher_opposing_ts(output, first))
 		return;
 
-	da_erase(output->interleaved_packets, 0);
+	interleave_queue_pop(&output->interleaved_packets, &out);
 
 	if (out.type == OBS_ENCODER_VIDEO) {
 		output->total_frames++;
@@ -1605,7 +1605,9 @@ static inline void send_interleaved(struct obs_output *output)
 		pthread_mutex_unlock(&output->caption_mutex);
 	}
 
+	profile_start(output_packet_name);
 	output->info.encoded_packet(output->context.data, &out);
+	profile_end(output_packet_name);
 	obs_encoder_packet_release(&out);
 }
 
@@ -1636,12 +1638,14 @@ static size_t get_interleaved_start_idx(struct obs_output *output)
 	int64_t closest_diff = 0x7FFFFFFFFFFFFFFFLL;
 	struct encoder_packet *first_video =
 		find_first_packet_type(output, OBS_ENCODER_VIDEO, 0);
+	struct interleave_iter it = {0};
+	struct encoder_packet *packet;
 	size_t video_idx = DARRAY_INVALID;
 	size_t idx = 0;
 
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
+	for (size_t i = 0;
+	     (packet = interleave_iter_next(&output->interleaved_packets, &it));
+	     i++) {
 		int64_t diff;
 
 		if (packet->type != OBS_ENCODER_AUDIO) {
@@ -1681,7 +1685,7 @@ static int prune_premature_packets(struct obs_output *output)
 		return -1;
 
 	max_idx = video_idx;
-	video = &output->interleaved_packets.array[video_idx];
+	video = find_first_packet_type(output, OBS_ENCODER_VIDEO, 0);
 	duration_usec = video->timebase_num * 1000000LL / video->timebase_den;
 
 	for (size_t i = 0; i < MAX_OUTPUT_AUDIO_ENCODERS; i++) {
@@ -1700,7 +1704,7 @@ static int prune_premature_packets(struct obs_output *output)
 			return -1;
 		}
 
-		audio = &output->interleaved_packets.array[audio_idx];
+		audio = find_first_packet_type(output, OBS_ENCODER_AUDIO, i);
 		if (audio_idx > max_idx)
 			max_idx = audio_idx;
 
@@ -1729,13 +1733,7 @@ static int prune_premature_packets(struct obs_output *output)
 
 static void discard_to_idx(struct obs_output *output, size_t idx)
 {
-	for (size_t i = 0; i < idx; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		obs_encoder_packet_release(packet);
-	}
-
-	da_erase_range(output->interleaved_packets, 0, idx);
+	interleave_queue_discard(&output->interleaved_packets, idx);
 }
 
 #define DEBUG_STARTING_PACKETS 0
@@ -1747,9 +1745,11 @@ static bool prune_interleaved_packets(struct obs_output *output)
 
 #if DEBUG_STARTING_PACKETS == 1
 	blog(LOG_DEBUG, "--------- Pruning! %d ---------", prune_start);
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
+	struct interleave_iter it = {0};
+	struct encoder_packet *packet;
+	for (size_t i = 0;
+	     (packet = interleave_iter_next(&output->interleaved_packets, &it));
+	     i++) {
 		blog(LOG_DEBUG, "packet: %s %d, ts: %lld, pruned = %s",
 		     packet->type == OBS_ENCODER_AUDIO ? "audio" : "video",
 		     (int)packet->track_idx, packet->dts_usec,
@@ -1774,45 +1774,24 @@ static bool prune_interleaved_packets(struct obs_output *output)
 static int find_first_packet_type_idx(struct obs_output *output,
 				      enum obs_encoder_type type, size_t idx)
 {
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-
-		if (packet->type == type && packet->track_idx == idx)
-			return (int)i;
-	}
-
-	return -1;
-}
-
-static int find_last_packet_type_idx(struct obs_output *output,
-				     enum obs_encoder_type type, size_t idx)
-{
-	for (size_t i = output->interleaved_packets.num; i > 0; i--) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i - 1];
-
-		if (packet->type == type && packet->track_idx == idx)
-			return (int)(i - 1);
-	}
-
-	return -1;
+	return interleave_queue_track_first_idx(&output->interleaved_packets,
+						type, idx);
 }
 
 static inline struct encoder_packet *
 find_first_packet_type(struct obs_output *output, enum obs_encoder_type type,
 		       size_t audio_idx)
 {
-	int idx = find_first_packet_type_idx(output, type, audio_idx);
-	return (idx != -1) ? &output->interleaved_packets.array[idx] : NULL;
+	return interleave_queue_track_first(&output->interleaved_packets, type,
+					    audio_idx);
 }
 
 static inline struct encoder_packet *
 find_last_packet_type(struct obs_output *output, enum obs_encoder_type type,
 		      size_t audio_idx)
 {
-	int idx = find_last_packet_type_idx(output, type, audio_idx);
-	return (idx != -1) ? &output->interleaved_packets.array[idx] : NULL;
+	return interleave_queue_track_last(&output->interleaved_packets, type,
+					   audio_idx);
 }
 
 static bool get_audio_and_video_packets(struct obs_output *output,
@@ -1920,69 +1899,34 @@ static bool initialize_interleaved_packets(struct obs_output *output)
 			output->highest_video_ts[i] -= video[i]->dts_usec;
 	}
 
-	/* apply new offsets to all existing packet DTS/PTS values */
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		apply_interleaved_packet_offset(output, packet);
-	}
+	/* apply new offsets to all existing packet DTS/PTS values.  offsets
+	 * are per track, so every track stays sorted and only the merged
+	 * order changes */
+	for (size_t i = 0; i < MAX_INTERLEAVE_TRACKS; i++) {
+		struct interleave_queue *q = &output->interleaved_packets;
+		size_t count = interleave_track_size(q, i);
 
-	return true;
-}
-
-static inline void insert_interleaved_packet(struct obs_output *output,
-					     struct encoder_packet *out)
-{
-	size_t idx;
-	for (idx = 0; idx < output->interleaved_packets.num; idx++) {
-		struct encoder_packet *cur_packet;
-		cur_packet = output->interleaved_packets.array + idx;
-
-		// sort video packets with same DTS by track index,
-		// to prevent the pruning logic from removing additional
-		// video tracks
-		if (out->dts_usec == cur_packet->dts_usec &&
-		    out->type == OBS_ENCODER_VIDEO &&
-		    cur_packet->type == OBS_ENCODER_VIDEO &&
-		    out->track_idx > cur_packet->track_idx)
-			continue;
-
-		if (out->dts_usec == cur_packet->dts_usec &&
-		    out->type == OBS_ENCODER_VIDEO) {
-			break;
-		} else if (out->dts_usec < cur_packet->dts_usec) {
-			break;
+		for (size_t j = 0; j < count; j++) {
+			struct interleave_entry *entry =
+				interleave_track_entry(q, i, j);
+			apply_interleaved_packet_offset(output, &entry->packet);
 		}
 	}
 
-	da_insert(output->interleaved_packets, idx, out);
-}
-
-static void resort_interleaved_packets(struct obs_output *output)
-{
-	DARRAY(struct encoder_packet) old_array;
-
-	old_array.da = output->interleaved_packets.da;
-	memset(&output->interleaved_packets, 0,
-	       sizeof(output->interleaved_packets));
-
-	for (size_t i = 0; i < old_array.num; i++)
-		insert_interleaved_packet(output, &old_array.array[i]);
-
-	da_free(old_array);
+	return true;
 }
 
 static void discard_unused_audio_packets(struct obs_output *output,
 					 int64_t dts_usec)
 {
+	struct interleave_iter it = {0};
+	struct encoder_packet *p;
 	size_t idx = 0;
 
-	for (; idx < output->interleaved_packets.num; idx++) {
-		struct encoder_packet *p =
-			&output->interleaved_packets.array[idx];
-
+	while ((p = interleave_iter_next(&output->interleaved_packets, &it))) {
 		if (p->dts_usec >= dts_usec)
 			break;
+		idx++;
 	}
 
 	if (idx)
@@ -2033,7 +1977,9 @@ static void interleave_packets(void *data, struct encoder_packet *packet)
 	else
 		check_received(output, packet);
 
-	insert_interleaved_packet(output, &out);
+	enum bmem_tag prev_tag = bmem_set_tag(BMEM_TAG_OUTPUT);
+	interleave_queue_push(&output->interleaved_packets, &out);
+	bmem_set_tag(prev_tag);
 	set_higher_ts(output, &out);
 
 	received_video = true;
@@ -2048,10 +1994,8 @@ static void interleave_packets(void *data, struct encoder_packet *packet)
 	if (output->received_audio && received_video) {
 		if (!was_started) {
 			if (prune_interleaved_packets(output)) {
-				if (initialize_interleaved_packets(output)) {
-					resort_interleaved_packets(output);
+				if (initialize_interleaved_packets(output))
 					send_interleaved(output);
-				}
 			}
 		} else {
 			send_interleaved(output);
@@ -2068,7 +2012,9 @@ static void default_encoded_callback(void *param, struct encoder_packet *packet)
 	if (data_active(output)) {
 		packet->track_idx = get_encoder_index(output, packet);
 
+		profile_start(output_packet_name);
 		output->info.encoded_packet(output->context.data, packet);
+		profile_end(output_packet_name);
 
 		if (packet->type == OBS_ENCODER_VIDEO)
 			output->total_frames++;
@@ -2078,6 +2024,7 @@ static void default_encoded_callback(void *param, struct encoder_packet *packet)
 		obs_encoder_packet_release(packet);
 }
 
+static const char *output_raw_video_name = "output_raw_video";
 static void default_raw_video_callback(void *param, struct video_data *frame)
 {
 	struct obs_output *output = param;
@@ -2085,8 +2032,11 @@ static void default_raw_video_callback(void *param, struct video_data *frame)
 	if (video_pause_check(&output->pause, frame->timestamp))
 		return;
 
-	if (data_active(output))
+	if (data_active(output)) {
+		profile_start(output_raw_video_name);
 		output->info.raw_video(output->context.data, frame);
+		profile_end(output_raw_video_name);
+	}
 	output->total_frames++;
 }
 
@@ -2134,6 +2084,7 @@ static bool prepare_audio(struct obs_output *output,
 	return true;
 }
 
+static const char *output_raw_audio_name = "output_raw_audio";
 static void default_raw_audio_callback(void *param, size_t mix_idx,
 				       struct audio_data *in)
 {
@@ -2182,11 +2133,13 @@ static void default_raw_audio_callback(void *param, size_t mix_idx,
 
 		output->total_audio_frames += AUDIO_OUTPUT_FRAMES;
 
+		profile_start(output_raw_audio_name);
 		if (output->info.raw_audio2)
 			output->info.raw_audio2(output->context.data, mix_idx,
 						&out);
 		else
 			output->info.raw_audio(output->context.data, &out);
+		profile_end(output_raw_audio_name);
 	}
 }
 
@@ -0,0 +1,386 @@
+/******************************************************************************
+    Copyright (C) 2023 by Lain Bailey <lain@obsproject.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "obs-internal.h"
+
+/*
+ * Encoder packet data arena.
+ *
+ *   Packet data is handed out in power-of-two size classes.  Released buffers
+ * go into a small per-thread cache first; when that fills up half of it is
+ * moved to the shared free list of the size class in one batch, and threads
+ * that run dry refill from the shared list the same way.  Packets are
+ * typically created on the encoder thread and released on an output's send
+ * thread, so in steady state buffers circulate between the two without ever
+ * going back to the heap.
+ *
+ *   Buffers larger than the biggest size class are allocated and freed
+ * directly.
+ */
+
+#define MIN_CLASS_SHIFT 10 /* 1 KiB */
+#define MAX_CLASS_SHIFT 24 /* 16 MiB */
+#define NUM_CLASSES (MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1)
+#define HEAP_CLASS NUM_CLASSES
+
+#define THREAD_CACHE_SIZE 16
+#define THREAD_CACHE_BYTES (4 * 1024 * 1024)
+#define MAX_SHARED_BYTES (64 * 1024 * 1024)
+
+struct packet_buf {
+	union {
+		struct {
+			volatile long refs;
+			uint32_t size_class;
+		};
+		struct packet_buf *next;
+
+		/* keep packet data on the same alignment bmalloc gives us */
+		uint8_t align[32];
+	};
+};
+
+struct size_class {
+	struct packet_buf *free_list;
+	size_t count;
+};
+
+struct thread_cache {
+	struct thread_cache *prev;
+	struct thread_cache *next;
+
+	struct packet_buf *bufs[NUM_CLASSES][THREAD_CACHE_SIZE];
+	size_t count[NUM_CLASSES];
+
+	uint64_t allocs;
+	uint64_t reused;
+	uint64_t releases;
+};
+
+struct packet_pool {
+	pthread_mutex_t mutex;
+	struct size_class classes[NUM_CLASSES];
+	size_t shared_bytes;
+
+	struct thread_cache *first_cache;
+
+	/* totals of threads that have already exited */
+	struct encoder_packet_pool_stats retired;
+	uint64_t heap_allocs;
+	uint64_t heap_frees;
+
+	/* set by obs_encoder_packet_pool_free until packets are created again,
+	 * threads give back their caches instead of filling them meanwhile */
+	volatile bool dead;
+};
+
+static struct packet_pool pool = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+static THREAD_LOCAL struct thread_cache *cur_cache = NULL;
+
+static inline size_t class_size(uint32_t size_class)
+{
+	return (size_t)1 << (size_class + MIN_CLASS_SHIFT);
+}
+
+static inline size_t thread_cache_cap(uint32_t size_class)
+{
+	size_t cap = THREAD_CACHE_BYTES / class_size(size_class);
+	if (cap > THREAD_CACHE_SIZE)
+		cap = THREAD_CACHE_SIZE;
+	return cap ? cap : 1;
+}
+
+static inline uint32_t get_size_class(size_t size)
+{
+	uint32_t shift = MIN_CLASS_SHIFT;
+
+	while (((size_t)1 << shift) < size) {
+		if (++shift > MAX_CLASS_SHIFT)
+			return HEAP_CLASS;
+	}
+
+	return shift - MIN_CLASS_SHIFT;
+}
+
+static inline struct packet_buf *buf_from_data(void *data)
+{
+	return (struct packet_buf *)data - 1;
+}
+
+/* call with pool.mutex held */
+static void push_shared(struct packet_buf *buf, uint32_t size_class)
+{
+	size_t size = class_size(size_class);
+
+	if (os_atomic_load_bool(&pool.dead) ||
+	    pool.shared_bytes + size > MAX_SHARED_BYTES) {
+		bfree(buf);
+		pool.heap_frees++;
+		return;
+	}
+
+	buf->next = pool.classes[size_class].free_list;
+	pool.classes[size_class].free_list = buf;
+	pool.classes[size_class].count++;
+	pool.shared_bytes += size;
+}
+
+/* call with pool.mutex held */
+static struct packet_buf *pop_shared(uint32_t size_class)
+{
+	struct size_class *sc = &pool.classes[size_class];
+	struct packet_buf *buf = sc->free_list;
+
+	if (buf) {
+		sc->free_list = buf->next;
+		sc->count--;
+		pool.shared_bytes -= class_size(size_class);
+	}
+
+	return buf;
+}
+
+/* call with pool.mutex held */
+static void flush_cache(struct thread_cache *cache)
+{
+	for (uint32_t i = 0; i < NUM_CLASSES; i++) {
+		for (size_t j = 0; j < cache->count[i]; j++)
+			push_shared(cache->bufs[i][j], i);
+		cache->count[i] = 0;
+	}
+}
+
+static void thread_cache_destroy(void *data)
+{
+	struct thread_cache *cache = data;
+
+	pthread_mutex_lock(&pool.mutex);
+	flush_cache(cache);
+
+	pool.retired.allocs += cache->allocs;
+	pool.retired.reused += cache->reused;
+	pool.retired.releases += cache->releases;
+
+	if (cache->prev)
+		cache->prev->next = cache->next;
+	else
+		pool.first_cache = cache->next;
+	if (cache->next)
+		cache->next->prev = cache->prev;
+	pthread_mutex_unlock(&pool.mutex);
+
+	cur_cache = NULL;
+	free(cache);
+}
+
+static void pool_init(void)
+{
+	pthread_key_create(&cache_key, thread_cache_destroy);
+}
+
+static struct thread_cache *get_thread_cache(void)
+{
+	struct thread_cache *cache = cur_cache;
+	if (cache)
+		return cache;
+
+	pthread_once(&pool_once, pool_init);
+
+	/* not tracked by bmem: a thread that outlives obs_shutdown (the UI
+	 * thread, for one) keeps its cache until it exits */
+	cache = calloc(1, sizeof(*cache));
+
+	pthread_mutex_lock(&pool.mutex);
+	cache->next = pool.first_cache;
+	if (cache->next)
+		cache->next->prev = cache;
+	pool.first_cache = cache;
+	pthread_mutex_unlock(&pool.mutex);
+
+	pthread_setspecific(cache_key, cache);
+	cur_cache = cache;
+	return cache;
+}
+
+/* pooled buffers stay counted as encoder memory while they sit in a cache */
+static inline struct packet_buf *heap_buf_alloc(size_t size)
+{
+	enum bmem_tag prev_tag = bmem_set_tag(BMEM_TAG_ENCODER);
+	struct packet_buf *buf = bmalloc(sizeof(struct packet_buf) + size);
+	bmem_set_tag(prev_tag);
+	return buf;
+}
+
+static struct packet_buf *packet_buf_alloc(size_t size)
+{
+	struct thread_cache *cache = get_thread_cache();
+	uint32_t size_class = get_size_class(size);
+	struct packet_buf *buf = NULL;
+
+	cache->allocs++;
+
+	if (os_atomic_load_bool(&pool.dead)) {
+		pthread_mutex_lock(&pool.mutex);
+		flush_cache(cache);
+		os_atomic_set_bool(&pool.dead, false);
+		pthread_mutex_unlock(&pool.mutex);
+	}
+
+	if (size_class == HEAP_CLASS) {
+		buf = heap_buf_alloc(size);
+
+		pthread_mutex_lock(&pool.mutex);
+		pool.heap_allocs++;
+		pthread_mutex_unlock(&pool.mutex);
+
+		buf->size_class = HEAP_CLASS;
+		return buf;
+	}
+
+	if (!cache->count[size_class]) {
+		size_t refill = (thread_cache_cap(size_class) + 1) / 2;
+
+		pthread_mutex_lock(&pool.mutex);
+		while (cache->count[size_class] < refill) {
+			struct packet_buf *shared = pop_shared(size_class);
+			if (!shared)
+				break;
+			cache->bufs[size_class][cache->count[size_class]++] =
+				shared;
+		}
+		if (!cache->count[size_class])
+			pool.heap_allocs++;
+		pthread_mutex_unlock(&pool.mutex);
+	}
+
+	if (cache->count[size_class]) {
+		buf = cache->bufs[size_class][--cache->count[size_class]];
+		cache->reused++;
+	} else {
+		buf = heap_buf_alloc(class_size(size_class));
+	}
+
+	buf->size_class = size_class;
+	return buf;
+}
+
+static void packet_buf_free(struct packet_buf *buf)
+{
+	struct thread_cache *cache = get_thread_cache();
+	uint32_t size_class = buf->size_class;
+
+	cache->releases++;
+
+	/* the pool was freed, so this thread gives back what it still holds
+	 * instead of caching more */
+	if (os_atomic_load_bool(&pool.dead)) {
+		pthread_mutex_lock(&pool.mutex);
+		flush_cache(cache);
+		bfree(buf);
+		pool.heap_frees++;
+		pthread_mutex_unlock(&pool.mutex);
+		return;
+	}
+
+	if (size_class == HEAP_CLASS) {
+		bfree(buf);
+
+		pthread_mutex_lock(&pool.mutex);
+		pool.heap_frees++;
+		pthread_mutex_unlock(&pool.mutex);
+		return;
+	}
+
+	if (cache->count[size_class] == thread_cache_cap(size_class)) {
+		size_t keep = thread_cache_cap(size_class) / 2;
+
+		pthread_mutex_lock(&pool.mutex);
+		while (cache->count[size_class] > keep) {
+			size_t idx = --cache->count[size_class];
+			push_shared(cache->bufs[size_class][idx], size_class);
+		}
+		pthread_mutex_unlock(&pool.mutex);
+	}
+
+	cache->bufs[size_class][cache->count[size_class]++] = buf;
+}
+
+void *obs_encoder_packet_data_alloc(size_t size)
+{
+	struct packet_buf *buf = packet_buf_alloc(size);
+	buf->refs = 1;
+	return buf + 1;
+}
+
+void obs_encoder_packet_data_addref(void *data)
+{
+	os_atomic_inc_long(&buf_from_data(data)->refs);
+}
+
+void obs_encoder_packet_data_release(void *data)
+{
+	struct packet_buf *buf = buf_from_data(data);
+	if (os_atomic_dec_long(&buf->refs) == 0)
+		packet_buf_free(buf);
+}
+
+/* the caches of other threads are only ever touched by their owners, they
+ * flush them the next time they release a packet or when they exit */
+void obs_encoder_packet_pool_free(void)
+{
+	pthread_mutex_lock(&pool.mutex);
+	os_atomic_set_bool(&pool.dead, true);
+
+	if (cur_cache)
+		flush_cache(cur_cache);
+
+	for (uint32_t i = 0; i < NUM_CLASSES; i++) {
+		struct packet_buf *buf;
+		while ((buf = pop_shared(i)) != NULL)
+			bfree(buf);
+	}
+
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+void obs_encoder_packet_pool_get_stats(struct encoder_packet_pool_stats *stats)
+{
+	if (!stats)
+		return;
+
+	pthread_mutex_lock(&pool.mutex);
+
+	*stats = pool.retired;
+	stats->heap_allocs = pool.heap_allocs;
+	stats->heap_frees = pool.heap_frees;
+	stats->pooled_bytes = pool.shared_bytes;
+
+	for (struct thread_cache *cache = pool.first_cache; cache;
+	     cache = cache->next) {
+		stats->allocs += cache->allocs;
+		stats->reused += cache->reused;
+		stats->releases += cache->releases;
+
+		for (uint32_t i = 0; i < NUM_CLASSES; i++)
+			stats->pooled_bytes += cache->count[i] * class_size(i);
+	}
+
+	pthread_mutex_unlock(&pool.mutex);
+}
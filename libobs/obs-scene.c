@@ -19,6 +19,7 @@
 #include "util/threading.h"
 #include "util/util_uint64.h"
 #include "graphics/math-defs.h"
+#include "media-io/audio-mix.h"
 #include "obs-scene.h"
 #include "obs-internal.h"
 
@@ -1466,12 +1467,7 @@ static void mix_audio_with_buf(float *p_out, float *p_in, float *buf_in,
 static inline void mix_audio(float *p_out, float *p_in, size_t pos,
 			     size_t count)
 {
-	register float *out = p_out + pos;
-	register float *in = p_in;
-	register float *end = in + count;
-
-	while (in < end)
-		*(out++) += *(in++);
+	audio_mix_add(p_out + pos, p_in, count);
 }
 
 static bool scene_audio_render(void *data, uint64_t *ts_out,
@@ -1567,6 +1563,12 @@ static bool scene_audio_render(void *data, uint64_t *ts_out,
 			continue;
 		}
 
+		/* nothing to add if the child only output digital silence */
+		if (source->audio_silent_since) {
+			item = item->next;
+			continue;
+		}
+
 		obs_source_get_audio_mix(source, &child_audio);
 
 		for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
@@ -21,6 +21,7 @@
 #include "media-io/format-conversion.h"
 #include "media-io/video-frame.h"
 #include "media-io/audio-io.h"
+#include "media-io/audio-mix.h"
 #include "util/threading.h"
 #include "util/platform.h"
 #include "util/util_uint64.h"
@@ -125,8 +126,17 @@ bool obs_source_init_context(struct obs_source *source, obs_data_t *settings,
 				   settings, name, uuid, hotkey_data, private))
 		return false;
 
-	return signal_handler_add_array(source->context.signals,
-					source_signals);
+	signal_handler_t *signals = source->context.signals;
+	if (!signal_handler_add_array(signals, source_signals))
+		return false;
+
+	source->mute_signal = signal_handler_get_id(signals, "mute");
+	source->volume_signal = signal_handler_get_id(signals, "volume");
+	source->audio_sync_signal =
+		signal_handler_get_id(signals, "audio_sync");
+	source->audio_balance_signal =
+		signal_handler_get_id(signals, "audio_balance");
+	return true;
 }
 
 const char *obs_source_get_display_name(const char *id)
@@ -3553,7 +3563,23 @@ static inline void free_async_cache(struct obs_source *source)
 	source->prev_async_frame = NULL;
 }
 
-#define MAX_UNUSED_FRAME_DURATION 5
+/*
+ * Async frame cache.
+ *
+ *   Frames are kept in a per-source cache and handed out again once the
+ * renderer is done with them, so in steady state a source cycles through the
+ * same few buffers.  The cache is only flushed when the frame size or
+ * conversion changes; a few frames are allocated up front at that point.
+ * Frames that go unused for a long time are freed again.
+ *
+ *   At most MAX_ASYNC_FRAMES frames can be queued for display.  If a source
+ * outputs frames faster than they are displayed the queued frames are dropped
+ * (back into the cache) and timing restarts with the new frame.
+ */
+
+#define MAX_UNUSED_FRAME_DURATION 300
+#define MAX_ASYNC_FRAMES 30
+#define PREALLOC_ASYNC_FRAMES 3
 
 /* frees frame allocations if they haven't been used for a specific period
  * of time */
@@ -3563,39 +3589,41 @@ static void clean_cache(obs_source_t *source)
 		struct async_frame *af = &source->async_cache.array[i - 1];
 		if (!af->used) {
 			if (++af->unused_count == MAX_UNUSED_FRAME_DURATION) {
-				obs_source_frame_destroy(af->frame);
+				obs_source_frame_decref(af->frame);
 				da_erase(source->async_cache, i - 1);
 			}
 		}
 	}
 }
 
-#define MAX_ASYNC_FRAMES 30
-//if return value is not null then do (os_atomic_dec_long(&output->refs) == 0) && obs_source_frame_destroy(output)
-static inline struct obs_source_frame *
-cache_video(struct obs_source *source, const struct obs_source_frame *frame)
+static struct obs_source_frame *add_cached_frame(obs_source_t *source,
+						 enum video_format format,
+						 uint32_t width,
+						 uint32_t height, bool used)
 {
-	struct obs_source_frame *new_frame = NULL;
+	struct async_frame new_af;
+	enum bmem_tag prev_tag = bmem_set_tag(BMEM_TAG_SOURCE);
 
-	pthread_mutex_lock(&source->async_mutex);
+	new_af.frame = obs_source_frame_create(format, width, height);
+	new_af.frame->refs = 1;
+	new_af.used = used;
+	new_af.unused_count = 0;
+	da_push_back(source->async_cache, &new_af);
 
-	if (source->async_frames.num >= MAX_ASYNC_FRAMES) {
-		free_async_cache(source);
-		source->last_frame_ts = 0;
-		pthread_mutex_unlock(&source->async_mutex);
-		return NULL;
-	}
+	bmem_set_tag(prev_tag);
 
-	if (async_texture_changed(source, frame)) {
-		free_async_cache(source);
-		source->async_cache_width = frame->width;
-		source->async_cache_height = frame->height;
-	}
+	source->async_stats.allocated++;
+	return new_af.frame;
+}
 
-	const enum video_format format = frame->format;
-	source->async_cache_format = format;
-	source->async_cache_full_range = frame->full_range;
-	source->async_cache_trc = frame->trc;
+/* returns a referenced, unused frame from the cache, allocating one if
+ * needed.  Call with async_mutex held. */
+static struct obs_source_frame *get_cached_frame(obs_source_t *source,
+						 enum video_format format,
+						 uint32_t width,
+						 uint32_t height)
+{
+	struct obs_source_frame *new_frame = NULL;
 
 	for (size_t i = 0; i < source->async_cache.num; i++) {
 		struct async_frame *af = &source->async_cache.array[i];
@@ -3604,6 +3632,7 @@ cache_video(struct obs_source *source, const struct obs_source_frame *frame)
 			new_frame->format = format;
 			af->used = true;
 			af->unused_count = 0;
+			source->async_stats.reused++;
 			break;
 		}
 	}
@@ -3611,19 +3640,70 @@ cache_video(struct obs_source *source, const struct obs_source_frame *frame)
 	clean_cache(source);
 
 	if (!new_frame) {
-		struct async_frame new_af;
-
-		new_frame = obs_source_frame_create(format, frame->width,
-						    frame->height);
-		new_af.frame = new_frame;
-		new_af.used = true;
-		new_af.unused_count = 0;
-		new_frame->refs = 1;
+		bool prealloc = !source->async_cache.num;
 
-		da_push_back(source->async_cache, &new_af);
+		new_frame = add_cached_frame(source, format, width, height,
+					     true);
+		for (size_t i = 1; prealloc && i < PREALLOC_ASYNC_FRAMES; i++)
+			add_cached_frame(source, format, width, height, false);
 	}
 
 	os_atomic_inc_long(&new_frame->refs);
+	return new_frame;
+}
+
+/* call with async_mutex held */
+static void set_async_cache_format(obs_source_t *source,
+				   const struct obs_source_frame *frame)
+{
+	if (async_texture_changed(source, frame)) {
+		free_async_cache(source);
+		source->async_cache_width = frame->width;
+		source->async_cache_height = frame->height;
+	}
+
+	source->async_cache_format = frame->format;
+	source->async_cache_full_range = frame->full_range;
+	source->async_cache_trc = frame->trc;
+}
+
+/* call with async_mutex held */
+static bool async_cache_has_frame(obs_source_t *source,
+				  const struct obs_source_frame *frame)
+{
+	for (size_t i = 0; i < source->async_cache.num; i++) {
+		if (source->async_cache.array[i].frame == frame)
+			return true;
+	}
+
+	return false;
+}
+
+/* returns the queued frames to the cache, call with async_mutex held */
+static void drop_async_frames(obs_source_t *source)
+{
+	for (size_t i = 0; i < source->async_frames.num; i++)
+		remove_async_frame(source, source->async_frames.array[i]);
+
+	source->async_stats.dropped += source->async_frames.num;
+	da_resize(source->async_frames, 0);
+	source->last_frame_ts = 0;
+}
+
+//if return value is not null then do (os_atomic_dec_long(&output->refs) == 0) && obs_source_frame_destroy(output)
+static inline struct obs_source_frame *
+cache_video(struct obs_source *source, const struct obs_source_frame *frame)
+{
+	struct obs_source_frame *new_frame = NULL;
+
+	pthread_mutex_lock(&source->async_mutex);
+
+	if (source->async_frames.num >= MAX_ASYNC_FRAMES)
+		drop_async_frames(source);
+
+	set_async_cache_format(source, frame);
+	new_frame = get_cached_frame(source, frame->format, frame->width,
+				     frame->height);
 
 	pthread_mutex_unlock(&source->async_mutex);
 
@@ -3632,6 +3712,19 @@ cache_video(struct obs_source *source, const struct obs_source_frame *frame)
 	return new_frame;
 }
 
+/* queues a referenced frame from the cache, call with async_mutex held */
+static void queue_async_frame(obs_source_t *source,
+			      struct obs_source_frame *frame)
+{
+	if (os_atomic_dec_long(&frame->refs) == 0) {
+		obs_source_frame_destroy(frame);
+	} else {
+		da_push_back(source->async_frames, &frame);
+		source->async_active = true;
+		source->async_stats.frames++;
+	}
+}
+
 static void
 obs_source_output_video_internal(obs_source_t *source,
 				 const struct obs_source_frame *frame)
@@ -3652,15 +3745,8 @@ obs_source_output_video_internal(obs_source_t *source,
 
 	/* ------------------------------------------- */
 	pthread_mutex_lock(&source->async_mutex);
-	if (output) {
-		if (os_atomic_dec_long(&output->refs) == 0) {
-			obs_source_frame_destroy(output);
-			output = NULL;
-		} else {
-			da_push_back(source->async_frames, &output);
-			source->async_active = true;
-		}
-	}
+	source->async_stats.copied++;
+	queue_async_frame(source, output);
 	pthread_mutex_unlock(&source->async_mutex);
 }
 
@@ -3720,6 +3806,92 @@ void obs_source_output_video2(obs_source_t *source,
 	obs_source_output_video_internal(source, &new_frame);
 }
 
+struct obs_source_frame *
+obs_source_borrow_video_frame(obs_source_t *source, enum video_format format,
+			      uint32_t width, uint32_t height)
+{
+	struct obs_source_frame *frame;
+
+	if (!obs_source_valid(source, "obs_source_borrow_video_frame"))
+		return NULL;
+	if (destroying(source) || format == VIDEO_FORMAT_NONE)
+		return NULL;
+
+	pthread_mutex_lock(&source->async_mutex);
+
+	struct obs_source_frame info = {
+		.format = format,
+		.width = width,
+		.height = height,
+		.full_range = source->async_cache_full_range,
+		.trc = source->async_cache_trc,
+	};
+
+	set_async_cache_format(source, &info);
+	frame = get_cached_frame(source, format, width, height);
+	pthread_mutex_unlock(&source->async_mutex);
+
+	frame->timestamp = 0;
+	frame->full_range = false;
+	frame->max_luminance = 0;
+	frame->flip = false;
+	frame->flags = 0;
+	frame->trc = VIDEO_TRC_DEFAULT;
+	memset(frame->color_matrix, 0, sizeof(frame->color_matrix));
+	memset(frame->color_range_min, 0, sizeof(frame->color_range_min));
+	memset(frame->color_range_max, 0, sizeof(frame->color_range_max));
+	return frame;
+}
+
+void obs_source_commit_video_frame(obs_source_t *source,
+				   struct obs_source_frame *frame)
+{
+	if (!obs_source_valid(source, "obs_source_commit_video_frame"))
+		return;
+	if (!obs_ptr_valid(frame, "obs_source_commit_video_frame"))
+		return;
+
+	if (!format_is_yuv(frame->format))
+		frame->full_range = true;
+
+	pthread_mutex_lock(&source->async_mutex);
+
+	if (source->async_frames.num >= MAX_ASYNC_FRAMES)
+		drop_async_frames(source);
+
+	set_async_cache_format(source, frame);
+
+	/* the cache may have been flushed since the frame was borrowed, by a
+	 * size change or by deactivating the source.  The frame itself is
+	 * still good, so keep it in the new cache instead of dropping it. */
+	if (!async_cache_has_frame(source, frame)) {
+		struct async_frame af = {frame, 0, true};
+
+		os_atomic_inc_long(&frame->refs);
+		da_push_back(source->async_cache, &af);
+	}
+
+	source->async_stats.borrowed++;
+	queue_async_frame(source, frame);
+
+	pthread_mutex_unlock(&source->async_mutex);
+}
+
+void obs_source_get_async_stats(obs_source_t *source,
+				struct obs_source_async_stats *stats)
+{
+	if (!obs_source_valid(source, "obs_source_get_async_stats"))
+		return;
+	if (!obs_ptr_valid(stats, "obs_source_get_async_stats"))
+		return;
+
+	pthread_mutex_lock(&source->async_mutex);
+	*stats = source->async_stats;
+	stats->cached = source->async_cache.num;
+	stats->queued = source->async_frames.num;
+	pthread_mutex_unlock(&source->async_mutex);
+}
+
 void obs_source_set_async_rotation(obs_source_t *source, long rotation)
 {
 	if (source)
@@ -4692,7 +4864,8 @@ void obs_source_set_volume(obs_source_t *source, float volume)
 		calldata_set_ptr(&data, "source", source);
 		calldata_set_float(&data, "volume", volume);
 
-		signal_handler_signal(source->context.signals, "volume", &data);
+		signal_handler_signal_id(source->context.signals,
+					 source->volume_signal, &data);
 		if (!source->context.private)
 			signal_handler_signal(obs->signals, "source_volume",
 					      &data);
@@ -4724,8 +4897,8 @@ void obs_source_set_sync_offset(obs_source_t *source, int64_t offset)
 		calldata_set_ptr(&data, "source", source);
 		calldata_set_int(&data, "offset", offset);
 
-		signal_handler_signal(source->context.signals, "audio_sync",
-				      &data);
+		signal_handler_signal_id(source->context.signals,
+					 source->audio_sync_signal, &data);
 
 		source->sync_offset = calldata_int(&data, "offset");
 	}
@@ -5261,7 +5434,8 @@ void obs_source_set_muted(obs_source_t *source, bool muted)
 	calldata_set_ptr(&data, "source", source);
 	calldata_set_bool(&data, "muted", muted);
 
-	signal_handler_signal(source->context.signals, "mute", &data);
+	signal_handler_signal_id(source->context.signals, source->mute_signal,
+				 &data);
 
 	pthread_mutex_lock(&source->audio_actions_mutex);
 	da_push_back(source->audio_actions, &action);
@@ -5532,7 +5706,16 @@ static void apply_audio_actions(obs_source_t *source, size_t channels,
 	}
 }
 
-static void apply_audio_volume(obs_source_t *source, uint32_t mixers,
+static inline void set_audio_silent(obs_source_t *source, bool silent)
+{
+	if (!silent)
+		source->audio_silent_since = 0;
+	else if (!source->audio_silent_since)
+		source->audio_silent_since = source->audio_ts;
+}
+
+/* returns true if the output was zeroed */
+static bool apply_audio_volume(obs_source_t *source, uint32_t mixers,
 			       size_t channels, size_t sample_rate)
 {
 	struct audio_action action;
@@ -5553,19 +5736,19 @@ static void apply_audio_volume(obs_source_t *source, uint32_t mixers,
 
 		if (action.timestamp < (source->audio_ts + duration)) {
 			apply_audio_actions(source, channels, sample_rate);
-			return;
+			return false;
 		}
 	}
 
 	vol = get_source_volume(source, source->audio_ts);
 	if (vol == 1.0f)
-		return;
+		return false;
 
 	if (vol == 0.0f || mixers == 0) {
 		memset(source->audio_output_buf[0][0], 0,
 		       AUDIO_OUTPUT_FRAMES * sizeof(float) *
 			       MAX_AUDIO_CHANNELS * MAX_AUDIO_MIXES);
-		return;
+		return true;
 	}
 
 	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
@@ -5574,6 +5757,8 @@ static void apply_audio_volume(obs_source_t *source, uint32_t mixers,
 		    (mixers & mix_and_val) != 0)
 			multiply_output_audio(source, mix, channels, vol);
 	}
+
+	return false;
 }
 
 static void custom_audio_render(obs_source_t *source, uint32_t mixers,
@@ -5600,6 +5785,7 @@ static void custom_audio_render(obs_source_t *source, uint32_t mixers,
 					    sample_rate);
 	source->audio_ts = success ? ts : 0;
 	source->audio_pending = !success;
+	source->audio_silent_since = 0;
 
 	if (!success || !source->audio_ts || !mixers)
 		return;
@@ -5616,7 +5802,8 @@ static void custom_audio_render(obs_source_t *source, uint32_t mixers,
 		}
 	}
 
-	apply_audio_volume(source, mixers, channels, sample_rate);
+	set_audio_silent(source, apply_audio_volume(source, mixers, channels,
+						    sample_rate));
 }
 
 static void audio_submix(obs_source_t *source, size_t channels,
@@ -5657,6 +5844,7 @@ static inline void process_audio_source_tick(obs_source_t *source,
 					     size_t sample_rate, size_t size)
 {
 	bool audio_submix = !!(source->info.output_flags & OBS_SOURCE_SUBMIX);
+	bool silent;
 
 	pthread_mutex_lock(&source->audio_buf_mutex);
 
@@ -5672,6 +5860,11 @@ static inline void process_audio_source_tick(obs_source_t *source,
 
 	pthread_mutex_unlock(&source->audio_buf_mutex);
 
+	/* the planes of a mix are contiguous, so this checks all channels */
+	silent = !audio_submix &&
+		 audio_mix_is_silent(source->audio_output_buf[0][0],
+				     size / sizeof(float) * channels);
+
 	for (size_t mix = 1; mix < MAX_AUDIO_MIXES; mix++) {
 		uint32_t mix_and_val = (1 << mix);
 
@@ -5683,7 +5876,7 @@ static inline void process_audio_source_tick(obs_source_t *source,
 			mix_and_val = 1;
 		}
 
-		if ((source->audio_mixers & mix_and_val) == 0 ||
+		if (silent || (source->audio_mixers & mix_and_val) == 0 ||
 		    (mixers & mix_and_val) == 0) {
 			memset(source->audio_output_buf[mix][0], 0,
 			       size * channels);
@@ -5696,6 +5889,7 @@ static inline void process_audio_source_tick(obs_source_t *source,
 	}
 
 	if (audio_submix) {
+		source->audio_silent_since = 0;
 		source->audio_pending = false;
 		return;
 	}
@@ -5703,7 +5897,13 @@ static inline void process_audio_source_tick(obs_source_t *source,
 	if ((source->audio_mixers & 1) == 0 || (mixers & 1) == 0)
 		memset(source->audio_output_buf[0][0], 0, size * channels);
 
-	apply_audio_volume(source, mixers, channels, sample_rate);
+	if ((source->audio_mixers & mixers) == 0)
+		silent = true;
+
+	if (apply_audio_volume(source, mixers, channels, sample_rate))
+		silent = true;
+
+	set_audio_silent(source, silent);
 	source->audio_pending = false;
 }
 
@@ -5942,8 +6142,8 @@ void obs_source_set_balance_value(obs_source_t *source, float balance)
 		calldata_set_ptr(&data, "source", source);
 		calldata_set_float(&data, "balance", balance);
 
-		signal_handler_signal(source->context.signals, "audio_balance",
-				      &data);
+		signal_handler_signal_id(source->context.signals,
+					 source->audio_balance_signal, &data);
 
 		source->balance = (float)calldata_float(&data, "balance");
 	}
@@ -29,6 +29,69 @@
 #include <windows.h>
 #endif
 
+static void tick_source_job(void *param)
+{
+	obs_source_video_tick(param, obs->data.tick_seconds);
+}
+
+static void add_tick_dependency(obs_source_t *parent, obs_source_t *child,
+				void *param)
+{
+	os_work_batch_t *batch = param;
+
+	/* sources created during this tick aren't part of the batch */
+	if (parent->tick_job && child->tick_job)
+		os_work_batch_add_dependency(batch, parent->tick_job - 1,
+					     child->tick_job - 1);
+}
+
+static const char *tick_sources_parallel_name = "tick_sources_parallel";
+static const char *tick_sources_worker_name = "tick_sources_worker";
+
+/* Containers tick after the sources they contain and filters after the
+ * source they filter (its tick shows/activates them), everything else may
+ * tick concurrently. */
+static void tick_sources_parallel(float seconds)
+{
+	struct obs_core_data *data = &obs->data;
+	os_work_batch_t *batch = data->tick_batch;
+
+	profile_start(tick_sources_parallel_name);
+
+	if (!batch)
+		batch = data->tick_batch =
+			os_work_batch_create(tick_sources_worker_name);
+
+	os_work_batch_clear(batch);
+	data->tick_seconds = seconds;
+
+	for (size_t i = 0; i < data->sources_to_tick.num; i++) {
+		obs_source_t *s = data->sources_to_tick.array[i];
+		s->tick_job = os_work_batch_add(batch, tick_source_job, s) + 1;
+	}
+
+	for (size_t i = 0; i < data->sources_to_tick.num; i++) {
+		obs_source_t *s = data->sources_to_tick.array[i];
+
+		obs_source_enum_active_sources(s, add_tick_dependency, batch);
+
+		pthread_mutex_lock(&s->filter_mutex);
+		for (size_t j = 0; j < s->filters.num; j++)
+			add_tick_dependency(s->filters.array[j], s, batch);
+		pthread_mutex_unlock(&s->filter_mutex);
+	}
+
+	os_work_batch_run(obs->work_pool, batch);
+
+	for (size_t i = 0; i < data->sources_to_tick.num; i++) {
+		obs_source_t *s = data->sources_to_tick.array[i];
+		s->tick_job = 0;
+		obs_source_release(s);
+	}
+
+	profile_end(tick_sources_parallel_name);
+}
+
 static uint64_t tick_sources(uint64_t cur_time, uint64_t last_time)
 {
 	struct obs_core_data *data = &obs->data;
@@ -75,6 +138,11 @@ static uint64_t tick_sources(uint64_t cur_time, uint64_t last_time)
 	/* ------------------------------------- */
 	/* call the tick function of each source */
 
+	if (os_atomic_load_bool(&obs->parallel_sources)) {
+		tick_sources_parallel(seconds);
+		return cur_time;
+	}
+
 	for (size_t i = 0; i < data->sources_to_tick.num; i++) {
 		obs_source_t *s = data->sources_to_tick.array[i];
 		obs_source_video_tick(s, seconds);
@@ -644,27 +712,21 @@ static inline bool download_frame(struct obs_core_video_mix *video,
 	return true;
 }
 
-static const uint8_t *set_gpu_converted_plane(uint32_t width, uint32_t height,
+/* queues the copy of a plane on the slice context, returns where the plane
+ * ends in the input */
+static const uint8_t *set_gpu_converted_plane(video_slices_t *slices,
+					      uint32_t width, uint32_t height,
 					      uint32_t linesize_input,
 					      uint32_t linesize_output,
 					      const uint8_t *in, uint8_t *out)
 {
-	if ((width == linesize_input) && (width == linesize_output)) {
-		size_t total = (size_t)width * (size_t)height;
-		memcpy(out, in, total);
-		in += total;
-	} else {
-		for (size_t y = 0; y < height; y++) {
-			memcpy(out, in, width);
-			out += linesize_output;
-			in += linesize_input;
-		}
-	}
-
-	return in;
+	video_slices_add_copy(slices, out, linesize_output, in, linesize_input,
+			      width, height);
+	return in + (size_t)linesize_input * (size_t)height;
 }
 
-static void set_gpu_converted_data(struct video_frame *output,
+static void set_gpu_converted_data(video_slices_t *slices,
+				   struct video_frame *output,
 				   const struct video_data *input,
 				   const struct video_output_info *info)
 {
@@ -673,20 +735,20 @@ static void set_gpu_converted_data(struct video_frame *output,
 		const uint32_t width = info->width;
 		const uint32_t height = info->height;
 
-		set_gpu_converted_plane(width, height, input->linesize[0],
-					output->linesize[0], input->data[0],
-					output->data[0]);
+		set_gpu_converted_plane(slices, width, height,
+					input->linesize[0], output->linesize[0],
+					input->data[0], output->data[0]);
 
 		const uint32_t width_d2 = width / 2;
 		const uint32_t height_d2 = height / 2;
 
-		set_gpu_converted_plane(width_d2, height_d2, input->linesize[1],
-					output->linesize[1], input->data[1],
-					output->data[1]);
+		set_gpu_converted_plane(slices, width_d2, height_d2,
+					input->linesize[1], output->linesize[1],
+					input->data[1], output->data[1]);
 
-		set_gpu_converted_plane(width_d2, height_d2, input->linesize[2],
-					output->linesize[2], input->data[2],
-					output->data[2]);
+		set_gpu_converted_plane(slices, width_d2, height_d2,
+					input->linesize[2], output->linesize[2],
+					input->data[2], output->data[2]);
 
 		break;
 	}
@@ -695,22 +757,22 @@ static void set_gpu_converted_data(struct video_frame *output,
 		const uint32_t height = info->height;
 		const uint32_t height_d2 = height / 2;
 		if (input->linesize[1]) {
-			set_gpu_converted_plane(width, height,
+			set_gpu_converted_plane(slices, width, height,
 						input->linesize[0],
 						output->linesize[0],
 						input->data[0],
 						output->data[0]);
-			set_gpu_converted_plane(width, height_d2,
+			set_gpu_converted_plane(slices, width, height_d2,
 						input->linesize[1],
 						output->linesize[1],
 						input->data[1],
 						output->data[1]);
 		} else {
 			const uint8_t *const in_uv = set_gpu_converted_plane(
-				width, height, input->linesize[0],
+				slices, width, height, input->linesize[0],
 				output->linesize[0], input->data[0],
 				output->data[0]);
-			set_gpu_converted_plane(width, height_d2,
+			set_gpu_converted_plane(slices, width, height_d2,
 						input->linesize[0],
 						output->linesize[1], in_uv,
 						output->data[1]);
@@ -722,17 +784,17 @@ static void set_gpu_converted_data(struct video_frame *output,
 		const uint32_t width = info->width;
 		const uint32_t height = info->height;
 
-		set_gpu_converted_plane(width, height, input->linesize[0],
-					output->linesize[0], input->data[0],
-					output->data[0]);
+		set_gpu_converted_plane(slices, width, height,
+					input->linesize[0], output->linesize[0],
+					input->data[0], output->data[0]);
 
-		set_gpu_converted_plane(width, height, input->linesize[1],
-					output->linesize[1], input->data[1],
-					output->data[1]);
+		set_gpu_converted_plane(slices, width, height,
+					input->linesize[1], output->linesize[1],
+					input->data[1], output->data[1]);
 
-		set_gpu_converted_plane(width, height, input->linesize[2],
-					output->linesize[2], input->data[2],
-					output->data[2]);
+		set_gpu_converted_plane(slices, width, height,
+					input->linesize[2], output->linesize[2],
+					input->data[2], output->data[2]);
 
 		break;
 	}
@@ -740,19 +802,19 @@ static void set_gpu_converted_data(struct video_frame *output,
 		const uint32_t width = info->width;
 		const uint32_t height = info->height;
 
-		set_gpu_converted_plane(width * 2, height, input->linesize[0],
-					output->linesize[0], input->data[0],
-					output->data[0]);
+		set_gpu_converted_plane(slices, width * 2, height,
+					input->linesize[0], output->linesize[0],
+					input->data[0], output->data[0]);
 
 		const uint32_t height_d2 = height / 2;
 
-		set_gpu_converted_plane(width, height_d2, input->linesize[1],
-					output->linesize[1], input->data[1],
-					output->data[1]);
+		set_gpu_converted_plane(slices, width, height_d2,
+					input->linesize[1], output->linesize[1],
+					input->data[1], output->data[1]);
 
-		set_gpu_converted_plane(width, height_d2, input->linesize[2],
-					output->linesize[2], input->data[2],
-					output->data[2]);
+		set_gpu_converted_plane(slices, width, height_d2,
+					input->linesize[2], output->linesize[2],
+					input->data[2], output->data[2]);
 
 		break;
 	}
@@ -761,22 +823,22 @@ static void set_gpu_converted_data(struct video_frame *output,
 		const uint32_t height = info->height;
 		const uint32_t height_d2 = height / 2;
 		if (input->linesize[1]) {
-			set_gpu_converted_plane(width_x2, height,
+			set_gpu_converted_plane(slices, width_x2, height,
 						input->linesize[0],
 						output->linesize[0],
 						input->data[0],
 						output->data[0]);
-			set_gpu_converted_plane(width_x2, height_d2,
+			set_gpu_converted_plane(slices, width_x2, height_d2,
 						input->linesize[1],
 						output->linesize[1],
 						input->data[1],
 						output->data[1]);
 		} else {
 			const uint8_t *const in_uv = set_gpu_converted_plane(
-				width_x2, height, input->linesize[0],
+				slices, width_x2, height, input->linesize[0],
 				output->linesize[0], input->data[0],
 				output->data[0]);
-			set_gpu_converted_plane(width_x2, height_d2,
+			set_gpu_converted_plane(slices, width_x2, height_d2,
 						input->linesize[0],
 						output->linesize[1], in_uv,
 						output->data[1]);
@@ -788,24 +850,24 @@ static void set_gpu_converted_data(struct video_frame *output,
 		const uint32_t width_x2 = info->width * 2;
 		const uint32_t height = info->height;
 
-		set_gpu_converted_plane(width_x2, height, input->linesize[0],
-					output->linesize[0], input->data[0],
-					output->data[0]);
+		set_gpu_converted_plane(slices, width_x2, height,
+					input->linesize[0], output->linesize[0],
+					input->data[0], output->data[0]);
 
-		set_gpu_converted_plane(width_x2, height, input->linesize[1],
-					output->linesize[1], input->data[1],
-					output->data[1]);
+		set_gpu_converted_plane(slices, width_x2, height,
+					input->linesize[1], output->linesize[1],
+					input->data[1], output->data[1]);
 
 		break;
 	}
 	case VIDEO_FORMAT_P416: {
 		const uint32_t height = info->height;
 
-		set_gpu_converted_plane(info->width * 2, height,
+		set_gpu_converted_plane(slices, info->width * 2, height,
 					input->linesize[0], output->linesize[0],
 					input->data[0], output->data[0]);
 
-		set_gpu_converted_plane(info->width * 4, height,
+		set_gpu_converted_plane(slices, info->width * 4, height,
 					input->linesize[1], output->linesize[1],
 					input->data[1], output->data[1]);
 
@@ -834,27 +896,24 @@ static void set_gpu_converted_data(struct video_frame *output,
 		/* unimplemented */
 		;
 	}
+
+	video_slices_run(slices);
 }
 
-static inline void copy_rgbx_frame(struct video_frame *output,
+static inline void copy_rgbx_frame(video_slices_t *slices,
+				   struct video_frame *output,
 				   const struct video_data *input,
 				   const struct video_output_info *info)
 {
-	uint8_t *in_ptr = input->data[0];
-	uint8_t *out_ptr = output->data[0];
-
-	/* if the line sizes match, do a single copy */
-	if (input->linesize[0] == output->linesize[0]) {
-		memcpy(out_ptr, in_ptr,
-		       (size_t)input->linesize[0] * (size_t)info->height);
-	} else {
-		const size_t copy_size = (size_t)info->width * 4;
-		for (size_t y = 0; y < info->height; y++) {
-			memcpy(out_ptr, in_ptr, copy_size);
-			in_ptr += input->linesize[0];
-			out_ptr += output->linesize[0];
-		}
-	}
+	/* if the line sizes match, the rows are copied as one block */
+	uint32_t copy_size = input->linesize[0] == output->linesize[0]
+				     ? input->linesize[0]
+				     : info->width * 4;
+
+	video_slices_add_copy(slices, output->data[0], output->linesize[0],
+			      input->data[0], input->linesize[0], copy_size,
+			      info->height);
+	video_slices_run(slices);
 }
 
 static inline void output_video_data(struct obs_core_video_mix *video,
@@ -870,10 +929,11 @@ static inline void output_video_data(struct obs_core_video_mix *video,
 					 input_frame->timestamp);
 	if (locked) {
 		if (video->gpu_conversion) {
-			set_gpu_converted_data(&output_frame, input_frame,
-					       info);
+			set_gpu_converted_data(obs->video.slices,
+					       &output_frame, input_frame, info);
 		} else {
-			copy_rgbx_frame(&output_frame, input_frame, info);
+			copy_rgbx_frame(obs->video.slices, &output_frame,
+					input_frame, info);
 		}
 
 		video_output_unlock_frame(video->video);
@@ -888,7 +948,7 @@ static inline void video_sleep(struct obs_core_video *video, uint64_t *p_time,
 	uint64_t t = cur_time + interval_ns;
 	int count;
 
-	if (os_sleepto_ns(t)) {
+	if (frame_pacing_sleepto(&video->pacing, t)) {
 		*p_time = t;
 		count = 1;
 	} else {
@@ -1214,6 +1274,14 @@ bool obs_graphics_thread_loop(struct obs_graphics_context *context)
 
 	frame_time_ns = os_gettime_ns() - frame_start;
 
+	/* video_time is still the time this frame was due */
+	frame_pacing_record(
+		&obs->video.pacing,
+		(int64_t)(frame_start - obs->video.video_time),
+		(int64_t)frame_time_ns,
+		(int64_t)(obs->video.video_time + context->interval -
+			  frame_start - frame_time_ns));
+
 	profile_end(context->video_thread_name);
 
 	profile_reenable_thread();
@@ -19,6 +19,7 @@
 
 #include "graphics/matrix4.h"
 #include "callback/calldata.h"
+#include "media-io/audio-mix.h"
 
 #include "obs.h"
 #include "obs-internal.h"
@@ -756,6 +757,8 @@ static int obs_init_video(struct obs_video_info *ovi)
 	if (!obs_view_add2(&obs->data.main_view, ovi))
 		return OBS_VIDEO_FAIL;
 
+	video->slices = video_slices_create(0);
+
 	int errorcode;
 #ifdef __APPLE__
 	pthread_attr_t attr;
@@ -893,6 +896,9 @@ static void obs_free_video(void)
 	pthread_mutex_destroy(&obs->video.task_mutex);
 	pthread_mutex_init_value(&obs->video.task_mutex);
 	circlebuf_free(&obs->video.tasks);
+
+	video_slices_destroy(obs->video.slices);
+	obs->video.slices = NULL;
 }
 
 static void obs_free_graphics(void)
@@ -975,6 +981,8 @@ static void obs_free_audio(void)
 	circlebuf_free(&audio->buffered_timestamps);
 	da_free(audio->render_order);
 	da_free(audio->root_nodes);
+	da_free(audio->render_edges);
+	os_work_batch_destroy(audio->render_batch);
 
 	da_free(audio->monitors);
 	bfree(audio->monitoring_device_name);
@@ -1097,6 +1105,7 @@ static void obs_free_data(void)
 		bfree(data->protocols.array[i]);
 	da_free(data->protocols);
 	da_free(data->sources_to_tick);
+	os_work_batch_destroy(data->tick_batch);
 }
 
 static const char *obs_signals[] = {
@@ -1243,6 +1252,7 @@ static bool obs_init(const char *locale, const char *module_config_path,
 	pthread_mutex_init_value(&obs->audio.task_mutex);
 	pthread_mutex_init_value(&obs->video.task_mutex);
 	pthread_mutex_init_value(&obs->video.mixes_mutex);
+	pthread_mutex_init_value(&obs->work_pool_mutex);
 
 	obs->name_store_owned = !store;
 	obs->name_store = store ? store : profiler_name_store_create();
@@ -1260,9 +1270,12 @@ static bool obs_init(const char *locale, const char *module_config_path,
 	if (!obs_init_hotkeys())
 		return false;
 
-	obs->destruction_task_thread = os_task_queue_create();
+	/* destroy callbacks and plugin tasks are allowed to block */
+	obs->destruction_task_thread = os_task_queue_create_dedicated();
 	if (!obs->destruction_task_thread)
 		return false;
+	if (pthread_mutex_init(&obs->work_pool_mutex, NULL) != 0)
+		return false;
 
 	if (module_config_path)
 		obs->module_config_path = bstrdup(module_config_path);
@@ -1438,6 +1451,9 @@ void obs_shutdown(void)
 	obs_free_audio();
 	obs_free_video();
 	os_task_queue_destroy(obs->destruction_task_thread);
+	if (obs->work_pool)
+		os_task_pool_release();
+	pthread_mutex_destroy(&obs->work_pool_mutex);
 	obs_free_hotkeys();
 	obs_free_graphics();
 	proc_handler_destroy(obs->procs);
@@ -1456,6 +1472,8 @@ void obs_shutdown(void)
 	if (obs->name_store_owned)
 		profiler_name_store_free(obs->name_store);
 
+	obs_encoder_packet_pool_free();
+
 	bfree(obs->module_config_path);
 	bfree(obs->locale);
 	bfree(obs);
@@ -1629,9 +1647,11 @@ bool obs_reset_audio2(const struct obs_audio_info2 *oai)
 	     "\tsamples per sec: %d\n"
 	     "\tspeakers:        %d\n"
 	     "\tmax buffering:   %d milliseconds\n"
-	     "\tbuffering type:  %s",
+	     "\tbuffering type:  %s\n"
+	     "\tmix kernels:     %s",
 	     (int)ai.samples_per_sec, (int)ai.speakers, max_buffering_ms,
-	     oai->fixed_buffering ? "fixed" : "dynamically increasing");
+	     oai->fixed_buffering ? "fixed" : "dynamically increasing",
+	     audio_mix_get_impl_name(audio_mix_get_impl()));
 
 	return obs_init_audio(&ai);
 }
@@ -3391,6 +3411,31 @@ bool obs_wait_for_destroy_queue(void)
 	return os_task_queue_wait(obs->destruction_task_thread);
 }
 
+void obs_set_parallel_sources(bool enable)
+{
+	if (!obs)
+		return;
+
+	pthread_mutex_lock(&obs->work_pool_mutex);
+
+	/* the pool is kept around until shutdown once acquired */
+	if (enable && !obs->work_pool) {
+		obs->work_pool = os_task_pool_acquire();
+		if (obs->work_pool)
+			blog(LOG_INFO, "Parallel sources: %zu worker threads",
+			     os_work_pool_get_thread_count(obs->work_pool));
+	}
+
+	os_atomic_set_bool(&obs->parallel_sources, enable && obs->work_pool);
+
+	pthread_mutex_unlock(&obs->work_pool_mutex);
+}
+
+bool obs_get_parallel_sources(void)
+{
+	return obs ? os_atomic_load_bool(&obs->parallel_sources) : false;
+}
+
 static void set_ui_thread(void *unused)
 {
 	is_ui_thread = true;
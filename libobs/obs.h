@@ -282,6 +282,17 @@ struct obs_source_frame {
 	bool prev_frame;
 };
 
+struct obs_source_async_stats {
+	uint64_t frames;    /* frames queued for display */
+	uint64_t copied;    /* frames copied from obs_source_output_video */
+	uint64_t borrowed;  /* frames filled in place and committed */
+	uint64_t reused;    /* frames that reused a cached buffer */
+	uint64_t allocated; /* frame buffers allocated */
+	uint64_t dropped;   /* queued frames dropped because of a backlog */
+	size_t cached;      /* frame buffers currently cached */
+	size_t queued;      /* frames currently queued for display */
+};
+
 struct obs_source_frame2 {
 	uint8_t *data[MAX_AV_PLANES];
 	uint32_t linesize[MAX_AV_PLANES];
@@ -440,6 +451,15 @@ EXPORT void obs_set_video_levels(float sdr_white_level,
 /** Gets the current audio settings, returns false if no audio */
 EXPORT bool obs_get_audio_info(struct obs_audio_info *oai);
 
+/**
+ * Enables ticking sources and rendering source audio on a pool of worker
+ * threads.  Children are always processed before their parents, but the
+ * video_tick and audio_render callbacks of unrelated sources run
+ * concurrently, so only enable this if all sources in use can handle that.
+ */
+EXPORT void obs_set_parallel_sources(bool enable);
+EXPORT bool obs_get_parallel_sources(void);
+
 /**
  * Opens a plugin module directly from a specific path.
  *
@@ -882,6 +902,53 @@ EXPORT uint64_t obs_get_frame_interval_ns(void);
 EXPORT uint32_t obs_get_total_frames(void);
 EXPORT uint32_t obs_get_lagged_frames(void);
 
+enum obs_frame_pacing_metric {
+	/** How late the graphics thread woke up for a frame */
+	OBS_FRAME_PACING_WAKE_ERROR,
+	/** Time from waking up to having rendered and output the frame */
+	OBS_FRAME_PACING_RENDER_TIME,
+	/** Time left until the next frame when done, negative if late */
+	OBS_FRAME_PACING_SLACK,
+};
+
+/** Percentiles of the last few hundred frames, all in nanoseconds */
+struct obs_frame_pacing_stats {
+	uint32_t samples;
+	int64_t min;
+	int64_t p1;
+	int64_t p50;
+	int64_t p90;
+	int64_t p99;
+	int64_t max;
+};
+
+EXPORT bool obs_get_frame_pacing_stats(enum obs_frame_pacing_metric metric,
+				       struct obs_frame_pacing_stats *stats);
+
+/**
+ * Counts the recent samples of a metric into num_buckets buckets of
+ * bucket_ns each, the first one starting at min_ns.  Values outside of the
+ * range are counted in the first or last bucket.  Returns the number of
+ * samples.
+ */
+EXPORT uint32_t obs_get_frame_pacing_histogram(
+	enum obs_frame_pacing_metric metric, int64_t min_ns, int64_t bucket_ns,
+	uint32_t *buckets, size_t num_buckets);
+
+enum obs_video_sleep_mode {
+	/** Sleep until the next frame is due */
+	OBS_VIDEO_SLEEP_DEFAULT,
+	/**
+	 * Sleep until shortly before the next frame is due and spin for the
+	 * rest.  The spin time adapts to how much the sleep overshoots.  Costs
+	 * some CPU time, but wakes up on time even on loaded systems.
+	 */
+	OBS_VIDEO_SLEEP_HYBRID,
+};
+
+EXPORT void obs_set_video_sleep_mode(enum obs_video_sleep_mode mode);
+EXPORT enum obs_video_sleep_mode obs_get_video_sleep_mode(void);
+
 EXPORT bool obs_nv12_tex_active(void);
 EXPORT bool obs_p010_tex_active(void);
 
@@ -1441,6 +1508,24 @@ EXPORT void obs_source_output_video(obs_source_t *source,
 EXPORT void obs_source_output_video2(obs_source_t *source,
 				     const struct obs_source_frame2 *frame);
 
+/**
+ * Borrows a writable frame from the source's frame cache, to output video
+ * without an extra copy.  Fill in the planes (using the linesizes of the
+ * frame) and the timestamp and color information, then queue it with
+ * obs_source_commit_video_frame, or hand it back with
+ * obs_source_release_frame if it won't be used.  The frame stays valid if the
+ * source's frame cache is flushed in the meantime.
+ */
+EXPORT struct obs_source_frame *
+obs_source_borrow_video_frame(obs_source_t *source, enum video_format format,
+			      uint32_t width, uint32_t height);
+EXPORT void obs_source_commit_video_frame(obs_source_t *source,
+					  struct obs_source_frame *frame);
+
+/** Gets async frame cache statistics */
+EXPORT void obs_source_get_async_stats(obs_source_t *source,
+				       struct obs_source_async_stats *stats);
+
 EXPORT void obs_source_set_async_rotation(obs_source_t *source, long rotation);
 
 EXPORT void obs_source_output_cea708(obs_source_t *source,
@@ -2562,6 +2647,28 @@ EXPORT void obs_encoder_packet_ref(struct encoder_packet *dst,
 				   struct encoder_packet *src);
 EXPORT void obs_encoder_packet_release(struct encoder_packet *packet);
 
+struct encoder_packet_pool_stats {
+	/** Packet buffers handed out in total */
+	uint64_t allocs;
+	/** Packet buffers that were served from the pool */
+	uint64_t reused;
+	/** Packet buffers returned to the pool */
+	uint64_t releases;
+	/** Packet buffers that had to be allocated from the heap */
+	uint64_t heap_allocs;
+	/** Packet buffers that were given back to the heap */
+	uint64_t heap_frees;
+	/** Bytes currently held by the pool for reuse */
+	uint64_t pooled_bytes;
+};
+
+/**
+ * Gets the counters of the allocator backing encoder packet data.  In steady
+ * state heap_allocs should stop growing while allocs and reused keep going.
+ */
+EXPORT void
+obs_encoder_packet_pool_get_stats(struct encoder_packet_pool_stats *stats);
+
 EXPORT void *obs_encoder_create_rerouted(obs_encoder_t *encoder,
 					 const char *reroute_id);
 
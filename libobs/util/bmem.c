@@ -14,8 +14,10 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include "base.h"
 #include "bmem.h"
 #include "platform.h"
@@ -96,6 +98,254 @@ static void a_free(void *ptr)
 #endif
 }
 
+/* ------------------------------------------------------------------------- */
+/* Allocation tags */
+
+static const char *tag_names[BMEM_TAG_COUNT] = {
+	"none", "source", "encoder", "output", "data", "graphics_staging",
+};
+
+static THREAD_LOCAL enum bmem_tag cur_tag = BMEM_TAG_NONE;
+
+#ifdef BMEM_TAGS
+
+/* each allocation starts with a header holding its size and tag, padded out
+ * to the alignment so the memory after it keeps its alignment */
+struct bmem_header {
+	size_t size;
+	enum bmem_tag tag;
+};
+
+#define HEADER_SIZE ALIGNMENT
+
+/* counted by each thread separately so that allocating never takes a lock.
+ * only the owning thread writes its counters.  they are never freed, so the
+ * counts of threads that have exited are kept. */
+struct thread_stats {
+	struct {
+		volatile uint64_t allocs;
+		volatile uint64_t frees;
+		volatile uint64_t alloc_bytes;
+		volatile uint64_t free_bytes;
+	} tags[BMEM_TAG_COUNT];
+	struct thread_stats *next;
+};
+
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct thread_stats *first_stats = NULL;
+static THREAD_LOCAL struct thread_stats *cur_stats = NULL;
+
+static struct thread_stats *get_thread_stats(void)
+{
+	struct thread_stats *stats = cur_stats;
+	if (stats)
+		return stats;
+
+	/* not bmalloc, which would count itself */
+	stats = calloc(1, sizeof(*stats));
+	if (!stats) {
+		os_breakpoint();
+		bcrash("Out of memory while trying to allocate %lu bytes",
+		       (unsigned long)sizeof(*stats));
+	}
+
+	pthread_mutex_lock(&stats_mutex);
+	stats->next = first_stats;
+	first_stats = stats;
+	pthread_mutex_unlock(&stats_mutex);
+
+	cur_stats = stats;
+	return stats;
+}
+
+static void *b_malloc(size_t size)
+{
+	struct bmem_header *header = a_malloc(size + HEADER_SIZE);
+	if (!header)
+		return NULL;
+
+	struct thread_stats *stats = get_thread_stats();
+	header->size = size;
+	header->tag = cur_tag;
+	stats->tags[cur_tag].allocs++;
+	stats->tags[cur_tag].alloc_bytes += size;
+
+	return (char *)header + HEADER_SIZE;
+}
+
+static void *b_realloc(void *ptr, size_t size)
+{
+	if (!ptr)
+		return b_malloc(size);
+
+	struct bmem_header *header =
+		(struct bmem_header *)((char *)ptr - HEADER_SIZE);
+	size_t old_size = header->size;
+
+	header = a_realloc(header, size + HEADER_SIZE);
+	if (!header)
+		return NULL;
+
+	struct thread_stats *stats = get_thread_stats();
+	header->size = size;
+	stats->tags[header->tag].alloc_bytes += size;
+	stats->tags[header->tag].free_bytes += old_size;
+
+	return (char *)header + HEADER_SIZE;
+}
+
+static void b_free(void *ptr)
+{
+	struct bmem_header *header =
+		(struct bmem_header *)((char *)ptr - HEADER_SIZE);
+
+	struct thread_stats *stats = get_thread_stats();
+	stats->tags[header->tag].frees++;
+	stats->tags[header->tag].free_bytes += header->size;
+
+	a_free(header);
+}
+
+bool bmem_tags_enabled(void)
+{
+	return true;
+}
+
+void bmem_snapshot(struct bmem_snapshot *snap)
+{
+	memset(snap, 0, sizeof(*snap));
+	snap->time = os_gettime_ns();
+
+	pthread_mutex_lock(&stats_mutex);
+	for (struct thread_stats *stats = first_stats; stats;
+	     stats = stats->next) {
+		for (size_t i = 0; i < BMEM_TAG_COUNT; i++) {
+			struct bmem_tag_stats *tag = &snap->tags[i];
+			tag->allocs += stats->tags[i].allocs;
+			tag->frees += stats->tags[i].frees;
+			tag->alloc_bytes += stats->tags[i].alloc_bytes;
+			tag->free_bytes += stats->tags[i].free_bytes;
+		}
+	}
+	pthread_mutex_unlock(&stats_mutex);
+}
+
+#else
+
+#define b_malloc a_malloc
+#define b_realloc a_realloc
+#define b_free a_free
+
+bool bmem_tags_enabled(void)
+{
+	return false;
+}
+
+void bmem_snapshot(struct bmem_snapshot *snap)
+{
+	memset(snap, 0, sizeof(*snap));
+	snap->time = os_gettime_ns();
+}
+
+#endif
+
+const char *bmem_tag_name(enum bmem_tag tag)
+{
+	return (unsigned)tag < BMEM_TAG_COUNT ? tag_names[tag] : NULL;
+}
+
+enum bmem_tag bmem_set_tag(enum bmem_tag tag)
+{
+	enum bmem_tag prev = cur_tag;
+	cur_tag = (unsigned)tag < BMEM_TAG_COUNT ? tag : BMEM_TAG_NONE;
+	return prev;
+}
+
+struct tag_summary {
+	int64_t live_bytes;
+	int64_t live_allocs;
+	int64_t bytes_change;
+	double allocs_per_sec;
+	double frees_per_sec;
+};
+
+static void get_tag_summary(struct tag_summary *sum,
+			    const struct bmem_snapshot *snap,
+			    const struct bmem_snapshot *since, size_t i)
+{
+	const struct bmem_tag_stats *tag = &snap->tags[i];
+
+	sum->live_bytes = (int64_t)(tag->alloc_bytes - tag->free_bytes);
+	sum->live_allocs = (int64_t)(tag->allocs - tag->frees);
+	sum->bytes_change = 0;
+	sum->allocs_per_sec = 0.0;
+	sum->frees_per_sec = 0.0;
+
+	if (!since)
+		return;
+
+	const struct bmem_tag_stats *prev = &since->tags[i];
+	double seconds = (double)(snap->time - since->time) / 1000000000.0;
+
+	sum->bytes_change = sum->live_bytes -
+			    (int64_t)(prev->alloc_bytes - prev->free_bytes);
+	if (seconds > 0.0) {
+		sum->allocs_per_sec = (tag->allocs - prev->allocs) / seconds;
+		sum->frees_per_sec = (tag->frees - prev->frees) / seconds;
+	}
+}
+
+void bmem_snapshot_print(const struct bmem_snapshot *snap,
+			 const struct bmem_snapshot *since)
+{
+	if (!bmem_tags_enabled())
+		return;
+
+	blog(LOG_INFO, "== Memory By Tag ================================");
+	for (size_t i = 0; i < BMEM_TAG_COUNT; i++) {
+		struct tag_summary sum;
+		get_tag_summary(&sum, snap, since, i);
+
+		blog(LOG_INFO,
+		     "%s: %" PRId64 " bytes in %" PRId64 " allocations, "
+		     "%+" PRId64 " bytes, %g allocs/s, %g frees/s",
+		     tag_names[i], sum.live_bytes, sum.live_allocs,
+		     sum.bytes_change, sum.allocs_per_sec, sum.frees_per_sec);
+	}
+	blog(LOG_INFO, "=================================================");
+}
+
+bool bmem_snapshot_dump_csv(const struct bmem_snapshot *snap,
+			    const struct bmem_snapshot *since,
+			    const char *filename)
+{
+	FILE *f = os_fopen(filename, "wb+");
+	if (!f)
+		return false;
+
+	fprintf(f, "tag,live_bytes,live_allocs,allocs,frees,alloc_bytes,"
+		   "free_bytes,bytes_change,allocs_per_sec,frees_per_sec\n");
+
+	for (size_t i = 0; i < BMEM_TAG_COUNT; i++) {
+		const struct bmem_tag_stats *tag = &snap->tags[i];
+		struct tag_summary sum;
+		get_tag_summary(&sum, snap, since, i);
+
+		fprintf(f,
+			"%s,%" PRId64 ",%" PRId64 ",%" PRIu64 ",%" PRIu64
+			",%" PRIu64 ",%" PRIu64 ",%" PRId64 ",%g,%g\n",
+			tag_names[i], sum.live_bytes, sum.live_allocs,
+			tag->allocs, tag->frees, tag->alloc_bytes,
+			tag->free_bytes, sum.bytes_change, sum.allocs_per_sec,
+			sum.frees_per_sec);
+	}
+
+	fclose(f);
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
 static long num_allocs = 0;
 
 void *bmalloc(size_t size)
@@ -108,7 +358,7 @@ void *bmalloc(size_t size)
 		size = 1;
 	}
 
-	void *ptr = a_malloc(size);
+	void *ptr = b_malloc(size);
 
 	if (!ptr) {
 		os_breakpoint();
@@ -133,7 +383,7 @@ void *brealloc(void *ptr, size_t size)
 		size = 1;
 	}
 
-	ptr = a_realloc(ptr, size);
+	ptr = b_realloc(ptr, size);
 
 	if (!ptr) {
 		os_breakpoint();
@@ -148,7 +398,7 @@ void bfree(void *ptr)
 {
 	if (ptr) {
 		os_atomic_dec_long(&num_allocs);
-		a_free(ptr);
+		b_free(ptr);
 	}
 }
 
@@ -43,6 +43,53 @@ EXPORT long bnum_allocs(void);
 
 EXPORT void *bmemdup(const void *ptr, size_t size);
 
+/* ------------------------------------------------------------------------- */
+/* Allocation tags
+ *
+ *   When libobs is built with ENABLE_BMEM_TAGS, every allocation is counted
+ * under the tag its thread had set when it was made, and frees and reallocs
+ * are counted under that same tag.  Otherwise tags are ignored and snapshots
+ * only hold zeroes. */
+
+enum bmem_tag {
+	BMEM_TAG_NONE,
+	BMEM_TAG_SOURCE,
+	BMEM_TAG_ENCODER,
+	BMEM_TAG_OUTPUT,
+	BMEM_TAG_DATA,
+	BMEM_TAG_GRAPHICS_STAGING,
+	BMEM_TAG_COUNT,
+};
+
+struct bmem_tag_stats {
+	uint64_t allocs;
+	uint64_t frees;
+	uint64_t alloc_bytes;
+	uint64_t free_bytes;
+};
+
+struct bmem_snapshot {
+	uint64_t time;
+	struct bmem_tag_stats tags[BMEM_TAG_COUNT];
+};
+
+EXPORT bool bmem_tags_enabled(void);
+EXPORT const char *bmem_tag_name(enum bmem_tag tag);
+
+/* sets the tag of the calling thread's allocations, and returns the previous
+ * tag so that it can be restored afterwards */
+EXPORT enum bmem_tag bmem_set_tag(enum bmem_tag tag);
+
+EXPORT void bmem_snapshot(struct bmem_snapshot *snap);
+
+/* prints or dumps the live bytes of each tag, along with the change and the
+ * rate of allocs and frees since an earlier snapshot if one is given */
+EXPORT void bmem_snapshot_print(const struct bmem_snapshot *snap,
+				const struct bmem_snapshot *since);
+EXPORT bool bmem_snapshot_dump_csv(const struct bmem_snapshot *snap,
+				   const struct bmem_snapshot *since,
+				   const char *filename);
+
 static inline void *bzalloc(size_t size)
 {
 	void *mem = bmalloc(size);
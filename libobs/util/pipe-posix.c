@@ -14,7 +14,14 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#ifndef __APPLE__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <sys/wait.h>
 
 #include "bmem.h"
@@ -23,6 +30,9 @@
 struct os_process_pipe {
 	bool read_pipe;
 	FILE *file;
+
+	/* set when the process wasn't started by popen */
+	pid_t pid;
 };
 
 os_process_pipe_t *os_process_pipe_create(const char *cmd_line,
@@ -47,12 +57,94 @@ os_process_pipe_t *os_process_pipe_create(const char *cmd_line,
 	return out;
 }
 
+static int pipe_cloexec(int fds[2])
+{
+#ifdef __APPLE__
+	if (pipe(fds) != 0)
+		return -1;
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	return 0;
+#else
+	return pipe2(fds, O_CLOEXEC);
+#endif
+}
+
+os_process_pipe_t *os_process_pipe_create_inherit(const char *cmd_line,
+						  const char *type,
+						  const int *fds,
+						  size_t num_fds)
+{
+	struct os_process_pipe pipe = {0};
+	struct os_process_pipe *out;
+	int ends[2];
+
+	if (!cmd_line || !type) {
+		return NULL;
+	}
+
+	pipe.read_pipe = *type == 'r';
+	if (pipe_cloexec(ends) != 0) {
+		return NULL;
+	}
+
+	/* the process gets one end as its stdout or stdin */
+	int child_std = pipe.read_pipe ? STDOUT_FILENO : STDIN_FILENO;
+	int child_end = pipe.read_pipe ? ends[1] : ends[0];
+	int parent_end = pipe.read_pipe ? ends[0] : ends[1];
+
+	pipe.pid = fork();
+	if (pipe.pid == 0) {
+		/* only async-signal-safe calls until exec */
+		if (child_end == child_std)
+			fcntl(child_std, F_SETFD, 0);
+		else if (dup2(child_end, child_std) == -1)
+			_exit(127);
+
+		for (size_t i = 0; i < num_fds; i++)
+			fcntl(fds[i], F_SETFD, 0);
+
+		execl("/bin/sh", "sh", "-c", cmd_line, (char *)NULL);
+		_exit(127);
+	}
+
+	close(child_end);
+	if (pipe.pid == -1) {
+		close(parent_end);
+		return NULL;
+	}
+
+	pipe.file = fdopen(parent_end, pipe.read_pipe ? "r" : "w");
+	if (!pipe.file) {
+		close(parent_end);
+		waitpid(pipe.pid, NULL, 0);
+		return NULL;
+	}
+
+	out = bmalloc(sizeof(pipe));
+	*out = pipe;
+	return out;
+}
+
+static int wait_process(os_process_pipe_t *pp)
+{
+	int status = 0;
+
+	if (!pp->pid)
+		return pclose(pp->file);
+
+	fclose(pp->file);
+	while (waitpid(pp->pid, &status, 0) == -1 && errno == EINTR)
+		;
+	return status;
+}
+
 int os_process_pipe_destroy(os_process_pipe_t *pp)
 {
 	int ret = 0;
 
 	if (pp) {
-		int status = pclose(pp->file);
+		int status = wait_process(pp);
 		if (WIFEXITED(status))
 			ret = (int)(char)WEXITSTATUS(status);
 		bfree(pp);
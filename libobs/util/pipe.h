@@ -29,6 +29,15 @@ EXPORT os_process_pipe_t *os_process_pipe_create(const char *cmd_line,
 						 const char *type);
 EXPORT int os_process_pipe_destroy(os_process_pipe_t *pp);
 
+#ifndef _WIN32
+/* like os_process_pipe_create, and the process also inherits the given file
+ * descriptors, which can stay close-on-exec for everything else */
+EXPORT os_process_pipe_t *os_process_pipe_create_inherit(const char *cmd_line,
+							 const char *type,
+							 const int *fds,
+							 size_t num_fds);
+#endif
+
 EXPORT size_t os_process_pipe_read(os_process_pipe_t *pp, uint8_t *data,
 				   size_t len);
 EXPORT size_t os_process_pipe_read_err(os_process_pipe_t *pp, uint8_t *data,
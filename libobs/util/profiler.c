@@ -10,8 +10,6 @@
 
 #include <zlib.h>
 
-//#define TRACK_OVERHEAD
-
 struct profiler_snapshot {
 	DARRAY(profiler_snapshot_entry_t) roots;
 };
@@ -32,22 +30,6 @@ struct profiler_snapshot_entry {
 
 typedef struct profiler_time_entry profiler_time_entry;
 
-typedef struct profile_call profile_call;
-struct profile_call {
-	const char *name;
-#ifdef TRACK_OVERHEAD
-	uint64_t overhead_start;
-#endif
-	uint64_t start_time;
-	uint64_t end_time;
-#ifdef TRACK_OVERHEAD
-	uint64_t overhead_end;
-#endif
-	uint64_t expected_time_between_calls;
-	DARRAY(profile_call) children;
-	profile_call *parent;
-};
-
 typedef struct profile_times_table_entry profile_times_table_entry;
 struct profile_times_table_entry {
 	size_t probes;
@@ -70,9 +52,6 @@ typedef struct profile_entry profile_entry;
 struct profile_entry {
 	const char *name;
 	profile_times_table times;
-#ifdef TRACK_OVERHEAD
-	profile_times_table overhead;
-#endif
 	uint64_t expected_time_between_calls;
 	profile_times_table times_between_calls;
 	DARRAY(profile_entry) children;
@@ -80,10 +59,50 @@ struct profile_entry {
 
 typedef struct profile_root_entry profile_root_entry;
 struct profile_root_entry {
-	pthread_mutex_t *mutex;
+	const char *name;
+	uint64_t expected_time_between_calls;
+};
+
+/* Each thread keeps its own call stack and its own copy of the tree of
+ * times, so that profiling a call neither allocates nor takes a shared
+ * lock.  Times are first written to a small buffer of records and only
+ * added to the tree, under the thread's own mutex, once a root call ends.
+ * Snapshots merge the trees of all threads.  When a thread exits its tree
+ * is merged into the tree of retired threads and freed. */
+
+#define PROFILE_MAX_DEPTH 64
+#define PROFILE_MAX_RECORDS 1024
+
+typedef struct profile_frame profile_frame;
+struct profile_frame {
 	const char *name;
 	profile_entry *entry;
-	profile_call *prev_call;
+	uint64_t start_time;
+};
+
+typedef struct profile_record profile_record;
+struct profile_record {
+	profile_times_table *map;
+	uint64_t usec;
+};
+
+typedef struct profile_thread_root profile_thread_root;
+struct profile_thread_root {
+	profile_entry entry;
+	uint64_t prev_start_time;
+};
+
+typedef struct profile_thread profile_thread;
+struct profile_thread {
+	pthread_mutex_t mutex;
+	DARRAY(profile_thread_root *) roots;
+	profile_thread_root *root;
+
+	profile_frame stack[PROFILE_MAX_DEPTH];
+	size_t depth;
+
+	profile_record records[PROFILE_MAX_RECORDS];
+	size_t num_records;
 };
 
 static inline uint64_t diff_ns_to_usec(uint64_t prev, uint64_t next)
@@ -208,9 +227,6 @@ static profile_entry *init_entry(profile_entry *entry, const char *name)
 {
 	entry->name = name;
 	init_hashmap(&entry->times, 1);
-#ifdef TRACK_OVERHEAD
-	init_hashmap(&entry->overhead, 1);
-#endif
 	entry->expected_time_between_calls = 0;
 	init_hashmap(&entry->times_between_calls, 1);
 	return entry;
@@ -228,52 +244,206 @@ static profile_entry *get_child(profile_entry *parent, const char *name)
 	return init_entry(da_push_back_new(parent->children), name);
 }
 
-static void merge_call(profile_entry *entry, profile_call *call,
-		       profile_call *prev_call)
+static void merge_times(profile_times_table *map, profile_times_table *from)
 {
-	const size_t num = call->children.num;
-	for (size_t i = 0; i < num; i++) {
-		profile_call *child = &call->children.array[i];
-		merge_call(get_child(entry, child->name), child, NULL);
+	migrate_old_entries(from, false);
+
+	for (size_t i = 0; i < from->size; i++) {
+		profiler_time_entry *entry = &from->entries[i].entry;
+		if (!from->entries[i].probes)
+			continue;
+
+		migrate_old_entries(map, true);
+		add_hashmap_entry(map, entry->time_delta, entry->count);
 	}
+}
 
-	if (entry->expected_time_between_calls != 0 && prev_call) {
-		migrate_old_entries(&entry->times_between_calls, true);
-		uint64_t usec = diff_ns_to_usec(prev_call->start_time,
-						call->start_time);
-		add_hashmap_entry(&entry->times_between_calls, usec, 1);
+static void merge_entry(profile_entry *entry, profile_entry *from)
+{
+	const size_t num = from->children.num;
+	for (size_t i = 0; i < num; i++) {
+		profile_entry *child = &from->children.array[i];
+		merge_entry(get_child(entry, child->name), child);
 	}
 
-	migrate_old_entries(&entry->times, true);
-	uint64_t usec = diff_ns_to_usec(call->start_time, call->end_time);
-	add_hashmap_entry(&entry->times, usec, 1);
+	if (entry->expected_time_between_calls != 0)
+		merge_times(&entry->times_between_calls,
+			    &from->times_between_calls);
 
-#ifdef TRACK_OVERHEAD
-	migrate_old_entries(&entry->overhead, true);
-	usec = diff_ns_to_usec(call->overhead_start, call->start_time);
-	usec += diff_ns_to_usec(call->end_time, call->overhead_end);
-	add_hashmap_entry(&entry->overhead, usec, 1);
-#endif
+	merge_times(&entry->times, &from->times);
 }
 
-static bool enabled = false;
+static volatile bool enabled = false;
 static pthread_mutex_t root_mutex = PTHREAD_MUTEX_INITIALIZER;
 static DARRAY(profile_root_entry) root_entries;
+static DARRAY(profile_thread *) profile_threads;
+static profile_thread *retired_profile = NULL;
+static volatile long profile_threads_epoch = 0;
 
-static THREAD_LOCAL profile_call *thread_context = NULL;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_profile_key;
+static pthread_key_t thread_ring_key;
+
+static THREAD_LOCAL profile_thread *thread_profile = NULL;
+static THREAD_LOCAL long thread_profile_epoch = 0;
 static THREAD_LOCAL bool thread_enabled = true;
 
+/* ------------------------------------------------------------------------- */
+/* Timeline tracing
+ *
+ *   While tracing, profile_start and profile_end also record a begin or end
+ * event into a ring owned by the calling thread, so that single slow frames
+ * can be looked at call by call rather than as averages.  Only the owning
+ * thread writes to its ring, and it publishes each event by advancing the
+ * head, so recording never takes a lock.  A dump copies each ring and drops
+ * whatever the owner may have overwritten in the meantime.
+ *
+ *   The ring of a thread that exits is kept so its events can still be
+ * dumped, and is taken over by a new thread once a later trace is started. */
+
+#define TRACE_RING_SIZE (64 * 1024)
+
+struct trace_event {
+	const char *name;
+	uint64_t time;
+	bool begin;
+};
+
+struct trace_ring {
+	struct trace_event events[TRACE_RING_SIZE];
+	volatile long head;
+	volatile long generation;
+	long tid;
+	int depth;
+	const char *thread_name;
+	bool exited;
+	struct trace_ring *next;
+};
+
+static volatile bool trace_enabled = false;
+static volatile long trace_generation = 0;
+static uint64_t trace_start_time = 0;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_ring *trace_rings = NULL;
+static long trace_num_threads = 0;
+static volatile long trace_rings_epoch = 0;
+
+static THREAD_LOCAL struct trace_ring *thread_ring = NULL;
+static THREAD_LOCAL long thread_ring_epoch = 0;
+
+static void thread_key_init(void);
+
+static struct trace_ring *create_trace_ring(void)
+{
+	struct trace_ring *ring = NULL;
+
+	pthread_once(&thread_key_once, thread_key_init);
+
+	pthread_mutex_lock(&trace_mutex);
+	long generation = os_atomic_load_long(&trace_generation);
+	for (struct trace_ring *r = trace_rings; r; r = r->next) {
+		if (r->exited && r->generation != generation) {
+			ring = r;
+			break;
+		}
+	}
+
+	if (ring) {
+		ring->head = 0;
+		ring->depth = 0;
+		ring->thread_name = NULL;
+		ring->exited = false;
+	} else {
+		ring = bzalloc(sizeof(struct trace_ring));
+		ring->next = trace_rings;
+		trace_rings = ring;
+	}
+
+	ring->tid = ++trace_num_threads;
+	ring->generation = -1;
+	thread_ring_epoch = trace_rings_epoch;
+	pthread_mutex_unlock(&trace_mutex);
+
+	pthread_setspecific(thread_ring_key, ring);
+	return ring;
+}
+
+static void thread_ring_destroy(void *data)
+{
+	struct trace_ring *ring = data;
+
+	/* rings are all freed by profiler_free when the epoch changes */
+	pthread_mutex_lock(&trace_mutex);
+	if (thread_ring_epoch == trace_rings_epoch)
+		ring->exited = true;
+	pthread_mutex_unlock(&trace_mutex);
+
+	thread_ring = NULL;
+}
+
+static void trace_record(const char *name, bool begin, uint64_t time)
+{
+	long generation = os_atomic_load_long(&trace_generation);
+	struct trace_ring *ring = thread_ring;
+
+	if (!ring ||
+	    thread_ring_epoch != os_atomic_load_long(&trace_rings_epoch))
+		ring = thread_ring = create_trace_ring();
+
+	/* a new trace was started, so start over */
+	if (ring->generation != generation) {
+		os_atomic_store_long(&ring->head, 0);
+		ring->depth = 0;
+		os_atomic_store_long(&ring->generation, generation);
+	}
+
+	if (begin) {
+		/* threads are named after the first root they profile */
+		if (!ring->thread_name && !ring->depth) {
+			pthread_mutex_lock(&trace_mutex);
+			ring->thread_name = name;
+			pthread_mutex_unlock(&trace_mutex);
+		}
+		ring->depth++;
+	} else if (ring->depth) {
+		ring->depth--;
+	}
+
+	long head = ring->head;
+	struct trace_event *event =
+		&ring->events[(unsigned long)head & (TRACE_RING_SIZE - 1)];
+	event->name = name;
+	event->time = time;
+	event->begin = begin;
+
+	os_atomic_store_long(&ring->head, (long)((unsigned long)head + 1));
+}
+
+static void free_trace_rings(void)
+{
+	pthread_mutex_lock(&trace_mutex);
+	os_atomic_set_bool(&trace_enabled, false);
+	os_atomic_inc_long(&trace_rings_epoch);
+
+	while (trace_rings) {
+		struct trace_ring *ring = trace_rings;
+		trace_rings = ring->next;
+		bfree(ring);
+	}
+	pthread_mutex_unlock(&trace_mutex);
+}
+
 void profiler_start(void)
 {
 	pthread_mutex_lock(&root_mutex);
-	enabled = true;
+	os_atomic_set_bool(&enabled, true);
 	pthread_mutex_unlock(&root_mutex);
 }
 
 void profiler_stop(void)
 {
 	pthread_mutex_lock(&root_mutex);
-	enabled = false;
+	os_atomic_set_bool(&enabled, false);
 	pthread_mutex_unlock(&root_mutex);
 }
 
@@ -283,14 +453,14 @@ void profile_reenable_thread(void)
 		return;
 
 	pthread_mutex_lock(&root_mutex);
-	thread_enabled = enabled;
+	thread_enabled = os_atomic_load_bool(&enabled);
 	pthread_mutex_unlock(&root_mutex);
 }
 
 static bool lock_root(void)
 {
 	pthread_mutex_lock(&root_mutex);
-	if (!enabled) {
+	if (!os_atomic_load_bool(&enabled)) {
 		pthread_mutex_unlock(&root_mutex);
 		thread_enabled = false;
 		return false;
@@ -301,25 +471,13 @@ static bool lock_root(void)
 
 static profile_root_entry *get_root_entry(const char *name)
 {
-	profile_root_entry *r_entry = NULL;
-
 	for (size_t i = 0; i < root_entries.num; i++) {
-		if (root_entries.array[i].name == name) {
-			r_entry = &root_entries.array[i];
-			break;
-		}
-	}
-
-	if (!r_entry) {
-		r_entry = da_push_back_new(root_entries);
-		r_entry->mutex = bmalloc(sizeof(pthread_mutex_t));
-		pthread_mutex_init(r_entry->mutex, NULL);
-
-		r_entry->name = name;
-		r_entry->entry = bzalloc(sizeof(profile_entry));
-		init_entry(r_entry->entry, name);
+		if (root_entries.array[i].name == name)
+			return &root_entries.array[i];
 	}
 
+	profile_root_entry *r_entry = da_push_back_new(root_entries);
+	r_entry->name = name;
 	return r_entry;
 }
 
@@ -329,114 +487,277 @@ void profile_register_root(const char *name,
 	if (!lock_root())
 		return;
 
-	get_root_entry(name)->entry->expected_time_between_calls =
+	get_root_entry(name)->expected_time_between_calls =
 		(expected_time_between_calls + 500) / 1000;
 	pthread_mutex_unlock(&root_mutex);
 }
 
-static void free_call_context(profile_call *context);
+/* profiler_free starts a new epoch, after which threads start over with
+ * new state rather than use the state that was freed */
+static profile_thread *get_thread_profile(void)
+{
+	long epoch = os_atomic_load_long(&profile_threads_epoch);
+	if (thread_profile && thread_profile_epoch == epoch)
+		return thread_profile;
+
+	if (!lock_root())
+		return NULL;
+
+	pthread_once(&thread_key_once, thread_key_init);
+
+	profile_thread *thread = bzalloc(sizeof(profile_thread));
+	pthread_mutex_init(&thread->mutex, NULL);
+	da_push_back(profile_threads, &thread);
+
+	thread_profile = thread;
+	thread_profile_epoch = profile_threads_epoch;
+	pthread_mutex_unlock(&root_mutex);
+
+	pthread_setspecific(thread_profile_key, thread);
+	return thread;
+}
+
+static void free_thread_profile(profile_thread *thread);
 
-static void merge_context(profile_call *context)
+/* call with root_mutex held, which also keeps snapshots out */
+static void retire_thread_profile(profile_thread *thread)
 {
-	pthread_mutex_t *mutex = NULL;
-	profile_entry *entry = NULL;
-	profile_call *prev_call = NULL;
+	profile_thread *retired = retired_profile;
+	if (!retired) {
+		retired = retired_profile = bzalloc(sizeof(profile_thread));
+		pthread_mutex_init(&retired->mutex, NULL);
+		da_push_back(profile_threads, &retired);
+	}
 
-	if (!lock_root()) {
-		free_call_context(context);
-		return;
+	/* times of scopes inside a root that never ended */
+	for (size_t i = 0; i < thread->num_records; i++) {
+		profile_record *record = &thread->records[i];
+		migrate_old_entries(record->map, true);
+		add_hashmap_entry(record->map, record->usec, 1);
 	}
 
-	profile_root_entry *r_entry = get_root_entry(context->name);
+	for (size_t i = 0; i < thread->roots.num; i++) {
+		profile_entry *from = &thread->roots.array[i]->entry;
+		profile_thread_root *root = NULL;
 
-	mutex = r_entry->mutex;
-	entry = r_entry->entry;
-	prev_call = r_entry->prev_call;
+		for (size_t j = 0; j < retired->roots.num; j++) {
+			if (retired->roots.array[j]->entry.name == from->name) {
+				root = retired->roots.array[j];
+				break;
+			}
+		}
+
+		if (!root) {
+			root = bzalloc(sizeof(profile_thread_root));
+			init_entry(&root->entry, from->name);
+			da_push_back(retired->roots, &root);
+		}
+
+		/* merge_entry leaves out the time between calls of roots
+		 * without an expected time */
+		merge_entry(&root->entry, from);
+		merge_times(&root->entry.times_between_calls,
+			    &from->times_between_calls);
+	}
+
+	da_erase_item(profile_threads, &thread);
+	free_thread_profile(thread);
+}
 
-	r_entry->prev_call = context;
+static void thread_profile_destroy(void *data)
+{
+	profile_thread *thread = data;
 
-	pthread_mutex_lock(mutex);
+	/* already freed by profiler_free if the epoch changed */
+	pthread_mutex_lock(&root_mutex);
+	if (thread_profile_epoch == profile_threads_epoch)
+		retire_thread_profile(thread);
 	pthread_mutex_unlock(&root_mutex);
 
-	merge_call(entry, context, prev_call);
+	thread_profile = NULL;
+}
+
+static void thread_key_init(void)
+{
+	pthread_key_create(&thread_profile_key, thread_profile_destroy);
+	pthread_key_create(&thread_ring_key, thread_ring_destroy);
+}
 
-	pthread_mutex_unlock(mutex);
+static bool flush_records(profile_thread *thread)
+{
+	if (!os_atomic_load_bool(&enabled)) {
+		thread->num_records = 0;
+		thread->depth = 0;
+		thread_enabled = false;
+		return false;
+	}
+
+	pthread_mutex_lock(&thread->mutex);
+	for (size_t i = 0; i < thread->num_records; i++) {
+		profile_record *record = &thread->records[i];
+		migrate_old_entries(record->map, true);
+		add_hashmap_entry(record->map, record->usec, 1);
+	}
+	pthread_mutex_unlock(&thread->mutex);
+
+	thread->num_records = 0;
+	return true;
+}
+
+static void add_record(profile_thread *thread, profile_times_table *map,
+		       uint64_t usec)
+{
+	if (thread->num_records == PROFILE_MAX_RECORDS &&
+	    !flush_records(thread))
+		return;
 
-	free_call_context(prev_call);
+	profile_record *record = &thread->records[thread->num_records++];
+	record->map = map;
+	record->usec = usec;
+}
+
+static profile_entry *get_thread_root(profile_thread *thread,
+				      const char *name)
+{
+	for (size_t i = 0; i < thread->roots.num; i++) {
+		profile_thread_root *root = thread->roots.array[i];
+		if (root->entry.name == name)
+			return &(thread->root = root)->entry;
+	}
+
+	/* also lists the root, so snapshots keep roots in the order they
+	 * were first seen */
+	if (!lock_root())
+		return NULL;
+	get_root_entry(name);
+	pthread_mutex_unlock(&root_mutex);
+
+	profile_thread_root *root = bzalloc(sizeof(profile_thread_root));
+	init_entry(&root->entry, name);
+
+	pthread_mutex_lock(&thread->mutex);
+	da_push_back(thread->roots, &root);
+	pthread_mutex_unlock(&thread->mutex);
+
+	thread->root = root;
+	return &root->entry;
+}
+
+static profile_entry *get_thread_child(profile_thread *thread,
+				       profile_entry *parent, const char *name)
+{
+	const size_t num = parent->children.num;
+	for (size_t i = 0; i < num; i++) {
+		profile_entry *child = &parent->children.array[i];
+		if (child->name == name)
+			return child;
+	}
+
+	/* adding a child can move its siblings, which records may point to */
+	if (!flush_records(thread))
+		return NULL;
+
+	pthread_mutex_lock(&thread->mutex);
+	profile_entry *child = get_child(parent, name);
+	pthread_mutex_unlock(&thread->mutex);
+
+	return child;
 }
 
 void profile_start(const char *name)
 {
+	if (os_atomic_load_bool(&trace_enabled))
+		trace_record(name, true, os_gettime_ns());
+
 	if (!thread_enabled)
 		return;
 
-	profile_call new_call = {
-		.name = name,
-#ifdef TRACK_OVERHEAD
-		.overhead_start = os_gettime_ns(),
-#endif
-		.parent = thread_context,
-	};
+	profile_thread *thread = get_thread_profile();
+	if (!thread)
+		return;
 
-	profile_call *call = NULL;
+	/* calls nested deeper than this are not timed */
+	if (thread->depth >= PROFILE_MAX_DEPTH) {
+		thread->depth++;
+		return;
+	}
 
-	if (new_call.parent) {
-		size_t idx = da_push_back(new_call.parent->children, &new_call);
-		call = &new_call.parent->children.array[idx];
+	profile_entry *entry = NULL;
+	if (thread->depth) {
+		profile_entry *parent = thread->stack[thread->depth - 1].entry;
+		entry = get_thread_child(thread, parent, name);
 	} else {
-		call = bmalloc(sizeof(profile_call));
-		memcpy(call, &new_call, sizeof(profile_call));
+		entry = get_thread_root(thread, name);
 	}
+	if (!entry)
+		return;
 
-	thread_context = call;
-	call->start_time = os_gettime_ns();
+	profile_frame *frame = &thread->stack[thread->depth++];
+	frame->name = name;
+	frame->entry = entry;
+	frame->start_time = os_gettime_ns();
 }
 
 void profile_end(const char *name)
 {
 	uint64_t end = os_gettime_ns();
+	if (os_atomic_load_bool(&trace_enabled))
+		trace_record(name, false, end);
+
 	if (!thread_enabled)
 		return;
 
-	profile_call *call = thread_context;
-	if (!call) {
+	profile_thread *thread = get_thread_profile();
+	if (!thread)
+		return;
+
+	if (!thread->depth) {
 		blog(LOG_ERROR, "Called profile end with no active profile");
 		return;
 	}
 
-	if (!call->name)
-		call->name = name;
+	if (thread->depth > PROFILE_MAX_DEPTH) {
+		thread->depth--;
+		return;
+	}
 
-	if (call->name != name) {
+	profile_frame *frame = &thread->stack[thread->depth - 1];
+	if (frame->name != name) {
 		blog(LOG_ERROR,
 		     "Called profile end with mismatching name: "
 		     "start(\"%s\"[%p]) <-> end(\"%s\"[%p])",
-		     call->name, call->name, name, name);
+		     frame->name, frame->name, name, name);
 
-		profile_call *parent = call->parent;
-		while (parent && parent->parent && parent->name != name)
-			parent = parent->parent;
+		size_t idx = thread->depth - 1;
+		while (idx && thread->stack[idx].name != name)
+			idx--;
 
-		if (!parent || parent->name != name)
+		if (thread->stack[idx].name != name)
 			return;
 
-		while (call->name != name) {
-			profile_end(call->name);
-			call = call->parent;
-		}
-	}
+		while (thread->depth && thread->depth - 1 > idx)
+			profile_end(thread->stack[thread->depth - 1].name);
+		if (!thread_enabled || !thread->depth)
+			return;
 
-	thread_context = call->parent;
+		frame = &thread->stack[idx];
+	}
 
-	call->end_time = end;
-#ifdef TRACK_OVERHEAD
-	call->overhead_end = os_gettime_ns();
-#endif
+	thread->depth--;
+	add_record(thread, &frame->entry->times,
+		   diff_ns_to_usec(frame->start_time, end));
 
-	if (call->parent)
+	if (thread->depth)
 		return;
 
-	merge_context(call);
+	profile_thread_root *root = thread->root;
+	if (root->prev_start_time)
+		add_record(thread, &root->entry.times_between_calls,
+			   diff_ns_to_usec(root->prev_start_time,
+					   frame->start_time));
+	root->prev_start_time = frame->start_time;
+
+	flush_records(thread);
 }
 
 static int profiler_time_entry_compare(const void *first, const void *second)
@@ -759,24 +1080,6 @@ void profiler_print_time_between_calls(profiler_snapshot_t *snap)
 			   profile_print_entry_expected, snap);
 }
 
-static void free_call_children(profile_call *call)
-{
-	if (!call)
-		return;
-
-	const size_t num = call->children.num;
-	for (size_t i = 0; i < num; i++)
-		free_call_children(&call->children.array[i]);
-
-	da_free(call->children);
-}
-
-static void free_call_context(profile_call *context)
-{
-	free_call_children(context);
-	bfree(context);
-}
-
 static void free_hashmap(profile_times_table *map)
 {
 	map->size = 0;
@@ -792,41 +1095,45 @@ static void free_profile_entry(profile_entry *entry)
 		free_profile_entry(&entry->children.array[i]);
 
 	free_hashmap(&entry->times);
-#ifdef TRACK_OVERHEAD
-	free_hashmap(&entry->overhead);
-#endif
 	free_hashmap(&entry->times_between_calls);
 	da_free(entry->children);
 }
 
-void profiler_free(void)
+static void free_thread_profile(profile_thread *thread)
 {
-	DARRAY(profile_root_entry) old_root_entries = {0};
-
-	pthread_mutex_lock(&root_mutex);
-	enabled = false;
-	da_move(old_root_entries, root_entries);
-	pthread_mutex_unlock(&root_mutex);
+	pthread_mutex_lock(&thread->mutex);
+	pthread_mutex_unlock(&thread->mutex);
+	pthread_mutex_destroy(&thread->mutex);
 
-	for (size_t i = 0; i < old_root_entries.num; i++) {
-		profile_root_entry *entry = &old_root_entries.array[i];
+	for (size_t i = 0; i < thread->roots.num; i++) {
+		free_profile_entry(&thread->roots.array[i]->entry);
+		bfree(thread->roots.array[i]);
+	}
 
-		pthread_mutex_lock(entry->mutex);
-		pthread_mutex_unlock(entry->mutex);
+	da_free(thread->roots);
+	bfree(thread);
+}
 
-		pthread_mutex_destroy(entry->mutex);
-		bfree(entry->mutex);
-		entry->mutex = NULL;
+void profiler_free(void)
+{
+	DARRAY(profile_thread *) old_threads = {0};
 
-		free_call_context(entry->prev_call);
+	pthread_mutex_lock(&root_mutex);
+	os_atomic_set_bool(&enabled, false);
+	os_atomic_inc_long(&profile_threads_epoch);
+	da_move(old_threads, profile_threads);
+	retired_profile = NULL;
+	da_free(root_entries);
+	pthread_mutex_unlock(&root_mutex);
 
-		free_profile_entry(entry->entry);
-		bfree(entry->entry);
-	}
+	for (size_t i = 0; i < old_threads.num; i++)
+		free_thread_profile(old_threads.array[i]);
 
-	da_free(old_root_entries);
+	da_free(old_threads);
 
 	pthread_mutex_destroy(&root_mutex);
+
+	free_trace_rings();
 }
 
 /* ------------------------------------------------------------------------- */
@@ -931,16 +1238,45 @@ profiler_snapshot_t *profile_snapshot_create(void)
 {
 	profiler_snapshot_t *snap = bzalloc(sizeof(profiler_snapshot_t));
 
+	DARRAY(profile_entry) roots = {0};
+
+	/* the times of each root are merged from every thread that profiled
+	 * it, while holding each thread's mutex in turn */
 	pthread_mutex_lock(&root_mutex);
-	da_reserve(snap->roots, root_entries.num);
+	da_reserve(roots, root_entries.num);
 	for (size_t i = 0; i < root_entries.num; i++) {
-		pthread_mutex_lock(root_entries.array[i].mutex);
-		add_entry_to_snapshot(root_entries.array[i].entry,
-				      da_push_back_new(snap->roots));
-		pthread_mutex_unlock(root_entries.array[i].mutex);
+		profile_entry *root = init_entry(da_push_back_new(roots),
+						 root_entries.array[i].name);
+		root->expected_time_between_calls =
+			root_entries.array[i].expected_time_between_calls;
+	}
+
+	for (size_t i = 0; i < profile_threads.num; i++) {
+		profile_thread *thread = profile_threads.array[i];
+
+		pthread_mutex_lock(&thread->mutex);
+		for (size_t j = 0; j < thread->roots.num; j++) {
+			profile_entry *entry = &thread->roots.array[j]->entry;
+
+			for (size_t k = 0; k < roots.num; k++) {
+				if (roots.array[k].name == entry->name) {
+					merge_entry(&roots.array[k], entry);
+					break;
+				}
+			}
+		}
+		pthread_mutex_unlock(&thread->mutex);
 	}
 	pthread_mutex_unlock(&root_mutex);
 
+	da_reserve(snap->roots, roots.num);
+	for (size_t i = 0; i < roots.num; i++) {
+		add_entry_to_snapshot(&roots.array[i],
+				      da_push_back_new(snap->roots));
+		free_profile_entry(&roots.array[i]);
+	}
+	da_free(roots);
+
 	for (size_t i = 0; i < snap->roots.num; i++)
 		sort_snapshot_entry(&snap->roots.array[i]);
 
@@ -1071,6 +1407,175 @@ bool profiler_snapshot_dump_csv_gz(const profiler_snapshot_t *snap,
 	return true;
 }
 
+/* ------------------------------------------------------------------------- */
+/* Timeline trace control and dumping */
+
+void profiler_trace_start(void)
+{
+	pthread_mutex_lock(&trace_mutex);
+	trace_start_time = os_gettime_ns();
+	os_atomic_inc_long(&trace_generation);
+	os_atomic_set_bool(&trace_enabled, true);
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+void profiler_trace_stop(void)
+{
+	os_atomic_set_bool(&trace_enabled, false);
+}
+
+bool profiler_trace_active(void)
+{
+	return os_atomic_load_bool(&trace_enabled);
+}
+
+static void trace_cat_name(struct dstr *buffer, const char *name)
+{
+	for (const char *ch = name; *ch; ch++) {
+		if (*ch == '"' || *ch == '\\')
+			dstr_catf(buffer, "\\%c", *ch);
+		else if ((unsigned char)*ch < 0x20)
+			dstr_catf(buffer, "\\u%04x", (unsigned char)*ch);
+		else
+			dstr_cat_ch(buffer, *ch);
+	}
+}
+
+/* copies the events the ring still holds, oldest first, leaving out any the
+ * owning thread may have overwritten while they were being copied */
+static size_t copy_trace_ring(struct trace_ring *ring,
+			      struct trace_event *events)
+{
+	unsigned long head = (unsigned long)os_atomic_load_long(&ring->head);
+	unsigned long count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+	unsigned long start = head - count;
+
+	for (unsigned long i = start; i != head; i++)
+		events[i - start] = ring->events[i & (TRACE_RING_SIZE - 1)];
+
+	unsigned long new_head =
+		(unsigned long)os_atomic_load_long(&ring->head);
+	unsigned long overwritten = new_head - start;
+	if (overwritten > TRACE_RING_SIZE - 1) {
+		overwritten -= TRACE_RING_SIZE - 1;
+		if (overwritten > count)
+			overwritten = count;
+		memmove(events, events + overwritten,
+			(count - overwritten) * sizeof(*events));
+		count -= overwritten;
+	}
+
+	return count;
+}
+
+static void trace_dump_ring(struct trace_ring *ring,
+			    struct trace_event *events, dump_csv_func func,
+			    void *data, struct dstr *buffer, bool *first)
+{
+	size_t count = copy_trace_ring(ring, events);
+	int depth = 0;
+
+	dstr_printf(buffer,
+		    "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+		    "\"tid\":%ld,\"args\":{\"name\":\"",
+		    *first ? "" : ",\n", ring->tid);
+	if (ring->thread_name)
+		trace_cat_name(buffer, ring->thread_name);
+	else
+		dstr_catf(buffer, "thread %ld", ring->tid);
+	dstr_cat(buffer, "\"}}");
+	func(data, buffer);
+	*first = false;
+
+	for (size_t i = 0; i < count; i++) {
+		const struct trace_event *event = &events[i];
+		double ts = (double)(int64_t)(event->time - trace_start_time) /
+			    1000.0;
+
+		/* the begin events of these were overwritten */
+		if (!event->begin && !depth)
+			continue;
+		depth += event->begin ? 1 : -1;
+
+		dstr_copy(buffer, ",\n{\"name\":\"");
+		trace_cat_name(buffer, event->name);
+		dstr_catf(buffer,
+			  "\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,"
+			  "\"tid\":%ld}",
+			  event->begin ? 'B' : 'E', ts, ring->tid);
+		func(data, buffer);
+	}
+}
+
+static void profiler_trace_dump(dump_csv_func func, void *data)
+{
+	struct trace_event *events =
+		bmalloc(sizeof(struct trace_event) * TRACE_RING_SIZE);
+	struct dstr buffer = {0};
+	bool first = true;
+
+	dstr_init_copy(&buffer,
+		       "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	func(data, &buffer);
+
+	pthread_mutex_lock(&trace_mutex);
+
+	long generation = os_atomic_load_long(&trace_generation);
+	for (struct trace_ring *ring = trace_rings; ring; ring = ring->next) {
+		if (os_atomic_load_long(&ring->generation) == generation)
+			trace_dump_ring(ring, events, func, data, &buffer,
+					&first);
+	}
+
+	pthread_mutex_unlock(&trace_mutex);
+
+	dstr_copy(&buffer, "\n]}\n");
+	func(data, &buffer);
+
+	dstr_free(&buffer);
+	bfree(events);
+}
+
+bool profiler_trace_dump_json(const char *filename)
+{
+	FILE *f = os_fopen(filename, "wb+");
+	if (!f)
+		return false;
+
+	profiler_trace_dump(dump_csv_fwrite, f);
+
+	fclose(f);
+	return true;
+}
+
+bool profiler_trace_dump_json_gz(const char *filename)
+{
+	gzFile gz;
+#ifdef _WIN32
+	wchar_t *filename_w = NULL;
+
+	os_utf8_to_wcs_ptr(filename, 0, &filename_w);
+	if (!filename_w)
+		return false;
+
+	gz = gzopen_w(filename_w, "wb");
+	bfree(filename_w);
+#else
+	gz = gzopen(filename, "wb");
+#endif
+	if (!gz)
+		return false;
+
+	profiler_trace_dump(dump_csv_gzwrite, gz);
+
+#ifdef _WIN32
+	gzclose_w(gz);
+#else
+	gzclose(gz);
+#endif
+	return true;
+}
+
 size_t profiler_snapshot_num_roots(profiler_snapshot_t *snap)
 {
 	return snap ? snap->roots.num : 0;
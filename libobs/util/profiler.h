@@ -33,6 +33,21 @@ EXPORT void profiler_print_time_between_calls(profiler_snapshot_t *snap);
 
 EXPORT void profiler_free(void);
 
+/* ------------------------------------------------------------------------- */
+/* Timeline tracing
+ *
+ *   Records every profile_start/profile_end as it happens, on top of the
+ * aggregated times, and dumps them in the Chrome trace event format, which
+ * chrome://tracing and the Perfetto UI both open.  Each thread keeps its
+ * most recent 64K events.  Starting a trace discards the previous one. */
+
+EXPORT void profiler_trace_start(void);
+EXPORT void profiler_trace_stop(void);
+EXPORT bool profiler_trace_active(void);
+
+EXPORT bool profiler_trace_dump_json(const char *filename);
+EXPORT bool profiler_trace_dump_json_gz(const char *filename);
+
 /* ------------------------------------------------------------------------- */
 /* Profiler name storage */
 
@@ -2,15 +2,24 @@
 #include "bmem.h"
 #include "threading.h"
 #include "circlebuf.h"
+#include "platform.h"
+
+/*
+ * A queue with pending tasks has exactly one job in its pool.  That job runs
+ * the next task and queues itself again if there's more to do, which keeps
+ * the tasks of a queue in order and lets other queues of the same priority
+ * take turns in between.  Queues share one pool unless they were created
+ * with a dedicated thread, which is then a pool of their own.
+ */
 
 struct os_task_queue {
-	pthread_t thread;
-	os_sem_t *sem;
-	long id;
+	os_work_pool_t *pool;
+	enum os_work_priority priority;
+	bool scheduled;
+	bool dedicated;
 
-	bool waiting;
-	bool tasks_processed;
-	os_event_t *wait_event;
+	uint64_t tasks_run;
+	volatile bool stopped;
 
 	pthread_mutex_t mutex;
 	struct circlebuf tasks;
@@ -21,33 +30,82 @@ struct os_task_info {
 	void *param;
 };
 
-static THREAD_LOCAL bool exit_thread = false;
-static THREAD_LOCAL long thread_id = 0;
-static volatile long thread_id_counter = 1;
+/* each wait has its own flag, tasks of other queues may be waiting on the
+ * same queue from the same pool thread */
+struct os_task_wait {
+	os_work_pool_t *pool;
+	volatile bool done;
+	uint64_t tasks_queued;
+	uint64_t tasks_done;
+};
 
-static void *tiny_tubular_task_thread(void *param);
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static os_work_pool_t *shared_pool = NULL;
+static long pool_refs = 0;
 
-os_task_queue_t *os_task_queue_create()
+static THREAD_LOCAL struct os_task_queue *cur_queue = NULL;
+
+static void run_queue(void *param);
+
+static os_work_pool_t *pool_acquire(void)
+{
+	os_work_pool_t *pool;
+
+	pthread_mutex_lock(&pool_mutex);
+	if (!shared_pool) {
+		int cores = os_get_logical_cores();
+		shared_pool = os_work_pool_create(cores > 2 ? (size_t)cores
+							    : 2);
+	}
+	if (shared_pool)
+		pool_refs++;
+	pool = shared_pool;
+	pthread_mutex_unlock(&pool_mutex);
+
+	return pool;
+}
+
+/* a pool thread can't join itself, if the last queue goes away from inside
+ * a task the pool is kept for the next queue instead */
+static void pool_release(void)
+{
+	os_work_pool_t *pool = NULL;
+
+	pthread_mutex_lock(&pool_mutex);
+	if (--pool_refs == 0 && !cur_queue) {
+		pool = shared_pool;
+		shared_pool = NULL;
+	}
+	pthread_mutex_unlock(&pool_mutex);
+
+	os_work_pool_destroy(pool);
+}
+
+os_work_pool_t *os_task_pool_acquire(void)
+{
+	return pool_acquire();
+}
+
+void os_task_pool_release(void)
+{
+	pool_release();
+}
+
+static os_task_queue_t *task_queue_create(bool dedicated)
 {
 	struct os_task_queue *tq = bzalloc(sizeof(*tq));
-	tq->id = os_atomic_inc_long(&thread_id_counter);
+	tq->priority = OS_WORK_PRIORITY_NORMAL;
+	tq->dedicated = dedicated;
 
 	if (pthread_mutex_init(&tq->mutex, NULL) != 0)
 		goto fail1;
-	if (os_sem_init(&tq->sem, 0) != 0)
+
+	tq->pool = dedicated ? os_work_pool_create(1) : pool_acquire();
+	if (!tq->pool)
 		goto fail2;
-	if (os_event_init(&tq->wait_event, OS_EVENT_TYPE_AUTO) != 0)
-		goto fail3;
-	if (pthread_create(&tq->thread, NULL, tiny_tubular_task_thread, tq) !=
-	    0)
-		goto fail4;
 
 	return tq;
 
-fail4:
-	os_event_destroy(tq->wait_event);
-fail3:
-	os_sem_destroy(tq->sem);
 fail2:
 	pthread_mutex_destroy(&tq->mutex);
 fail1:
@@ -55,6 +113,36 @@ fail1:
 	return NULL;
 }
 
+os_task_queue_t *os_task_queue_create()
+{
+	return task_queue_create(false);
+}
+
+os_task_queue_t *os_task_queue_create_dedicated(void)
+{
+	return task_queue_create(true);
+}
+
+/* wait, if not NULL, gets the number of tasks taken off the queue so far */
+static void push_task(struct os_task_queue *tq, const struct os_task_info *ti,
+		      struct os_task_wait *wait)
+{
+	enum os_work_priority priority;
+	bool schedule;
+
+	pthread_mutex_lock(&tq->mutex);
+	if (wait)
+		wait->tasks_queued = tq->tasks_run;
+	circlebuf_push_back(&tq->tasks, ti, sizeof(*ti));
+	schedule = !tq->scheduled;
+	tq->scheduled = true;
+	priority = tq->priority;
+	pthread_mutex_unlock(&tq->mutex);
+
+	if (schedule)
+		os_work_pool_queue(tq->pool, priority, run_queue, tq);
+}
+
 bool os_task_queue_queue_task(os_task_queue_t *tq, os_task_t task, void *param)
 {
 	struct os_task_info ti = {
@@ -65,23 +153,34 @@ bool os_task_queue_queue_task(os_task_queue_t *tq, os_task_t task, void *param)
 	if (!tq)
 		return false;
 
-	pthread_mutex_lock(&tq->mutex);
-	circlebuf_push_back(&tq->tasks, &ti, sizeof(ti));
-	pthread_mutex_unlock(&tq->mutex);
-	os_sem_post(tq->sem);
+	push_task(tq, &ti, NULL);
 	return true;
 }
 
-static void wait_for_thread(void *data)
+static void wait_for_queue(void *data)
+{
+	struct os_task_wait *wait = data;
+	os_work_pool_t *pool = wait->pool;
+
+	os_atomic_set_bool(&wait->done, true);
+	os_work_pool_notify(pool);
+}
+
+static void stop_queue(void *data)
 {
 	os_task_queue_t *tq = data;
-	os_event_signal(tq->wait_event);
+	os_work_pool_t *pool = tq->pool;
+
+	os_atomic_set_bool(&tq->stopped, true);
+	os_work_pool_notify(pool);
 }
 
-static void stop_thread(void *unused)
+/* a task that waits on another queue of the same pool could be holding up
+ * the pool thread that queue needs, so it runs queued jobs in the meantime */
+static void wait_on_queue(struct os_task_queue *tq, volatile bool *done)
 {
-	exit_thread = true;
-	UNUSED_PARAMETER(unused);
+	bool help = cur_queue && cur_queue->pool == tq->pool;
+	os_work_pool_wait(tq->pool, done, help);
 }
 
 void os_task_queue_destroy(os_task_queue_t *tq)
@@ -89,10 +188,14 @@ void os_task_queue_destroy(os_task_queue_t *tq)
 	if (!tq)
 		return;
 
-	os_task_queue_queue_task(tq, stop_thread, NULL);
-	pthread_join(tq->thread, NULL);
-	os_event_destroy(tq->wait_event);
-	os_sem_destroy(tq->sem);
+	os_task_queue_queue_task(tq, stop_queue, tq);
+	wait_on_queue(tq, &tq->stopped);
+
+	if (tq->dedicated)
+		os_work_pool_destroy(tq->pool);
+	else
+		pool_release();
+
 	pthread_mutex_destroy(&tq->mutex);
 	circlebuf_free(&tq->tasks);
 	bfree(tq);
@@ -103,63 +206,74 @@ bool os_task_queue_wait(os_task_queue_t *tq)
 	if (!tq)
 		return false;
 
+	struct os_task_wait wait = {tq->pool};
 	struct os_task_info ti = {
-		wait_for_thread,
-		tq,
+		wait_for_queue,
+		&wait,
 	};
 
-	pthread_mutex_lock(&tq->mutex);
-	tq->waiting = true;
-	tq->tasks_processed = false;
-	circlebuf_push_back(&tq->tasks, &ti, sizeof(ti));
-	pthread_mutex_unlock(&tq->mutex);
+	push_task(tq, &ti, &wait);
+	wait_on_queue(tq, &wait.done);
 
-	os_sem_post(tq->sem);
-	os_event_wait(tq->wait_event);
-
-	pthread_mutex_lock(&tq->mutex);
-	bool tasks_processed = tq->tasks_processed;
-	pthread_mutex_unlock(&tq->mutex);
-
-	return tasks_processed;
+	return wait.tasks_done != wait.tasks_queued;
 }
 
 bool os_task_queue_inside(os_task_queue_t *tq)
 {
-	return tq->id == thread_id;
+	return tq && cur_queue == tq;
 }
 
-static void *tiny_tubular_task_thread(void *param)
+void os_task_queue_set_priority(os_task_queue_t *tq,
+				enum os_work_priority priority)
 {
-	struct os_task_queue *tq = param;
-	thread_id = tq->id;
+	if (!tq)
+		return;
 
-	os_set_thread_name(__FUNCTION__);
+	pthread_mutex_lock(&tq->mutex);
+	tq->priority = priority;
+	pthread_mutex_unlock(&tq->mutex);
+}
 
-	while (!exit_thread && os_sem_wait(tq->sem) == 0) {
-		struct os_task_info ti;
+static void run_queue(void *param)
+{
+	struct os_task_queue *tq = param;
+	struct os_task_queue *prev_queue = cur_queue;
+	enum os_work_priority priority;
+	struct os_task_info ti;
+	bool more;
 
-		pthread_mutex_lock(&tq->mutex);
+	pthread_mutex_lock(&tq->mutex);
+	circlebuf_pop_front(&tq->tasks, &ti, sizeof(ti));
+	if (tq->tasks.size && ti.task == wait_for_queue) {
+		circlebuf_push_back(&tq->tasks, &ti, sizeof(ti));
+		circlebuf_pop_front(&tq->tasks, &ti, sizeof(ti));
+	}
+	if (tq->tasks.size && ti.task == stop_queue) {
+		circlebuf_push_back(&tq->tasks, &ti, sizeof(ti));
 		circlebuf_pop_front(&tq->tasks, &ti, sizeof(ti));
-		if (tq->tasks.size && ti.task == wait_for_thread) {
-			circlebuf_push_back(&tq->tasks, &ti, sizeof(ti));
-			circlebuf_pop_front(&tq->tasks, &ti, sizeof(ti));
-		}
-		if (tq->tasks.size && ti.task == stop_thread) {
-			circlebuf_push_back(&tq->tasks, &ti, sizeof(ti));
-			circlebuf_pop_front(&tq->tasks, &ti, sizeof(ti));
-		}
-		if (tq->waiting) {
-			if (ti.task == wait_for_thread) {
-				tq->waiting = false;
-			} else {
-				tq->tasks_processed = true;
-			}
-		}
-		pthread_mutex_unlock(&tq->mutex);
-
-		ti.task(ti.param);
 	}
+	if (ti.task == wait_for_queue) {
+		struct os_task_wait *wait = ti.param;
+		wait->tasks_done = tq->tasks_run;
+	} else if (ti.task != stop_queue) {
+		tq->tasks_run++;
+	}
+	pthread_mutex_unlock(&tq->mutex);
 
-	return NULL;
+	cur_queue = tq;
+	ti.task(ti.param);
+	cur_queue = prev_queue;
+
+	/* the queue is freed as soon as the stop task has signalled */
+	if (ti.task == stop_queue)
+		return;
+
+	pthread_mutex_lock(&tq->mutex);
+	more = tq->tasks.size != 0;
+	tq->scheduled = more;
+	priority = tq->priority;
+	pthread_mutex_unlock(&tq->mutex);
+
+	if (more)
+		os_work_pool_queue(tq->pool, priority, run_queue, tq);
 }
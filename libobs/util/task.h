@@ -1,23 +1,47 @@
 #pragma once
 
 #include "c99defs.h"
+#include "work-pool.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*
+ * Serial task queues.
+ *
+ *   The tasks of a queue run one after another in the order they were
+ * queued, tasks of different queues can run in parallel.  By default queues
+ * don't have a thread of their own, they all share one thread pool sized to
+ * the number of logical cores, which also runs audio mixing and other work
+ * batches.  A task that blocks holds up one of those threads for as long as
+ * it does, so queues whose tasks block (waiting on other threads, the
+ * graphics context, file or network I/O) should be created with
+ * os_task_queue_create_dedicated, which gives them a thread of their own.
+ */
+
 struct os_task_queue;
 typedef struct os_task_queue os_task_queue_t;
 
 typedef void (*os_task_t)(void *param);
 
 EXPORT os_task_queue_t *os_task_queue_create();
+EXPORT os_task_queue_t *os_task_queue_create_dedicated(void);
 EXPORT bool os_task_queue_queue_task(os_task_queue_t *tt, os_task_t task,
 				     void *param);
 EXPORT void os_task_queue_destroy(os_task_queue_t *tt);
 EXPORT bool os_task_queue_wait(os_task_queue_t *tt);
 EXPORT bool os_task_queue_inside(os_task_queue_t *tt);
 
+/* the pool the queues run on, for running work batches on the same threads.
+ * Each acquire has to be paired with a release. */
+EXPORT os_work_pool_t *os_task_pool_acquire(void);
+EXPORT void os_task_pool_release(void);
+
+/* defaults to OS_WORK_PRIORITY_NORMAL */
+EXPORT void os_task_queue_set_priority(os_task_queue_t *tt,
+				       enum os_work_priority priority);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,525 @@
+#include "work-pool.h"
+#include "bmem.h"
+#include "darray.h"
+#include "platform.h"
+#include "profiler.h"
+#include "threading.h"
+
+struct work_job {
+	os_work_t work;
+	void *param;
+	size_t num_deps;
+	size_t first_dependent;
+	volatile long pending;
+};
+
+/* links a job to one job that runs after it */
+struct work_edge {
+	size_t job;
+	size_t next;
+};
+
+struct os_work_batch {
+	const char *profile_name;
+	DARRAY(struct work_job) jobs;
+	DARRAY(struct work_edge) edges;
+
+	volatile long remaining;
+	os_event_t *done;
+};
+
+/* batch is NULL for jobs queued on their own */
+struct work_item {
+	struct os_work_batch *batch;
+	size_t job;
+	os_work_t work;
+	void *param;
+};
+
+#define NUM_PRIORITIES (OS_WORK_PRIORITY_HIGH + 1)
+
+struct work_deque {
+	pthread_mutex_t mutex;
+	DARRAY(struct work_item) items;
+};
+
+struct work_worker {
+	struct os_work_pool *pool;
+	struct work_deque deque;
+	pthread_t thread;
+	size_t idx;
+	bool thread_created;
+};
+
+struct os_work_pool {
+	struct work_worker *workers;
+	size_t num_workers;
+
+	/* jobs queued from outside the pool and single jobs, per priority */
+	struct work_deque inject[NUM_PRIORITIES];
+
+	os_sem_t *sem;
+	volatile long idle;
+	volatile bool stop;
+
+	/* threads blocked in os_work_pool_wait */
+	pthread_mutex_t wait_mutex;
+	pthread_cond_t wait_cond;
+	volatile long waiters;
+};
+
+#define NO_EDGE ((size_t)-1)
+
+static THREAD_LOCAL struct work_worker *cur_worker = NULL;
+
+/* ------------------------------------------------------------------------- */
+
+static inline void deque_push(struct work_deque *deque,
+			      const struct work_item *item)
+{
+	pthread_mutex_lock(&deque->mutex);
+	da_push_back(deque->items, item);
+	pthread_mutex_unlock(&deque->mutex);
+}
+
+/* the owner takes the newest item, everyone else the oldest */
+static bool deque_take(struct work_deque *deque, bool newest,
+		       const struct os_work_batch *batch,
+		       struct work_item *item)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&deque->mutex);
+
+	if (batch) {
+		for (size_t i = deque->items.num; i > 0; i--) {
+			if (deque->items.array[i - 1].batch == batch) {
+				*item = deque->items.array[i - 1];
+				da_erase(deque->items, i - 1);
+				found = true;
+				break;
+			}
+		}
+	} else if (deque->items.num) {
+		size_t idx = newest ? deque->items.num - 1 : 0;
+		*item = deque->items.array[idx];
+		da_erase(deque->items, idx);
+		found = true;
+	}
+
+	pthread_mutex_unlock(&deque->mutex);
+	return found;
+}
+
+static inline bool deque_empty(struct work_deque *deque)
+{
+	pthread_mutex_lock(&deque->mutex);
+	bool empty = deque->items.num == 0;
+	pthread_mutex_unlock(&deque->mutex);
+	return empty;
+}
+
+static inline void deque_free(struct work_deque *deque)
+{
+	da_free(deque->items);
+	pthread_mutex_destroy(&deque->mutex);
+}
+
+static void wake_waiters(struct os_work_pool *pool)
+{
+	if (os_atomic_load_long(&pool->waiters) > 0) {
+		pthread_mutex_lock(&pool->wait_mutex);
+		pthread_cond_broadcast(&pool->wait_cond);
+		pthread_mutex_unlock(&pool->wait_mutex);
+	}
+}
+
+static void wake_worker(struct os_work_pool *pool)
+{
+	if (os_atomic_load_long(&pool->idle) > 0)
+		os_sem_post(pool->sem);
+	wake_waiters(pool);
+}
+
+static void push_item(struct os_work_pool *pool, const struct work_item *item)
+{
+	struct work_worker *worker = cur_worker;
+
+	if (worker && worker->pool == pool)
+		deque_push(&worker->deque, item);
+	else
+		deque_push(&pool->inject[OS_WORK_PRIORITY_HIGH], item);
+
+	wake_worker(pool);
+}
+
+/* batch limits the search to the jobs of one batch (for helping callers).
+ * Batch jobs are looked for first, then the normal and low priority single
+ * jobs. */
+static bool take_item(struct os_work_pool *pool, struct work_worker *self,
+		      const struct os_work_batch *batch, struct work_item *item)
+{
+	size_t start = self ? self->idx + 1 : 0;
+
+	if (self && deque_take(&self->deque, true, NULL, item))
+		return true;
+	if (deque_take(&pool->inject[OS_WORK_PRIORITY_HIGH], false, batch,
+		       item))
+		return true;
+
+	for (size_t i = 0; i < pool->num_workers; i++) {
+		struct work_worker *victim =
+			&pool->workers[(start + i) % pool->num_workers];
+		if (victim == self)
+			continue;
+		if (deque_take(&victim->deque, false, batch, item))
+			return true;
+	}
+
+	if (batch)
+		return false;
+
+	for (size_t i = OS_WORK_PRIORITY_HIGH; i > 0; i--) {
+		if (deque_take(&pool->inject[i - 1], false, NULL, item))
+			return true;
+	}
+
+	return false;
+}
+
+static bool has_items(struct os_work_pool *pool)
+{
+	for (size_t i = 0; i < NUM_PRIORITIES; i++) {
+		if (!deque_empty(&pool->inject[i]))
+			return true;
+	}
+
+	for (size_t i = 0; i < pool->num_workers; i++) {
+		if (!deque_empty(&pool->workers[i].deque))
+			return true;
+	}
+
+	return false;
+}
+
+/* returns true if this was the last job of the batch.  Only workers signal
+ * the batch, the thread running the batch knows when it finished it. */
+static bool run_item(struct os_work_pool *pool, const struct work_item *item,
+		     bool signal)
+{
+	struct os_work_batch *batch = item->batch;
+	struct work_job *job;
+	size_t edge;
+
+	if (!batch) {
+		item->work(item->param);
+		return false;
+	}
+
+	job = &batch->jobs.array[item->job];
+	edge = job->first_dependent;
+
+	job->work(job->param);
+
+	while (edge != NO_EDGE) {
+		struct work_edge *e = &batch->edges.array[edge];
+		struct work_job *next = &batch->jobs.array[e->job];
+
+		if (os_atomic_dec_long(&next->pending) == 0) {
+			struct work_item ready = {batch, e->job, NULL, NULL};
+			push_item(pool, &ready);
+		}
+
+		edge = e->next;
+	}
+
+	if (os_atomic_dec_long(&batch->remaining) != 0)
+		return false;
+
+	if (signal)
+		os_event_signal(batch->done);
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void *work_pool_thread(void *param)
+{
+	struct work_worker *worker = param;
+	struct os_work_pool *pool = worker->pool;
+	const char *profile_name = NULL;
+
+	cur_worker = worker;
+	os_set_thread_name("work-pool: worker thread");
+
+	while (!os_atomic_load_bool(&pool->stop)) {
+		struct work_item item;
+
+		if (take_item(pool, worker, NULL, &item)) {
+			const char *name = item.batch
+						   ? item.batch->profile_name
+						   : NULL;
+
+			if (name != profile_name) {
+				if (profile_name)
+					profile_end(profile_name);
+				if (name)
+					profile_start(name);
+				profile_name = name;
+			}
+
+			run_item(pool, &item, true);
+			continue;
+		}
+
+		if (profile_name) {
+			profile_end(profile_name);
+			profile_name = NULL;
+		}
+
+		/* check again after announcing ourselves as idle so a push
+		 * that happened in between isn't missed */
+		os_atomic_inc_long(&pool->idle);
+		if (!has_items(pool) && !os_atomic_load_bool(&pool->stop))
+			os_sem_wait(pool->sem);
+		os_atomic_dec_long(&pool->idle);
+	}
+
+	if (profile_name)
+		profile_end(profile_name);
+
+	cur_worker = NULL;
+	return NULL;
+}
+
+os_work_pool_t *os_work_pool_create(size_t threads)
+{
+	struct os_work_pool *pool = bzalloc(sizeof(*pool));
+
+	if (!threads) {
+		int cores = os_get_logical_cores();
+		threads = cores > 1 ? (size_t)cores - 1 : 1;
+	}
+
+	if (os_sem_init(&pool->sem, 0) != 0) {
+		bfree(pool);
+		return NULL;
+	}
+	if (pthread_cond_init(&pool->wait_cond, NULL) != 0) {
+		os_sem_destroy(pool->sem);
+		bfree(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->wait_mutex, NULL);
+
+	for (size_t i = 0; i < NUM_PRIORITIES; i++)
+		pthread_mutex_init(&pool->inject[i].mutex, NULL);
+
+	pool->workers = bzalloc(sizeof(struct work_worker) * threads);
+	pool->num_workers = threads;
+
+	for (size_t i = 0; i < threads; i++) {
+		struct work_worker *worker = &pool->workers[i];
+		worker->pool = pool;
+		worker->idx = i;
+		pthread_mutex_init(&worker->deque.mutex, NULL);
+	}
+
+	for (size_t i = 0; i < threads; i++) {
+		struct work_worker *worker = &pool->workers[i];
+
+		if (pthread_create(&worker->thread, NULL, work_pool_thread,
+				   worker) != 0) {
+			os_work_pool_destroy(pool);
+			return NULL;
+		}
+
+		worker->thread_created = true;
+	}
+
+	return pool;
+}
+
+void os_work_pool_destroy(os_work_pool_t *pool)
+{
+	if (!pool)
+		return;
+
+	os_atomic_set_bool(&pool->stop, true);
+
+	for (size_t i = 0; i < pool->num_workers; i++)
+		os_sem_post(pool->sem);
+
+	for (size_t i = 0; i < pool->num_workers; i++) {
+		if (pool->workers[i].thread_created)
+			pthread_join(pool->workers[i].thread, NULL);
+	}
+
+	for (size_t i = 0; i < pool->num_workers; i++)
+		deque_free(&pool->workers[i].deque);
+
+	for (size_t i = 0; i < NUM_PRIORITIES; i++)
+		deque_free(&pool->inject[i]);
+	pthread_cond_destroy(&pool->wait_cond);
+	pthread_mutex_destroy(&pool->wait_mutex);
+	os_sem_destroy(pool->sem);
+	bfree(pool->workers);
+	bfree(pool);
+}
+
+size_t os_work_pool_get_thread_count(const os_work_pool_t *pool)
+{
+	return pool ? pool->num_workers : 0;
+}
+
+void os_work_pool_queue(os_work_pool_t *pool, enum os_work_priority priority,
+			os_work_t work, void *param)
+{
+	struct work_item item = {NULL, 0, work, param};
+
+	if (priority > OS_WORK_PRIORITY_HIGH)
+		priority = OS_WORK_PRIORITY_HIGH;
+
+	deque_push(&pool->inject[priority], &item);
+	wake_worker(pool);
+}
+
+bool os_work_pool_run_one(os_work_pool_t *pool)
+{
+	struct work_worker *self = cur_worker;
+	struct work_item item;
+
+	if (self && self->pool != pool)
+		self = NULL;
+	if (!take_item(pool, self, NULL, &item))
+		return false;
+
+	run_item(pool, &item, true);
+	return true;
+}
+
+void os_work_pool_wait(os_work_pool_t *pool, volatile bool *done, bool help)
+{
+	while (!os_atomic_load_bool(done)) {
+		if (help && os_work_pool_run_one(pool))
+			continue;
+
+		/* checked again after announcing ourselves as waiting, a job
+		 * or notify that comes in between then finds us */
+		pthread_mutex_lock(&pool->wait_mutex);
+		os_atomic_inc_long(&pool->waiters);
+		if (!os_atomic_load_bool(done) && !(help && has_items(pool)))
+			pthread_cond_wait(&pool->wait_cond, &pool->wait_mutex);
+		os_atomic_dec_long(&pool->waiters);
+		pthread_mutex_unlock(&pool->wait_mutex);
+	}
+}
+
+void os_work_pool_notify(os_work_pool_t *pool)
+{
+	wake_waiters(pool);
+}
+
+/* ------------------------------------------------------------------------- */
+
+os_work_batch_t *os_work_batch_create(const char *profile_name)
+{
+	struct os_work_batch *batch = bzalloc(sizeof(*batch));
+	batch->profile_name = profile_name;
+
+	if (os_event_init(&batch->done, OS_EVENT_TYPE_AUTO) != 0) {
+		bfree(batch);
+		return NULL;
+	}
+
+	return batch;
+}
+
+void os_work_batch_destroy(os_work_batch_t *batch)
+{
+	if (!batch)
+		return;
+
+	os_event_destroy(batch->done);
+	da_free(batch->jobs);
+	da_free(batch->edges);
+	bfree(batch);
+}
+
+void os_work_batch_clear(os_work_batch_t *batch)
+{
+	da_resize(batch->jobs, 0);
+	da_resize(batch->edges, 0);
+}
+
+size_t os_work_batch_add(os_work_batch_t *batch, os_work_t work, void *param)
+{
+	struct work_job job = {
+		.work = work,
+		.param = param,
+		.first_dependent = NO_EDGE,
+	};
+
+	return da_push_back(batch->jobs, &job);
+}
+
+void os_work_batch_add_dependency(os_work_batch_t *batch, size_t job,
+				  size_t runs_after)
+{
+	struct work_job *first = &batch->jobs.array[runs_after];
+	struct work_edge edge = {job, first->first_dependent};
+
+	first->first_dependent = da_push_back(batch->edges, &edge);
+	batch->jobs.array[job].num_deps++;
+}
+
+size_t os_work_batch_get_count(const os_work_batch_t *batch)
+{
+	return batch->jobs.num;
+}
+
+void os_work_batch_run(os_work_pool_t *pool, os_work_batch_t *batch)
+{
+	struct work_deque *inject = &pool->inject[OS_WORK_PRIORITY_HIGH];
+	size_t num = batch->jobs.num;
+	size_t ready = 0;
+	bool finished = false;
+
+	if (!num)
+		return;
+
+	os_atomic_set_long(&batch->remaining, (long)num);
+
+	for (size_t i = 0; i < num; i++) {
+		struct work_job *job = &batch->jobs.array[i];
+		os_atomic_set_long(&job->pending, (long)job->num_deps);
+	}
+
+	/* queue everything that can start right away in one go */
+	pthread_mutex_lock(&inject->mutex);
+	for (size_t i = 0; i < num; i++) {
+		if (!batch->jobs.array[i].num_deps) {
+			struct work_item item = {batch, i, NULL, NULL};
+			da_push_back(inject->items, &item);
+			ready++;
+		}
+	}
+	pthread_mutex_unlock(&inject->mutex);
+
+	for (size_t i = 0; i < ready && i < pool->num_workers; i++)
+		wake_worker(pool);
+
+	/* help out until there's nothing of ours left to take, then wait for
+	 * the workers to finish whatever they are still running */
+	while (!finished) {
+		struct work_item item;
+
+		if (take_item(pool, NULL, batch, &item)) {
+			finished = run_item(pool, &item, false);
+		} else {
+			os_event_wait(batch->done);
+			finished = os_atomic_load_long(&batch->remaining) == 0;
+		}
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "c99defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Work-stealing thread pool for running graphs of small jobs.
+ *
+ *   A batch is a set of jobs plus "runs after" dependencies between them.
+ * Running a batch hands the jobs without dependencies to the pool; each
+ * worker keeps its own deque of ready jobs (newest first for itself, oldest
+ * first for thieves) and a job becomes ready as soon as the last job it
+ * depends on finishes.  The thread running the batch helps out until
+ * everything is done.  Dependencies must not form a cycle.
+ *
+ *   Single jobs can also be queued without a batch.  They are run in queue
+ * order per priority, higher priorities first; batch jobs are treated as
+ * high priority.
+ */
+
+struct os_work_pool;
+struct os_work_batch;
+typedef struct os_work_pool os_work_pool_t;
+typedef struct os_work_batch os_work_batch_t;
+
+typedef void (*os_work_t)(void *param);
+
+enum os_work_priority {
+	OS_WORK_PRIORITY_LOW,
+	OS_WORK_PRIORITY_NORMAL,
+	OS_WORK_PRIORITY_HIGH,
+};
+
+/* 0 threads picks one less than the number of logical cores */
+EXPORT os_work_pool_t *os_work_pool_create(size_t threads);
+EXPORT void os_work_pool_destroy(os_work_pool_t *pool);
+EXPORT size_t os_work_pool_get_thread_count(const os_work_pool_t *pool);
+
+EXPORT void os_work_pool_queue(os_work_pool_t *pool,
+			       enum os_work_priority priority, os_work_t work,
+			       void *param);
+
+/* runs one queued job on the calling thread, returns false if there was
+ * nothing to run.  Meant for threads that wait on work queued in the pool. */
+EXPORT bool os_work_pool_run_one(os_work_pool_t *pool);
+
+/* blocks until *done is set, running queued jobs in the meantime if help is
+ * true.  Whoever sets *done has to call os_work_pool_notify afterwards. */
+EXPORT void os_work_pool_wait(os_work_pool_t *pool, volatile bool *done,
+			      bool help);
+EXPORT void os_work_pool_notify(os_work_pool_t *pool);
+
+/* profile_name, if not NULL, is used for a profiler scope on each worker
+ * while it is working on the batch */
+EXPORT os_work_batch_t *os_work_batch_create(const char *profile_name);
+EXPORT void os_work_batch_destroy(os_work_batch_t *batch);
+EXPORT void os_work_batch_clear(os_work_batch_t *batch);
+EXPORT size_t os_work_batch_add(os_work_batch_t *batch, os_work_t work,
+				void *param);
+EXPORT void os_work_batch_add_dependency(os_work_batch_t *batch, size_t job,
+					 size_t runs_after);
+EXPORT size_t os_work_batch_get_count(const os_work_batch_t *batch);
+
+/* runs every job of the batch and returns once all of them are done */
+EXPORT void os_work_batch_run(os_work_pool_t *pool, os_work_batch_t *batch);
+
+#ifdef __cplusplus
+}
+#endif
@@ -45,6 +45,8 @@ target_sources(
           obs-ffmpeg-output.h
           obs-ffmpeg-mux.c
           obs-ffmpeg-mux.h
+          replay-store.c
+          replay-store.h
           obs-ffmpeg-hls-mux.c
           obs-ffmpeg-source.c
           obs-ffmpeg-compat.h
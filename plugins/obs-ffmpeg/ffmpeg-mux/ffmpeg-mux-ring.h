@@ -0,0 +1,397 @@
+/*
+ * Copyright (c) 2023 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+/*
+ * Shared memory transport between obs-ffmpeg-mux and ffmpeg-mux.
+ *
+ *   The ring lives in a close-on-exec memfd that ffmpeg-mux is explicitly
+ * made to inherit, see os_process_pipe_create_inherit.  Its data area is
+ * mapped twice in a row, so any message no larger than the ring is
+ * contiguous in memory and can be muxed straight from the ring.  Messages
+ * are the same as on the pipe: an ffm_packet_info followed by its data.
+ * Larger messages are passed through in ring sized pieces.
+ *
+ *   Positions are free running byte counts, head is only written by the
+ * writer and tail only by the reader.  A side that has to wait sleeps on a
+ * futex, and the other side only makes the wake syscall when it is
+ * actually waiting.
+ *
+ *   Both sides also watch a pipe to the other process while waiting, so
+ * neither waits forever if the other one exits: ffmpeg-mux watches stdin,
+ * obs-ffmpeg-mux a pipe whose write end only ffmpeg-mux holds.
+ *
+ *   The ring is offered with an FFM_PACKET_RING message on the pipe once
+ * the headers are sent, and ffmpeg-mux claims it when it reads the offer.
+ * The writer doesn't wait for that: it keeps using the pipe and checks the
+ * state before each message.  Once the ring is claimed it sends an empty
+ * FFM_PACKET_RING message as the last one on the pipe and switches to the
+ * ring, so ffmpeg-mux reads the pipe up to there and the order is kept.
+ * If the ring isn't claimed after a while the writer declines it instead,
+ * and whichever gets there first decides whether the switch happens.
+ *
+ *   ffmpeg-mux also leaves its file output counters in the header when it
+ * exits, for obs-ffmpeg-mux to log.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ffmpeg-mux.h"
+
+#ifdef __linux__
+#define FFM_RING_SUPPORTED
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define FFM_RING_HEADER_SIZE 4096
+#define FFM_RING_DEFAULT_SIZE (32 * 1024 * 1024)
+#define FFM_RING_WAIT_MS 100
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+enum ffm_ring_state {
+	FFM_RING_OFFERED,
+	FFM_RING_CLAIMED,
+	FFM_RING_DECLINED,
+};
+
+struct ffm_ring_info {
+	int32_t fd;
+	uint32_t reserved;
+	uint64_t capacity;
+};
+
+struct ffm_ring_header {
+	uint64_t capacity;
+	uint32_t state;
+	uint32_t closed;
+
+	uint8_t pad0[48];
+	uint64_t head;
+	uint32_t data_seq;
+	uint32_t reader_waiting;
+
+	uint8_t pad1[48];
+	uint64_t tail;
+	uint32_t space_seq;
+	uint32_t writer_waiting;
+
+	uint8_t pad2[48];
+	/* filled in by ffmpeg-mux before it exits */
+	struct ffm_io_stats io_stats;
+};
+
+struct ffm_ring {
+	struct ffm_ring_header *header;
+	uint8_t *data;
+	uint64_t capacity;
+	int fd;
+
+	/* pipe that hangs up when the other process exits */
+	int peer_fd;
+};
+
+/* ------------------------------------------------------------------------- */
+
+static inline uint64_t ffm_load64(uint64_t *ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void ffm_store64(uint64_t *ptr, uint64_t val)
+{
+	__atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t ffm_load32(uint32_t *ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+static inline void ffm_store32(uint32_t *ptr, uint32_t val)
+{
+	__atomic_store_n(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+static inline void ffm_futex_wait(uint32_t *addr, uint32_t val, int ms)
+{
+	struct timespec ts = {ms / 1000, (ms % 1000) * 1000000};
+	syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static inline void ffm_futex_wake(uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static inline bool ffm_peer_gone(int fd)
+{
+	struct pollfd pfd = {fd, 0, 0};
+	return poll(&pfd, 1, 0) == 1 && (pfd.revents & (POLLHUP | POLLERR));
+}
+
+/* ------------------------------------------------------------------------- */
+
+static inline bool ffm_ring_map(struct ffm_ring *ring)
+{
+	const int prot = PROT_READ | PROT_WRITE;
+	uint8_t *data;
+
+	ring->header = mmap(NULL, FFM_RING_HEADER_SIZE, prot, MAP_SHARED,
+			    ring->fd, 0);
+	if (ring->header == MAP_FAILED) {
+		ring->header = NULL;
+		return false;
+	}
+
+	data = mmap(NULL, ring->capacity * 2, PROT_NONE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data == MAP_FAILED)
+		return false;
+
+	/* data area, then the same data area again right after it */
+	if (mmap(data, ring->capacity, prot, MAP_SHARED | MAP_FIXED, ring->fd,
+		 FFM_RING_HEADER_SIZE) == MAP_FAILED ||
+	    mmap(data + ring->capacity, ring->capacity, prot,
+		 MAP_SHARED | MAP_FIXED, ring->fd,
+		 FFM_RING_HEADER_SIZE) == MAP_FAILED) {
+		munmap(data, ring->capacity * 2);
+		return false;
+	}
+
+	ring->data = data;
+	return true;
+}
+
+static inline void ffm_ring_free(struct ffm_ring *ring)
+{
+	if (ring->data)
+		munmap(ring->data, ring->capacity * 2);
+	if (ring->header)
+		munmap(ring->header, FFM_RING_HEADER_SIZE);
+	if (ring->fd >= 0)
+		close(ring->fd);
+
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+	ring->peer_fd = -1;
+}
+
+/* writer side, capacity has to be a multiple of the page size.  The fd is
+ * close-on-exec. */
+static inline bool ffm_ring_create(struct ffm_ring *ring, uint64_t capacity)
+{
+	memset(ring, 0, sizeof(*ring));
+	ring->capacity = capacity;
+	ring->peer_fd = -1;
+	ring->fd = (int)syscall(SYS_memfd_create, "obs-ffmpeg-mux",
+				   MFD_CLOEXEC);
+	if (ring->fd == -1)
+		return false;
+
+	if (ftruncate(ring->fd, FFM_RING_HEADER_SIZE + capacity) != 0 ||
+	    !ffm_ring_map(ring)) {
+		ffm_ring_free(ring);
+		return false;
+	}
+
+	ring->header->capacity = capacity;
+	return true;
+}
+
+/* reader side, from the fd and capacity of an FFM_PACKET_RING message */
+static inline bool ffm_ring_open(struct ffm_ring *ring,
+				 const struct ffm_ring_info *info, int peer_fd)
+{
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = info->fd;
+	ring->capacity = info->capacity;
+	ring->peer_fd = peer_fd;
+
+	if (!ffm_ring_map(ring) || ring->header->capacity != info->capacity) {
+		ffm_ring_free(ring);
+		return false;
+	}
+
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static inline uint64_t ffm_ring_free_space(struct ffm_ring *ring)
+{
+	return ring->capacity - (ring->header->head -
+				 ffm_load64(&ring->header->tail));
+}
+
+static inline uint64_t ffm_ring_available(struct ffm_ring *ring)
+{
+	return ffm_load64(&ring->header->head) - ring->header->tail;
+}
+
+static inline bool ffm_ring_wait_space(struct ffm_ring *ring, uint64_t size)
+{
+	struct ffm_ring_header *h = ring->header;
+
+	for (;;) {
+		uint32_t seq = ffm_load32(&h->space_seq);
+
+		if (ffm_ring_free_space(ring) >= size)
+			return true;
+		if (ffm_load32(&h->closed) || ffm_peer_gone(ring->peer_fd))
+			return false;
+
+		ffm_store32(&h->writer_waiting, 1);
+		if (ffm_ring_free_space(ring) < size)
+			ffm_futex_wait(&h->space_seq, seq, FFM_RING_WAIT_MS);
+		ffm_store32(&h->writer_waiting, 0);
+	}
+}
+
+static inline bool ffm_ring_wait_data(struct ffm_ring *ring, uint64_t size)
+{
+	struct ffm_ring_header *h = ring->header;
+
+	for (;;) {
+		uint32_t seq = ffm_load32(&h->data_seq);
+
+		if (ffm_ring_available(ring) >= size)
+			return true;
+		if (ffm_load32(&h->closed) || ffm_peer_gone(ring->peer_fd))
+			return ffm_ring_available(ring) >= size;
+
+		ffm_store32(&h->reader_waiting, 1);
+		if (ffm_ring_available(ring) < size)
+			ffm_futex_wait(&h->data_seq, seq, FFM_RING_WAIT_MS);
+		ffm_store32(&h->reader_waiting, 0);
+	}
+}
+
+static inline void ffm_ring_publish(struct ffm_ring *ring, uint64_t size)
+{
+	struct ffm_ring_header *h = ring->header;
+
+	ffm_store64(&h->head, h->head + size);
+	__atomic_add_fetch(&h->data_seq, 1, __ATOMIC_SEQ_CST);
+	if (ffm_load32(&h->reader_waiting))
+		ffm_futex_wake(&h->data_seq);
+}
+
+static inline void ffm_ring_consume(struct ffm_ring *ring, uint64_t size)
+{
+	struct ffm_ring_header *h = ring->header;
+
+	ffm_store64(&h->tail, h->tail + size);
+	__atomic_add_fetch(&h->space_seq, 1, __ATOMIC_SEQ_CST);
+	if (ffm_load32(&h->writer_waiting))
+		ffm_futex_wake(&h->space_seq);
+}
+
+static inline uint8_t *ffm_ring_write_ptr(struct ffm_ring *ring)
+{
+	return ring->data + ring->header->head % ring->capacity;
+}
+
+static inline uint8_t *ffm_ring_read_ptr(struct ffm_ring *ring)
+{
+	return ring->data + ring->header->tail % ring->capacity;
+}
+
+/* writes an ffm_packet_info and its data as one message */
+static inline bool ffm_ring_write(struct ffm_ring *ring, const void *info,
+			   size_t info_size, const uint8_t *data, size_t size)
+{
+	uint64_t total = info_size + size;
+
+	if (total <= ring->capacity) {
+		if (!ffm_ring_wait_space(ring, total))
+			return false;
+
+		uint8_t *ptr = ffm_ring_write_ptr(ring);
+		memcpy(ptr, info, info_size);
+		memcpy(ptr + info_size, data, size);
+		ffm_ring_publish(ring, total);
+		return true;
+	}
+
+	if (!ffm_ring_wait_space(ring, info_size))
+		return false;
+	memcpy(ffm_ring_write_ptr(ring), info, info_size);
+	ffm_ring_publish(ring, info_size);
+
+	while (size) {
+		uint64_t chunk = size < ring->capacity ? size : ring->capacity;
+
+		if (!ffm_ring_wait_space(ring, chunk))
+			return false;
+		memcpy(ffm_ring_write_ptr(ring), data, chunk);
+		ffm_ring_publish(ring, chunk);
+
+		data += chunk;
+		size -= chunk;
+	}
+
+	return true;
+}
+
+/* marks the end of the data, or that the reader stopped reading */
+static inline void ffm_ring_close(struct ffm_ring *ring)
+{
+	struct ffm_ring_header *h = ring->header;
+
+	ffm_store32(&h->closed, 1);
+	__atomic_add_fetch(&h->data_seq, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&h->space_seq, 1, __ATOMIC_SEQ_CST);
+	ffm_futex_wake(&h->data_seq);
+	ffm_futex_wake(&h->space_seq);
+}
+
+/* reader side, returns whether the ring is to be used */
+static inline bool ffm_ring_claim(struct ffm_ring *ring)
+{
+	uint32_t expected = FFM_RING_OFFERED;
+	return __atomic_compare_exchange_n(&ring->header->state, &expected,
+					   FFM_RING_CLAIMED, false,
+					   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/* writer side, doesn't wait */
+static inline bool ffm_ring_claimed(struct ffm_ring *ring)
+{
+	return ffm_load32(&ring->header->state) == FFM_RING_CLAIMED;
+}
+
+/* writer side, returns false if the reader claimed the ring first */
+static inline bool ffm_ring_decline(struct ffm_ring *ring)
+{
+	uint32_t expected = FFM_RING_OFFERED;
+	return __atomic_compare_exchange_n(&ring->header->state, &expected,
+					   FFM_RING_DECLINED, false,
+					   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+#endif
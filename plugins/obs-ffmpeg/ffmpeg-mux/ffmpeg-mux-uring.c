@@ -0,0 +1,517 @@
+/*
+ * Copyright (c) 2023 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* for O_DIRECT */
+#define _GNU_SOURCE
+
+#include "ffmpeg-mux-uring.h"
+
+#ifdef FFM_URING_SUPPORTED
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <util/platform.h>
+
+/* alignment used for direct io, which is fine for any device that has
+ * 4K or smaller logical blocks */
+#define DIRECT_ALIGN 4096
+
+struct uring_buf {
+	/* room for the carried partial block in front of the chunk */
+	uint8_t *mem;
+
+	/* the write in flight */
+	int fd;
+	uint8_t *data;
+	size_t size;
+	size_t done;
+	uint64_t offset;
+	uint64_t start_ns;
+	bool busy;
+};
+
+struct ffm_uring {
+	int ring_fd;
+	int fd;
+	int direct_fd;
+	struct ffm_io_stats *stats;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	uint32_t *sq_tail;
+	uint32_t *sq_mask;
+	uint32_t *sq_array;
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	struct uring_buf bufs[FFM_URING_DEPTH];
+	int cur;
+	uint32_t in_flight;
+
+	/* where the data written so far ends, and how much of it is still
+	 * carried at the front of the current buffer */
+	uint64_t end;
+	size_t carry;
+
+	int error;
+};
+
+/* ------------------------------------------------------------------------- */
+
+static inline int uring_enter(struct ffm_uring *u, uint32_t submit,
+			      uint32_t wait)
+{
+	unsigned int flags = wait ? IORING_ENTER_GETEVENTS : 0;
+	int ret;
+
+	do {
+		ret = (int)syscall(__NR_io_uring_enter, u->ring_fd, submit, wait,
+				   flags, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret;
+}
+
+static inline bool set_error(struct ffm_uring *u, int error)
+{
+	if (!u->error)
+		u->error = error;
+	errno = u->error;
+	return false;
+}
+
+static bool uring_submit(struct ffm_uring *u, struct uring_buf *buf)
+{
+	uint32_t tail = *u->sq_tail;
+	uint32_t idx = tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = buf->fd;
+	sqe->addr = (uint64_t)(uintptr_t)(buf->data + buf->done);
+	sqe->len = (uint32_t)(buf->size - buf->done);
+	sqe->off = buf->offset + buf->done;
+	sqe->user_data = (uint64_t)(buf - u->bufs);
+
+	u->sq_array[idx] = idx;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	if (uring_enter(u, 1, 0) < 0)
+		return set_error(u, errno);
+	return true;
+}
+
+static bool uring_start(struct ffm_uring *u, struct uring_buf *buf, int fd,
+			uint8_t *data, size_t size, uint64_t offset)
+{
+	buf->fd = fd;
+	buf->data = data;
+	buf->size = size;
+	buf->done = 0;
+	buf->offset = offset;
+	buf->start_ns = os_gettime_ns();
+	buf->busy = true;
+
+	if (++u->in_flight > u->stats->max_in_flight)
+		u->stats->max_in_flight = u->in_flight;
+
+	return uring_submit(u, buf);
+}
+
+static void complete(struct ffm_uring *u, struct io_uring_cqe *cqe)
+{
+	struct uring_buf *buf = &u->bufs[cqe->user_data];
+
+	if (cqe->res > 0) {
+		buf->done += (size_t)cqe->res;
+
+		/* short write, issue the rest */
+		if (buf->done < buf->size && !u->error && uring_submit(u, buf))
+			return;
+	} else {
+		set_error(u, cqe->res < 0 ? -cqe->res : EIO);
+	}
+
+	uint64_t ns = os_gettime_ns() - buf->start_ns;
+	struct ffm_io_stats *stats = u->stats;
+
+	stats->bytes += buf->done;
+	stats->writes++;
+	stats->write_ns += ns;
+	if (ns > stats->max_write_ns)
+		stats->max_write_ns = ns;
+
+	buf->busy = false;
+	u->in_flight--;
+}
+
+/* handles any finished writes, waiting for at least one if asked to.  Only
+ * fails if it can't wait, errors of the writes themselves are kept in
+ * u->error. */
+static bool reap(struct ffm_uring *u, bool wait)
+{
+	uint32_t head = *u->cq_head;
+	bool reaped = false;
+
+	for (;;) {
+		uint32_t tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+
+		if (head == tail) {
+			if (reaped || !wait)
+				break;
+
+			uint64_t start = os_gettime_ns();
+			int ret = uring_enter(u, 0, 1);
+			u->stats->wait_ns += os_gettime_ns() - start;
+
+			if (ret < 0)
+				return set_error(u, errno);
+			continue;
+		}
+
+		complete(u, &u->cqes[head & *u->cq_mask]);
+		__atomic_store_n(u->cq_head, ++head, __ATOMIC_RELEASE);
+		reaped = true;
+	}
+
+	return true;
+}
+
+/* waits for every write in flight, even after one of them failed */
+static bool drain(struct ffm_uring *u)
+{
+	while (u->in_flight) {
+		if (!reap(u, true))
+			break;
+	}
+
+	return u->error ? set_error(u, u->error) : true;
+}
+
+/* blocking write through the page cache, for the odd partial block */
+static bool write_sync(struct ffm_uring *u, const uint8_t *data, size_t size,
+		       uint64_t offset)
+{
+	uint64_t start = os_gettime_ns();
+
+	while (size) {
+		ssize_t ret = pwrite(u->fd, data, size, (off_t)offset);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return set_error(u, errno);
+		}
+
+		data += ret;
+		size -= (size_t)ret;
+		offset += (uint64_t)ret;
+		u->stats->bytes += (uint64_t)ret;
+	}
+
+	uint64_t ns = os_gettime_ns() - start;
+	u->stats->writes++;
+	u->stats->write_ns += ns;
+	u->stats->wait_ns += ns;
+	if (ns > u->stats->max_write_ns)
+		u->stats->max_write_ns = ns;
+	return true;
+}
+
+/* reads back the start of the block a write begins in */
+static bool read_head(struct ffm_uring *u, uint8_t *data, size_t size,
+		      uint64_t offset)
+{
+	size_t total = 0;
+
+	while (total < size) {
+		ssize_t ret = pread(u->fd, data + total, size - total,
+				    (off_t)(offset + total));
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return set_error(u, errno);
+		if (ret == 0)
+			break;
+		total += (size_t)ret;
+	}
+
+	/* past the end of the file, which would read back as zeroes */
+	memset(data + total, 0, size - total);
+	return true;
+}
+
+static bool next_buffer(struct ffm_uring *u)
+{
+	for (;;) {
+		for (int i = 0; i < FFM_URING_DEPTH; i++) {
+			if (!u->bufs[i].busy) {
+				u->cur = i;
+				return true;
+			}
+		}
+
+		if (!reap(u, true) || u->error)
+			return set_error(u, u->error);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool map_rings(struct ffm_uring *u, struct io_uring_params *p)
+{
+	const int prot = PROT_READ | PROT_WRITE;
+	const int flags = MAP_SHARED | MAP_POPULATE;
+
+	u->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(uint32_t);
+	u->cq_ring_size =
+		p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_ring_size > u->sq_ring_size)
+			u->sq_ring_size = u->cq_ring_size;
+		u->cq_ring_size = u->sq_ring_size;
+	}
+
+	u->sq_ring = mmap(NULL, u->sq_ring_size, prot, flags, u->ring_fd,
+			  IORING_OFF_SQ_RING);
+	if (u->sq_ring == MAP_FAILED) {
+		u->sq_ring = NULL;
+		return false;
+	}
+
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		u->cq_ring = u->sq_ring;
+	} else {
+		u->cq_ring = mmap(NULL, u->cq_ring_size, prot, flags,
+				  u->ring_fd, IORING_OFF_CQ_RING);
+		if (u->cq_ring == MAP_FAILED) {
+			u->cq_ring = NULL;
+			return false;
+		}
+	}
+
+	u->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, prot, flags, u->ring_fd,
+		       IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		u->sqes = NULL;
+		return false;
+	}
+
+	uint8_t *sq = u->sq_ring;
+	uint8_t *cq = u->cq_ring;
+
+	u->sq_tail = (uint32_t *)(sq + p->sq_off.tail);
+	u->sq_mask = (uint32_t *)(sq + p->sq_off.ring_mask);
+	u->sq_array = (uint32_t *)(sq + p->sq_off.array);
+	u->cq_head = (uint32_t *)(cq + p->cq_off.head);
+	u->cq_tail = (uint32_t *)(cq + p->cq_off.tail);
+	u->cq_mask = (uint32_t *)(cq + p->cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+	return true;
+}
+
+static void free_uring(struct ffm_uring *u)
+{
+	for (int i = 0; i < FFM_URING_DEPTH; i++)
+		free(u->bufs[i].mem);
+
+	if (u->sqes)
+		munmap(u->sqes, u->sqes_size);
+	if (u->cq_ring && u->cq_ring != u->sq_ring)
+		munmap(u->cq_ring, u->cq_ring_size);
+	if (u->sq_ring)
+		munmap(u->sq_ring, u->sq_ring_size);
+
+	if (u->ring_fd != -1)
+		close(u->ring_fd);
+	if (u->direct_fd != -1)
+		close(u->direct_fd);
+	if (u->fd != -1)
+		close(u->fd);
+
+	free(u);
+}
+
+struct ffm_uring *ffm_uring_create(const char *path, bool direct,
+				   struct ffm_io_stats *stats)
+{
+	struct io_uring_params params = {0};
+	int error;
+
+	struct ffm_uring *u = calloc(1, sizeof(*u));
+	if (!u)
+		return NULL;
+
+	u->ring_fd = -1;
+	u->direct_fd = -1;
+	u->stats = stats;
+
+	u->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (u->fd == -1)
+		goto fail;
+
+	u->ring_fd = (int)syscall(__NR_io_uring_setup, FFM_URING_DEPTH,
+				  &params);
+	if (u->ring_fd == -1)
+		goto fail;
+
+	/* IORING_OP_WRITE came with the same kernel as this flag */
+	if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+		errno = ENOSYS;
+		goto fail;
+	}
+
+	if (!map_rings(u, &params))
+		goto fail;
+
+	for (int i = 0; i < FFM_URING_DEPTH; i++) {
+		if (posix_memalign((void **)&u->bufs[i].mem, DIRECT_ALIGN,
+				   FFM_URING_BUFFER_SIZE + DIRECT_ALIGN) != 0)
+			goto fail;
+	}
+
+	if (direct) {
+		u->direct_fd = open(path, O_WRONLY | O_DIRECT | O_CLOEXEC);
+		if (u->direct_fd == -1)
+			printf("Direct io not available for this file, "
+			       "writing through the page cache\n");
+	}
+
+	stats->backend = u->direct_fd != -1 ? FFM_IO_URING_DIRECT
+					    : FFM_IO_URING;
+	return u;
+
+fail:
+	error = errno;
+	free_uring(u);
+	errno = error;
+	return NULL;
+}
+
+uint8_t *ffm_uring_buffer(struct ffm_uring *u)
+{
+	return u->bufs[u->cur].mem + u->carry;
+}
+
+static bool write_buffered(struct ffm_uring *u, uint64_t offset, size_t size)
+{
+	struct uring_buf *buf = &u->bufs[u->cur];
+
+	if (!uring_start(u, buf, u->fd, buf->mem, size, offset))
+		return false;
+
+	u->end = offset + size;
+	return next_buffer(u);
+}
+
+static bool write_direct(struct ffm_uring *u, uint64_t offset, size_t size)
+{
+	struct uring_buf *buf = &u->bufs[u->cur];
+
+	/* the chunk was filled after the carried data, which is where the
+	 * write would have to start anyway */
+	size_t total = u->carry + size;
+	size_t whole = total & ~(size_t)(DIRECT_ALIGN - 1);
+	size_t rest = total - whole;
+	uint64_t start = offset - u->carry;
+
+	u->end = offset + size;
+	u->carry = rest;
+
+	if (!whole)
+		return true;
+
+	if (!uring_start(u, buf, u->direct_fd, buf->mem, whole, start))
+		return false;
+
+	uint8_t *tail = buf->mem + whole;
+	if (!next_buffer(u))
+		return false;
+
+	memcpy(u->bufs[u->cur].mem, tail, rest);
+	return true;
+}
+
+/* makes sure nothing written so far is left in memory */
+static bool flush_carry(struct ffm_uring *u)
+{
+	struct uring_buf *buf = &u->bufs[u->cur];
+	size_t carry = u->carry;
+
+	u->carry = 0;
+	return !carry || write_sync(u, buf->mem, carry, u->end - carry);
+}
+
+bool ffm_uring_write(struct ffm_uring *u, uint64_t offset, size_t size)
+{
+	if (u->error)
+		return set_error(u, u->error);
+	if (!size)
+		return true;
+
+	if (offset != u->end) {
+		if (!drain(u))
+			return false;
+
+		if (u->direct_fd != -1) {
+			struct uring_buf *buf = &u->bufs[u->cur];
+			size_t head = (size_t)(offset % DIRECT_ALIGN);
+			size_t carry = u->carry;
+
+			/* the chunk is already in the buffer after the old
+			 * carried data, move it to after the new one */
+			if (!flush_carry(u))
+				return false;
+			memmove(buf->mem + head, buf->mem + carry, size);
+			if (!read_head(u, buf->mem, head, offset - head))
+				return false;
+			u->carry = head;
+		}
+	}
+
+	return u->direct_fd != -1 ? write_direct(u, offset, size)
+				  : write_buffered(u, offset, size);
+}
+
+bool ffm_uring_close(struct ffm_uring *u)
+{
+	bool success = drain(u) && flush_carry(u);
+	int error = u->error;
+
+	free_uring(u);
+
+	if (error)
+		errno = error;
+	return success && !error;
+}
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2023 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+/*
+ * io_uring file writer for the ffmpeg-mux io thread.
+ *
+ *   Chunks are filled in place in one of several page aligned buffers, and
+ * each one is written at its own file offset, so a few writes can be in
+ * flight while the next chunk is filled.  A write that doesn't continue
+ * where the previous one ended, like ffmpeg seeking back to rewrite the
+ * moov atom or the cues, first waits for every write in flight, so writes
+ * to the same part of the file always land in order.
+ *
+ *   With direct io, data bypasses the page cache, which only works for
+ * whole blocks.  The partial block at the end of a chunk is carried over to
+ * the front of the next buffer, and only written through the page cache if
+ * the next write doesn't follow on from it.  A write that starts in the
+ * middle of a block reads the start of that block back first.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ffmpeg-mux.h"
+
+#ifdef __linux__
+#define FFM_URING_SUPPORTED
+
+#define FFM_URING_BUFFER_SIZE (1024 * 1024)
+#define FFM_URING_DEPTH 8
+
+struct ffm_uring;
+
+/* creates or truncates the file, returns NULL if the file can't be opened
+ * or io_uring isn't available.  Falls back to writing through the page
+ * cache if the file system doesn't do direct io. */
+extern struct ffm_uring *ffm_uring_create(const char *path, bool direct,
+					  struct ffm_io_stats *stats);
+
+/* finishes all writes, returns false if any of them failed */
+extern bool ffm_uring_close(struct ffm_uring *u);
+
+/* buffer to fill with the next chunk, FFM_URING_BUFFER_SIZE bytes */
+extern uint8_t *ffm_uring_buffer(struct ffm_uring *u);
+
+/* writes size bytes of the buffer at offset, errno is set on failure */
+extern bool ffm_uring_write(struct ffm_uring *u, uint64_t offset, size_t size);
+
+#endif
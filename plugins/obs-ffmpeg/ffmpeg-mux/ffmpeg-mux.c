@@ -25,6 +25,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "ffmpeg-mux.h"
+#include "ffmpeg-mux-ring.h"
+#include "ffmpeg-mux-uring.h"
 
 #include <util/threading.h>
 #include <util/platform.h>
@@ -45,6 +47,9 @@
 
 static char *global_stream_key = "";
 
+/* file output counters of every file written so far */
+static struct ffm_io_stats global_io_stats = {0};
+
 struct resize_buf {
 	uint8_t *buf;
 	size_t size;
@@ -134,6 +139,10 @@ struct io_buffer {
 	FILE *output_file;
 	struct circlebuf data;
 	uint64_t next_pos;
+	struct ffm_io_stats stats;
+#ifdef FFM_URING_SUPPORTED
+	struct ffm_uring *uring;
+#endif
 };
 
 struct ffmpeg_mux {
@@ -201,6 +210,20 @@ static void free_avformat(struct ffmpeg_mux *ffm)
 	ffm->num_audio_streams = 0;
 }
 
+static void add_io_stats(struct ffm_io_stats *total,
+			 const struct ffm_io_stats *stats)
+{
+	total->bytes += stats->bytes;
+	total->writes += stats->writes;
+	total->write_ns += stats->write_ns;
+	total->wait_ns += stats->wait_ns;
+	if (stats->max_write_ns > total->max_write_ns)
+		total->max_write_ns = stats->max_write_ns;
+	if (stats->max_in_flight > total->max_in_flight)
+		total->max_in_flight = stats->max_in_flight;
+	total->backend = stats->backend;
+}
+
 static void ffmpeg_mux_free(struct ffmpeg_mux *ffm)
 {
 	if (ffm->initialized) {
@@ -218,6 +241,8 @@ static void ffmpeg_mux_free(struct ffmpeg_mux *ffm)
 		pthread_mutex_unlock(&ffm->io.data_mutex);
 		pthread_join(ffm->io.io_thread, NULL);
 
+		add_io_stats(&global_io_stats, &ffm->io.stats);
+
 		// Cleanup everything else
 		os_event_destroy(ffm->io.new_data_available_event);
 		os_event_destroy(ffm->io.buffer_space_available_event);
@@ -714,6 +739,42 @@ static inline bool ffmpeg_mux_get_extra_data(struct ffmpeg_mux *ffm)
 
 #define CHUNK_SIZE 1048576
 
+// Writes a chunk at offset, which stdio files have already been seeked to.
+// With io_uring the write is only issued and chunk becomes the next buffer.
+static bool write_chunk(struct ffmpeg_mux *ffm, unsigned char **chunk,
+			size_t size, uint64_t offset)
+{
+	struct ffm_io_stats *stats = &ffm->io.stats;
+
+#ifdef FFM_URING_SUPPORTED
+	if (ffm->io.uring) {
+		if (!ffm_uring_write(ffm->io.uring, offset, size))
+			return false;
+
+		*chunk = ffm_uring_buffer(ffm->io.uring);
+		return true;
+	}
+#else
+	UNUSED_PARAMETER(offset);
+#endif
+
+	uint64_t start = os_gettime_ns();
+
+	if (fwrite(*chunk, size, 1, ffm->io.output_file) != 1)
+		return false;
+
+	uint64_t ns = os_gettime_ns() - start;
+
+	stats->bytes += size;
+	stats->writes++;
+	stats->write_ns += ns;
+	stats->wait_ns += ns;
+	if (ns > stats->max_write_ns)
+		stats->max_write_ns = ns;
+	stats->max_in_flight = 1;
+	return true;
+}
+
 static void *ffmpeg_mux_io_thread(void *data)
 {
 	struct ffmpeg_mux *ffm = data;
@@ -721,7 +782,16 @@ static void *ffmpeg_mux_io_thread(void *data)
 	// Chunk collects the writes into a larger batch
 	size_t chunk_used = 0;
 
-	unsigned char *chunk = malloc(CHUNK_SIZE);
+	unsigned char *chunk;
+#ifdef FFM_URING_SUPPORTED
+	// With io_uring the chunk is filled in place in the writer's buffers
+	if (ffm->io.uring)
+		chunk = ffm_uring_buffer(ffm->io.uring);
+	else
+		chunk = malloc(CHUNK_SIZE);
+#else
+	chunk = malloc(CHUNK_SIZE);
+#endif
 	if (!chunk) {
 		os_atomic_set_bool(&ffm->io.output_error, true);
 		fprintf(stderr, "Error allocating memory for output\n");
@@ -828,8 +898,10 @@ static void *ffmpeg_mux_io_thread(void *data)
 
 			// Seek if we need to
 			if (want_seek) {
-				os_fseeki64(ffm->io.output_file,
-					    next_seek_position, SEEK_SET);
+				if (ffm->io.output_file)
+					os_fseeki64(ffm->io.output_file,
+						    next_seek_position,
+						    SEEK_SET);
 
 				// Update the next virtual position, making sure to take
 				// into account the size of the chunk we're about to write.
@@ -840,8 +912,8 @@ static void *ffmpeg_mux_io_thread(void *data)
 			}
 
 			// Write the current chunk to the output file
-			if (fwrite(chunk, chunk_used, 1, ffm->io.output_file) !=
-			    1) {
+			if (!write_chunk(ffm, &chunk, chunk_used,
+					 current_seek_position - chunk_used)) {
 				os_atomic_set_bool(&ffm->io.output_error, true);
 				fprintf(stderr, "Error writing to '%s', %s\n",
 					ffm->params.printable_file.array,
@@ -859,6 +931,21 @@ static void *ffmpeg_mux_io_thread(void *data)
 	}
 
 error:
+#ifdef FFM_URING_SUPPORTED
+	if (ffm->io.uring) {
+		if (!ffm_uring_close(ffm->io.uring) &&
+		    !os_atomic_load_bool(&ffm->io.output_error)) {
+			os_atomic_set_bool(&ffm->io.output_error, true);
+			fprintf(stderr, "Error writing to '%s', %s\n",
+				ffm->params.printable_file.array,
+				strerror(errno));
+		}
+
+		ffm->io.uring = NULL;
+		return NULL;
+	}
+#endif
+
 	if (chunk)
 		free(chunk);
 
@@ -930,6 +1017,50 @@ static int ffmpeg_mux_write_av_buffer(void *opaque, uint8_t *buf, int buf_size)
 	return buf_size;
 }
 
+// "obs_io" in the muxer settings picks how files are written rather than
+// being passed on to ffmpeg: "uring", or "direct" for io_uring with direct io
+static enum ffm_io_backend get_io_backend(AVDictionary **dict)
+{
+	AVDictionaryEntry *entry = av_dict_get(*dict, "obs_io", NULL, 0);
+	enum ffm_io_backend backend = FFM_IO_STDIO;
+
+	if (!entry)
+		return backend;
+
+	if (strcmp(entry->value, "uring") == 0)
+		backend = FFM_IO_URING;
+	else if (strcmp(entry->value, "direct") == 0)
+		backend = FFM_IO_URING_DIRECT;
+	else if (strcmp(entry->value, "stdio") != 0)
+		printf("Unknown obs_io '%s', using stdio\n", entry->value);
+
+	av_dict_set(dict, "obs_io", NULL, 0);
+	return backend;
+}
+
+static bool open_io_file(struct ffmpeg_mux *ffm, enum ffm_io_backend backend)
+{
+#ifdef FFM_URING_SUPPORTED
+	if (backend != FFM_IO_STDIO) {
+		ffm->io.uring = ffm_uring_create(ffm->params.file,
+						 backend == FFM_IO_URING_DIRECT,
+						 &ffm->io.stats);
+		if (ffm->io.uring)
+			return true;
+
+		printf("Couldn't set up io_uring (%s), using stdio\n",
+		       strerror(errno));
+	}
+#else
+	if (backend != FFM_IO_STDIO)
+		printf("io_uring is only available on Linux, using stdio\n");
+#endif
+
+	ffm->io.stats.backend = FFM_IO_STDIO;
+	ffm->io.output_file = os_fopen(ffm->params.file, "wb");
+	return ffm->io.output_file != NULL;
+}
+
 static inline int open_output_file(struct ffmpeg_mux *ffm)
 {
 #if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(59, 0, 100)
@@ -939,6 +1070,17 @@ static inline int open_output_file(struct ffmpeg_mux *ffm)
 #endif
 	int ret;
 
+	AVDictionary *dict = NULL;
+	if ((ret = av_dict_parse_string(&dict, ffm->params.muxer_settings, "=",
+					" ", 0))) {
+		fprintf(stderr, "Failed to parse muxer settings: %s\n%s\n",
+			av_err2str(ret), ffm->params.muxer_settings);
+
+		av_dict_free(&dict);
+	}
+
+	enum ffm_io_backend backend = get_io_backend(&dict);
+
 	if ((format->flags & AVFMT_NOFILE) == 0) {
 		if (!ffmpeg_mux_is_network(ffm)) {
 			// If not outputting to a network, write to a circlebuf
@@ -947,11 +1089,11 @@ static inline int open_output_file(struct ffmpeg_mux *ffm)
 			// stalls when recording.
 
 			// We're in charge of managing the actual file now
-			ffm->io.output_file = os_fopen(ffm->params.file, "wb");
-			if (!ffm->io.output_file) {
+			if (!open_io_file(ffm, backend)) {
 				fprintf(stderr, "Couldn't open '%s', %s\n",
 					ffm->params.printable_file.array,
 					strerror(errno));
+				av_dict_free(&dict);
 				return FFM_ERROR;
 			}
 
@@ -986,20 +1128,12 @@ static inline int open_output_file(struct ffmpeg_mux *ffm)
 				fprintf(stderr, "Couldn't open '%s', %s\n",
 					ffm->params.printable_file.array,
 					av_err2str(ret));
+				av_dict_free(&dict);
 				return FFM_ERROR;
 			}
 		}
 	}
 
-	AVDictionary *dict = NULL;
-	if ((ret = av_dict_parse_string(&dict, ffm->params.muxer_settings, "=",
-					" ", 0))) {
-		fprintf(stderr, "Failed to parse muxer settings: %s\n%s\n",
-			av_err2str(ret), ffm->params.muxer_settings);
-
-		av_dict_free(&dict);
-	}
-
 	if (av_dict_count(dict) > 0) {
 		printf("Using muxer settings:");
 
@@ -1213,14 +1347,12 @@ static inline bool ffmpeg_mux_packet(struct ffmpeg_mux *ffm, uint8_t *buf,
 	return ret >= 0;
 }
 
-static inline bool read_change_file(struct ffmpeg_mux *ffm, uint32_t size,
-				    struct resize_buf *filename, int argc,
-				    char **argv)
+static inline bool read_change_file(struct ffmpeg_mux *ffm, uint8_t *data,
+				    uint32_t size, struct resize_buf *filename,
+				    int argc, char **argv)
 {
 	resize_buf_resize(filename, size + 1);
-	if (safe_read(filename->buf, size) != size) {
-		return false;
-	}
+	memcpy(filename->buf, data, size);
 	filename->buf[size] = 0;
 
 #ifdef ENABLE_FFMPEG_MUX_DEBUG
@@ -1246,6 +1378,127 @@ static inline bool read_change_file(struct ffmpeg_mux *ffm, uint32_t size,
 
 /* ------------------------------------------------------------------------- */
 
+struct ffm_input {
+	struct resize_buf rb;
+
+#ifdef FFM_RING_SUPPORTED
+	struct ffm_ring ring;
+	bool ring_claimed;
+	bool ring_active;
+
+	/* size of the message still in the ring while it's being muxed */
+	uint64_t pending;
+#endif
+};
+
+#ifdef FFM_RING_SUPPORTED
+static bool read_ring_packet(struct ffm_input *in,
+			     struct ffm_packet_info *info, uint8_t **data)
+{
+	struct ffm_ring *ring = &in->ring;
+	const uint64_t info_size = sizeof(*info);
+
+	if (!ffm_ring_wait_data(ring, info_size))
+		return false;
+	memcpy(info, ffm_ring_read_ptr(ring), info_size);
+
+	/* mux straight from the ring if the message fits */
+	if (info_size + info->size <= ring->capacity) {
+		if (!ffm_ring_wait_data(ring, info_size + info->size))
+			return false;
+
+		*data = ffm_ring_read_ptr(ring) + info_size;
+		in->pending = info_size + info->size;
+		return true;
+	}
+
+	ffm_ring_consume(ring, info_size);
+	resize_buf_resize(&in->rb, info->size);
+
+	for (uint64_t pos = 0; pos < info->size;) {
+		uint64_t chunk = info->size - pos;
+		if (chunk > ring->capacity)
+			chunk = ring->capacity;
+
+		if (!ffm_ring_wait_data(ring, chunk))
+			return false;
+
+		memcpy(in->rb.buf + pos, ffm_ring_read_ptr(ring), chunk);
+		ffm_ring_consume(ring, chunk);
+		pos += chunk;
+	}
+
+	*data = in->rb.buf;
+	return true;
+}
+
+/* the offer is claimed right away, and the empty message after it is the
+ * last one on the pipe */
+static void open_ring(struct ffm_input *in, uint8_t *data, uint32_t size)
+{
+	struct ffm_ring_info info;
+
+	if (size == 0) {
+		in->ring_active = in->ring_claimed;
+		return;
+	}
+	if (size != sizeof(info) || in->ring_claimed)
+		return;
+
+	memcpy(&info, data, sizeof(info));
+	if (!ffm_ring_open(&in->ring, &info, STDIN_FILENO)) {
+		fprintf(stderr, "Failed to map shared memory ring\n");
+		return;
+	}
+
+	in->ring_claimed = ffm_ring_claim(&in->ring);
+	if (!in->ring_claimed)
+		ffm_ring_free(&in->ring);
+}
+#endif
+
+static bool read_packet(struct ffm_input *in, struct ffm_packet_info *info,
+			uint8_t **data)
+{
+#ifdef FFM_RING_SUPPORTED
+	if (in->ring_active)
+		return read_ring_packet(in, info, data);
+#endif
+
+	if (safe_read(info, sizeof(*info)) != sizeof(*info))
+		return false;
+
+	resize_buf_resize(&in->rb, info->size);
+	*data = in->rb.buf;
+	return safe_read(in->rb.buf, info->size) == info->size;
+}
+
+static inline void release_packet(struct ffm_input *in)
+{
+#ifdef FFM_RING_SUPPORTED
+	if (in->pending) {
+		ffm_ring_consume(&in->ring, in->pending);
+		in->pending = 0;
+	}
+#else
+	UNUSED_PARAMETER(in);
+#endif
+}
+
+static void free_input(struct ffm_input *in)
+{
+#ifdef FFM_RING_SUPPORTED
+	if (in->ring_claimed) {
+		in->ring.header->io_stats = global_io_stats;
+		ffm_ring_close(&in->ring);
+		ffm_ring_free(&in->ring);
+	}
+#endif
+	resize_buf_free(&in->rb);
+}
+
+/* ------------------------------------------------------------------------- */
+
 #ifdef _WIN32
 int wmain(int argc, wchar_t *argv_w[])
 #else
@@ -1254,8 +1507,9 @@ int main(int argc, char *argv[])
 {
 	struct ffm_packet_info info = {0};
 	struct ffmpeg_mux ffm = {0};
-	struct resize_buf rb = {0};
+	struct ffm_input in = {0};
 	struct resize_buf rb_filename = {0};
+	uint8_t *data;
 	bool fail = false;
 	int ret;
 
@@ -1287,24 +1541,23 @@ int main(int argc, char *argv[])
 		return ret;
 	}
 
-	while (!fail && safe_read(&info, sizeof(info)) == sizeof(info)) {
+	while (!fail && read_packet(&in, &info, &data)) {
 		if (info.type == FFM_PACKET_CHANGE_FILE) {
-			fail = !read_change_file(&ffm, info.size, &rb_filename,
-						 argc, argv);
-			continue;
-		}
-
-		resize_buf_resize(&rb, info.size);
-
-		if (safe_read(rb.buf, info.size) == info.size) {
-			fail = !ffmpeg_mux_packet(&ffm, rb.buf, &info);
+			fail = !read_change_file(&ffm, data, info.size,
+						 &rb_filename, argc, argv);
+#ifdef FFM_RING_SUPPORTED
+		} else if (info.type == FFM_PACKET_RING) {
+			open_ring(&in, data, info.size);
+#endif
 		} else {
-			fail = true;
+			fail = !ffmpeg_mux_packet(&ffm, data, &info);
 		}
+
+		release_packet(&in);
 	}
 
 	ffmpeg_mux_free(&ffm);
-	resize_buf_free(&rb);
+	free_input(&in);
 	resize_buf_free(&rb_filename);
 
 #ifdef _WIN32
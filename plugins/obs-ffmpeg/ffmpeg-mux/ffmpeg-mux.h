@@ -23,6 +23,7 @@ enum ffm_packet_type {
 	FFM_PACKET_VIDEO,
 	FFM_PACKET_AUDIO,
 	FFM_PACKET_CHANGE_FILE,
+	FFM_PACKET_RING,
 };
 
 #define FFM_SUCCESS 0
@@ -37,3 +38,20 @@ struct ffm_packet_info {
 	enum ffm_packet_type type;
 	bool keyframe;
 };
+
+enum ffm_io_backend {
+	FFM_IO_STDIO,
+	FFM_IO_URING,
+	FFM_IO_URING_DIRECT,
+};
+
+/* file output counters, handed back to obs-ffmpeg-mux when it exits */
+struct ffm_io_stats {
+	uint64_t bytes;
+	uint64_t writes;
+	uint64_t write_ns;     /* from issuing each write until it finished */
+	uint64_t wait_ns;      /* time the io thread was blocked on the disk */
+	uint64_t max_write_ns;
+	uint32_t backend;
+	uint32_t max_in_flight;
+};
@@ -37,7 +37,7 @@ void ffmpeg_hls_mux_destroy(void *data)
 		da_free(stream->mux_packets);
 		circlebuf_free(&stream->packets);
 
-		os_process_pipe_destroy(stream->pipe);
+		stop_pipe(stream);
 		dstr_free(&stream->path);
 		dstr_free(&stream->printable_path);
 		dstr_free(&stream->stream_key);
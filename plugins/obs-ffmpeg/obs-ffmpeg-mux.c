@@ -14,6 +14,10 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ******************************************************************************/
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include "ffmpeg-mux/ffmpeg-mux.h"
 #include "obs-ffmpeg-mux.h"
 #include "obs-ffmpeg-formats.h"
@@ -24,6 +28,11 @@
 
 #include <libavformat/avformat.h>
 
+#ifdef FFM_RING_SUPPORTED
+#include <fcntl.h>
+#include <inttypes.h>
+#endif
+
 #define do_log(level, format, ...)                  \
 	blog(level, "[ffmpeg muxer: '%s'] " format, \
 	     obs_output_get_name(stream->output), ##__VA_ARGS__)
@@ -54,6 +63,7 @@ static inline void replay_buffer_clear(struct ffmpeg_muxer *stream)
 	}
 
 	circlebuf_free(&stream->packets);
+	replay_store_clear(stream->store);
 	stream->cur_size = 0;
 	stream->cur_time = 0;
 	stream->max_size = 0;
@@ -73,8 +83,10 @@ static void ffmpeg_mux_destroy(void *data)
 		obs_encoder_packet_release(&stream->mux_packets.array[i]);
 	da_free(stream->mux_packets);
 	circlebuf_free(&stream->packets);
+	replay_snapshot_destroy(stream->snapshot);
+	replay_store_destroy(stream->store);
 
-	os_process_pipe_destroy(stream->pipe);
+	stop_pipe(stream);
 	dstr_free(&stream->path);
 	dstr_free(&stream->printable_path);
 	dstr_free(&stream->stream_key);
@@ -324,14 +336,104 @@ static void build_command_line(struct ffmpeg_muxer *stream, struct dstr *cmd,
 	add_muxer_params(cmd, stream);
 }
 
+#ifdef FFM_RING_SUPPORTED
+static void free_ring(struct ffmpeg_muxer *stream)
+{
+	if (stream->ring.header) {
+		close(stream->ring.peer_fd);
+		ffm_ring_free(&stream->ring);
+	}
+	stream->ring_offered = 0;
+	stream->ring_active = false;
+}
+
+/* ffmpeg-mux inherits the ring and the write end of a pipe that hangs up
+ * once it exits, see ffmpeg-mux-ring.h */
+static int create_ring(struct ffmpeg_muxer *stream)
+{
+	int peer[2];
+
+	if (stream->is_network)
+		return -1;
+	if (!ffm_ring_create(&stream->ring, FFM_RING_DEFAULT_SIZE))
+		return -1;
+
+	if (pipe2(peer, O_CLOEXEC) != 0) {
+		ffm_ring_free(&stream->ring);
+		return -1;
+	}
+
+	stream->ring.peer_fd = peer[0];
+	return peer[1];
+}
+#endif
+
 void start_pipe(struct ffmpeg_muxer *stream, const char *path)
 {
 	struct dstr cmd;
 	build_command_line(stream, &cmd, path);
+
+#ifdef FFM_RING_SUPPORTED
+	int peer = create_ring(stream);
+	if (peer != -1) {
+		int fds[] = {stream->ring.fd, peer};
+		stream->pipe = os_process_pipe_create_inherit(cmd.array, "w",
+							      fds, 2);
+		close(peer);
+		if (!stream->pipe)
+			free_ring(stream);
+	} else {
+		stream->pipe = os_process_pipe_create(cmd.array, "w");
+	}
+#else
 	stream->pipe = os_process_pipe_create(cmd.array, "w");
+#endif
+
 	dstr_free(&cmd);
 }
 
+#ifdef FFM_RING_SUPPORTED
+static void log_io_stats(struct ffmpeg_muxer *stream,
+			 const struct ffm_io_stats *stats)
+{
+	static const char *backends[] = {"stdio", "io_uring",
+					 "io_uring direct"};
+
+	if (!stats->writes || stats->backend > FFM_IO_URING_DIRECT)
+		return;
+
+	info("File output (%s): %.1f MB in %" PRIu64 " writes, "
+	     "%.1f ms average write, %.1f ms slowest write, "
+	     "%.1f ms blocked on disk, up to %u writes in flight",
+	     backends[stats->backend], (double)stats->bytes / 1048576.0,
+	     stats->writes,
+	     (double)stats->write_ns / (double)stats->writes / 1000000.0,
+	     (double)stats->max_write_ns / 1000000.0,
+	     (double)stats->wait_ns / 1000000.0, stats->max_in_flight);
+}
+#endif
+
+int stop_pipe(struct ffmpeg_muxer *stream)
+{
+	int ret;
+
+#ifdef FFM_RING_SUPPORTED
+	if (stream->ring_active)
+		ffm_ring_close(&stream->ring);
+#endif
+
+	ret = os_process_pipe_destroy(stream->pipe);
+	stream->pipe = NULL;
+
+#ifdef FFM_RING_SUPPORTED
+	/* ffmpeg-mux has exited, so its counters are final */
+	if (stream->ring_active)
+		log_io_stats(stream, &stream->ring.header->io_stats);
+	free_ring(stream);
+#endif
+	return ret;
+}
+
 static void set_file_not_readable_error(struct ffmpeg_muxer *stream,
 					obs_data_t *settings, const char *path)
 {
@@ -498,8 +600,7 @@ int deactivate(struct ffmpeg_muxer *stream, int code)
 	}
 
 	if (active(stream)) {
-		ret = os_process_pipe_destroy(stream->pipe);
-		stream->pipe = NULL;
+		ret = stop_pipe(stream);
 
 		os_atomic_set_bool(&stream->active, false);
 		os_atomic_set_bool(&stream->sent_headers, false);
@@ -637,10 +738,86 @@ static void generate_filename(struct ffmpeg_muxer *stream, struct dstr *dst,
 	obs_data_release(settings);
 }
 
+static bool write_pipe_message(struct ffmpeg_muxer *stream,
+			       struct ffm_packet_info *info,
+			       const uint8_t *data)
+{
+	size_t ret;
+
+	ret = os_process_pipe_write(stream->pipe, (const uint8_t *)info,
+				    sizeof(*info));
+	if (ret != sizeof(*info)) {
+		warn("os_process_pipe_write for info structure failed");
+		signal_failure(stream);
+		return false;
+	}
+
+	ret = os_process_pipe_write(stream->pipe, data, info->size);
+	if (ret != info->size) {
+		warn("os_process_pipe_write for packet data failed");
+		signal_failure(stream);
+		return false;
+	}
+
+	return true;
+}
+
+#ifdef FFM_RING_SUPPORTED
+#define RING_CLAIM_TIMEOUT_NS 2000000000ULL
+
+/* called before each message while the ring is offered, never waits */
+static bool update_ring(struct ffmpeg_muxer *stream)
+{
+	struct ffm_packet_info pkt_info = {.type = FFM_PACKET_RING};
+
+	if (!ffm_ring_claimed(&stream->ring)) {
+		/* an ffmpeg-mux that can't map the ring keeps reading the
+		 * pipe */
+		if (os_gettime_ns() - stream->ring_offered <
+		    RING_CLAIM_TIMEOUT_NS)
+			return true;
+		if (ffm_ring_decline(&stream->ring)) {
+			free_ring(stream);
+			return true;
+		}
+	}
+
+	/* the last message on the pipe, everything after it goes through the
+	 * ring */
+	if (!write_pipe_message(stream, &pkt_info, NULL))
+		return false;
+
+	stream->ring_active = true;
+	info("Sending packets through shared memory");
+	return true;
+}
+#endif
+
+static bool send_message(struct ffmpeg_muxer *stream,
+			 struct ffm_packet_info *info, const uint8_t *data)
+{
+#ifdef FFM_RING_SUPPORTED
+	if (stream->ring_offered && !stream->ring_active &&
+	    !update_ring(stream))
+		return false;
+
+	if (stream->ring_active) {
+		if (!ffm_ring_write(&stream->ring, info, sizeof(*info), data,
+				    info->size)) {
+			warn("Writing to the shared memory ring failed");
+			signal_failure(stream);
+			return false;
+		}
+		return true;
+	}
+#endif
+
+	return write_pipe_message(stream, info, data);
+}
+
 bool write_packet(struct ffmpeg_muxer *stream, struct encoder_packet *packet)
 {
 	bool is_video = packet->type == OBS_ENCODER_VIDEO;
-	size_t ret;
 
 	struct ffm_packet_info info = {.pts = packet->pts,
 				       .dts = packet->dts,
@@ -660,20 +837,8 @@ bool write_packet(struct ffmpeg_muxer *stream, struct encoder_packet *packet)
 		}
 	}
 
-	ret = os_process_pipe_write(stream->pipe, (const uint8_t *)&info,
-				    sizeof(info));
-	if (ret != sizeof(info)) {
-		warn("os_process_pipe_write for info structure failed");
-		signal_failure(stream);
-		return false;
-	}
-
-	ret = os_process_pipe_write(stream->pipe, packet->data, packet->size);
-	if (ret != packet->size) {
-		warn("os_process_pipe_write for packet data failed");
-		signal_failure(stream);
+	if (!send_message(stream, &info, packet->data))
 		return false;
-	}
 
 	stream->total_bytes += packet->size;
 
@@ -707,6 +872,25 @@ static bool send_video_headers(struct ffmpeg_muxer *stream)
 	return write_packet(stream, &packet);
 }
 
+#ifdef FFM_RING_SUPPORTED
+static bool offer_ring(struct ffmpeg_muxer *stream)
+{
+	struct ffm_ring_info ring_info = {
+		.fd = stream->ring.fd,
+		.capacity = stream->ring.capacity,
+	};
+	struct ffm_packet_info pkt_info = {.type = FFM_PACKET_RING,
+					   .size = sizeof(ring_info)};
+
+	if (!send_message(stream, &pkt_info, (const uint8_t *)&ring_info))
+		return false;
+
+	/* send_message switches over once ffmpeg-mux claims it */
+	stream->ring_offered = os_gettime_ns();
+	return true;
+}
+#endif
+
 bool send_headers(struct ffmpeg_muxer *stream)
 {
 	obs_encoder_t *aencoder;
@@ -725,6 +909,11 @@ bool send_headers(struct ffmpeg_muxer *stream)
 		}
 	} while (aencoder);
 
+#ifdef FFM_RING_SUPPORTED
+	if (stream->ring.header && !offer_ring(stream))
+		return false;
+#endif
+
 	return true;
 }
 
@@ -757,28 +946,11 @@ static inline bool should_split(struct ffmpeg_muxer *stream,
 
 static bool send_new_filename(struct ffmpeg_muxer *stream, const char *filename)
 {
-	size_t ret;
 	uint32_t size = (uint32_t)strlen(filename);
 	struct ffm_packet_info info = {.type = FFM_PACKET_CHANGE_FILE,
 				       .size = size};
 
-	ret = os_process_pipe_write(stream->pipe, (const uint8_t *)&info,
-				    sizeof(info));
-	if (ret != sizeof(info)) {
-		warn("os_process_pipe_write for info structure failed");
-		signal_failure(stream);
-		return false;
-	}
-
-	ret = os_process_pipe_write(stream->pipe, (const uint8_t *)filename,
-				    size);
-	if (ret != size) {
-		warn("os_process_pipe_write for packet data failed");
-		signal_failure(stream);
-		return false;
-	}
-
-	return true;
+	return send_message(stream, &info, (const uint8_t *)filename);
 }
 
 static bool prepare_split_file(struct ffmpeg_muxer *stream,
@@ -1046,6 +1218,30 @@ static bool replay_buffer_start(void *data)
 	obs_data_t *s = obs_output_get_settings(stream->output);
 	stream->max_time = obs_data_get_int(s, "max_time_sec") * 1000000LL;
 	stream->max_size = obs_data_get_int(s, "max_size_mb") * (1024 * 1024);
+	int64_t max_memory =
+		obs_data_get_int(s, "max_memory_mb") * (1024 * 1024);
+
+	stream->segmented = max_memory > 0;
+	if (stream->segmented) {
+		const char *dir = obs_data_get_string(s, "spill_directory");
+		char *default_dir = NULL;
+
+		if (!*dir) {
+			default_dir = obs_module_config_path("replay-spill");
+			dir = default_dir;
+		}
+
+		if (!stream->store)
+			stream->store = replay_store_create(
+				obs_output_get_name(stream->output));
+		if (stream->store)
+			replay_store_set_memory_limit(stream->store,
+						      max_memory, dir);
+		else
+			stream->segmented = false;
+
+		bfree(default_dir);
+	}
 	obs_data_release(s);
 
 	os_atomic_set_bool(&stream->active, true);
@@ -1150,6 +1346,11 @@ static void insert_packet(mux_packets_t *packets, struct encoder_packet *packet,
 	da_insert(*packets, idx, &pkt);
 }
 
+static bool write_replay_packet(void *param, struct encoder_packet *packet)
+{
+	return write_packet(param, packet);
+}
+
 static void *replay_buffer_mux_thread(void *data)
 {
 	struct ffmpeg_muxer *stream = data;
@@ -1170,6 +1371,16 @@ static void *replay_buffer_mux_thread(void *data)
 		goto error;
 	}
 
+	if (stream->snapshot) {
+		if (!replay_snapshot_write(stream->snapshot, write_replay_packet,
+					   stream)) {
+			warn("Could not write packet for file '%s'",
+			     stream->path.array);
+			error = true;
+			goto error;
+		}
+	}
+
 	for (size_t i = 0; i < stream->mux_packets.num; i++) {
 		struct encoder_packet *pkt = &stream->mux_packets.array[i];
 		if (!write_packet(stream, pkt)) {
@@ -1184,14 +1395,15 @@ static void *replay_buffer_mux_thread(void *data)
 	info("Wrote replay buffer to '%s'", stream->path.array);
 
 error:
-	os_process_pipe_destroy(stream->pipe);
-	stream->pipe = NULL;
+	stop_pipe(stream);
 	if (error) {
 		for (size_t i = 0; i < stream->mux_packets.num; i++)
 			obs_encoder_packet_release(
 				&stream->mux_packets.array[i]);
 	}
 	da_free(stream->mux_packets);
+	replay_snapshot_destroy(stream->snapshot);
+	stream->snapshot = NULL;
 	os_atomic_set_bool(&stream->muxing, false);
 
 	if (!error) {
@@ -1209,6 +1421,13 @@ static void replay_buffer_save(struct ffmpeg_muxer *stream)
 	const size_t size = sizeof(struct encoder_packet);
 	size_t num_packets = stream->packets.size / size;
 
+	/* segments are already in order, the mux thread merges the tracks as
+	 * it writes them */
+	if (stream->segmented) {
+		stream->snapshot = replay_store_snapshot(stream->store);
+		num_packets = 0;
+	}
+
 	da_reserve(stream->mux_packets, num_packets);
 
 	/* ---------------------------- */
@@ -1271,10 +1490,27 @@ static void deactivate_replay_buffer(struct ffmpeg_muxer *stream, int code)
 	replay_buffer_clear(stream);
 }
 
+static inline void replay_buffer_push(struct ffmpeg_muxer *stream,
+				      struct encoder_packet *packet)
+{
+	struct encoder_packet pkt;
+
+	obs_encoder_packet_ref(&pkt, packet);
+	replay_buffer_purge(stream, &pkt);
+
+	if (!stream->packets.size)
+		stream->cur_time = pkt.dts_usec;
+	stream->cur_size += pkt.size;
+
+	circlebuf_push_back(&stream->packets, packet, sizeof(*packet));
+
+	if (packet->type == OBS_ENCODER_VIDEO && packet->keyframe)
+		stream->keyframes++;
+}
+
 static void replay_buffer_data(void *data, struct encoder_packet *packet)
 {
 	struct ffmpeg_muxer *stream = data;
-	struct encoder_packet pkt;
 
 	if (!active(stream))
 		return;
@@ -1292,17 +1528,13 @@ static void replay_buffer_data(void *data, struct encoder_packet *packet)
 		}
 	}
 
-	obs_encoder_packet_ref(&pkt, packet);
-	replay_buffer_purge(stream, &pkt);
-
-	if (!stream->packets.size)
-		stream->cur_time = pkt.dts_usec;
-	stream->cur_size += pkt.size;
-
-	circlebuf_push_back(&stream->packets, packet, sizeof(*packet));
-
-	if (packet->type == OBS_ENCODER_VIDEO && packet->keyframe)
-		stream->keyframes++;
+	if (stream->segmented) {
+		replay_store_purge(stream->store, stream->max_size,
+				   stream->max_time, packet);
+		replay_store_push(stream->store, packet);
+	} else {
+		replay_buffer_push(stream, packet);
+	}
 
 	if (stream->save_ts && packet->sys_dts_usec >= stream->save_ts) {
 		if (os_atomic_load_bool(&stream->muxing))
@@ -1322,6 +1554,8 @@ static void replay_buffer_defaults(obs_data_t *s)
 {
 	obs_data_set_default_int(s, "max_time_sec", 15);
 	obs_data_set_default_int(s, "max_size_mb", 500);
+	obs_data_set_default_int(s, "max_memory_mb", 0);
+	obs_data_set_default_string(s, "spill_directory", "");
 	obs_data_set_default_string(s, "format", "%CCYY-%MM-%DD %hh-%mm-%ss");
 	obs_data_set_default_string(s, "extension", "mp4");
 	obs_data_set_default_bool(s, "allow_spaces", true);
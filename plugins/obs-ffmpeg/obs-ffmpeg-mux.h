@@ -9,6 +9,9 @@
 #include <util/platform.h>
 #include <util/threading.h>
 
+#include "ffmpeg-mux/ffmpeg-mux-ring.h"
+#include "replay-store.h"
+
 typedef DARRAY(struct encoder_packet) mux_packets_t;
 
 struct ffmpeg_muxer {
@@ -38,6 +41,11 @@ struct ffmpeg_muxer {
 	volatile bool muxing;
 	mux_packets_t mux_packets;
 
+	/* segmented replay buffer, used when a memory limit is set */
+	replay_store_t *store;
+	replay_snapshot_t *snapshot;
+	bool segmented;
+
 	/* split file */
 	bool found_video;
 	bool found_audio[MAX_AUDIO_MIXES];
@@ -64,11 +72,19 @@ struct ffmpeg_muxer {
 	bool is_network;
 	bool split_file;
 	bool allow_overwrite;
+
+#ifdef FFM_RING_SUPPORTED
+	/* shared memory transport to ffmpeg-mux, see ffmpeg-mux-ring.h */
+	struct ffm_ring ring;
+	uint64_t ring_offered;
+	bool ring_active;
+#endif
 };
 
 bool stopping(struct ffmpeg_muxer *stream);
 bool active(struct ffmpeg_muxer *stream);
 void start_pipe(struct ffmpeg_muxer *stream, const char *path);
+int stop_pipe(struct ffmpeg_muxer *stream);
 bool write_packet(struct ffmpeg_muxer *stream, struct encoder_packet *packet);
 bool send_headers(struct ffmpeg_muxer *stream);
 int deactivate(struct ffmpeg_muxer *stream, int code);
@@ -43,6 +43,9 @@ struct ffmpeg_source {
 	char *input_format;
 	char *ffmpeg_options;
 	int buffering_mb;
+	int seek_cache_mb;
+	int decode_threads;
+	enum mp_decode_threading decode_threading;
 	int speed_percent;
 	bool is_looping;
 	bool is_local_file;
@@ -105,6 +108,7 @@ static bool is_local_file_modified(obs_properties_t *props,
 	obs_property_t *buffering = obs_properties_get(props, "buffering_mb");
 	obs_property_t *seekable = obs_properties_get(props, "seekable");
 	obs_property_t *speed = obs_properties_get(props, "speed_percent");
+	obs_property_t *seek_cache = obs_properties_get(props, "seek_cache_mb");
 	obs_property_t *reconnect_delay_sec =
 		obs_properties_get(props, "reconnect_delay_sec");
 	obs_property_set_visible(input, !enabled);
@@ -113,6 +117,7 @@ static bool is_local_file_modified(obs_properties_t *props,
 	obs_property_set_visible(local_file, enabled);
 	obs_property_set_visible(looping, enabled);
 	obs_property_set_visible(speed, enabled);
+	obs_property_set_visible(seek_cache, enabled);
 	obs_property_set_visible(seekable, !enabled);
 	obs_property_set_visible(reconnect_delay_sec, !enabled);
 
@@ -129,6 +134,10 @@ static void ffmpeg_source_defaults(obs_data_t *settings)
 	obs_data_set_default_int(settings, "reconnect_delay_sec", 10);
 	obs_data_set_default_int(settings, "buffering_mb", 2);
 	obs_data_set_default_int(settings, "speed_percent", 100);
+	obs_data_set_default_int(settings, "seek_cache_mb", 0);
+	obs_data_set_default_int(settings, "decode_threads", 0);
+	obs_data_set_default_int(settings, "decode_threading",
+				 MP_DECODE_THREADING_AUTO);
 	obs_data_set_default_bool(settings, "log_changes", true);
 }
 
@@ -205,6 +214,27 @@ static obs_properties_t *ffmpeg_source_getproperties(void *data)
 	obs_properties_add_bool(props, "hw_decode",
 				obs_module_text("HardwareDecode"));
 
+	prop = obs_properties_add_list(props, "decode_threading",
+				       obs_module_text("DecodeThreading"),
+				       OBS_COMBO_TYPE_LIST,
+				       OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(prop, obs_module_text("DecodeThreading.Auto"),
+				  MP_DECODE_THREADING_AUTO);
+	obs_property_list_add_int(prop,
+				  obs_module_text("DecodeThreading.Frame"),
+				  MP_DECODE_THREADING_FRAME);
+	obs_property_list_add_int(prop,
+				  obs_module_text("DecodeThreading.Slice"),
+				  MP_DECODE_THREADING_SLICE);
+	obs_property_set_long_description(
+		prop, obs_module_text("DecodeThreading.ToolTip"));
+
+	prop = obs_properties_add_int(props, "decode_threads",
+				      obs_module_text("DecodeThreads"), 0, 64,
+				      1);
+	obs_property_set_long_description(
+		prop, obs_module_text("DecodeThreads.ToolTip"));
+
 	obs_properties_add_bool(props, "clear_on_media_end",
 				obs_module_text("ClearOnMediaEnd"));
 
@@ -220,6 +250,13 @@ static obs_properties_t *ffmpeg_source_getproperties(void *data)
 					     1, 200, 1);
 	obs_property_int_set_suffix(prop, "%");
 
+	prop = obs_properties_add_int(props, "seek_cache_mb",
+				      obs_module_text("SeekCacheMB"), 0, 4096,
+				      64);
+	obs_property_int_set_suffix(prop, " MB");
+	obs_property_set_long_description(
+		prop, obs_module_text("SeekCacheMB.ToolTip"));
+
 	prop = obs_properties_add_list(props, "color_range",
 				       obs_module_text("ColorRange"),
 				       OBS_COMBO_TYPE_LIST,
@@ -255,6 +292,9 @@ static void dump_source_info(struct ffmpeg_source *s, const char *input,
 		"\tinput:                   %s\n"
 		"\tinput_format:            %s\n"
 		"\tspeed:                   %d\n"
+		"\tseek_cache_mb:           %d\n"
+		"\tdecode_threads:          %d\n"
+		"\tdecode_threading:        %d\n"
 		"\tis_looping:              %s\n"
 		"\tis_linear_alpha:         %s\n"
 		"\tis_hw_decoding:          %s\n"
@@ -265,7 +305,9 @@ static void dump_source_info(struct ffmpeg_source *s, const char *input,
 		"\tffmpeg_options:          %s",
 		input ? input : "(null)",
 		input_format ? input_format : "(null)", s->speed_percent,
-		s->is_looping ? "yes" : "no", s->is_linear_alpha ? "yes" : "no",
+		s->seek_cache_mb, s->decode_threads, (int)s->decode_threading,
+		s->is_looping ? "yes" : "no",
+		s->is_linear_alpha ? "yes" : "no",
 		s->is_hw_decoding ? "yes" : "no",
 		s->is_clear_on_media_end ? "yes" : "no",
 		s->restart_on_activate ? "yes" : "no",
@@ -337,6 +379,9 @@ static void ffmpeg_source_open(struct ffmpeg_source *s)
 			.format = s->input_format,
 			.buffering = s->buffering_mb * 1024 * 1024,
 			.speed = s->speed_percent,
+			.seek_cache_mb = s->seek_cache_mb,
+			.decode_threads = s->decode_threads,
+			.decode_threading = s->decode_threading,
 			.force_range = s->range,
 			.is_linear_alpha = s->is_linear_alpha,
 			.hardware_decoding = s->is_hw_decoding,
@@ -453,6 +498,9 @@ static void ffmpeg_source_update(void *data, obs_data_t *settings)
 	enum video_range_type range;
 	bool is_linear_alpha;
 	int speed_percent;
+	int seek_cache_mb;
+	int decode_threads;
+	enum mp_decode_threading decode_threading;
 	bool is_looping;
 
 	bfree(s->input_format);
@@ -487,11 +535,17 @@ static void ffmpeg_source_update(void *data, obs_data_t *settings)
 	speed_percent = (int)obs_data_get_int(settings, "speed_percent");
 	if (speed_percent < 1 || speed_percent > 200)
 		speed_percent = 100;
+	seek_cache_mb = (int)obs_data_get_int(settings, "seek_cache_mb");
+	decode_threads = (int)obs_data_get_int(settings, "decode_threads");
+	decode_threading = obs_data_get_int(settings, "decode_threading");
 	ffmpeg_options = obs_data_get_string(settings, "ffmpeg_options");
 
 	/* Restart media source if these properties are changed */
 	if (s->is_hw_decoding != is_hw_decoding || s->range != range ||
 	    s->speed_percent != speed_percent ||
+	    s->seek_cache_mb != seek_cache_mb ||
+	    s->decode_threads != decode_threads ||
+	    s->decode_threading != decode_threading ||
 	    (s->ffmpeg_options &&
 	     strcmp(s->ffmpeg_options, ffmpeg_options) != 0))
 		should_restart_media = true;
@@ -525,6 +579,9 @@ static void ffmpeg_source_update(void *data, obs_data_t *settings)
 	s->is_linear_alpha = is_linear_alpha;
 	s->buffering_mb = (int)obs_data_get_int(settings, "buffering_mb");
 	s->speed_percent = speed_percent;
+	s->seek_cache_mb = seek_cache_mb;
+	s->decode_threads = decode_threads;
+	s->decode_threading = decode_threading;
 	s->is_local_file = is_local_file;
 	s->seekable = obs_data_get_bool(settings, "seekable");
 	s->ffmpeg_options = ffmpeg_options ? bstrdup(ffmpeg_options) : NULL;
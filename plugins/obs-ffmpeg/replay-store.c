@@ -0,0 +1,727 @@
+/******************************************************************************
+    Copyright (C) 2023 by Lain Bailey <lain@obsproject.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include <util/darray.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#include "replay-store.h"
+
+#define do_log(level, format, ...)                 \
+	blog(level, "[replay store: '%s'] " format, \
+	     store->name, ##__VA_ARGS__)
+
+#define warn(format, ...) do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...) do_log(LOG_INFO, format, ##__VA_ARGS__)
+
+/* video, then one per audio track */
+#define MAX_TRACKS (1 + MAX_AUDIO_MIXES)
+
+static inline size_t packet_track(const struct encoder_packet *packet)
+{
+	return packet->type == OBS_ENCODER_VIDEO ? 0 : 1 + packet->track_idx;
+}
+
+/* ------------------------------------------------------------------------ */
+
+struct replay_packet {
+	struct encoder_packet packet;
+
+	/* offset of the data in the spill file, -1 while in memory */
+	int64_t offset;
+};
+
+struct replay_segment {
+	volatile long refs;
+
+	DARRAY(struct replay_packet) packets;
+	int64_t start_dts_usec;
+	int64_t size;
+	uint32_t tracks;
+	bool keyframe;
+
+	/* no more packets are added once the next segment has started */
+	bool closed;
+	bool spilled;
+	bool removed;
+	struct dstr path;
+};
+
+struct replay_store {
+	char *name;
+	pthread_mutex_t mutex;
+
+	DARRAY(struct replay_segment *) segments;
+	int64_t size;
+	int64_t mem_size;
+	int keyframes;
+
+	int64_t max_memory;
+	struct dstr spill_dir;
+	long spill_tag;
+	uint64_t spill_count;
+	bool spill_failed;
+
+	pthread_t spill_thread;
+	os_sem_t *spill_sem;
+	volatile bool stop;
+};
+
+/* spill files are named after the session that wrote them, so the files a
+ * crashed session left behind can be told apart from the live ones */
+static pthread_once_t spill_session_once = PTHREAD_ONCE_INIT;
+static uint64_t spill_session = 0;
+static volatile long spill_tags = 0;
+
+static void spill_session_init(void)
+{
+	spill_session = os_gettime_ns();
+}
+
+static void segment_release(struct replay_segment *segment)
+{
+	if (!segment || os_atomic_dec_long(&segment->refs) != 0)
+		return;
+
+	for (size_t i = 0; i < segment->packets.num; i++)
+		obs_encoder_packet_release(&segment->packets.array[i].packet);
+	da_free(segment->packets);
+
+	if (segment->spilled)
+		os_unlink(segment->path.array);
+	dstr_free(&segment->path);
+	bfree(segment);
+}
+
+static inline void segment_addref(struct replay_segment *segment)
+{
+	os_atomic_inc_long(&segment->refs);
+}
+
+/* ------------------------------------------------------------------------ */
+
+static bool write_spill_file(struct replay_segment *segment, int64_t *offsets)
+{
+	FILE *file = os_fopen(segment->path.array, "wb");
+	int64_t offset = 0;
+	bool success = true;
+
+	if (!file)
+		return false;
+
+	for (size_t i = 0; i < segment->packets.num; i++) {
+		struct encoder_packet *pkt = &segment->packets.array[i].packet;
+
+		if (fwrite(pkt->data, 1, pkt->size, file) != pkt->size) {
+			success = false;
+			break;
+		}
+
+		offsets[i] = offset;
+		offset += (int64_t)pkt->size;
+	}
+
+	if (fclose(file) != 0)
+		success = false;
+	if (!success)
+		os_unlink(segment->path.array);
+	return success;
+}
+
+/* oldest finished segment still in memory, if over the memory limit */
+static struct replay_segment *next_spill_segment(struct replay_store *store)
+{
+	if (store->spill_failed || !store->max_memory ||
+	    store->mem_size <= store->max_memory)
+		return NULL;
+
+	for (size_t i = 0; i < store->segments.num; i++) {
+		struct replay_segment *segment = store->segments.array[i];
+		if (!segment->closed)
+			break;
+		if (!segment->spilled)
+			return segment;
+	}
+
+	return NULL;
+}
+
+static void spill_segment(struct replay_store *store,
+			  struct replay_segment *segment)
+{
+	int64_t *offsets =
+		bmalloc(sizeof(int64_t) * (segment->packets.num + 1));
+	bool success;
+
+	/* closed segments are only changed by this thread */
+	success = write_spill_file(segment, offsets);
+
+	pthread_mutex_lock(&store->mutex);
+
+	if (success) {
+		for (size_t i = 0; i < segment->packets.num; i++) {
+			struct replay_packet *rp = &segment->packets.array[i];
+			struct encoder_packet header = rp->packet;
+
+			obs_encoder_packet_release(&rp->packet);
+			rp->packet = header;
+			rp->packet.data = NULL;
+			rp->offset = offsets[i];
+		}
+
+		segment->spilled = true;
+		if (!segment->removed)
+			store->mem_size -= segment->size;
+
+	} else if (!store->spill_failed) {
+		warn("Failed to write spill file '%s', keeping the remaining "
+		     "packets in memory",
+		     segment->path.array);
+		store->spill_failed = true;
+	}
+
+	pthread_mutex_unlock(&store->mutex);
+	bfree(offsets);
+}
+
+static void *spill_thread(void *data)
+{
+	struct replay_store *store = data;
+
+	os_set_thread_name("replay-store: spill thread");
+
+	while (os_sem_wait(store->spill_sem) == 0) {
+		if (os_atomic_load_bool(&store->stop))
+			break;
+
+		for (;;) {
+			struct replay_segment *segment;
+
+			pthread_mutex_lock(&store->mutex);
+			segment = next_spill_segment(store);
+			if (segment) {
+				segment_addref(segment);
+				dstr_printf(&segment->path,
+					    "%s/replay-%" PRIx64 "-%ld-%" PRIu64
+					    ".spill",
+					    store->spill_dir.array,
+					    spill_session, store->spill_tag,
+					    store->spill_count++);
+			}
+			pthread_mutex_unlock(&store->mutex);
+
+			if (!segment)
+				break;
+
+			spill_segment(store, segment);
+			segment_release(segment);
+		}
+	}
+
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------ */
+
+replay_store_t *replay_store_create(const char *name)
+{
+	struct replay_store *store = bzalloc(sizeof(*store));
+	store->name = bstrdup(name);
+
+	pthread_once(&spill_session_once, spill_session_init);
+	store->spill_tag = os_atomic_inc_long(&spill_tags);
+
+	if (pthread_mutex_init(&store->mutex, NULL) != 0)
+		goto fail0;
+	if (os_sem_init(&store->spill_sem, 0) != 0)
+		goto fail1;
+
+	if (pthread_create(&store->spill_thread, NULL, spill_thread, store) !=
+	    0)
+		goto fail2;
+
+	return store;
+
+fail2:
+	os_sem_destroy(store->spill_sem);
+fail1:
+	pthread_mutex_destroy(&store->mutex);
+fail0:
+	bfree(store->name);
+	bfree(store);
+	return NULL;
+}
+
+void replay_store_destroy(replay_store_t *store)
+{
+	if (!store)
+		return;
+
+	os_atomic_set_bool(&store->stop, true);
+	os_sem_post(store->spill_sem);
+	pthread_join(store->spill_thread, NULL);
+
+	replay_store_clear(store);
+
+	da_free(store->segments);
+	dstr_free(&store->spill_dir);
+	os_sem_destroy(store->spill_sem);
+	pthread_mutex_destroy(&store->mutex);
+	bfree(store->name);
+	bfree(store);
+}
+
+static bool is_stale_spill_file(const char *name)
+{
+	const char *ext = strrchr(name, '.');
+	char *end;
+
+	if (strncmp(name, "replay-", 7) != 0 || !ext ||
+	    strcmp(ext, ".spill") != 0)
+		return false;
+
+	uint64_t session = strtoull(name + 7, &end, 16);
+	return *end != '-' || session != spill_session;
+}
+
+/* removes the spill files of earlier sessions */
+static void remove_stale_spill_files(struct replay_store *store,
+				     const char *spill_dir)
+{
+	os_dir_t *dir = os_opendir(spill_dir);
+	struct os_dirent *ent;
+	struct dstr path = {0};
+	int removed = 0;
+
+	if (!dir)
+		return;
+
+	while ((ent = os_readdir(dir)) != NULL) {
+		if (ent->directory || !is_stale_spill_file(ent->d_name))
+			continue;
+
+		dstr_printf(&path, "%s/%s", spill_dir, ent->d_name);
+		if (os_unlink(path.array) == 0)
+			removed++;
+	}
+
+	os_closedir(dir);
+	dstr_free(&path);
+
+	if (removed)
+		info("Removed %d stale spill files from '%s'", removed,
+		     spill_dir);
+}
+
+void replay_store_set_memory_limit(replay_store_t *store, int64_t max_memory,
+				   const char *spill_dir)
+{
+	if (max_memory && spill_dir) {
+		os_mkdirs(spill_dir);
+		remove_stale_spill_files(store, spill_dir);
+	}
+
+	pthread_mutex_lock(&store->mutex);
+	store->max_memory = max_memory;
+	store->spill_failed = false;
+	dstr_copy(&store->spill_dir, spill_dir);
+	pthread_mutex_unlock(&store->mutex);
+
+	if (max_memory) {
+		info("Keeping up to %" PRId64 " MB in memory, spilling to '%s'",
+		     max_memory / (1024 * 1024), spill_dir);
+		os_sem_post(store->spill_sem);
+	}
+}
+
+/* removes the front segment, the caller releases it after unlocking */
+static struct replay_segment *pop_segment(struct replay_store *store)
+{
+	struct replay_segment *segment = store->segments.array[0];
+
+	store->size -= segment->size;
+	if (!segment->spilled)
+		store->mem_size -= segment->size;
+	if (segment->keyframe)
+		store->keyframes--;
+
+	segment->removed = true;
+	da_erase(store->segments, 0);
+	return segment;
+}
+
+void replay_store_clear(replay_store_t *store)
+{
+	DARRAY(struct replay_segment *) removed;
+
+	if (!store)
+		return;
+
+	pthread_mutex_lock(&store->mutex);
+	removed.da = store->segments.da;
+	for (size_t i = 0; i < removed.num; i++)
+		removed.array[i]->removed = true;
+	da_init(store->segments);
+	store->size = 0;
+	store->mem_size = 0;
+	store->keyframes = 0;
+	pthread_mutex_unlock(&store->mutex);
+
+	for (size_t i = 0; i < removed.num; i++)
+		segment_release(removed.array[i]);
+	da_free(removed);
+}
+
+void replay_store_purge(replay_store_t *store, int64_t max_size,
+			int64_t max_time, const struct encoder_packet *next)
+{
+	DARRAY(struct replay_segment *) removed = {0};
+
+	pthread_mutex_lock(&store->mutex);
+
+	while (store->segments.num && store->keyframes > 2) {
+		struct replay_segment *first = store->segments.array[0];
+		bool over_size = max_size &&
+				 store->size + (int64_t)next->size > max_size;
+		bool over_time = next->dts_usec - first->start_dts_usec >
+				 max_time;
+
+		if (!over_size && !over_time)
+			break;
+
+		struct replay_segment *segment = pop_segment(store);
+		da_push_back(removed, &segment);
+	}
+
+	pthread_mutex_unlock(&store->mutex);
+
+	for (size_t i = 0; i < removed.num; i++)
+		segment_release(removed.array[i]);
+	da_free(removed);
+}
+
+void replay_store_push(replay_store_t *store, struct encoder_packet *packet)
+{
+	bool keyframe = packet->type == OBS_ENCODER_VIDEO && packet->keyframe;
+	struct replay_segment *segment = NULL;
+	struct replay_packet *rp;
+	bool spill;
+
+	pthread_mutex_lock(&store->mutex);
+
+	if (store->segments.num)
+		segment = store->segments.array[store->segments.num - 1];
+
+	if (!segment || keyframe) {
+		if (segment)
+			segment->closed = true;
+
+		segment = bzalloc(sizeof(*segment));
+		segment->refs = 1;
+		segment->start_dts_usec = packet->dts_usec;
+		segment->keyframe = keyframe;
+		da_push_back(store->segments, &segment);
+
+		if (keyframe)
+			store->keyframes++;
+	}
+
+	rp = da_push_back_new(segment->packets);
+	obs_encoder_packet_ref(&rp->packet, packet);
+	rp->offset = -1;
+
+	segment->size += (int64_t)packet->size;
+	segment->tracks |= 1 << packet_track(packet);
+	store->size += (int64_t)packet->size;
+	store->mem_size += (int64_t)packet->size;
+
+	spill = next_spill_segment(store) != NULL;
+
+	pthread_mutex_unlock(&store->mutex);
+
+	if (spill)
+		os_sem_post(store->spill_sem);
+}
+
+int64_t replay_store_get_size(replay_store_t *store)
+{
+	pthread_mutex_lock(&store->mutex);
+	int64_t size = store->size;
+	pthread_mutex_unlock(&store->mutex);
+	return size;
+}
+
+int64_t replay_store_get_memory_size(replay_store_t *store)
+{
+	pthread_mutex_lock(&store->mutex);
+	int64_t size = store->mem_size;
+	pthread_mutex_unlock(&store->mutex);
+	return size;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* packets of a segment as of when the snapshot was taken */
+struct segment_view {
+	struct replay_segment *segment;
+	size_t count;
+	uint32_t tracks;
+	DARRAY(struct replay_packet) packets;
+	bool loaded;
+	FILE *file;
+};
+
+struct track_cursor {
+	size_t seg;
+	size_t idx;
+	bool done;
+};
+
+struct replay_snapshot {
+	struct replay_store *store;
+	DARRAY(struct segment_view) views;
+	DARRAY(uint8_t) buffer;
+};
+
+replay_snapshot_t *replay_store_snapshot(replay_store_t *store)
+{
+	struct replay_snapshot *snapshot = bzalloc(sizeof(*snapshot));
+	snapshot->store = store;
+
+	pthread_mutex_lock(&store->mutex);
+
+	da_resize(snapshot->views, store->segments.num);
+	for (size_t i = 0; i < store->segments.num; i++) {
+		struct segment_view *view = &snapshot->views.array[i];
+
+		memset(view, 0, sizeof(*view));
+		view->segment = store->segments.array[i];
+		view->count = view->segment->packets.num;
+		view->tracks = view->segment->tracks;
+		segment_addref(view->segment);
+	}
+
+	pthread_mutex_unlock(&store->mutex);
+	return snapshot;
+}
+
+static void unload_view(struct segment_view *view)
+{
+	for (size_t i = 0; i < view->packets.num; i++)
+		obs_encoder_packet_release(&view->packets.array[i].packet);
+	da_free(view->packets);
+
+	if (view->file) {
+		fclose(view->file);
+		view->file = NULL;
+	}
+
+	segment_release(view->segment);
+	view->segment = NULL;
+}
+
+void replay_snapshot_destroy(replay_snapshot_t *snapshot)
+{
+	if (!snapshot)
+		return;
+
+	for (size_t i = 0; i < snapshot->views.num; i++) {
+		if (snapshot->views.array[i].segment)
+			unload_view(&snapshot->views.array[i]);
+	}
+
+	da_free(snapshot->views);
+	da_free(snapshot->buffer);
+	bfree(snapshot);
+}
+
+static void load_view(struct replay_snapshot *snapshot,
+		      struct segment_view *view)
+{
+	struct replay_segment *segment = view->segment;
+
+	/* the spill thread can release the data at any time, so reference
+	 * what is still in memory right away */
+	pthread_mutex_lock(&snapshot->store->mutex);
+
+	da_resize(view->packets, view->count);
+	for (size_t i = 0; i < view->count; i++) {
+		struct replay_packet *src = &segment->packets.array[i];
+		struct replay_packet *dst = &view->packets.array[i];
+
+		if (src->packet.data)
+			obs_encoder_packet_ref(&dst->packet, &src->packet);
+		else
+			dst->packet = src->packet;
+		dst->offset = src->offset;
+	}
+
+	pthread_mutex_unlock(&snapshot->store->mutex);
+	view->loaded = true;
+}
+
+static bool advance_cursor(struct replay_snapshot *snapshot,
+			   struct track_cursor *cursor, size_t track)
+{
+	while (cursor->seg < snapshot->views.num) {
+		struct segment_view *view = &snapshot->views.array[cursor->seg];
+
+		if (view->tracks & (1 << track)) {
+			if (!view->loaded)
+				load_view(snapshot, view);
+
+			for (; cursor->idx < view->packets.num; cursor->idx++) {
+				struct encoder_packet *pkt =
+					&view->packets.array[cursor->idx].packet;
+				if (packet_track(pkt) == track)
+					return true;
+			}
+		}
+
+		cursor->seg++;
+		cursor->idx = 0;
+	}
+
+	cursor->done = true;
+	return false;
+}
+
+static inline struct replay_packet *
+cursor_packet(struct replay_snapshot *snapshot, struct track_cursor *cursor)
+{
+	return &snapshot->views.array[cursor->seg].packets.array[cursor->idx];
+}
+
+static bool read_packet_data(struct replay_snapshot *snapshot,
+			     struct segment_view *view,
+			     struct encoder_packet *pkt, int64_t offset)
+{
+	struct replay_store *store = snapshot->store;
+
+	if (!view->file) {
+		view->file = os_fopen(view->segment->path.array, "rb");
+		if (!view->file) {
+			warn("Failed to open spill file '%s'",
+			     view->segment->path.array);
+			return false;
+		}
+	}
+
+	da_resize(snapshot->buffer, pkt->size);
+
+	if (os_fseeki64(view->file, offset, SEEK_SET) != 0 ||
+	    fread(snapshot->buffer.array, 1, pkt->size, view->file) !=
+		    pkt->size) {
+		warn("Failed to read spill file '%s'",
+		     view->segment->path.array);
+		return false;
+	}
+
+	pkt->data = snapshot->buffer.array;
+	return true;
+}
+
+bool replay_snapshot_write(replay_snapshot_t *snapshot, replay_write_t write,
+			   void *param)
+{
+	struct track_cursor cursors[MAX_TRACKS] = {0};
+	int64_t usec_offsets[MAX_TRACKS] = {0};
+	int64_t ts_offsets[MAX_TRACKS] = {0};
+	size_t unloaded = 0;
+
+	/* each track starts at the first packet it has in the snapshot */
+	for (size_t i = 0; i < MAX_TRACKS; i++) {
+		if (!advance_cursor(snapshot, &cursors[i], i))
+			continue;
+
+		struct encoder_packet *pkt =
+			&cursor_packet(snapshot, &cursors[i])->packet;
+
+		if (i == 0) {
+			ts_offsets[i] = pkt->pts;
+			usec_offsets[i] = pkt->pts * 1000000 /
+					  pkt->timebase_den;
+		} else {
+			ts_offsets[i] = pkt->dts;
+			usec_offsets[i] = pkt->dts_usec;
+		}
+	}
+
+	for (;;) {
+		struct track_cursor *next = NULL;
+		int64_t next_usec = 0;
+		size_t next_track = 0;
+
+		/* every track is in order, so the next packet to write is the
+		 * earliest of their heads, ties go to the one added first */
+		for (size_t i = 0; i < MAX_TRACKS; i++) {
+			struct track_cursor *cursor = &cursors[i];
+			if (cursor->done)
+				continue;
+
+			int64_t usec =
+				cursor_packet(snapshot, cursor)->packet.dts_usec -
+				usec_offsets[i];
+
+			if (!next || usec < next_usec ||
+			    (usec == next_usec &&
+			     (cursor->seg < next->seg ||
+			      (cursor->seg == next->seg &&
+			       cursor->idx < next->idx)))) {
+				next = cursor;
+				next_usec = usec;
+				next_track = i;
+			}
+		}
+
+		if (!next)
+			break;
+
+		struct segment_view *view = &snapshot->views.array[next->seg];
+		struct replay_packet *rp = cursor_packet(snapshot, next);
+		struct encoder_packet pkt = rp->packet;
+
+		pkt.dts_usec = next_usec;
+		pkt.dts -= ts_offsets[next_track];
+		pkt.pts -= ts_offsets[next_track];
+
+		if (rp->offset >= 0 &&
+		    !read_packet_data(snapshot, view, &pkt, rp->offset))
+			return false;
+		if (!write(param, &pkt))
+			return false;
+
+		next->idx++;
+		advance_cursor(snapshot, next, next_track);
+
+		/* drop the segments every track is done with */
+		size_t min_seg = snapshot->views.num;
+		for (size_t i = 0; i < MAX_TRACKS; i++) {
+			if (!cursors[i].done && cursors[i].seg < min_seg)
+				min_seg = cursors[i].seg;
+		}
+
+		for (; unloaded < min_seg; unloaded++)
+			unload_view(&snapshot->views.array[unloaded]);
+	}
+
+	return true;
+}
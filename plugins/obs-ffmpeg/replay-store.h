@@ -0,0 +1,59 @@
+#pragma once
+
+#include <obs.h>
+
+/*
+ * Segmented replay buffer storage.
+ *
+ *   Packets are grouped into segments that each start at a video keyframe,
+ * and the segments are kept oldest first, so they are indexed both by
+ * keyframe and by dts.  Purging drops whole segments from the front.
+ *
+ *   When a memory limit is set, a spill thread writes the oldest finished
+ * segments to files in the spill directory and releases their packet data
+ * until the packets kept in memory fit the limit again.  Only the packet
+ * headers of spilled segments stay in memory.
+ *
+ *   Saving takes a snapshot of the current segments and writes them out in
+ * order, merging the tracks as it goes, so nothing has to be sorted.
+ */
+
+struct replay_store;
+struct replay_snapshot;
+typedef struct replay_store replay_store_t;
+typedef struct replay_snapshot replay_snapshot_t;
+
+typedef bool (*replay_write_t)(void *param, struct encoder_packet *packet);
+
+extern replay_store_t *replay_store_create(const char *name);
+extern void replay_store_destroy(replay_store_t *store);
+
+/* a max_memory of 0 keeps every packet in memory, spill files left in
+ * spill_dir by earlier sessions are removed */
+extern void replay_store_set_memory_limit(replay_store_t *store,
+					  int64_t max_memory,
+					  const char *spill_dir);
+
+extern void replay_store_clear(replay_store_t *store);
+
+/* drops segments from the front until the next packet fits max_size bytes
+ * and max_time microseconds, always keeping the last two keyframes */
+extern void replay_store_purge(replay_store_t *store, int64_t max_size,
+			       int64_t max_time,
+			       const struct encoder_packet *next);
+
+/* adds a reference to the packet */
+extern void replay_store_push(replay_store_t *store,
+			      struct encoder_packet *packet);
+
+extern int64_t replay_store_get_size(replay_store_t *store);
+extern int64_t replay_store_get_memory_size(replay_store_t *store);
+
+/* the store has to outlive its snapshots */
+extern replay_snapshot_t *replay_store_snapshot(replay_store_t *store);
+extern void replay_snapshot_destroy(replay_snapshot_t *snapshot);
+
+/* writes every packet of the snapshot in dts order, with the timestamps of
+ * each track made to start at zero */
+extern bool replay_snapshot_write(replay_snapshot_t *snapshot,
+				  replay_write_t write, void *param);
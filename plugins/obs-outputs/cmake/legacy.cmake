@@ -23,6 +23,7 @@ target_sources(
           net-if.c
           net-if.h
           null-output.c
+          packet-ring.h
           rtmp-helpers.h
           rtmp-stream.c
           rtmp-stream.h
@@ -250,72 +250,150 @@ void flv_meta_data(obs_output_t *context, uint8_t **output, size_t *size,
 static int32_t last_time = 0;
 #endif
 
-static void flv_video(struct serializer *s, int32_t dts_offset,
-		      struct encoder_packet *packet, bool is_header)
+static inline void w8(struct flv_tag_prefix *prefix, uint8_t val)
+{
+	prefix->data[prefix->size++] = val;
+}
+
+static inline void wb24(struct flv_tag_prefix *prefix, uint32_t val)
+{
+	w8(prefix, (uint8_t)(val >> 16));
+	w8(prefix, (uint8_t)(val >> 8));
+	w8(prefix, (uint8_t)val);
+}
+
+static void w4cc(struct flv_tag_prefix *prefix, enum video_id_t id)
+{
+	switch (id) {
+	case CODEC_AV1:
+		w8(prefix, 'a');
+		w8(prefix, 'v');
+		w8(prefix, '0');
+		w8(prefix, '1');
+		break;
+#ifdef ENABLE_HEVC
+	case CODEC_HEVC:
+		w8(prefix, 'h');
+		w8(prefix, 'v');
+		w8(prefix, 'c');
+		w8(prefix, '1');
+		break;
+#endif
+	case CODEC_H264:
+		assert(0);
+	}
+}
+
+static inline void prefix_init(struct flv_tag_prefix *prefix, uint8_t type,
+			       int32_t time_ms)
+{
+	prefix->type = type;
+	prefix->time_ms = time_ms;
+	prefix->timestamp = ((uint32_t)time_ms & 0xFFFFFF) |
+			    (((uint32_t)(time_ms >> 24) & 0x7F) << 24);
+	prefix->size = 0;
+}
+
+void flv_packet_prefix(struct encoder_packet *packet, int32_t dts_offset,
+		       bool is_header, struct flv_tag_prefix *prefix)
 {
-	int64_t offset = packet->pts - packet->dts;
 	int32_t time_ms = get_ms_time(packet, packet->dts) - dts_offset;
 
-	if (!packet->data || !packet->size)
-		return;
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		int64_t offset = packet->pts - packet->dts;
+
+		prefix_init(prefix, RTMP_PACKET_TYPE_VIDEO, time_ms);
+		w8(prefix, packet->keyframe ? 0x17 : 0x27);
+		w8(prefix, is_header ? 0 : 1);
+		wb24(prefix, get_ms_time(packet, offset));
+	} else {
+		prefix_init(prefix, RTMP_PACKET_TYPE_AUDIO, time_ms);
+		w8(prefix, 0xaf);
+		w8(prefix, is_header ? 0 : 1);
+	}
+}
 
-	s_w8(s, RTMP_PACKET_TYPE_VIDEO);
+// Y2023 spec
+static void flv_packet_ex_prefix(struct encoder_packet *packet,
+				 enum video_id_t codec_id, int32_t dts_offset,
+				 int type, struct flv_tag_prefix *prefix)
+{
+	int32_t time_ms = get_ms_time(packet, packet->dts) - dts_offset;
 
-#ifdef DEBUG_TIMESTAMPS
-	blog(LOG_DEBUG, "Video: %lu", time_ms);
+	assert(packet->type == OBS_ENCODER_VIDEO);
 
-	if (last_time > time_ms)
-		blog(LOG_DEBUG, "Non-monotonic");
+	prefix_init(prefix, RTMP_PACKET_TYPE_VIDEO, time_ms);
 
-	last_time = time_ms;
+	// packet ext header
+	w8(prefix,
+	   FRAME_HEADER_EX | type | (packet->keyframe ? FT_KEY : FT_INTER));
+	w4cc(prefix, codec_id);
+
+#ifdef ENABLE_HEVC
+	// hevc composition time offset
+	if (codec_id == CODEC_HEVC && type == PACKETTYPE_FRAMES) {
+		wb24(prefix, get_ms_time(packet, packet->pts - packet->dts));
+	}
 #endif
+}
 
-	s_wb24(s, (uint32_t)packet->size + 5);
-	s_wb24(s, (uint32_t)time_ms);
-	s_w8(s, (time_ms >> 24) & 0x7F);
-	s_wb24(s, 0);
+static void flv_tag(struct serializer *s, struct encoder_packet *packet,
+		    const struct flv_tag_prefix *prefix)
+{
+	s_w8(s, prefix->type);
+	s_wb24(s, (uint32_t)(packet->size + prefix->size));
+	s_wtimestamp(s, prefix->time_ms);
+	s_wb24(s, 0); // always 0
 
-	/* these are the 5 extra bytes mentioned above */
-	s_w8(s, packet->keyframe ? 0x17 : 0x27);
-	s_w8(s, is_header ? 0 : 1);
-	s_wb24(s, get_ms_time(packet, offset));
+	s_write(s, prefix->data, prefix->size);
 	s_write(s, packet->data, packet->size);
 
 	/* write tag size (starting byte doesn't count) */
 	s_wb32(s, (uint32_t)serializer_get_pos(s) - 1);
 }
 
-static void flv_audio(struct serializer *s, int32_t dts_offset,
+static void flv_video(struct serializer *s, int32_t dts_offset,
 		      struct encoder_packet *packet, bool is_header)
 {
-	int32_t time_ms = get_ms_time(packet, packet->dts) - dts_offset;
+	struct flv_tag_prefix prefix;
 
 	if (!packet->data || !packet->size)
 		return;
 
-	s_w8(s, RTMP_PACKET_TYPE_AUDIO);
+	flv_packet_prefix(packet, dts_offset, is_header, &prefix);
 
 #ifdef DEBUG_TIMESTAMPS
-	blog(LOG_DEBUG, "Audio: %lu", time_ms);
+	blog(LOG_DEBUG, "Video: %lu", prefix.time_ms);
 
-	if (last_time > time_ms)
+	if (last_time > prefix.time_ms)
 		blog(LOG_DEBUG, "Non-monotonic");
 
-	last_time = time_ms;
+	last_time = prefix.time_ms;
 #endif
 
-	s_wb24(s, (uint32_t)packet->size + 2);
-	s_wb24(s, (uint32_t)time_ms);
-	s_w8(s, (time_ms >> 24) & 0x7F);
-	s_wb24(s, 0);
+	flv_tag(s, packet, &prefix);
+}
 
-	/* these are the two extra bytes mentioned above */
-	s_w8(s, 0xaf);
-	s_w8(s, is_header ? 0 : 1);
-	s_write(s, packet->data, packet->size);
+static void flv_audio(struct serializer *s, int32_t dts_offset,
+		      struct encoder_packet *packet, bool is_header)
+{
+	struct flv_tag_prefix prefix;
 
-	/* write tag size (starting byte doesn't count) */
-	s_wb32(s, (uint32_t)serializer_get_pos(s) - 1);
+	if (!packet->data || !packet->size)
+		return;
+
+	flv_packet_prefix(packet, dts_offset, is_header, &prefix);
+
+#ifdef DEBUG_TIMESTAMPS
+	blog(LOG_DEBUG, "Audio: %lu", prefix.time_ms);
+
+	if (last_time > prefix.time_ms)
+		blog(LOG_DEBUG, "Non-monotonic");
+
+	last_time = prefix.time_ms;
+#endif
+
+	flv_tag(s, packet, &prefix);
 }
 
 void flv_packet_mux(struct encoder_packet *packet, int32_t dts_offset,
@@ -341,42 +419,11 @@ void flv_packet_ex(struct encoder_packet *packet, enum video_id_t codec_id,
 {
 	struct array_output_data data;
 	struct serializer s;
+	struct flv_tag_prefix prefix;
 	array_output_serializer_init(&s, &data);
 
-	assert(packet->type == OBS_ENCODER_VIDEO);
-
-	int32_t time_ms = get_ms_time(packet, packet->dts) - dts_offset;
-
-	// packet head
-	int header_metadata_size = 5;
-#ifdef ENABLE_HEVC
-	// 3 extra bytes for composition time offset
-	if (codec_id == CODEC_HEVC && type == PACKETTYPE_FRAMES) {
-		header_metadata_size = 8;
-	}
-#endif
-	s_w8(&s, RTMP_PACKET_TYPE_VIDEO);
-	s_wb24(&s, (uint32_t)packet->size + header_metadata_size);
-	s_wtimestamp(&s, time_ms);
-	s_wb24(&s, 0); // always 0
-
-	// packet ext header
-	s_w8(&s,
-	     FRAME_HEADER_EX | type | (packet->keyframe ? FT_KEY : FT_INTER));
-	s_w4cc(&s, codec_id);
-
-#ifdef ENABLE_HEVC
-	// hevc composition time offset
-	if (codec_id == CODEC_HEVC && type == PACKETTYPE_FRAMES) {
-		s_wb24(&s, get_ms_time(packet, packet->pts - packet->dts));
-	}
-#endif
-
-	// packet data
-	s_write(&s, packet->data, packet->size);
-
-	// packet tail
-	s_wb32(&s, (uint32_t)serializer_get_pos(&s) - 1);
+	flv_packet_ex_prefix(packet, codec_id, dts_offset, type, &prefix);
+	flv_tag(&s, packet, &prefix);
 
 	*output = data.bytes.array;
 	*size = data.bytes.num;
@@ -388,8 +435,8 @@ void flv_packet_start(struct encoder_packet *packet, enum video_id_t codec,
 	flv_packet_ex(packet, codec, 0, output, size, PACKETTYPE_SEQ_START);
 }
 
-void flv_packet_frames(struct encoder_packet *packet, enum video_id_t codec,
-		       int32_t dts_offset, uint8_t **output, size_t *size)
+static inline int frames_packet_type(struct encoder_packet *packet,
+				     enum video_id_t codec)
 {
 	int packet_type = PACKETTYPE_FRAMES;
 #ifdef ENABLE_HEVC
@@ -397,8 +444,26 @@ void flv_packet_frames(struct encoder_packet *packet, enum video_id_t codec,
 	// time offsets of 0. See Enhanced RTMP spec.
 	if (codec == CODEC_HEVC && packet->dts == packet->pts)
 		packet_type = PACKETTYPE_FRAMESX;
+#else
+	UNUSED_PARAMETER(packet);
+	UNUSED_PARAMETER(codec);
 #endif
-	flv_packet_ex(packet, codec, dts_offset, output, size, packet_type);
+	return packet_type;
+}
+
+void flv_packet_frames(struct encoder_packet *packet, enum video_id_t codec,
+		       int32_t dts_offset, uint8_t **output, size_t *size)
+{
+	flv_packet_ex(packet, codec, dts_offset, output, size,
+		      frames_packet_type(packet, codec));
+}
+
+void flv_packet_frames_prefix(struct encoder_packet *packet,
+			      enum video_id_t codec, int32_t dts_offset,
+			      struct flv_tag_prefix *prefix)
+{
+	flv_packet_ex_prefix(packet, codec, dts_offset,
+			     frames_packet_type(packet, codec), prefix);
 }
 
 void flv_packet_end(struct encoder_packet *packet, enum video_id_t codec,
@@ -47,6 +47,15 @@ static int32_t get_ms_time(struct encoder_packet *packet, int64_t val)
 	return (int32_t)(val * MILLISECOND_DEN / packet->timebase_den);
 }
 
+/* the part of an FLV audio/video tag that precedes the encoded data */
+struct flv_tag_prefix {
+	uint8_t type;
+	int32_t time_ms;
+	uint32_t timestamp; /* time_ms as stored in the tag header */
+	uint8_t data[8];
+	size_t size;
+};
+
 extern void write_file_info(FILE *file, int64_t duration_ms, int64_t size);
 
 extern void flv_meta_data(obs_output_t *context, uint8_t **output, size_t *size,
@@ -66,6 +75,12 @@ extern void flv_packet_start(struct encoder_packet *packet,
 extern void flv_packet_frames(struct encoder_packet *packet,
 			      enum video_id_t codec, int32_t dts_offset,
 			      uint8_t **output, size_t *size);
+extern void flv_packet_prefix(struct encoder_packet *packet,
+			      int32_t dts_offset, bool is_header,
+			      struct flv_tag_prefix *prefix);
+extern void flv_packet_frames_prefix(struct encoder_packet *packet,
+				     enum video_id_t codec, int32_t dts_offset,
+				     struct flv_tag_prefix *prefix);
 extern void flv_packet_end(struct encoder_packet *packet, enum video_id_t codec,
 			   uint8_t **output, size_t *size);
 extern void flv_packet_metadata(enum video_id_t codec, uint8_t **output,
@@ -5375,3 +5375,291 @@ RTMP_Write(RTMP *r, const char *buf, int size, int streamIdx)
     }
     return size+s2;
 }
+
+#ifndef _WIN32
+#include <sys/uio.h>
+
+#define RTMP_MAX_IOV 64
+
+static int
+WriteV(RTMP *r, struct iovec *iov, int iovcnt)
+{
+    struct linger l;
+
+    while (iovcnt > 0)
+    {
+        struct msghdr msg;
+        ssize_t nBytes;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+
+        nBytes = sendmsg(r->m_sb.sb_socket, &msg, MSG_NOSIGNAL);
+        if (nBytes < 0)
+        {
+            int sockerr = GetSockError();
+            RTMP_Log(RTMP_LOGERROR, "%s, RTMP send error %d", __FUNCTION__,
+                     sockerr);
+
+            if (sockerr == EINTR && !RTMP_ctrlC)
+                continue;
+
+            r->last_error_code = sockerr;
+
+            /* same abortive shutdown as WriteN */
+            l.l_onoff = 1;
+            l.l_linger = 0;
+            setsockopt(r->m_sb.sb_socket, SOL_SOCKET, SO_LINGER, (char *)&l, sizeof(l));
+            RTMPSockBuf_Close(&r->m_sb);
+
+            RTMP_Close(r);
+            return FALSE;
+        }
+
+        if (nBytes == 0)
+            return FALSE;
+
+        /* skip what was sent, partial writes can end mid-entry */
+        while (iovcnt > 0 && (size_t)nBytes >= iov->iov_len)
+        {
+            nBytes -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + nBytes;
+            iov->iov_len -= nBytes;
+        }
+    }
+
+    return TRUE;
+}
+
+/* Chunks the body straight out of the caller's buffers. Mirrors the header
+ * handling of RTMP_SendPacket, including reusing the previous packet's
+ * attributes on the channel. */
+static int
+SendPacketVec(RTMP *r, RTMPPacket *packet, const RTMPIOVec *body, int nbody)
+{
+    const RTMPPacket *prevPacket;
+    struct iovec iov[RTMP_MAX_IOV];
+    int iovcnt = 0;
+    uint32_t last = 0;
+    int nSize, hSize = 0, cSize = 0;
+    char hbuf[RTMP_MAX_HEADER_SIZE], cbuf[3], c;
+    uint32_t t;
+    int nChunkSize = r->m_outChunkSize;
+    int part = 0, partOffset = 0;
+    int remaining;
+
+    if (packet->m_nChannel >= r->m_channelsAllocatedOut)
+    {
+        int n = packet->m_nChannel + 10;
+        RTMPPacket **packets = realloc(r->m_vecChannelsOut, sizeof(RTMPPacket*) * n);
+        if (!packets)
+        {
+            free(r->m_vecChannelsOut);
+            r->m_vecChannelsOut = NULL;
+            r->m_channelsAllocatedOut = 0;
+            return FALSE;
+        }
+        r->m_vecChannelsOut = packets;
+        memset(r->m_vecChannelsOut + r->m_channelsAllocatedOut, 0, sizeof(RTMPPacket*) * (n - r->m_channelsAllocatedOut));
+        r->m_channelsAllocatedOut = n;
+    }
+
+    prevPacket = r->m_vecChannelsOut[packet->m_nChannel];
+    if (prevPacket && packet->m_headerType != RTMP_PACKET_SIZE_LARGE)
+    {
+        if (prevPacket->m_nBodySize == packet->m_nBodySize
+                && prevPacket->m_packetType == packet->m_packetType
+                && packet->m_headerType == RTMP_PACKET_SIZE_MEDIUM)
+            packet->m_headerType = RTMP_PACKET_SIZE_SMALL;
+
+        if (prevPacket->m_nTimeStamp == packet->m_nTimeStamp
+                && packet->m_headerType == RTMP_PACKET_SIZE_SMALL)
+            packet->m_headerType = RTMP_PACKET_SIZE_MINIMUM;
+        last = prevPacket->m_nTimeStamp;
+    }
+
+    nSize = packetSize[packet->m_headerType];
+    t = packet->m_nTimeStamp - last;
+
+    if (packet->m_nChannel > 319)
+        cSize = 2;
+    else if (packet->m_nChannel > 63)
+        cSize = 1;
+
+    c = packet->m_headerType << 6;
+    switch (cSize)
+    {
+    case 0:
+        c |= packet->m_nChannel;
+        break;
+    case 1:
+        break;
+    case 2:
+        c |= 1;
+        break;
+    }
+
+    hbuf[hSize++] = c;
+    if (cSize)
+    {
+        int tmp = packet->m_nChannel - 64;
+        hbuf[hSize++] = tmp & 0xff;
+        if (cSize == 2)
+            hbuf[hSize++] = tmp >> 8;
+    }
+
+    if (nSize > 1)
+    {
+        AMF_EncodeInt24(hbuf + hSize, hbuf + sizeof(hbuf), t > 0xffffff ? 0xffffff : t);
+        hSize += 3;
+    }
+
+    if (nSize > 4)
+    {
+        AMF_EncodeInt24(hbuf + hSize, hbuf + sizeof(hbuf), packet->m_nBodySize);
+        hSize += 3;
+        hbuf[hSize++] = packet->m_packetType;
+    }
+
+    if (nSize > 8)
+        hSize += EncodeInt32LE(hbuf + hSize, packet->m_nInfoField2);
+
+    if (nSize > 1 && t >= 0xffffff)
+    {
+        AMF_EncodeInt32(hbuf + hSize, hbuf + sizeof(hbuf), t);
+        hSize += 4;
+    }
+
+    /* every continuation chunk shares the same basic header */
+    cbuf[0] = (0xc0 | c);
+    if (cSize)
+    {
+        int tmp = packet->m_nChannel - 64;
+        cbuf[1] = tmp & 0xff;
+        if (cSize == 2)
+            cbuf[2] = tmp >> 8;
+    }
+
+    iov[iovcnt].iov_base = hbuf;
+    iov[iovcnt].iov_len = hSize;
+    iovcnt++;
+
+    remaining = packet->m_nBodySize;
+    while (remaining > 0)
+    {
+        int chunk = remaining < nChunkSize ? remaining : nChunkSize;
+
+        remaining -= chunk;
+
+        while (chunk > 0)
+        {
+            int len = body[part].len - partOffset;
+            if (len > chunk)
+                len = chunk;
+
+            if (len > 0)
+            {
+                iov[iovcnt].iov_base = (char *)body[part].base + partOffset;
+                iov[iovcnt].iov_len = len;
+                iovcnt++;
+            }
+
+            chunk -= len;
+            partOffset += len;
+            if (partOffset == body[part].len && part + 1 < nbody)
+            {
+                part++;
+                partOffset = 0;
+            }
+
+            /* keep room for a continuation header plus one slice */
+            if (iovcnt >= RTMP_MAX_IOV - 2)
+            {
+                if (!WriteV(r, iov, iovcnt))
+                    return FALSE;
+                iovcnt = 0;
+            }
+        }
+
+        if (remaining > 0)
+        {
+            iov[iovcnt].iov_base = cbuf;
+            iov[iovcnt].iov_len = 1 + cSize;
+            iovcnt++;
+        }
+    }
+
+    if (iovcnt && !WriteV(r, iov, iovcnt))
+        return FALSE;
+
+    if (!r->m_vecChannelsOut[packet->m_nChannel])
+        r->m_vecChannelsOut[packet->m_nChannel] = malloc(sizeof(RTMPPacket));
+    memcpy(r->m_vecChannelsOut[packet->m_nChannel], packet, sizeof(RTMPPacket));
+    r->m_vecChannelsOut[packet->m_nChannel]->m_body = NULL;
+    return TRUE;
+}
+#endif
+
+/* Sends one audio/video/data message whose body is split over several
+ * buffers, e.g. a small FLV tag prefix followed by the encoded frame.  On
+ * plain TCP the chunks are gathered straight from those buffers with
+ * sendmsg(), otherwise the body is assembled once and sent the usual way. */
+int
+RTMP_WriteVec(RTMP *r, int packetType, uint32_t timestamp,
+              const RTMPIOVec *body, int nbody, int streamIdx)
+{
+    RTMPPacket pkt;
+    uint32_t size = 0;
+    int ret;
+
+    for (int i = 0; i < nbody; i++)
+        size += body[i].len;
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.m_nChannel = 0x04;	/* source channel */
+    pkt.m_nInfoField2 = r->Link.streams[streamIdx].id;
+    pkt.m_packetType = packetType;
+    pkt.m_nBodySize = size;
+    pkt.m_nTimeStamp = timestamp;
+
+    if (((packetType == RTMP_PACKET_TYPE_AUDIO
+            || packetType == RTMP_PACKET_TYPE_VIDEO) &&
+            !timestamp) || packetType == RTMP_PACKET_TYPE_INFO)
+    {
+        pkt.m_headerType = RTMP_PACKET_SIZE_LARGE;
+    }
+    else
+    {
+        pkt.m_headerType = RTMP_PACKET_SIZE_MEDIUM;
+    }
+
+#ifndef _WIN32
+    if (!(r->Link.protocol & RTMP_FEATURE_HTTP) && !r->m_sb.sb_ssl &&
+            !(r->m_bCustomSend && r->m_customSendFunc) && size)
+    {
+        return SendPacketVec(r, &pkt, body, nbody) ? (int)size : -1;
+    }
+#endif
+
+    if (!RTMPPacket_Alloc(&pkt, size))
+    {
+        RTMP_Log(RTMP_LOGDEBUG, "%s, failed to allocate packet", __FUNCTION__);
+        return -1;
+    }
+
+    for (int i = 0, pos = 0; i < nbody; i++)
+    {
+        memcpy(pkt.m_body + pos, body[i].base, body[i].len);
+        pos += body[i].len;
+    }
+
+    ret = RTMP_SendPacket(r, &pkt, FALSE);
+    RTMPPacket_Free(&pkt);
+    return ret ? (int)size : -1;
+}
@@ -543,6 +543,15 @@ extern "C"
     int RTMP_Read(RTMP *r, char *buf, int size);
     int RTMP_Write(RTMP *r, const char *buf, int size, int streamIdx);
 
+    typedef struct RTMPIOVec
+    {
+        const char *base;
+        int len;
+    } RTMPIOVec;
+
+    int RTMP_WriteVec(RTMP *r, int packetType, uint32_t timestamp,
+                      const RTMPIOVec *body, int nbody, int streamIdx);
+
 #ifdef USE_HASHSWF
     /* hashswf.c */
     int RTMP_HashSWF(const char *url, unsigned int *size, unsigned char *hash,
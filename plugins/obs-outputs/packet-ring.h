@@ -0,0 +1,154 @@
+#pragma once
+
+#include <obs.h>
+#include <util/bmem.h>
+#include <util/circlebuf.h>
+#include <util/threading.h>
+
+/*
+ * Bounded single-producer/single-consumer packet ring.
+ *
+ * The producer only ever writes the tail index and the slots between tail and
+ * head + PACKET_RING_SIZE, the consumer only ever writes the head index, so
+ * neither side needs a lock.  Indices are free running and wrap around; the
+ * slot is the index masked by the (power of two) ring size.
+ *
+ * The producer may read (but not modify) slots that are still queued, which
+ * is what the rtmp drop policy uses to find out how much is buffered.
+ *
+ * Packets are never dropped when the ring is full.  They go to an overflow
+ * queue under a mutex instead, and keep going there until the consumer has
+ * emptied it, so the order is kept.  Only the consumer empties it, and only
+ * once the ring is empty.
+ */
+
+#define PACKET_RING_SIZE 4096
+#define PACKET_RING_MASK (PACKET_RING_SIZE - 1)
+
+struct packet_ring_slot {
+	struct encoder_packet packet;
+	uint64_t enqueue_ts;
+	bool overflow;
+};
+
+struct packet_ring {
+	struct packet_ring_slot *slots;
+	volatile long head;
+	volatile long tail;
+
+	pthread_mutex_t overflow_mutex;
+	struct circlebuf overflow;
+	volatile long overflow_count;
+};
+
+static inline bool packet_ring_init(struct packet_ring *ring)
+{
+	ring->slots = bzalloc(sizeof(struct packet_ring_slot) *
+			      PACKET_RING_SIZE);
+	ring->head = 0;
+	ring->tail = 0;
+	ring->overflow_count = 0;
+	circlebuf_init(&ring->overflow);
+	pthread_mutex_init_value(&ring->overflow_mutex);
+	return pthread_mutex_init(&ring->overflow_mutex, NULL) == 0;
+}
+
+static inline void packet_ring_free(struct packet_ring *ring)
+{
+	pthread_mutex_destroy(&ring->overflow_mutex);
+	circlebuf_free(&ring->overflow);
+	bfree(ring->slots);
+	ring->slots = NULL;
+}
+
+static inline unsigned long packet_ring_diff(long a, long b)
+{
+	return (unsigned long)a - (unsigned long)b;
+}
+
+static inline struct packet_ring_slot *packet_ring_slot(struct packet_ring *ring,
+							long idx)
+{
+	return &ring->slots[(unsigned long)idx & PACKET_RING_MASK];
+}
+
+static inline size_t packet_ring_count(struct packet_ring *ring)
+{
+	long tail = os_atomic_load_long(&ring->tail);
+	long head = os_atomic_load_long(&ring->head);
+	return packet_ring_diff(tail, head) +
+	       (size_t)os_atomic_load_long(&ring->overflow_count);
+}
+
+/* producer side, returns true if the packet had to go to the overflow queue
+ * while it was empty */
+static inline bool packet_ring_push(struct packet_ring *ring,
+				    const struct encoder_packet *packet,
+				    uint64_t ts)
+{
+	long tail = ring->tail;
+	long head = os_atomic_load_long(&ring->head);
+	struct packet_ring_slot *slot;
+
+	if (os_atomic_load_long(&ring->overflow_count) ||
+	    packet_ring_diff(tail, head) >= PACKET_RING_SIZE) {
+		struct packet_ring_slot overflow = {
+			.packet = *packet,
+			.enqueue_ts = ts,
+			.overflow = true,
+		};
+
+		pthread_mutex_lock(&ring->overflow_mutex);
+		circlebuf_push_back(&ring->overflow, &overflow,
+				    sizeof(overflow));
+		long count = os_atomic_inc_long(&ring->overflow_count);
+		pthread_mutex_unlock(&ring->overflow_mutex);
+		return count == 1;
+	}
+
+	slot = packet_ring_slot(ring, tail);
+	slot->packet = *packet;
+	slot->enqueue_ts = ts;
+	slot->overflow = false;
+
+	os_atomic_store_long(&ring->tail, (long)((unsigned long)tail + 1));
+	return false;
+}
+
+/* consumer side, idx is set to the index the packet was queued at, packets
+ * from the overflow queue have none */
+static inline bool packet_ring_pop(struct packet_ring *ring,
+				   struct packet_ring_slot *out, long *idx)
+{
+	long head = ring->head;
+	long tail = os_atomic_load_long(&ring->tail);
+
+	/* the producer may have refilled the ring since it was seen empty, and
+	 * what is in the ring is older than the overflow, so check again under
+	 * the mutex, nothing goes into the ring while the overflow has any */
+	while (head == tail) {
+		bool popped = false;
+
+		if (!os_atomic_load_long(&ring->overflow_count))
+			return false;
+
+		pthread_mutex_lock(&ring->overflow_mutex);
+		tail = os_atomic_load_long(&ring->tail);
+		if (head == tail && ring->overflow.size) {
+			circlebuf_pop_front(&ring->overflow, out, sizeof(*out));
+			os_atomic_dec_long(&ring->overflow_count);
+			popped = true;
+		}
+		pthread_mutex_unlock(&ring->overflow_mutex);
+
+		if (popped)
+			return true;
+	}
+
+	*out = *packet_ring_slot(ring, head);
+	if (idx)
+		*idx = head;
+
+	os_atomic_store_long(&ring->head, (long)((unsigned long)head + 1));
+	return true;
+}
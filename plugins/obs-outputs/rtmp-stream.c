@@ -60,21 +60,25 @@ static void log_rtmp(int level, const char *format, va_list args)
 
 static inline size_t num_buffered_packets(struct rtmp_stream *stream);
 
+/* the queue stays closed to rtmp_stream_data until init_connect opens it */
 static inline void free_packets(struct rtmp_stream *stream)
 {
+	struct packet_ring_slot slot;
 	size_t num_packets;
 
 	pthread_mutex_lock(&stream->packets_mutex);
 
+	os_atomic_set_bool(&stream->queue_closed, true);
+	while (os_atomic_load_bool(&stream->pushing))
+		os_sleep_ms(0);
+
 	num_packets = num_buffered_packets(stream);
 	if (num_packets)
 		info("Freeing %d remaining packets", (int)num_packets);
 
-	while (stream->packets.size) {
-		struct encoder_packet packet;
-		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
-		obs_encoder_packet_release(&packet);
-	}
+	while (packet_ring_pop(&stream->packets, &slot, NULL))
+		obs_encoder_packet_release(&slot.packet);
+
 	pthread_mutex_unlock(&stream->packets_mutex);
 }
 
@@ -130,7 +134,7 @@ static void rtmp_stream_destroy(void *data)
 	os_event_destroy(stream->stop_event);
 	os_sem_destroy(stream->send_sem);
 	pthread_mutex_destroy(&stream->packets_mutex);
-	circlebuf_free(&stream->packets);
+	packet_ring_free(&stream->packets);
 #ifdef TEST_FRAMEDROPS
 	circlebuf_free(&stream->droptest_info);
 #endif
@@ -153,12 +157,16 @@ static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 	struct rtmp_stream *stream = bzalloc(sizeof(struct rtmp_stream));
 	stream->output = output;
 	pthread_mutex_init_value(&stream->packets_mutex);
+	stream->queue_closed = true;
 
 	RTMP_LogSetCallback(log_rtmp);
 	RTMP_LogSetLevel(RTMP_LOGWARNING);
 
+	if (!packet_ring_init(&stream->packets))
+		goto fail;
 	if (pthread_mutex_init(&stream->packets_mutex, NULL) != 0)
 		goto fail;
+
 	if (os_event_init(&stream->stop_event, OS_EVENT_TYPE_MANUAL) != 0)
 		goto fail;
 
@@ -234,20 +242,84 @@ static inline void set_rtmp_dstr(AVal *val, struct dstr *str)
 	val->av_len = valid ? (int)str->len : 0;
 }
 
+static inline bool packet_dropped(struct rtmp_stream *stream,
+				  const struct encoder_packet *packet, long idx)
+{
+	long drop_before = os_atomic_load_long(&stream->drop_before);
+	long drop_priority = os_atomic_load_long(&stream->drop_priority);
+
+	/* do not drop audio data or video keyframes */
+	return packet->type == OBS_ENCODER_VIDEO &&
+	       (long)packet_ring_diff(drop_before, idx) > 0 &&
+	       packet->drop_priority < drop_priority;
+}
+
 static inline bool get_next_packet(struct rtmp_stream *stream,
-				   struct encoder_packet *packet)
+				   struct packet_ring_slot *slot)
 {
-	bool new_packet = false;
+	long idx;
 
-	pthread_mutex_lock(&stream->packets_mutex);
-	if (stream->packets.size) {
-		circlebuf_pop_front(&stream->packets, packet,
-				    sizeof(struct encoder_packet));
-		new_packet = true;
+	while (packet_ring_pop(&stream->packets, slot, &idx)) {
+		if (slot->overflow ||
+		    !packet_dropped(stream, &slot->packet, idx))
+			return true;
+
+		os_atomic_inc_long(&stream->queue_dropped_frames);
+		obs_encoder_packet_release(&slot->packet);
 	}
-	pthread_mutex_unlock(&stream->packets_mutex);
 
-	return new_packet;
+	return false;
+}
+
+static void add_send_latency(struct rtmp_stream *stream, uint64_t enqueue_ts)
+{
+	uint64_t latency = os_gettime_ns() - enqueue_ts;
+	uint64_t bucket = latency / 1000000;
+
+	if (bucket >= SEND_LATENCY_BUCKETS)
+		bucket = SEND_LATENCY_BUCKETS - 1;
+
+	stream->send_latency[bucket]++;
+	stream->send_latency_count++;
+	if (latency > stream->send_latency_max_ns)
+		stream->send_latency_max_ns = latency;
+}
+
+static int get_send_latency_percentile(struct rtmp_stream *stream,
+				       double percentile)
+{
+	uint64_t target =
+		(uint64_t)((double)stream->send_latency_count * percentile);
+	uint64_t total = 0;
+
+	for (int i = 0; i < SEND_LATENCY_BUCKETS; i++) {
+		total += stream->send_latency[i];
+		if (total > target)
+			return i;
+	}
+
+	return SEND_LATENCY_BUCKETS - 1;
+}
+
+static void log_send_latency(struct rtmp_stream *stream)
+{
+	if (!stream->send_latency_count)
+		return;
+
+	info("Enqueue to send latency: p50 %dms, p90 %dms, p99 %dms, "
+	     "max %" PRIu64 "ms (%" PRIu64 " packets)",
+	     get_send_latency_percentile(stream, 0.50),
+	     get_send_latency_percentile(stream, 0.90),
+	     get_send_latency_percentile(stream, 0.99),
+	     stream->send_latency_max_ns / 1000000,
+	     stream->send_latency_count);
+}
+
+static void reset_send_latency(struct rtmp_stream *stream)
+{
+	memset(stream->send_latency, 0, sizeof(stream->send_latency));
+	stream->send_latency_count = 0;
+	stream->send_latency_max_ns = 0;
 }
 
 static bool process_recv_data(struct rtmp_stream *stream, size_t size)
@@ -406,6 +478,48 @@ static int handle_socket_read(struct rtmp_stream *stream)
 	return 0;
 }
 
+/* Sends a frame without muxing it into a temporary FLV tag first: the tag
+ * prefix is built on the stack and librtmp chunks the payload straight out of
+ * the encoder packet. */
+static int send_packet_vec(struct rtmp_stream *stream,
+			   struct encoder_packet *packet, bool enhanced)
+{
+	struct flv_tag_prefix prefix;
+	RTMPIOVec body[2];
+	size_t size = 0;
+	int ret = 0;
+
+	if (enhanced)
+		flv_packet_frames_prefix(packet, stream->video_codec,
+					 stream->start_dts_offset, &prefix);
+	else
+		flv_packet_prefix(packet, stream->start_dts_offset, false,
+				  &prefix);
+
+	/* the muxers write nothing for empty packets */
+	if (packet->data && packet->size) {
+		body[0].base = (const char *)prefix.data;
+		body[0].len = (int)prefix.size;
+		body[1].base = (const char *)packet->data;
+		body[1].len = (int)packet->size;
+
+		/* same size the full FLV tag would have had */
+		size = 11 + prefix.size + packet->size + 4;
+
+#ifdef TEST_FRAMEDROPS
+		droptest_cap_data_rate(stream, size);
+#endif
+
+		ret = RTMP_WriteVec(&stream->rtmp, prefix.type,
+				    prefix.timestamp, body, 2, 0);
+	}
+
+	obs_encoder_packet_release(packet);
+
+	stream->total_bytes_sent += size;
+	return ret;
+}
+
 static int send_packet(struct rtmp_stream *stream,
 		       struct encoder_packet *packet, bool is_header,
 		       size_t idx)
@@ -418,6 +532,9 @@ static int send_packet(struct rtmp_stream *stream,
 	if (handle_socket_read(stream))
 		return -1;
 
+	if (idx == 0 && !is_header)
+		return send_packet_vec(stream, packet, false);
+
 	if (idx > 0) {
 		flv_additional_packet_mux(
 			packet, is_header ? 0 : stream->start_dts_offset, &data,
@@ -454,13 +571,13 @@ static int send_packet_ex(struct rtmp_stream *stream,
 	if (handle_socket_read(stream))
 		return -1;
 
+	if (!is_header && !is_footer)
+		return send_packet_vec(stream, packet, true);
+
 	if (is_header) {
 		flv_packet_start(packet, stream->video_codec, &data, &size);
-	} else if (is_footer) {
-		flv_packet_end(packet, stream->video_codec, &data, &size);
 	} else {
-		flv_packet_frames(packet, stream->video_codec,
-				  stream->start_dts_offset, &data, &size);
+		flv_packet_end(packet, stream->video_codec, &data, &size);
 	}
 
 #ifdef TEST_FRAMEDROPS
@@ -639,6 +756,7 @@ static void *send_thread(void *data)
 #endif
 
 	while (os_sem_wait(stream->send_sem) == 0) {
+		struct packet_ring_slot slot;
 		struct encoder_packet packet;
 		struct dbr_frame dbr_frame;
 
@@ -646,9 +764,11 @@ static void *send_thread(void *data)
 			break;
 		}
 
-		if (!get_next_packet(stream, &packet))
+		if (!get_next_packet(stream, &slot))
 			continue;
 
+		packet = slot.packet;
+
 		if (stopping(stream)) {
 			if (can_shutdown_stream(stream, &packet)) {
 				obs_encoder_packet_release(&packet);
@@ -682,6 +802,8 @@ static void *send_thread(void *data)
 			break;
 		}
 
+		add_send_latency(stream, slot.enqueue_ts);
+
 		if (stream->dbr_enabled) {
 			dbr_frame.send_end = os_gettime_ns();
 
@@ -707,6 +829,8 @@ static void *send_thread(void *data)
 	log_sndbuf_size(stream);
 #endif
 
+	log_send_latency(stream);
+
 	if (stream->new_socket_loop) {
 		os_event_signal(stream->send_thread_signaled_exit);
 		os_event_signal(stream->buffer_has_data_event);
@@ -727,6 +851,9 @@ static void *send_thread(void *data)
 		}
 	}
 
+	/* before signaling, so a reconnect can't drain at the same time */
+	free_packets(stream);
+
 	if (!stopping(stream)) {
 		pthread_detach(stream->send_thread);
 		obs_output_signal_stop(stream->output, OBS_OUTPUT_DISCONNECTED);
@@ -736,7 +863,6 @@ static void *send_thread(void *data)
 		obs_output_end_data_capture(stream->output);
 	}
 
-	free_packets(stream);
 	os_event_reset(stream->stop_event);
 	os_atomic_set_bool(&stream->active, false);
 	stream->sent_headers = false;
@@ -1257,6 +1383,12 @@ static bool init_connect(struct rtmp_stream *stream)
 	stream->dropped_frames = 0;
 	stream->min_priority = 0;
 	stream->got_first_video = false;
+	os_atomic_set_long(&stream->drop_before, stream->packets.tail);
+	os_atomic_set_long(&stream->drop_priority, 0);
+	os_atomic_set_long(&stream->queue_dropped_frames, 0);
+	stream->last_overflow_warn_ts = 0;
+	reset_send_latency(stream);
+	os_atomic_set_bool(&stream->queue_closed, false);
 
 	settings = obs_output_get_settings(stream->output);
 	dstr_copy(&stream->path,
@@ -1410,74 +1542,74 @@ static bool rtmp_stream_start(void *data)
 			      stream) == 0;
 }
 
+#define OVERFLOW_WARN_INTERVAL_NS 10000000000ULL
+
 static inline bool add_packet(struct rtmp_stream *stream,
 			      struct encoder_packet *packet)
 {
-	circlebuf_push_back(&stream->packets, packet,
-			    sizeof(struct encoder_packet));
+	uint64_t ts = os_gettime_ns();
+
+	/* nothing is dropped here, the drop policy takes care of that */
+	if (packet_ring_push(&stream->packets, packet, ts) &&
+	    (!stream->last_overflow_warn_ts ||
+	     ts - stream->last_overflow_warn_ts >= OVERFLOW_WARN_INTERVAL_NS)) {
+		warn("Packet queue is full, queueing %d packets in total",
+		     (int)num_buffered_packets(stream));
+		stream->last_overflow_warn_ts = ts;
+	}
+
 	return true;
 }
 
 static inline size_t num_buffered_packets(struct rtmp_stream *stream)
 {
-	return stream->packets.size / sizeof(struct encoder_packet);
+	return packet_ring_count(&stream->packets);
 }
 
+/* marks the queued packets below the given priority to be dropped by the send
+ * thread instead of removing them from the queue here, so the encoder thread
+ * never has to wait for the network thread */
 static void drop_frames(struct rtmp_stream *stream, const char *name,
 			int highest_priority, bool pframes)
 {
 	UNUSED_PARAMETER(pframes);
 
-	struct circlebuf new_buf = {0};
-	int num_frames_dropped = 0;
+	long tail = stream->packets.tail;
+	long head = os_atomic_load_long(&stream->packets.head);
+	long drop_before = os_atomic_load_long(&stream->drop_before);
+	long drop_priority = os_atomic_load_long(&stream->drop_priority);
 
-#ifdef _DEBUG
-	int start_packets = (int)num_buffered_packets(stream);
-#else
-	UNUSED_PARAMETER(name);
-#endif
-
-	circlebuf_reserve(&new_buf, sizeof(struct encoder_packet) * 8);
-
-	while (stream->packets.size) {
-		struct encoder_packet packet;
-		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
+	/* keep the higher priority of a previous drop that the send thread
+	 * has not fully applied yet */
+	if ((long)packet_ring_diff(drop_before, head) <= 0 ||
+	    drop_priority < highest_priority)
+		drop_priority = highest_priority;
 
-		/* do not drop audio data or video keyframes */
-		if (packet.type == OBS_ENCODER_AUDIO ||
-		    packet.drop_priority >= highest_priority) {
-			circlebuf_push_back(&new_buf, &packet, sizeof(packet));
-
-		} else {
-			num_frames_dropped++;
-			obs_encoder_packet_release(&packet);
-		}
-	}
-
-	circlebuf_free(&stream->packets);
-	stream->packets = new_buf;
+	os_atomic_set_long(&stream->drop_priority, drop_priority);
+	os_atomic_set_long(&stream->drop_before, tail);
 
 	if (stream->min_priority < highest_priority)
 		stream->min_priority = highest_priority;
-	if (!num_frames_dropped)
-		return;
 
-	stream->dropped_frames += num_frames_dropped;
 #ifdef _DEBUG
-	debug("Dropped %s, prev packet count: %d, new packet count: %d", name,
-	      start_packets, (int)num_buffered_packets(stream));
+	debug("Dropping %s, packet count: %d", name,
+	      (int)num_buffered_packets(stream));
+#else
+	UNUSED_PARAMETER(name);
 #endif
 }
 
 static bool find_first_video_packet(struct rtmp_stream *stream,
 				    struct encoder_packet *first)
 {
-	size_t count = stream->packets.size / sizeof(*first);
+	long tail = stream->packets.tail;
+	long idx = os_atomic_load_long(&stream->packets.head);
 
-	for (size_t i = 0; i < count; i++) {
+	for (; idx != tail; idx = (long)((unsigned long)idx + 1)) {
 		struct encoder_packet *cur =
-			circlebuf_data(&stream->packets, i * sizeof(*first));
-		if (cur->type == OBS_ENCODER_VIDEO && !cur->keyframe) {
+			&packet_ring_slot(&stream->packets, idx)->packet;
+		if (cur->type == OBS_ENCODER_VIDEO && !cur->keyframe &&
+		    !packet_dropped(stream, cur, idx)) {
 			*first = *cur;
 			return true;
 		}
@@ -1707,15 +1839,18 @@ static void rtmp_stream_data(void *data, struct encoder_packet *packet)
 		obs_encoder_packet_ref(&new_packet, packet);
 	}
 
-	pthread_mutex_lock(&stream->packets_mutex);
+	/* pairs with free_packets: either the queue is seen closed here, or
+	 * the drain waits for this push */
+	os_atomic_set_bool(&stream->pushing, true);
 
-	if (!disconnected(stream)) {
+	if (!disconnected(stream) &&
+	    !os_atomic_load_bool(&stream->queue_closed)) {
 		added_packet = (packet->type == OBS_ENCODER_VIDEO)
 				       ? add_video_packet(stream, &new_packet)
 				       : add_packet(stream, &new_packet);
 	}
 
-	pthread_mutex_unlock(&stream->packets_mutex);
+	os_atomic_set_bool(&stream->pushing, false);
 
 	if (added_packet)
 		os_sem_post(stream->send_sem);
@@ -1793,7 +1928,8 @@ static uint64_t rtmp_stream_total_bytes_sent(void *data)
 static int rtmp_stream_dropped_frames(void *data)
 {
 	struct rtmp_stream *stream = data;
-	return stream->dropped_frames;
+	return stream->dropped_frames +
+	       (int)os_atomic_load_long(&stream->queue_dropped_frames);
 }
 
 static float rtmp_stream_congestion(void *data)
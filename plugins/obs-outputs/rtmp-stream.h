@@ -7,6 +7,7 @@
 #include "librtmp/rtmp.h"
 #include "librtmp/log.h"
 #include "flv-mux.h"
+#include "packet-ring.h"
 #include "net-if.h"
 
 #ifdef _WIN32
@@ -47,6 +48,9 @@ struct droptest_info {
 };
 #endif
 
+/* 1 ms buckets, the last bucket collects everything above */
+#define SEND_LATENCY_BUCKETS 2048
+
 struct dbr_frame {
 	uint64_t send_beg;
 	uint64_t send_end;
@@ -56,8 +60,16 @@ struct dbr_frame {
 struct rtmp_stream {
 	obs_output_t *output;
 
+	/* filled by rtmp_stream_data, drained by send_thread */
+	struct packet_ring packets;
+
+	/* free_packets closes the queue and waits out a push in progress, so
+	 * nothing is queued after the final drain, drains themselves are
+	 * serialized by packets_mutex */
 	pthread_mutex_t packets_mutex;
-	struct circlebuf packets;
+	volatile bool queue_closed;
+	volatile bool pushing;
+	uint64_t last_overflow_warn_ts;
 	bool sent_headers;
 
 	bool got_first_video;
@@ -92,9 +104,20 @@ struct rtmp_stream {
 
 	int64_t last_dts_usec;
 
+	/* set by the drop policy, applied by send_thread: video packets queued
+	 * before drop_before with a lower priority than drop_priority are
+	 * released instead of sent */
+	volatile long drop_before;
+	volatile long drop_priority;
+	volatile long queue_dropped_frames;
+
 	uint64_t total_bytes_sent;
 	int dropped_frames;
 
+	uint32_t send_latency[SEND_LATENCY_BUCKETS];
+	uint64_t send_latency_count;
+	uint64_t send_latency_max_ns;
+
 #ifdef TEST_FRAMEDROPS
 	struct circlebuf droptest_info;
 	uint64_t droptest_last_key_check;
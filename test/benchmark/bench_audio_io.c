@@ -0,0 +1,119 @@
+#include <stdio.h>
+
+#include <util/platform.h>
+#include <util/threading.h>
+#include <media-io/audio-io.h>
+
+#define BENCH_MIXES 6
+#define BENCH_INPUTS 18
+#define BENCH_TICKS 20
+
+struct bench_output {
+	volatile long ticks;
+	uint64_t tick_start;
+	uint64_t busy_ns;
+	pthread_mutex_t mutex;
+};
+
+struct bench_input {
+	struct bench_output *out;
+};
+
+static bool input_audio(void *param, uint64_t start_ts, uint64_t end_ts,
+			uint64_t *new_ts, uint32_t active_mixers,
+			struct audio_output_data *mixes)
+{
+	struct bench_output *out = param;
+
+	out->tick_start = os_gettime_ns();
+	*new_ts = start_ts;
+	os_atomic_inc_long(&out->ticks);
+
+	UNUSED_PARAMETER(end_ts);
+	UNUSED_PARAMETER(active_mixers);
+	UNUSED_PARAMETER(mixes);
+	return true;
+}
+
+/* stands in for an encoder, the tick is done once the last input is */
+static void receive_audio(void *param, size_t mix_idx, struct audio_data *data)
+{
+	struct bench_input *input = param;
+	struct bench_output *out = input->out;
+
+	os_sleep_ms(1);
+
+	uint64_t busy = os_gettime_ns() - out->tick_start;
+	pthread_mutex_lock(&out->mutex);
+	if (busy > out->busy_ns)
+		out->busy_ns = busy;
+	pthread_mutex_unlock(&out->mutex);
+
+	UNUSED_PARAMETER(mix_idx);
+	UNUSED_PARAMETER(data);
+}
+
+static void wait_ticks(struct bench_output *out, long ticks)
+{
+	long start = os_atomic_load_long(&out->ticks);
+	while (os_atomic_load_long(&out->ticks) - start < ticks)
+		os_sleep_ms(5);
+}
+
+/* Times the output of six mixes with three inputs each, as with separate
+ * stream, recording and replay buffer encoders per track, one after another
+ * and in parallel. */
+int main()
+{
+	struct audio_output_info info = {0};
+	struct bench_output out = {0};
+	struct bench_input inputs[BENCH_INPUTS];
+	audio_t *audio = NULL;
+
+	pthread_mutex_init(&out.mutex, NULL);
+
+	info.name = "bench";
+	info.samples_per_sec = 48000;
+	info.format = AUDIO_FORMAT_FLOAT_PLANAR;
+	info.speakers = SPEAKERS_STEREO;
+	info.input_callback = input_audio;
+	info.input_param = &out;
+
+	if (audio_output_open(&audio, &info) != AUDIO_OUTPUT_SUCCESS)
+		return 1;
+
+	for (size_t i = 0; i < BENCH_INPUTS; i++) {
+		inputs[i].out = &out;
+		audio_output_connect(audio, i % BENCH_MIXES, NULL,
+				     receive_audio, &inputs[i]);
+	}
+
+	for (int parallel = 0; parallel < 2; parallel++) {
+		audio_output_set_parallel(audio, parallel);
+		wait_ticks(&out, 2);
+
+		uint64_t total = 0;
+		for (int tick = 0; tick < BENCH_TICKS; tick++) {
+			pthread_mutex_lock(&out.mutex);
+			out.busy_ns = 0;
+			pthread_mutex_unlock(&out.mutex);
+
+			wait_ticks(&out, 2);
+
+			pthread_mutex_lock(&out.mutex);
+			total += out.busy_ns;
+			pthread_mutex_unlock(&out.mutex);
+		}
+
+		printf("audio io: %s output, %.2f ms per tick\n",
+		       parallel ? "parallel" : "serial",
+		       (double)total / BENCH_TICKS / 1000000.0);
+	}
+
+	for (size_t i = 0; i < BENCH_INPUTS; i++)
+		audio_output_disconnect(audio, i % BENCH_MIXES, receive_audio,
+					&inputs[i]);
+	audio_output_close(audio);
+	pthread_mutex_destroy(&out.mutex);
+	return 0;
+}
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <media-io/audio-io.h>
+#include <media-io/audio-mix.h>
+
+#define BENCH_SOURCES 32
+#define BENCH_TICKS 200
+
+/* Times what the audio thread does each tick with every mix active: every
+ * source is added to 6 mixes of 8 channels, after which each mix is copied
+ * to the unclamped buffer and clamped.  Every kernel the CPU supports is
+ * timed. */
+int main()
+{
+	const size_t planes = MAX_AUDIO_MIXES * MAX_AUDIO_CHANNELS;
+
+	enum audio_mix_impl best = audio_mix_get_impl();
+	float *sources = bmalloc(BENCH_SOURCES * TOTAL_AUDIO_SIZE);
+	float *mixes = bmalloc(TOTAL_AUDIO_SIZE);
+	float *unclamped = bmalloc(TOTAL_AUDIO_SIZE);
+
+	for (size_t i = 0; i < BENCH_SOURCES * planes * AUDIO_OUTPUT_FRAMES;
+	     i++)
+		sources[i] = ((float)rand() / (float)RAND_MAX - 0.5f) * 0.4f;
+
+	for (int impl = AUDIO_MIX_IMPL_C; impl <= (int)best; impl++) {
+		if (!audio_mix_set_impl(impl))
+			continue;
+
+		uint64_t start = os_gettime_ns();
+
+		for (size_t tick = 0; tick < BENCH_TICKS; tick++) {
+			memset(mixes, 0, TOTAL_AUDIO_SIZE);
+
+			for (size_t src = 0; src < BENCH_SOURCES; src++) {
+				float *src_planes =
+					sources + src * planes *
+							  AUDIO_OUTPUT_FRAMES;
+
+				for (size_t p = 0; p < planes; p++)
+					audio_mix_add(
+						mixes + p * AUDIO_OUTPUT_FRAMES,
+						src_planes +
+							p * AUDIO_OUTPUT_FRAMES,
+						AUDIO_OUTPUT_FRAMES);
+			}
+
+			for (size_t p = 0; p < planes; p++)
+				audio_mix_clamp(
+					mixes + p * AUDIO_OUTPUT_FRAMES,
+					unclamped + p * AUDIO_OUTPUT_FRAMES,
+					AUDIO_OUTPUT_FRAMES);
+		}
+
+		uint64_t elapsed = os_gettime_ns() - start;
+
+		printf("audio mix (%s): %d sources x %d mixes x %d channels, "
+		       "%.1f us/tick\n",
+		       audio_mix_get_impl_name(impl), BENCH_SOURCES,
+		       MAX_AUDIO_MIXES, MAX_AUDIO_CHANNELS,
+		       (double)elapsed / BENCH_TICKS / 1000.0);
+	}
+
+	audio_mix_set_impl(best);
+
+	bfree(sources);
+	bfree(mixes);
+	bfree(unclamped);
+	return 0;
+}
@@ -0,0 +1,61 @@
+#include <stdio.h>
+
+#include <util/platform.h>
+#include <obs-interleave.h>
+
+#define BENCH_PACKETS 1000000
+
+static void push_packet(struct interleave_queue *q, enum obs_encoder_type type,
+			size_t track_idx, int64_t dts_usec)
+{
+	struct encoder_packet packet = {0};
+	packet.type = type;
+	packet.track_idx = track_idx;
+	packet.dts_usec = dts_usec;
+	packet.dts = dts_usec;
+
+	interleave_queue_push(q, &packet);
+}
+
+/* Feeds 2 video tracks at 60 fps and 6 audio tracks at 48 kHz AAC framing
+ * through the queue while holding a few seconds of delay, and reports the
+ * cost per packet. */
+int main()
+{
+	const int64_t video_usec = 16667;
+	const int64_t audio_usec = 21333;
+	const size_t delay_packets = 20 * 60 * 8;
+
+	struct interleave_queue q = {0};
+	struct encoder_packet packet;
+	int64_t video_ts = 0;
+	int64_t audio_ts = 0;
+	size_t pushed = 0;
+
+	uint64_t start = os_gettime_ns();
+
+	while (pushed < BENCH_PACKETS) {
+		if (video_ts <= audio_ts) {
+			for (size_t i = 0; i < 2; i++)
+				push_packet(&q, OBS_ENCODER_VIDEO, i, video_ts);
+			video_ts += video_usec;
+			pushed += 2;
+		} else {
+			for (size_t i = 0; i < 6; i++)
+				push_packet(&q, OBS_ENCODER_AUDIO, i, audio_ts);
+			audio_ts += audio_usec;
+			pushed += 6;
+		}
+
+		while (q.num > delay_packets)
+			interleave_queue_pop(&q, &packet);
+	}
+
+	uint64_t elapsed = os_gettime_ns() - start;
+
+	printf("interleave: %zu packets, %zu queued, %.1f ns/packet\n", pushed,
+	       delay_packets, (double)elapsed / (double)pushed);
+
+	interleave_queue_free(&q);
+	return 0;
+}
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <util/platform.h>
+
+#include "ffmpeg-mux.h"
+#include "ffmpeg-mux-ring.h"
+
+/* lossless 4K frames are several megabytes each */
+#define BENCH_PACKET_SIZE (8 * 1024 * 1024)
+#define BENCH_PACKETS 256
+
+struct peer {
+	pid_t pid;
+	int to_child;
+	int from_child;
+};
+
+/* both sides get a pipe that hangs up once the other one exits, like stdin
+ * and the peer pipe between obs-ffmpeg-mux and ffmpeg-mux */
+static bool start_peer(struct peer *peer, int (*child)(int peer_fd, void *),
+		       void *param)
+{
+	int to_child[2];
+	int from_child[2];
+
+	if (pipe(to_child) != 0 || pipe(from_child) != 0)
+		return false;
+
+	peer->pid = fork();
+	if (peer->pid == -1)
+		return false;
+
+	if (peer->pid == 0) {
+		close(to_child[1]);
+		close(from_child[0]);
+		_exit(child(to_child[0], param));
+	}
+
+	close(to_child[0]);
+	close(from_child[1]);
+	peer->to_child = to_child[1];
+	peer->from_child = from_child[0];
+	return true;
+}
+
+static int finish_peer(struct peer *peer)
+{
+	int status = 0;
+
+	if (peer->to_child != -1)
+		close(peer->to_child);
+	waitpid(peer->pid, &status, 0);
+	close(peer->from_child);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/* the same reads ffmpeg-mux does from stdin */
+static int pipe_reader(int peer_fd, void *param)
+{
+	FILE *file = fdopen(peer_fd, "rb");
+	uint8_t *buf = malloc(BENCH_PACKET_SIZE);
+	struct ffm_packet_info info;
+	uint32_t count = 0;
+
+	UNUSED_PARAMETER(param);
+
+	while (fread(&info, 1, sizeof(info), file) == sizeof(info)) {
+		if (fread(buf, 1, info.size, file) != info.size)
+			return 2;
+		count++;
+	}
+
+	free(buf);
+	fclose(file);
+	return count == BENCH_PACKETS ? 0 : 5;
+}
+
+/* muxes straight from the ring like ffmpeg-mux, packets fit in the ring */
+static int ring_reader(int peer_fd, void *param)
+{
+	struct ffm_ring_info *ring_info = param;
+	struct ffm_ring ring;
+	uint32_t count = 0;
+
+	if (!ffm_ring_open(&ring, ring_info, peer_fd) || !ffm_ring_claim(&ring))
+		return 1;
+
+	while (ffm_ring_wait_data(&ring, sizeof(struct ffm_packet_info))) {
+		struct ffm_packet_info info;
+
+		memcpy(&info, ffm_ring_read_ptr(&ring), sizeof(info));
+		if (!ffm_ring_wait_data(&ring, sizeof(info) + info.size))
+			return 2;
+		ffm_ring_consume(&ring, sizeof(info) + info.size);
+		count++;
+	}
+
+	ffm_ring_close(&ring);
+	ffm_ring_free(&ring);
+	return count == BENCH_PACKETS ? 0 : 5;
+}
+
+static double cpu_seconds(int who)
+{
+	struct rusage usage;
+	getrusage(who, &usage);
+	return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+	       (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) /
+		       1000000.0;
+}
+
+struct bench_start {
+	uint64_t ns;
+	double cpu_self;
+	double cpu_children;
+};
+
+static struct bench_start bench_begin(void)
+{
+	struct bench_start start = {
+		.cpu_self = cpu_seconds(RUSAGE_SELF),
+		.cpu_children = cpu_seconds(RUSAGE_CHILDREN),
+		.ns = os_gettime_ns(),
+	};
+	return start;
+}
+
+static void print_bench(const char *name, const struct bench_start *start)
+{
+	double secs = (double)(os_gettime_ns() - start->ns) / 1000000000.0;
+	double mb = (double)BENCH_PACKET_SIZE * BENCH_PACKETS / 1048576.0;
+	double cpu = cpu_seconds(RUSAGE_SELF) - start->cpu_self +
+		     cpu_seconds(RUSAGE_CHILDREN) - start->cpu_children;
+
+	printf("mux transport: %s %.0f MB/s, %.2f cpu seconds per GB\n", name,
+	       mb / secs, cpu / (mb / 1024.0));
+}
+
+static bool bench_pipe(const uint8_t *data)
+{
+	struct bench_start start = bench_begin();
+	struct peer peer;
+
+	if (!start_peer(&peer, pipe_reader, NULL))
+		return false;
+
+	FILE *file = fdopen(peer.to_child, "wb");
+	bool success = true;
+
+	for (uint32_t idx = 0; success && idx < BENCH_PACKETS; idx++) {
+		struct ffm_packet_info info = {.size = BENCH_PACKET_SIZE,
+					       .index = idx};
+		success = fwrite(&info, 1, sizeof(info), file) ==
+				  sizeof(info) &&
+			  fwrite(data, 1, BENCH_PACKET_SIZE, file) ==
+				  BENCH_PACKET_SIZE;
+	}
+
+	fclose(file);
+	peer.to_child = -1;
+	if (finish_peer(&peer) != 0 || !success)
+		return false;
+
+	print_bench("pipe", &start);
+	return true;
+}
+
+static bool bench_ring(const uint8_t *data)
+{
+	struct ffm_ring ring;
+	struct peer peer;
+	bool success = true;
+
+	if (!ffm_ring_create(&ring, FFM_RING_DEFAULT_SIZE))
+		return false;
+
+	struct ffm_ring_info ring_info = {.fd = ring.fd,
+					  .capacity = ring.capacity};
+	struct bench_start start = bench_begin();
+
+	if (!start_peer(&peer, ring_reader, &ring_info)) {
+		ffm_ring_free(&ring);
+		return false;
+	}
+	ring.peer_fd = peer.from_child;
+
+	for (uint32_t idx = 0; success && idx < BENCH_PACKETS; idx++) {
+		struct ffm_packet_info info = {.size = BENCH_PACKET_SIZE,
+					       .index = idx};
+		success = ffm_ring_write(&ring, &info, sizeof(info), data,
+					 BENCH_PACKET_SIZE);
+	}
+
+	ffm_ring_close(&ring);
+	if (finish_peer(&peer) != 0)
+		success = false;
+	if (success)
+		print_bench("ring", &start);
+
+	ffm_ring_free(&ring);
+	return success;
+}
+
+/* Sustained throughput and CPU use of the pipe and the ring for a high
+ * bitrate lossless recording, without the muxing itself. */
+int main()
+{
+	uint8_t *data = malloc(BENCH_PACKET_SIZE);
+	bool success;
+
+	for (uint32_t i = 0; i < BENCH_PACKET_SIZE; i++)
+		data[i] = (uint8_t)(i * 7);
+
+	success = bench_pipe(data) && bench_ring(data);
+
+	free(data);
+	return success ? 0 : 1;
+}
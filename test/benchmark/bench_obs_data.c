@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <obs-data.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+
+#define BENCH_SOURCES 3000
+#define BENCH_LOADS 10
+
+static obs_data_t *create_source(int idx)
+{
+	obs_data_t *source = obs_data_create();
+	obs_data_t *settings = obs_data_create();
+	obs_data_array_t *filters = obs_data_array_create();
+	char name[64];
+
+	snprintf(name, sizeof(name), "Source %d", idx);
+	obs_data_set_string(source, "name", name);
+	obs_data_set_string(source, "uuid",
+			    "2a0e4f6c-7d1b-4c3e-9f2a-1b2c3d4e5f60");
+	obs_data_set_string(source, "id",
+			    idx % 3 ? "image_source" : "ffmpeg_source");
+	obs_data_set_int(source, "mixers", 255);
+	obs_data_set_double(source, "volume", 1.0);
+	obs_data_set_bool(source, "enabled", true);
+	obs_data_set_bool(source, "muted", false);
+
+	obs_data_set_string(settings, "local_file",
+			    "/home/user/Videos/recordings/intro.mp4");
+	obs_data_set_bool(settings, "looping", true);
+	obs_data_set_int(settings, "speed_percent", 100);
+	obs_data_set_string(settings, "text", "Caf\xc3\xa9 \"quoted\"\nline");
+	obs_data_set_obj(source, "settings", settings);
+
+	for (int i = 0; i < 2; i++) {
+		obs_data_t *filter = obs_data_create();
+		obs_data_t *filter_settings = obs_data_create();
+
+		obs_data_set_string(filter, "name", "Color Correction");
+		obs_data_set_string(filter, "id", "color_filter");
+		obs_data_set_double(filter_settings, "gamma", 0.25);
+		obs_data_set_double(filter_settings, "contrast", -0.1);
+		obs_data_set_obj(filter, "settings", filter_settings);
+		obs_data_array_push_back(filters, filter);
+
+		obs_data_release(filter_settings);
+		obs_data_release(filter);
+	}
+	obs_data_set_array(source, "filters", filters);
+
+	obs_data_array_release(filters);
+	obs_data_release(settings);
+	return source;
+}
+
+static obs_data_t *create_collection(void)
+{
+	obs_data_t *collection = obs_data_create();
+	obs_data_array_t *sources = obs_data_array_create();
+
+	for (int i = 0; i < BENCH_SOURCES; i++) {
+		obs_data_t *source = create_source(i);
+		obs_data_array_push_back(sources, source);
+		obs_data_release(source);
+	}
+
+	obs_data_set_string(collection, "name", "Benchmark");
+	obs_data_set_array(collection, "sources", sources);
+
+	obs_data_array_release(sources);
+	return collection;
+}
+
+/* loading a large scene collection from json */
+static bool bench_load_collection(void)
+{
+	obs_data_t *collection = create_collection();
+	char *json = bstrdup(obs_data_get_json_pretty(collection));
+	uint64_t load_ns = 0;
+	uint64_t release_ns = 0;
+	long allocs = 0;
+
+	obs_data_release(collection);
+
+	for (int i = 0; i < BENCH_LOADS; i++) {
+		long start_allocs = bnum_allocs();
+		uint64_t start = os_gettime_ns();
+
+		obs_data_t *data = obs_data_create_from_json(json);
+		if (!data) {
+			bfree(json);
+			return false;
+		}
+
+		uint64_t loaded = os_gettime_ns();
+		allocs = bnum_allocs() - start_allocs;
+
+		obs_data_release(data);
+
+		release_ns += os_gettime_ns() - loaded;
+		load_ns += loaded - start;
+	}
+
+	printf("obs_data: %zu byte collection of %d sources loaded in "
+	       "%.2f ms and released in %.2f ms, %ld allocations\n",
+	       strlen(json), BENCH_SOURCES,
+	       (double)load_ns / BENCH_LOADS / 1000000.0,
+	       (double)release_ns / BENCH_LOADS / 1000000.0, allocs);
+
+	bfree(json);
+	return true;
+}
+
+int main()
+{
+	return bench_load_collection() ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+#include <stdio.h>
+
+#include <util/platform.h>
+#include <util/profiler.h>
+#include <util/threading.h>
+
+#define BENCH_THREADS 4
+#define BENCH_FRAMES 200000
+#define BENCH_SCOPES_PER_FRAME 8
+
+static const char *frame_name = "bench_frame";
+static const char *tick_name = "tick";
+static const char *render_name = "render";
+static const char *draw_name = "draw";
+
+static void bench_frames(void)
+{
+	for (int i = 0; i < BENCH_FRAMES; i++) {
+		profile_start(frame_name);
+		profile_start(tick_name);
+		profile_end(tick_name);
+		profile_start(render_name);
+		for (int j = 0; j < BENCH_SCOPES_PER_FRAME - 3; j++) {
+			profile_start(draw_name);
+			profile_end(draw_name);
+		}
+		profile_end(render_name);
+		profile_end(frame_name);
+	}
+}
+
+static void *bench_thread(void *param)
+{
+	UNUSED_PARAMETER(param);
+	bench_frames();
+	return NULL;
+}
+
+static double bench_ns_per_scope(size_t num_threads)
+{
+	pthread_t threads[BENCH_THREADS];
+	uint64_t start = os_gettime_ns();
+
+	for (size_t i = 0; i < num_threads; i++)
+		pthread_create(&threads[i], NULL, bench_thread, NULL);
+	for (size_t i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	double ns = (double)(os_gettime_ns() - start);
+	return ns / ((double)BENCH_FRAMES * BENCH_SCOPES_PER_FRAME);
+}
+
+/* Cost of a profile_start/profile_end pair, with one thread and with
+ * several threads profiling at the same time.  The time of the scopes
+ * themselves, two os_gettime_ns calls, is included. */
+int main()
+{
+	profiler_start();
+
+	uint64_t start = os_gettime_ns();
+	for (int i = 0; i < BENCH_FRAMES * BENCH_SCOPES_PER_FRAME; i++) {
+		os_gettime_ns();
+		os_gettime_ns();
+	}
+	double clock_ns = (double)(os_gettime_ns() - start) /
+			  ((double)BENCH_FRAMES * BENCH_SCOPES_PER_FRAME);
+
+	printf("profiler: %.1f ns per scope on 1 thread, %.1f ns per scope "
+	       "on %d threads, %.1f ns of which is reading the clock\n",
+	       bench_ns_per_scope(1), bench_ns_per_scope(BENCH_THREADS),
+	       BENCH_THREADS, clock_ns);
+
+	profiler_stop();
+	profiler_free();
+	return 0;
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <media-io/video-slices.h>
+
+#define BENCH_ITERATIONS 20
+
+struct bench_plane {
+	uint32_t bytes_per_pixel;
+	uint32_t width_div;
+	uint32_t height_div;
+};
+
+struct bench_format {
+	const char *name;
+	size_t planes;
+	struct bench_plane plane[3];
+};
+
+static const struct bench_format bench_formats[] = {
+	{"NV12", 2, {{1, 1, 1}, {2, 2, 2}}},
+	{"I420", 3, {{1, 1, 1}, {1, 2, 2}, {1, 2, 2}}},
+	{"I444", 3, {{1, 1, 1}, {1, 1, 1}, {1, 1, 1}}},
+	{"P010", 2, {{2, 1, 1}, {4, 2, 2}}},
+	{"RGBA", 1, {{4, 1, 1}}},
+};
+
+static void fill_random(uint8_t *data, size_t size, uint32_t seed)
+{
+	for (size_t i = 0; i < size; i++) {
+		seed = seed * 1664525 + 1013904223;
+		data[i] = (uint8_t)(seed >> 24);
+	}
+}
+
+static double bench_copy(video_slices_t *vs, const struct bench_format *format,
+			 uint32_t width, uint32_t height, uint8_t *src,
+			 uint8_t *dst)
+{
+	size_t frame_bytes = 0;
+	uint64_t start = os_gettime_ns();
+
+	for (size_t i = 0; i < BENCH_ITERATIONS; i++) {
+		size_t offset = 0;
+		frame_bytes = 0;
+
+		for (size_t p = 0; p < format->planes; p++) {
+			const struct bench_plane *plane = &format->plane[p];
+			uint32_t row_bytes = width / plane->width_div *
+					     plane->bytes_per_pixel;
+			uint32_t rows = height / plane->height_div;
+
+			/* staging surfaces are usually padded */
+			uint32_t src_linesize = (row_bytes + 255) & ~255;
+
+			video_slices_add_copy(vs, dst + offset, row_bytes,
+					      src + offset, src_linesize,
+					      row_bytes, rows);
+			offset += (size_t)src_linesize * rows;
+			frame_bytes += (size_t)row_bytes * rows;
+		}
+
+		video_slices_run(vs);
+	}
+
+	uint64_t elapsed = os_gettime_ns() - start;
+	return (double)(frame_bytes * BENCH_ITERATIONS) / (double)elapsed;
+}
+
+/* Copies each format at 1080p, 1440p and 4K on the calling thread only and
+ * split into bands, and reports the throughput of both. */
+int main()
+{
+	static const uint32_t sizes[][2] = {
+		{1920, 1080},
+		{2560, 1440},
+		{3840, 2160},
+	};
+	const size_t max_bytes = (size_t)(3840 * 4 + 256) * 2160;
+
+	video_slices_t *vs = video_slices_create(0);
+	uint8_t *src = bmalloc(max_bytes);
+	uint8_t *dst = bmalloc(max_bytes);
+
+	fill_random(src, max_bytes, 2);
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		for (size_t f = 0;
+		     f < sizeof(bench_formats) / sizeof(bench_formats[0]);
+		     f++) {
+			const struct bench_format *format = &bench_formats[f];
+			uint32_t cx = sizes[s][0];
+			uint32_t cy = sizes[s][1];
+
+			double single =
+				bench_copy(NULL, format, cx, cy, src, dst);
+			double sliced =
+				bench_copy(vs, format, cx, cy, src, dst);
+
+			printf("video slices: %ux%u %s copy: %.2f GB/s, "
+			       "sliced %.2f GB/s\n",
+			       cx, cy, format->name, single, sliced);
+		}
+	}
+
+	bfree(src);
+	bfree(dst);
+	video_slices_destroy(vs);
+	return 0;
+}
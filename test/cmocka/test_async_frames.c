@@ -0,0 +1,158 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <string.h>
+#include <cmocka.h>
+
+#include <obs.h>
+
+#define FRAME_WIDTH 64
+#define FRAME_HEIGHT 48
+
+static const char *test_source_get_name(void *type)
+{
+	UNUSED_PARAMETER(type);
+	return "Async frame test source";
+}
+
+static void *test_source_create(obs_data_t *settings, obs_source_t *source)
+{
+	UNUSED_PARAMETER(settings);
+	return source;
+}
+
+static void test_source_destroy(void *data)
+{
+	UNUSED_PARAMETER(data);
+}
+
+static struct obs_source_info test_source_info = {
+	.id = "test_async_frames_source",
+	.type = OBS_SOURCE_TYPE_INPUT,
+	.output_flags = OBS_SOURCE_ASYNC_VIDEO,
+	.get_name = test_source_get_name,
+	.create = test_source_create,
+	.destroy = test_source_destroy,
+};
+
+/* libobs can't start without a display on some platforms, the tests are
+ * skipped then */
+static int setup(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	if (obs_startup("en-US", NULL, NULL))
+		obs_register_source(&test_source_info);
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	if (obs_initialized())
+		obs_shutdown();
+	return 0;
+}
+
+static obs_source_t *create_test_source(void)
+{
+	if (!obs_initialized())
+		skip();
+
+	obs_source_t *source = obs_source_create_private(
+		"test_async_frames_source", "async frames", NULL);
+	assert_non_null(source);
+	return source;
+}
+
+static struct obs_source_frame *borrow_frame(obs_source_t *source,
+					     uint32_t width, uint32_t height)
+{
+	struct obs_source_frame *frame = obs_source_borrow_video_frame(
+		source, VIDEO_FORMAT_I420, width, height);
+
+	assert_non_null(frame);
+	assert_int_equal(frame->width, width);
+	assert_int_equal(frame->height, height);
+	assert_true(frame->linesize[0] >= width);
+
+	for (uint32_t y = 0; y < height; y++)
+		memset(frame->data[0] + y * frame->linesize[0], 0x80, width);
+	frame->timestamp = 1000;
+	return frame;
+}
+
+/* a borrowed frame is queued like a copied one, and one that's handed back
+ * is just returned to the cache */
+static void borrow_commit_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	obs_source_t *source = create_test_source();
+	struct obs_source_async_stats stats;
+
+	struct obs_source_frame *frame =
+		borrow_frame(source, FRAME_WIDTH, FRAME_HEIGHT);
+	obs_source_commit_video_frame(source, frame);
+
+	frame = borrow_frame(source, FRAME_WIDTH, FRAME_HEIGHT);
+	obs_source_release_frame(source, frame);
+
+	obs_source_get_async_stats(source, &stats);
+	assert_int_equal(stats.borrowed, 1);
+	assert_int_equal(stats.copied, 0);
+	assert_int_equal(stats.queued, 1);
+
+	obs_source_release(source);
+}
+
+/* a frame committed after the cache was flushed under it is still queued,
+ * instead of being freed on the spot */
+static void commit_after_flush_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	obs_source_t *source = create_test_source();
+	struct obs_source_async_stats stats;
+
+	/* deactivating the source */
+	struct obs_source_frame *frame =
+		borrow_frame(source, FRAME_WIDTH, FRAME_HEIGHT);
+	obs_source_output_video(source, NULL);
+
+	obs_source_get_async_stats(source, &stats);
+	assert_int_equal(stats.cached, 0);
+
+	obs_source_commit_video_frame(source, frame);
+
+	obs_source_get_async_stats(source, &stats);
+	assert_int_equal(stats.borrowed, 1);
+	assert_int_equal(stats.queued, 1);
+	assert_int_equal(stats.cached, 1);
+
+	/* a frame of another size borrowed in the meantime */
+	frame = borrow_frame(source, FRAME_WIDTH, FRAME_HEIGHT);
+	struct obs_source_frame *small =
+		borrow_frame(source, FRAME_WIDTH / 2, FRAME_HEIGHT / 2);
+
+	obs_source_commit_video_frame(source, frame);
+	obs_source_commit_video_frame(source, small);
+
+	obs_source_get_async_stats(source, &stats);
+	assert_int_equal(stats.borrowed, 3);
+	assert_int_equal(stats.queued, 1);
+	assert_int_equal(stats.cached, 1);
+
+	obs_source_release(source);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(borrow_commit_test),
+		cmocka_unit_test(commit_after_flush_test),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
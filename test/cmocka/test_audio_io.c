@@ -0,0 +1,176 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <string.h>
+#include <cmocka.h>
+
+#include <util/platform.h>
+#include <util/threading.h>
+#include <media-io/audio-io.h>
+
+#define NUM_INPUTS 6
+#define TICKS 20
+
+struct test_output {
+	volatile long ticks;
+};
+
+static bool input_audio(void *param, uint64_t start_ts, uint64_t end_ts,
+			uint64_t *new_ts, uint32_t active_mixers,
+			struct audio_output_data *mixes)
+{
+	struct test_output *out = param;
+
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
+		if ((active_mixers & (1 << mix)) == 0)
+			continue;
+		for (size_t i = 0; i < AUDIO_OUTPUT_FRAMES; i++)
+			mixes[mix].data[0][i] = (float)(mix + 1) * 0.1f;
+	}
+
+	*new_ts = start_ts;
+	os_atomic_inc_long(&out->ticks);
+
+	UNUSED_PARAMETER(end_ts);
+	return true;
+}
+
+struct test_input {
+	audio_t *audio;
+	size_t mix_idx;
+	uint32_t work_ms;
+	volatile long calls;
+	uint64_t last_ts;
+	bool bad_data;
+	bool out_of_order;
+	bool disconnect;
+};
+
+static void receive_audio(void *param, size_t mix_idx, struct audio_data *data)
+{
+	struct test_input *input = param;
+	const float *samples = (const float *)data->data[0];
+	float expected = (float)(input->mix_idx + 1) * 0.1f;
+
+	if (mix_idx != input->mix_idx || data->frames != AUDIO_OUTPUT_FRAMES ||
+	    samples[0] != expected ||
+	    samples[AUDIO_OUTPUT_FRAMES - 1] != expected)
+		input->bad_data = true;
+
+	if (input->calls && data->timestamp <= input->last_ts)
+		input->out_of_order = true;
+	input->last_ts = data->timestamp;
+
+	/* stands in for an encoder */
+	if (input->work_ms)
+		os_sleep_ms(input->work_ms);
+
+	if (os_atomic_inc_long(&input->calls) == 3 && input->disconnect)
+		audio_output_disconnect(input->audio, mix_idx, receive_audio,
+					input);
+}
+
+static audio_t *open_audio(struct test_output *out)
+{
+	struct audio_output_info info = {0};
+	audio_t *audio = NULL;
+
+	info.name = "test";
+	info.samples_per_sec = 48000;
+	info.format = AUDIO_FORMAT_FLOAT_PLANAR;
+	info.speakers = SPEAKERS_STEREO;
+	info.input_callback = input_audio;
+	info.input_param = out;
+
+	assert_int_equal(audio_output_open(&audio, &info),
+			 AUDIO_OUTPUT_SUCCESS);
+	return audio;
+}
+
+static void wait_ticks(struct test_output *out, long ticks)
+{
+	long start = os_atomic_load_long(&out->ticks);
+	while (os_atomic_load_long(&out->ticks) - start < ticks)
+		os_sleep_ms(5);
+}
+
+/* every input gets every tick, in order, with its own mix's data */
+static void audio_io_parallel_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	struct test_output out = {0};
+	struct test_input inputs[NUM_INPUTS] = {0};
+	audio_t *audio = open_audio(&out);
+
+	audio_output_set_parallel(audio, true);
+	assert_true(audio_output_parallel(audio));
+
+	for (size_t i = 0; i < NUM_INPUTS; i++) {
+		inputs[i].audio = audio;
+		inputs[i].mix_idx = i % 3;
+		inputs[i].work_ms = 2;
+		assert_true(audio_output_connect(audio, inputs[i].mix_idx,
+						 NULL, receive_audio,
+						 &inputs[i]));
+	}
+
+	wait_ticks(&out, TICKS);
+
+	for (size_t i = 0; i < NUM_INPUTS; i++)
+		audio_output_disconnect(audio, inputs[i].mix_idx,
+					receive_audio, &inputs[i]);
+	assert_false(audio_output_active(audio));
+
+	long ticks = os_atomic_load_long(&out.ticks);
+	for (size_t i = 0; i < NUM_INPUTS; i++) {
+		assert_false(inputs[i].bad_data);
+		assert_false(inputs[i].out_of_order);
+		assert_true(inputs[i].calls >= TICKS - 1);
+		assert_true(inputs[i].calls <= ticks);
+	}
+
+	audio_output_close(audio);
+}
+
+/* disconnecting from inside a parallel callback is applied after the tick */
+static void audio_io_disconnect_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	struct test_output out = {0};
+	struct test_input self = {0};
+	struct test_input other = {0};
+	audio_t *audio = open_audio(&out);
+
+	audio_output_set_parallel(audio, true);
+
+	self.audio = audio;
+	self.disconnect = true;
+	other.audio = audio;
+
+	assert_true(audio_output_connect(audio, 0, NULL, receive_audio, &self));
+	assert_true(
+		audio_output_connect(audio, 0, NULL, receive_audio, &other));
+
+	wait_ticks(&out, 10);
+
+	assert_int_equal(os_atomic_load_long(&self.calls), 3);
+	assert_true(os_atomic_load_long(&other.calls) >= 9);
+	assert_true(audio_output_active(audio));
+
+	audio_output_disconnect(audio, 0, receive_audio, &other);
+	assert_false(audio_output_active(audio));
+
+	audio_output_close(audio);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(audio_io_parallel_test),
+		cmocka_unit_test(audio_io_disconnect_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,125 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <math.h>
+#include <cmocka.h>
+
+#include <media-io/audio-io.h>
+#include <media-io/audio-mix.h>
+
+#define TEST_FLOATS 1027
+
+static float random_sample(void)
+{
+	return ((float)rand() / (float)RAND_MAX) * 4.0f - 2.0f;
+}
+
+static void audio_mix_add_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	enum audio_mix_impl best = audio_mix_get_impl();
+	float src[TEST_FLOATS];
+	float dst[TEST_FLOATS];
+	float ref[TEST_FLOATS];
+
+	for (int impl = AUDIO_MIX_IMPL_C; impl <= (int)best; impl++) {
+		assert_true(audio_mix_set_impl(impl));
+
+		/* odd offsets and counts to cover the unaligned tails */
+		for (size_t start = 0; start < 5; start++) {
+			for (size_t i = 0; i < TEST_FLOATS; i++) {
+				src[i] = random_sample();
+				dst[i] = ref[i] = random_sample();
+			}
+
+			for (size_t i = start; i < TEST_FLOATS; i++)
+				ref[i] += src[i - start];
+
+			audio_mix_add(dst + start, src, TEST_FLOATS - start);
+			assert_memory_equal(dst, ref, sizeof(dst));
+		}
+	}
+
+	audio_mix_set_impl(best);
+}
+
+static void audio_mix_clamp_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	enum audio_mix_impl best = audio_mix_get_impl();
+	float data[TEST_FLOATS];
+	float orig[TEST_FLOATS];
+	float unclamped[TEST_FLOATS];
+
+	for (int impl = AUDIO_MIX_IMPL_C; impl <= (int)best; impl++) {
+		assert_true(audio_mix_set_impl(impl));
+
+		for (size_t i = 0; i < TEST_FLOATS; i++)
+			data[i] = orig[i] = random_sample();
+		data[3] = orig[3] = NAN;
+		data[17] = orig[17] = -NAN;
+		data[TEST_FLOATS - 1] = orig[TEST_FLOATS - 1] = NAN;
+		data[40] = orig[40] = INFINITY;
+		data[41] = orig[41] = -INFINITY;
+
+		audio_mix_clamp(data, unclamped, TEST_FLOATS);
+
+		for (size_t i = 0; i < TEST_FLOATS; i++) {
+			float val = orig[i];
+			val = (val == val) ? val : 0.0f;
+			val = (val > 1.0f) ? 1.0f : val;
+			val = (val < -1.0f) ? -1.0f : val;
+
+			assert_true(data[i] == val);
+		}
+
+		assert_memory_equal(unclamped, orig, sizeof(orig));
+	}
+
+	audio_mix_set_impl(best);
+}
+
+static void audio_mix_silent_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	enum audio_mix_impl best = audio_mix_get_impl();
+	float data[TEST_FLOATS] = {0};
+
+	for (int impl = AUDIO_MIX_IMPL_C; impl <= (int)best; impl++) {
+		assert_true(audio_mix_set_impl(impl));
+
+		data[5] = -0.0f;
+		assert_true(audio_mix_is_silent(data, TEST_FLOATS));
+
+		/* the tail is handled separately from the vector loop */
+		for (size_t pos = 0; pos < TEST_FLOATS; pos += 113) {
+			data[pos] = 1e-30f;
+			assert_false(audio_mix_is_silent(data, TEST_FLOATS));
+			data[pos] = NAN;
+			assert_false(audio_mix_is_silent(data, TEST_FLOATS));
+			data[pos] = 0.0f;
+		}
+
+		data[TEST_FLOATS - 1] = 1.0f;
+		assert_false(audio_mix_is_silent(data, TEST_FLOATS));
+		assert_true(audio_mix_is_silent(data, TEST_FLOATS - 1));
+		data[TEST_FLOATS - 1] = 0.0f;
+	}
+
+	audio_mix_set_impl(best);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(audio_mix_add_test),
+		cmocka_unit_test(audio_mix_clamp_test),
+		cmocka_unit_test(audio_mix_silent_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
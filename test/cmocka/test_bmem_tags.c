@@ -0,0 +1,149 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmocka.h>
+
+#include <util/bmem.h>
+#include <util/threading.h>
+
+#define TEST_FILE "test_bmem_tags.csv"
+#define TEST_THREADS 4
+#define TEST_ALLOCS 1000
+
+static uint64_t live_bytes(const struct bmem_snapshot *snap, enum bmem_tag tag)
+{
+	return snap->tags[tag].alloc_bytes - snap->tags[tag].free_bytes;
+}
+
+static void tag_names_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	assert_true(bmem_tags_enabled());
+	assert_string_equal(bmem_tag_name(BMEM_TAG_DATA), "data");
+	assert_string_equal(bmem_tag_name(BMEM_TAG_GRAPHICS_STAGING),
+			    "graphics_staging");
+	assert_null(bmem_tag_name(BMEM_TAG_COUNT));
+
+	/* setting a tag gives back the previous one */
+	assert_int_equal(bmem_set_tag(BMEM_TAG_SOURCE), BMEM_TAG_NONE);
+	assert_int_equal(bmem_set_tag(BMEM_TAG_NONE), BMEM_TAG_SOURCE);
+}
+
+/* reallocs and frees count against the tag of the allocation, not the tag
+ * set at the time */
+static void tag_counts_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	struct bmem_snapshot before, after;
+	bmem_snapshot(&before);
+
+	enum bmem_tag prev = bmem_set_tag(BMEM_TAG_ENCODER);
+	void *ptr = bmalloc(100);
+	bmem_set_tag(BMEM_TAG_OUTPUT);
+	ptr = brealloc(ptr, 300);
+
+	bmem_snapshot(&after);
+
+	assert_int_equal(after.tags[BMEM_TAG_ENCODER].allocs -
+				 before.tags[BMEM_TAG_ENCODER].allocs,
+			 1);
+	assert_int_equal(live_bytes(&after, BMEM_TAG_ENCODER) -
+				 live_bytes(&before, BMEM_TAG_ENCODER),
+			 300);
+	assert_int_equal(live_bytes(&after, BMEM_TAG_OUTPUT),
+			 live_bytes(&before, BMEM_TAG_OUTPUT));
+
+	bfree(ptr);
+	bmem_set_tag(prev);
+
+	bmem_snapshot(&after);
+	assert_int_equal(after.tags[BMEM_TAG_ENCODER].frees -
+				 before.tags[BMEM_TAG_ENCODER].frees,
+			 1);
+	assert_int_equal(live_bytes(&after, BMEM_TAG_ENCODER),
+			 live_bytes(&before, BMEM_TAG_ENCODER));
+}
+
+static void *alloc_thread(void *param)
+{
+	void **ptrs = param;
+
+	bmem_set_tag(BMEM_TAG_SOURCE);
+	for (int i = 0; i < TEST_ALLOCS; i++)
+		ptrs[i] = bmalloc(16);
+	return NULL;
+}
+
+/* counts of threads that have exited are kept, and memory allocated on one
+ * thread can be freed on another */
+static void tag_threads_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	static void *ptrs[TEST_THREADS][TEST_ALLOCS];
+	pthread_t threads[TEST_THREADS];
+	struct bmem_snapshot before, after;
+
+	bmem_snapshot(&before);
+
+	for (size_t i = 0; i < TEST_THREADS; i++)
+		assert_int_equal(pthread_create(&threads[i], NULL,
+						alloc_thread, ptrs[i]),
+				 0);
+	for (size_t i = 0; i < TEST_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	bmem_snapshot(&after);
+
+	assert_int_equal(live_bytes(&after, BMEM_TAG_SOURCE) -
+				 live_bytes(&before, BMEM_TAG_SOURCE),
+			 TEST_THREADS * TEST_ALLOCS * 16);
+
+	for (size_t i = 0; i < TEST_THREADS; i++)
+		for (size_t j = 0; j < TEST_ALLOCS; j++)
+			bfree(ptrs[i][j]);
+
+	bmem_snapshot(&after);
+	assert_int_equal(live_bytes(&after, BMEM_TAG_SOURCE),
+			 live_bytes(&before, BMEM_TAG_SOURCE));
+}
+
+static void dump_csv_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	struct bmem_snapshot before, after;
+	bmem_snapshot(&before);
+	bmem_snapshot(&after);
+
+	assert_true(bmem_snapshot_dump_csv(&after, &before, TEST_FILE));
+
+	/* read with stdio, libobs' file helpers allocate with its own copy of
+	 * bmem */
+	char csv[1024] = {0};
+	FILE *f = fopen(TEST_FILE, "rb");
+	assert_non_null(f);
+	fread(csv, 1, sizeof(csv) - 1, f);
+	fclose(f);
+	remove(TEST_FILE);
+
+	assert_true(strncmp(csv, "tag,live_bytes,", 15) == 0);
+	assert_non_null(strstr(csv, "\ngraphics_staging,"));
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(tag_names_test),
+		cmocka_unit_test(tag_counts_test),
+		cmocka_unit_test(tag_threads_test),
+		cmocka_unit_test(dump_csv_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,153 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <obs-interleave.h>
+
+static void push_packet(struct interleave_queue *q, enum obs_encoder_type type,
+			size_t track_idx, int64_t dts_usec)
+{
+	struct encoder_packet packet = {0};
+	packet.type = type;
+	packet.track_idx = track_idx;
+	packet.dts_usec = dts_usec;
+	packet.dts = dts_usec;
+
+	interleave_queue_push(q, &packet);
+}
+
+static void interleave_order_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	struct interleave_queue q = {0};
+	struct encoder_packet packet;
+
+	push_packet(&q, OBS_ENCODER_AUDIO, 1, 100);
+	push_packet(&q, OBS_ENCODER_AUDIO, 0, 100);
+	push_packet(&q, OBS_ENCODER_VIDEO, 1, 100);
+	push_packet(&q, OBS_ENCODER_VIDEO, 0, 100);
+	push_packet(&q, OBS_ENCODER_AUDIO, 0, 50);
+	push_packet(&q, OBS_ENCODER_VIDEO, 0, 200);
+	push_packet(&q, OBS_ENCODER_VIDEO, 0, 150);
+
+	assert_int_equal(q.num, 7);
+
+	/* audio 0 went backwards, it is sorted within its own track */
+	assert_true(interleave_queue_pop(&q, &packet));
+	assert_int_equal(packet.type, OBS_ENCODER_AUDIO);
+	assert_int_equal(packet.dts_usec, 50);
+
+	/* video before audio at equal dts, video by track index */
+	assert_true(interleave_queue_pop(&q, &packet));
+	assert_int_equal(packet.type, OBS_ENCODER_VIDEO);
+	assert_int_equal(packet.track_idx, 0);
+	assert_true(interleave_queue_pop(&q, &packet));
+	assert_int_equal(packet.type, OBS_ENCODER_VIDEO);
+	assert_int_equal(packet.track_idx, 1);
+
+	/* audio at equal dts in the order it was received */
+	assert_true(interleave_queue_pop(&q, &packet));
+	assert_int_equal(packet.type, OBS_ENCODER_AUDIO);
+	assert_int_equal(packet.track_idx, 1);
+	assert_true(interleave_queue_pop(&q, &packet));
+	assert_int_equal(packet.type, OBS_ENCODER_AUDIO);
+	assert_int_equal(packet.track_idx, 0);
+
+	assert_true(interleave_queue_pop(&q, &packet));
+	assert_int_equal(packet.dts_usec, 150);
+	assert_true(interleave_queue_pop(&q, &packet));
+	assert_int_equal(packet.dts_usec, 200);
+
+	assert_false(interleave_queue_pop(&q, &packet));
+	assert_int_equal(q.num, 0);
+
+	interleave_queue_free(&q);
+}
+
+static void interleave_index_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	struct interleave_queue q = {0};
+
+	push_packet(&q, OBS_ENCODER_AUDIO, 0, 0);
+	push_packet(&q, OBS_ENCODER_AUDIO, 0, 21333);
+	push_packet(&q, OBS_ENCODER_VIDEO, 0, 16666);
+	push_packet(&q, OBS_ENCODER_AUDIO, 1, 10000);
+
+	assert_int_equal(
+		interleave_queue_track_first_idx(&q, OBS_ENCODER_AUDIO, 0), 0);
+	assert_int_equal(
+		interleave_queue_track_first_idx(&q, OBS_ENCODER_AUDIO, 1), 1);
+	assert_int_equal(
+		interleave_queue_track_first_idx(&q, OBS_ENCODER_VIDEO, 0), 2);
+	assert_int_equal(
+		interleave_queue_track_first_idx(&q, OBS_ENCODER_VIDEO, 1), -1);
+
+	assert_int_equal(
+		interleave_queue_track_last(&q, OBS_ENCODER_AUDIO, 0)->dts_usec,
+		21333);
+
+	interleave_queue_discard(&q, 2);
+	assert_int_equal(q.num, 2);
+	assert_int_equal(interleave_queue_first(&q)->dts_usec, 16666);
+
+	interleave_queue_free(&q);
+}
+
+/* 2 video tracks at 60 fps and 6 audio tracks at 48 kHz AAC framing held
+ * with a second of delay come out in dts order */
+static void interleave_stream_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	const int64_t video_usec = 16667;
+	const int64_t audio_usec = 21333;
+	const size_t delay_packets = 60 * 8;
+	const size_t total_packets = 20000;
+
+	struct interleave_queue q = {0};
+	struct encoder_packet packet;
+	int64_t video_ts = 0;
+	int64_t audio_ts = 0;
+	int64_t last_dts = -1;
+	size_t pushed = 0;
+	size_t popped = 0;
+
+	while (pushed < total_packets) {
+		if (video_ts <= audio_ts) {
+			for (size_t i = 0; i < 2; i++)
+				push_packet(&q, OBS_ENCODER_VIDEO, i, video_ts);
+			video_ts += video_usec;
+			pushed += 2;
+		} else {
+			for (size_t i = 0; i < 6; i++)
+				push_packet(&q, OBS_ENCODER_AUDIO, i, audio_ts);
+			audio_ts += audio_usec;
+			pushed += 6;
+		}
+
+		while (q.num > delay_packets) {
+			assert_true(interleave_queue_pop(&q, &packet));
+			assert_true(packet.dts_usec >= last_dts);
+			last_dts = packet.dts_usec;
+			popped++;
+		}
+	}
+
+	assert_int_equal(popped + q.num, pushed);
+	interleave_queue_free(&q);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(interleave_order_test),
+		cmocka_unit_test(interleave_index_test),
+		cmocka_unit_test(interleave_stream_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,384 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmocka.h>
+
+#include <sys/wait.h>
+
+#include <util/platform.h>
+
+#include "ffmpeg-mux.h"
+#include "ffmpeg-mux-ring.h"
+
+#define TEST_RING_SIZE (1024 * 1024)
+
+static inline uint8_t pattern(uint32_t packet, uint32_t i)
+{
+	return (uint8_t)(packet * 31 + i * 7);
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct peer {
+	pid_t pid;
+	int to_child;
+	int from_child;
+};
+
+/* both sides get a pipe that hangs up once the other one exits, like stdin
+ * and the peer pipe between obs-ffmpeg-mux and ffmpeg-mux */
+static struct peer start_peer(int (*child)(int peer_fd, void *param),
+			      void *param)
+{
+	struct peer peer;
+	int to_child[2];
+	int from_child[2];
+
+	assert_int_equal(pipe(to_child), 0);
+	assert_int_equal(pipe(from_child), 0);
+
+	peer.pid = fork();
+	assert_true(peer.pid != -1);
+
+	if (peer.pid == 0) {
+		close(to_child[1]);
+		close(from_child[0]);
+		_exit(child(to_child[0], param));
+	}
+
+	close(to_child[0]);
+	close(from_child[1]);
+	peer.to_child = to_child[1];
+	peer.from_child = from_child[0];
+	return peer;
+}
+
+static int finish_peer(struct peer *peer)
+{
+	int status = 0;
+
+	close(peer->to_child);
+	waitpid(peer->pid, &status, 0);
+	close(peer->from_child);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct ring_child {
+	struct ffm_ring_info info;
+	uint32_t packets;
+	bool verify;
+};
+
+static int ring_reader(int peer_fd, void *param)
+{
+	struct ring_child *rc = param;
+	struct ffm_ring ring;
+	uint8_t *copy = NULL;
+	uint32_t count = 0;
+
+	if (!ffm_ring_open(&ring, &rc->info, peer_fd) || !ffm_ring_claim(&ring))
+		return 1;
+
+	for (;;) {
+		struct ffm_packet_info info;
+		const uint64_t info_size = sizeof(info);
+		uint8_t *data;
+
+		if (!ffm_ring_wait_data(&ring, info_size))
+			break;
+		memcpy(&info, ffm_ring_read_ptr(&ring), info_size);
+
+		if (info_size + info.size <= ring.capacity) {
+			if (!ffm_ring_wait_data(&ring, info_size + info.size))
+				return 2;
+			data = ffm_ring_read_ptr(&ring) + info_size;
+		} else {
+			ffm_ring_consume(&ring, info_size);
+			copy = realloc(copy, info.size);
+
+			for (uint64_t pos = 0; pos < info.size;) {
+				uint64_t chunk = info.size - pos;
+				if (chunk > ring.capacity)
+					chunk = ring.capacity;
+				if (!ffm_ring_wait_data(&ring, chunk))
+					return 2;
+				memcpy(copy + pos, ffm_ring_read_ptr(&ring),
+				       chunk);
+				ffm_ring_consume(&ring, chunk);
+				pos += chunk;
+			}
+			data = copy;
+		}
+
+		if (info.index != count || (int64_t)info.size != info.pts)
+			return 3;
+
+		for (uint32_t i = 0; rc->verify && i < info.size; i++) {
+			if (data[i] != pattern(count, i))
+				return 4;
+		}
+
+		if (data != copy)
+			ffm_ring_consume(&ring, info_size + info.size);
+		count++;
+	}
+
+	free(copy);
+	ffm_ring_close(&ring);
+	ffm_ring_free(&ring);
+	return count == rc->packets ? 0 : 5;
+}
+
+static bool ring_write(struct ffm_ring *ring, uint32_t idx, uint8_t *data,
+		       uint32_t size)
+{
+	struct ffm_packet_info info = {.pts = size,
+				       .size = size,
+				       .index = idx,
+				       .type = FFM_PACKET_VIDEO};
+
+	return ffm_ring_write(ring, &info, sizeof(info), data, size);
+}
+
+/* messages of every size, including ones that wrap around the end of the
+ * ring and ones larger than the whole ring, arrive intact and in order */
+static void ring_roundtrip_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	const uint32_t sizes[] = {0,
+				  1,
+				  1000,
+				  TEST_RING_SIZE / 3,
+				  TEST_RING_SIZE - sizeof(struct ffm_packet_info),
+				  TEST_RING_SIZE - 1,
+				  TEST_RING_SIZE,
+				  TEST_RING_SIZE * 3 + 17,
+				  4096,
+				  777777};
+	const uint32_t num = sizeof(sizes) / sizeof(sizes[0]);
+	struct ring_child rc = {0};
+	struct ffm_ring ring;
+
+	assert_true(ffm_ring_create(&ring, TEST_RING_SIZE));
+	rc.info.fd = ring.fd;
+	rc.info.capacity = ring.capacity;
+	rc.packets = num * 4;
+	rc.verify = true;
+
+	struct peer peer = start_peer(ring_reader, &rc);
+	ring.peer_fd = peer.from_child;
+
+	uint8_t *data = malloc(TEST_RING_SIZE * 4);
+	for (uint32_t idx = 0; idx < rc.packets; idx++) {
+		uint32_t size = sizes[idx % num];
+		for (uint32_t i = 0; i < size; i++)
+			data[i] = pattern(idx, i);
+		assert_true(ring_write(&ring, idx, data, size));
+	}
+	free(data);
+
+	ffm_ring_close(&ring);
+	assert_int_equal(finish_peer(&peer), 0);
+	assert_true(ffm_ring_claimed(&ring));
+	ffm_ring_free(&ring);
+}
+
+static int exit_reader(int peer_fd, void *param)
+{
+	UNUSED_PARAMETER(peer_fd);
+	UNUSED_PARAMETER(param);
+	return 0;
+}
+
+/* an offer nobody claims is declined, and a reader that exits doesn't leave
+ * the writer waiting for space */
+static void ring_decline_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	struct ffm_ring ring;
+	struct ffm_ring reader;
+
+	assert_true(ffm_ring_create(&ring, TEST_RING_SIZE));
+	ring.peer_fd = -1;
+
+	assert_false(ffm_ring_claimed(&ring));
+	assert_true(ffm_ring_decline(&ring));
+
+	struct ffm_ring_info info = {.fd = dup(ring.fd),
+				     .capacity = ring.capacity};
+	assert_true(ffm_ring_open(&reader, &info, -1));
+	assert_false(ffm_ring_claim(&reader));
+	ffm_ring_free(&reader);
+	ffm_ring_free(&ring);
+
+	assert_true(ffm_ring_create(&ring, TEST_RING_SIZE));
+	struct peer peer = start_peer(exit_reader, NULL);
+	ring.peer_fd = peer.from_child;
+
+	uint8_t *data = calloc(1, TEST_RING_SIZE / 2);
+	bool success = true;
+	for (uint32_t idx = 0; success && idx < 16; idx++)
+		success = ring_write(&ring, idx, data, TEST_RING_SIZE / 2);
+	free(data);
+
+	assert_false(success);
+	finish_peer(&peer);
+	ffm_ring_free(&ring);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool read_all(int fd, void *buf, size_t size)
+{
+	uint8_t *ptr = buf;
+
+	while (size) {
+		ssize_t ret = read(fd, ptr, size);
+		if (ret <= 0)
+			return false;
+		ptr += ret;
+		size -= (size_t)ret;
+	}
+	return true;
+}
+
+static bool write_all(int fd, const void *buf, size_t size)
+{
+	const uint8_t *ptr = buf;
+
+	while (size) {
+		ssize_t ret = write(fd, ptr, size);
+		if (ret <= 0)
+			return false;
+		ptr += ret;
+		size -= (size_t)ret;
+	}
+	return true;
+}
+
+/* reads the pipe like ffmpeg-mux does, claiming the ring when it's offered
+ * and switching to it at the empty FFM_PACKET_RING message */
+static int switch_reader(int peer_fd, void *param)
+{
+	struct ring_child *rc = param;
+	struct ffm_ring ring;
+	bool claimed = false;
+	uint32_t count = 0;
+	uint8_t data[256];
+
+	for (;;) {
+		struct ffm_packet_info info;
+
+		if (!read_all(peer_fd, &info, sizeof(info)) ||
+		    info.size > sizeof(data) ||
+		    !read_all(peer_fd, data, info.size))
+			return 1;
+
+		if (info.type != FFM_PACKET_RING) {
+			if (info.index != count++)
+				return 3;
+		} else if (info.size == 0) {
+			break;
+		} else if (!claimed) {
+			struct ffm_ring_info ring_info;
+			memcpy(&ring_info, data, sizeof(ring_info));
+			if (!ffm_ring_open(&ring, &ring_info, peer_fd))
+				return 2;
+			claimed = ffm_ring_claim(&ring);
+		}
+	}
+
+	if (!claimed)
+		return 4;
+
+	while (ffm_ring_wait_data(&ring, sizeof(struct ffm_packet_info))) {
+		struct ffm_packet_info info;
+		memcpy(&info, ffm_ring_read_ptr(&ring), sizeof(info));
+		if (!ffm_ring_wait_data(&ring, sizeof(info) + info.size))
+			return 2;
+		if (info.index != count++)
+			return 3;
+		ffm_ring_consume(&ring, sizeof(info) + info.size);
+	}
+
+	ffm_ring_close(&ring);
+	ffm_ring_free(&ring);
+	return count == rc->packets ? 0 : 5;
+}
+
+/* the writer keeps using the pipe after the offer without waiting for it to
+ * be claimed, and no message is lost or reordered when it switches */
+static void ring_switch_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	struct ring_child rc = {.packets = 1000};
+	uint8_t data[64] = {0};
+	struct ffm_ring ring;
+	uint32_t on_pipe = 0;
+	bool active = false;
+
+	assert_true(ffm_ring_create(&ring, TEST_RING_SIZE));
+	struct peer peer = start_peer(switch_reader, &rc);
+	ring.peer_fd = peer.from_child;
+
+	struct ffm_ring_info ring_info = {.fd = ring.fd,
+					  .capacity = ring.capacity};
+	struct ffm_packet_info offer = {.type = FFM_PACKET_RING,
+					.size = sizeof(ring_info)};
+	assert_true(write_all(peer.to_child, &offer, sizeof(offer)));
+	assert_true(write_all(peer.to_child, &ring_info, sizeof(ring_info)));
+
+	for (uint32_t idx = 0; idx < rc.packets; idx++) {
+		struct ffm_packet_info info = {.size = sizeof(data),
+					       .index = idx,
+					       .type = FFM_PACKET_VIDEO};
+
+		/* the first few always go through the pipe */
+		if (!active && idx >= 10 && ffm_ring_claimed(&ring)) {
+			struct ffm_packet_info end = {.type = FFM_PACKET_RING};
+			assert_true(write_all(peer.to_child, &end,
+					      sizeof(end)));
+			active = true;
+		}
+
+		if (active) {
+			assert_true(ffm_ring_write(&ring, &info, sizeof(info),
+						   data, sizeof(data)));
+		} else {
+			assert_true(write_all(peer.to_child, &info,
+					      sizeof(info)));
+			assert_true(write_all(peer.to_child, data,
+					      sizeof(data)));
+			on_pipe++;
+			if (idx >= 10)
+				os_sleep_ms(1);
+		}
+	}
+
+	assert_true(active);
+	assert_true(on_pipe >= 10);
+	assert_false(ffm_ring_decline(&ring));
+
+	ffm_ring_close(&ring);
+	assert_int_equal(finish_peer(&peer), 0);
+	ffm_ring_free(&ring);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(ring_roundtrip_test),
+		cmocka_unit_test(ring_decline_test),
+		cmocka_unit_test(ring_switch_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
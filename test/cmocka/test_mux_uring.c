@@ -0,0 +1,108 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmocka.h>
+
+#include <util/platform.h>
+
+#include "ffmpeg-mux-uring.h"
+
+#define TEST_FILE "test_mux_uring.tmp"
+#define TEST_FILE_SIZE (16 * 1024 * 1024)
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(uint32_t max)
+{
+	rng_state = rng_state * 1103515245 + 12345;
+	return (rng_state >> 8) % max;
+}
+
+static void write_chunk(struct ffm_uring *u, uint8_t *expected,
+			uint64_t offset, size_t size)
+{
+	uint8_t *buf = ffm_uring_buffer(u);
+
+	for (size_t i = 0; i < size; i++) {
+		uint8_t val = (uint8_t)rng(256);
+		buf[i] = val;
+		expected[offset + i] = val;
+	}
+
+	assert_true(ffm_uring_write(u, offset, size));
+}
+
+/* chunks of any size written one after the other, with the occasional
+ * seek back to rewrite a few bytes, the way the mp4 and mkv muxers update
+ * their headers, end up in the file exactly as written */
+static void write_file(bool direct)
+{
+	struct ffm_io_stats stats = {0};
+	uint8_t *expected = calloc(1, TEST_FILE_SIZE);
+	uint64_t end = 0;
+
+	struct ffm_uring *u = ffm_uring_create(TEST_FILE, direct, &stats);
+	if (!u) {
+		free(expected);
+		skip();
+	}
+
+	while (end < TEST_FILE_SIZE - FFM_URING_BUFFER_SIZE) {
+		size_t size = rng(4) ? rng(FFM_URING_BUFFER_SIZE) + 1
+				     : FFM_URING_BUFFER_SIZE;
+		write_chunk(u, expected, end, size);
+		end += size;
+
+		if (rng(8) == 0) {
+			uint64_t offset = rng((uint32_t)end - 100);
+			write_chunk(u, expected, offset, rng(100) + 1);
+		}
+	}
+
+	/* the final rewrite of the header */
+	write_chunk(u, expected, 3, 50);
+	assert_true(ffm_uring_close(u));
+
+	assert_true(stats.backend == FFM_IO_URING ||
+		    stats.backend == FFM_IO_URING_DIRECT);
+	assert_true(stats.bytes >= end);
+	assert_true(stats.writes > 0);
+	assert_true(stats.max_in_flight > 1);
+
+	FILE *file = fopen(TEST_FILE, "rb");
+	uint8_t *data = malloc(TEST_FILE_SIZE);
+	assert_non_null(file);
+
+	assert_int_equal(fread(data, 1, TEST_FILE_SIZE, file), end);
+	assert_memory_equal(data, expected, end);
+
+	fclose(file);
+	os_unlink(TEST_FILE);
+	free(data);
+	free(expected);
+}
+
+static void uring_write_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+	write_file(false);
+}
+
+static void uring_direct_write_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+	write_file(true);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(uring_write_test),
+		cmocka_unit_test(uring_direct_write_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
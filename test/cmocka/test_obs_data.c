@@ -0,0 +1,234 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmocka.h>
+
+#include <obs-data.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+
+/* escapes, unicode and every type of value, with nulls skipped and only the
+ * objects of arrays kept, the same as when loading through jansson */
+static void load_values_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	obs_data_t *data = obs_data_create_from_json(
+		" {\"str\": \"a\\n\\\"b\\\"\\u00e9\\ud83d\\ude00\\/\","
+		"\"utf8\":\"caf\xc3\xa9\","
+		"\"int\":-9223372036854775808,\"max\":9223372036854775807,"
+		"\"real\":-2.5e2,\"zero\":-0,\"t\":true,\"f\":false,\"n\":null,"
+		"\"obj\":{\"nested\":{\"x\":1}},"
+		"\"arr\":[1,{\"a\":1},\"s\",[{\"b\":2}],null,{\"a\":2}],"
+		"\"\":\"empty key\"} ");
+	assert_non_null(data);
+
+	assert_string_equal(obs_data_get_string(data, "str"),
+			    "a\n\"b\"\xc3\xa9\xf0\x9f\x98\x80/");
+	assert_string_equal(obs_data_get_string(data, "utf8"),
+			    "caf\xc3\xa9");
+	assert_true(obs_data_get_int(data, "int") ==
+		    -9223372036854775807LL - 1);
+	assert_true(obs_data_get_int(data, "max") == 9223372036854775807LL);
+	assert_true(obs_data_get_double(data, "real") == -250.0);
+	assert_true(obs_data_get_int(data, "zero") == 0);
+	assert_true(obs_data_get_bool(data, "t"));
+	assert_false(obs_data_get_bool(data, "f"));
+	assert_false(obs_data_has_user_value(data, "n"));
+	assert_string_equal(obs_data_get_string(data, ""), "empty key");
+
+	obs_data_item_t *item = obs_data_item_byname(data, "real");
+	assert_int_equal(obs_data_item_numtype(item), OBS_DATA_NUM_DOUBLE);
+	obs_data_item_release(&item);
+
+	obs_data_t *obj = obs_data_get_obj(data, "obj");
+	obs_data_t *nested = obs_data_get_obj(obj, "nested");
+	assert_int_equal(obs_data_get_int(nested, "x"), 1);
+	obs_data_release(nested);
+	obs_data_release(obj);
+
+	obs_data_array_t *array = obs_data_get_array(data, "arr");
+	assert_int_equal(obs_data_array_count(array), 2);
+	obs_data_t *second = obs_data_array_item(array, 1);
+	assert_int_equal(obs_data_get_int(second, "a"), 2);
+	obs_data_release(second);
+	obs_data_array_release(array);
+
+	obs_data_release(data);
+}
+
+/* anything jansson rejects is still rejected */
+static void load_errors_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	static const char *invalid[] = {
+		"{\"a\":1,\"a\":2}",
+		"{\"a\":null,\"a\":1}",
+		"{\"a\":\"\\u0000\"}",
+		"{\"a\":\"\\udc00\"}",
+		"{\"a\":\"\xc0\x80\"}",
+		"{\"a\":\"\xed\xa0\x80\"}",
+		"{\"a\":\"tab\there\"}",
+		"{\"a\":01}",
+		"{\"a\":1.}",
+		"{\"a\":1e400}",
+		"{\"a\":9223372036854775808}",
+		"{\"a\":1,}",
+		"{\"a\":tru}",
+		"{\"a\":1} x",
+		"{\"a\":{\"b\":1}",
+	};
+
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+		assert_null(obs_data_create_from_json(invalid[i]));
+
+	/* valid, but loaded through jansson */
+	obs_data_t *data = obs_data_create_from_json("[{\"a\":1}]");
+	assert_non_null(data);
+	assert_null(obs_data_first(data));
+	obs_data_release(data);
+}
+
+/* loaded items keep working when they grow, get defaults, or outlive the
+ * data they were loaded with */
+static void modify_loaded_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	obs_data_t *data = obs_data_create_from_json(
+		"{\"name\":\"src\",\"n\":5,\"d\":1.5,"
+		"\"settings\":{\"name\":\"inner\"},"
+		"\"filters\":[{\"name\":\"f1\"},{\"name\":\"f2\"}]}");
+	assert_non_null(data);
+
+	obs_data_t *settings = obs_data_get_obj(data, "settings");
+	obs_data_array_t *filters = obs_data_get_array(data, "filters");
+	obs_data_item_t *item = obs_data_item_byname(settings, "name");
+
+	obs_data_set_string(data, "name", "a name too long to fit in place");
+	obs_data_set_int(data, "n", 7);
+	obs_data_set_default_int(data, "n", 3);
+	obs_data_set_default_string(data, "name", "default");
+	obs_data_set_string(data, "new", "value");
+	obs_data_erase(data, "d");
+
+	assert_string_equal(obs_data_get_string(data, "name"),
+			    "a name too long to fit in place");
+	assert_int_equal(obs_data_get_int(data, "n"), 7);
+	assert_int_equal(obs_data_get_default_int(data, "n"), 3);
+	assert_string_equal(obs_data_get_default_string(data, "name"),
+			    "default");
+	assert_string_equal(obs_data_get_string(data, "new"), "value");
+	assert_false(obs_data_has_user_value(data, "d"));
+
+	obs_data_t *copy = obs_data_create();
+	obs_data_apply(copy, data);
+	assert_string_equal(obs_data_get_json(copy), obs_data_get_json(data));
+	obs_data_release(copy);
+
+	obs_data_release(data);
+
+	obs_data_item_set_string(&item, "changed after the root was released");
+	assert_string_equal(obs_data_item_get_name(item), "name");
+	assert_string_equal(obs_data_item_get_string(item),
+			    "changed after the root was released");
+
+	obs_data_t *filter = obs_data_array_item(filters, 1);
+	assert_string_equal(obs_data_get_string(filter, "name"), "f2");
+	obs_data_release(filter);
+
+	obs_data_item_release(&item);
+	obs_data_array_release(filters);
+	obs_data_release(settings);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static obs_data_t *create_source(int idx)
+{
+	obs_data_t *source = obs_data_create();
+	obs_data_t *settings = obs_data_create();
+	obs_data_array_t *filters = obs_data_array_create();
+	char name[64];
+
+	snprintf(name, sizeof(name), "Source %d", idx);
+	obs_data_set_string(source, "name", name);
+	obs_data_set_string(source, "uuid",
+			    "2a0e4f6c-7d1b-4c3e-9f2a-1b2c3d4e5f60");
+	obs_data_set_string(source, "id",
+			    idx % 3 ? "image_source" : "ffmpeg_source");
+	obs_data_set_int(source, "mixers", 255);
+	obs_data_set_double(source, "volume", 1.0);
+	obs_data_set_bool(source, "enabled", true);
+	obs_data_set_bool(source, "muted", false);
+
+	obs_data_set_string(settings, "local_file",
+			    "/home/user/Videos/recordings/intro.mp4");
+	obs_data_set_bool(settings, "looping", true);
+	obs_data_set_int(settings, "speed_percent", 100);
+	obs_data_set_string(settings, "text", "Caf\xc3\xa9 \"quoted\"\nline");
+	obs_data_set_obj(source, "settings", settings);
+
+	for (int i = 0; i < 2; i++) {
+		obs_data_t *filter = obs_data_create();
+		obs_data_t *filter_settings = obs_data_create();
+
+		obs_data_set_string(filter, "name", "Color Correction");
+		obs_data_set_string(filter, "id", "color_filter");
+		obs_data_set_double(filter_settings, "gamma", 0.25);
+		obs_data_set_double(filter_settings, "contrast", -0.1);
+		obs_data_set_obj(filter, "settings", filter_settings);
+		obs_data_array_push_back(filters, filter);
+
+		obs_data_release(filter_settings);
+		obs_data_release(filter);
+	}
+	obs_data_set_array(source, "filters", filters);
+
+	obs_data_array_release(filters);
+	obs_data_release(settings);
+	return source;
+}
+
+/* a collection loaded from json saves back to the same text */
+static void load_collection_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	obs_data_t *collection = obs_data_create();
+	obs_data_array_t *sources = obs_data_array_create();
+
+	for (int i = 0; i < 50; i++) {
+		obs_data_t *source = create_source(i);
+		obs_data_array_push_back(sources, source);
+		obs_data_release(source);
+	}
+
+	obs_data_set_string(collection, "name", "Collection");
+	obs_data_set_array(collection, "sources", sources);
+
+	const char *json = obs_data_get_json_pretty(collection);
+	obs_data_t *data = obs_data_create_from_json(json);
+	assert_non_null(data);
+	assert_string_equal(obs_data_get_json_pretty(data), json);
+
+	obs_data_release(data);
+	obs_data_array_release(sources);
+	obs_data_release(collection);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(load_values_test),
+		cmocka_unit_test(load_errors_test),
+		cmocka_unit_test(modify_loaded_test),
+		cmocka_unit_test(load_collection_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,151 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <obs.h>
+#include <util/threading.h>
+
+#define QUEUE_DEPTH 8
+#define WARMUP_PACKETS 2000
+#define ROUND_PACKETS 10000
+#define MAX_ROUNDS 10
+
+/* audio frames up to large video keyframes, one size class each */
+static const size_t packet_sizes[] = {64, 1500, 40000, 600000};
+#define NUM_SIZES (sizeof(packet_sizes) / sizeof(packet_sizes[0]))
+
+/* packets are created on one thread and released on another, like those of
+ * an encoder and an output's send thread */
+struct packet_queue {
+	struct encoder_packet packets[QUEUE_DEPTH];
+	os_sem_t *slots;
+	os_sem_t *items;
+	size_t count;
+};
+
+static void create_packet(struct encoder_packet *dst, size_t size)
+{
+	static uint8_t data[600000];
+	struct encoder_packet src = {
+		.type = OBS_ENCODER_VIDEO,
+		.data = data,
+		.size = size,
+	};
+
+	PRAGMA_WARN_PUSH
+	PRAGMA_WARN_DEPRECATION
+	obs_duplicate_encoder_packet(dst, &src);
+	PRAGMA_WARN_POP
+}
+
+static void *consumer_thread(void *param)
+{
+	struct packet_queue *queue = param;
+
+	for (size_t i = 0; i < queue->count; i++) {
+		struct encoder_packet *pkt = &queue->packets[i % QUEUE_DEPTH];
+		struct encoder_packet ref;
+
+		os_sem_wait(queue->items);
+
+		/* an output keeps its own reference for a while */
+		obs_encoder_packet_ref(&ref, pkt);
+		obs_encoder_packet_release(pkt);
+		obs_encoder_packet_release(&ref);
+
+		os_sem_post(queue->slots);
+	}
+
+	return NULL;
+}
+
+static void cycle_packets(size_t count)
+{
+	struct packet_queue queue = {.count = count};
+	pthread_t thread;
+
+	assert_int_equal(os_sem_init(&queue.slots, QUEUE_DEPTH), 0);
+	assert_int_equal(os_sem_init(&queue.items, 0), 0);
+	assert_int_equal(
+		pthread_create(&thread, NULL, consumer_thread, &queue), 0);
+
+	for (size_t i = 0; i < count; i++) {
+		os_sem_wait(queue.slots);
+		create_packet(&queue.packets[i % QUEUE_DEPTH],
+			      packet_sizes[i % NUM_SIZES]);
+		os_sem_post(queue.items);
+	}
+
+	pthread_join(thread, NULL);
+	os_sem_destroy(queue.slots);
+	os_sem_destroy(queue.items);
+}
+
+/* once packets have gone around a few times, every new one is served from
+ * the pool and the heap isn't touched anymore, how many buffers that takes
+ * depends on how the two threads were scheduled */
+static void steady_state_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	struct encoder_packet_pool_stats before;
+	struct encoder_packet_pool_stats after;
+	bool steady = false;
+
+	cycle_packets(WARMUP_PACKETS);
+
+	for (int round = 0; !steady && round < MAX_ROUNDS; round++) {
+		obs_encoder_packet_pool_get_stats(&before);
+		cycle_packets(ROUND_PACKETS);
+		obs_encoder_packet_pool_get_stats(&after);
+
+		assert_int_equal(after.allocs - before.allocs, ROUND_PACKETS);
+		assert_int_equal(after.releases - before.releases,
+				 ROUND_PACKETS);
+		steady = after.heap_allocs == before.heap_allocs;
+	}
+
+	assert_true(steady);
+	assert_true(after.pooled_bytes > 0);
+}
+
+/* released packets are reused for packets of the same size class only */
+static void size_class_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	struct encoder_packet_pool_stats before;
+	struct encoder_packet_pool_stats after;
+	struct encoder_packet small;
+	struct encoder_packet large;
+
+	create_packet(&small, packet_sizes[0]);
+	obs_encoder_packet_release(&small);
+	create_packet(&large, packet_sizes[NUM_SIZES - 1]);
+	obs_encoder_packet_release(&large);
+
+	obs_encoder_packet_pool_get_stats(&before);
+
+	for (size_t i = 0; i < 100; i++) {
+		create_packet(&small, packet_sizes[0]);
+		create_packet(&large, packet_sizes[NUM_SIZES - 1]);
+		assert_true(large.data != small.data);
+		obs_encoder_packet_release(&small);
+		obs_encoder_packet_release(&large);
+	}
+
+	obs_encoder_packet_pool_get_stats(&after);
+	assert_int_equal(after.heap_allocs, before.heap_allocs);
+	assert_int_equal(after.reused - before.reused, 200);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(steady_state_test),
+		cmocka_unit_test(size_class_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
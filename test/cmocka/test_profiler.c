@@ -0,0 +1,246 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmocka.h>
+
+#include <util/platform.h>
+#include <util/profiler.h>
+#include <util/threading.h>
+
+#define TEST_THREADS 4
+#define TEST_FRAMES 1000
+
+static const char *frame_name = "frame";
+static const char *tick_name = "tick";
+static const char *render_name = "render";
+static const char *draw_name = "draw";
+static const char *threads_root_name = "threads_frame";
+static const char *mismatch_root_name = "mismatch_frame";
+static const char *exited_root_name = "exited_frame";
+
+struct find_entry {
+	const char *name;
+	profiler_snapshot_entry_t *entry;
+};
+
+static bool find_entry_func(void *context, profiler_snapshot_entry_t *entry)
+{
+	struct find_entry *find = context;
+
+	if (strcmp(profiler_snapshot_entry_name(entry), find->name) == 0) {
+		find->entry = entry;
+		return false;
+	}
+	return true;
+}
+
+static profiler_snapshot_entry_t *find_root(profiler_snapshot_t *snap,
+					    const char *name)
+{
+	struct find_entry find = {.name = name};
+	profiler_snapshot_enumerate_roots(snap, find_entry_func, &find);
+	return find.entry;
+}
+
+static profiler_snapshot_entry_t *find_child(profiler_snapshot_entry_t *entry,
+					     const char *name)
+{
+	struct find_entry find = {.name = name};
+	profiler_snapshot_enumerate_children(entry, find_entry_func, &find);
+	return find.entry;
+}
+
+static void profile_frame(const char *root)
+{
+	profile_start(root);
+
+	profile_start(tick_name);
+	profile_end(tick_name);
+
+	profile_start(render_name);
+	for (int i = 0; i < 2; i++) {
+		profile_start(draw_name);
+		profile_end(draw_name);
+	}
+	profile_end(render_name);
+
+	profile_end(root);
+}
+
+/* every scope is counted under its parent, and the time between calls of
+ * a root is tracked once it has an expected interval */
+static void profiler_tree_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	profile_register_root(frame_name, 1000000);
+
+	for (int i = 0; i < TEST_FRAMES; i++)
+		profile_frame(frame_name);
+
+	profiler_snapshot_t *snap = profile_snapshot_create();
+	profiler_snapshot_entry_t *root = find_root(snap, frame_name);
+	assert_non_null(root);
+
+	assert_int_equal(profiler_snapshot_entry_overall_count(root),
+			 TEST_FRAMES);
+	assert_int_equal(
+		profiler_snapshot_entry_overall_between_calls_count(root),
+		TEST_FRAMES - 1);
+	assert_int_equal(profiler_snapshot_entry_expected_time_between_calls(
+				 root),
+			 1000);
+	assert_int_equal(profiler_snapshot_num_children(root), 2);
+
+	profiler_snapshot_entry_t *tick = find_child(root, tick_name);
+	profiler_snapshot_entry_t *render = find_child(root, render_name);
+	assert_non_null(tick);
+	assert_non_null(render);
+	assert_int_equal(profiler_snapshot_entry_overall_count(tick),
+			 TEST_FRAMES);
+	assert_int_equal(profiler_snapshot_entry_overall_count(render),
+			 TEST_FRAMES);
+
+	profiler_snapshot_entry_t *draw = find_child(render, draw_name);
+	assert_non_null(draw);
+	assert_int_equal(profiler_snapshot_entry_overall_count(draw),
+			 TEST_FRAMES * 2);
+	assert_true(profiler_snapshot_entry_max_time(render) >=
+		    profiler_snapshot_entry_min_time(draw));
+
+	profile_snapshot_free(snap);
+}
+
+static void *frame_thread(void *param)
+{
+	UNUSED_PARAMETER(param);
+
+	for (int i = 0; i < TEST_FRAMES; i++)
+		profile_frame(threads_root_name);
+	return NULL;
+}
+
+/* the same root profiled on several threads adds up in the snapshot, also
+ * while snapshots are being taken */
+static void profiler_threads_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	pthread_t threads[TEST_THREADS];
+
+	for (size_t i = 0; i < TEST_THREADS; i++)
+		assert_int_equal(pthread_create(&threads[i], NULL,
+						frame_thread, NULL),
+				 0);
+
+	for (int i = 0; i < 10; i++)
+		profile_snapshot_free(profile_snapshot_create());
+
+	for (size_t i = 0; i < TEST_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	profiler_snapshot_t *snap = profile_snapshot_create();
+	profiler_snapshot_entry_t *root = find_root(snap, threads_root_name);
+	assert_non_null(root);
+	assert_int_equal(profiler_snapshot_entry_overall_count(root),
+			 TEST_THREADS * TEST_FRAMES);
+
+	profiler_snapshot_entry_t *render = find_child(root, render_name);
+	profiler_snapshot_entry_t *draw = find_child(render, draw_name);
+	assert_int_equal(profiler_snapshot_entry_overall_count(draw),
+			 TEST_THREADS * TEST_FRAMES * 2);
+
+	profile_snapshot_free(snap);
+}
+
+static void *exiting_thread(void *param)
+{
+	const char *root = param;
+
+	for (int i = 0; i < TEST_FRAMES; i++)
+		profile_frame(root);
+
+	/* left open when the thread exits */
+	profile_start(root);
+	profile_start(tick_name);
+	profile_end(tick_name);
+	return NULL;
+}
+
+/* the times of threads that have exited are kept, including the time
+ * between calls of their roots */
+static void profiler_exited_threads_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	pthread_t thread;
+
+	profile_register_root(exited_root_name, 1000000);
+
+	for (int i = 0; i < 3; i++) {
+		assert_int_equal(pthread_create(&thread, NULL, exiting_thread,
+						(void *)exited_root_name),
+				 0);
+		pthread_join(thread, NULL);
+	}
+
+	profiler_snapshot_t *snap = profile_snapshot_create();
+	profiler_snapshot_entry_t *root = find_root(snap, exited_root_name);
+	assert_non_null(root);
+	assert_int_equal(profiler_snapshot_entry_overall_count(root),
+			 3 * TEST_FRAMES);
+	assert_int_equal(
+		profiler_snapshot_entry_overall_between_calls_count(root),
+		3 * (TEST_FRAMES - 1));
+	assert_int_equal(profiler_snapshot_entry_overall_count(
+				 find_child(root, tick_name)),
+			 3 * (TEST_FRAMES + 1));
+
+	profile_snapshot_free(snap);
+}
+
+/* ending an outer scope also ends the scopes left open inside it */
+static void profiler_mismatch_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	profile_start(mismatch_root_name);
+	profile_start(render_name);
+	profile_start(draw_name);
+	profile_end(mismatch_root_name);
+
+	/* not open, ignored */
+	profile_end(tick_name);
+
+	profiler_snapshot_t *snap = profile_snapshot_create();
+	profiler_snapshot_entry_t *root = find_root(snap, mismatch_root_name);
+	assert_non_null(root);
+	assert_int_equal(profiler_snapshot_entry_overall_count(root), 1);
+
+	profiler_snapshot_entry_t *render = find_child(root, render_name);
+	assert_non_null(render);
+	assert_int_equal(profiler_snapshot_entry_overall_count(render), 1);
+	assert_int_equal(profiler_snapshot_entry_overall_count(
+				 find_child(render, draw_name)),
+			 1);
+
+	profile_snapshot_free(snap);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(profiler_tree_test),
+		cmocka_unit_test(profiler_threads_test),
+		cmocka_unit_test(profiler_exited_threads_test),
+		cmocka_unit_test(profiler_mismatch_test),
+	};
+
+	profiler_start();
+	int ret = cmocka_run_group_tests(tests, NULL, NULL);
+	profiler_stop();
+	profiler_free();
+	return ret;
+}
@@ -0,0 +1,193 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmocka.h>
+
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <util/profiler.h>
+#include <util/threading.h>
+
+#define TEST_FILE "test_profiler_trace.json"
+#define TEST_THREADS 4
+#define TEST_CALLS 1000
+
+static const char *outer_name = "outer";
+static const char *inner_name = "inner";
+static const char *quoted_name = "say \"hi\"\\";
+
+static size_t count_str(const char *haystack, const char *needle)
+{
+	size_t count = 0;
+
+	while ((haystack = strstr(haystack, needle)) != NULL) {
+		haystack += strlen(needle);
+		count++;
+	}
+
+	return count;
+}
+
+static char *dump_trace(void)
+{
+	assert_true(profiler_trace_dump_json(TEST_FILE));
+
+	char *json = os_quick_read_utf8_file(TEST_FILE);
+	assert_non_null(json);
+	os_unlink(TEST_FILE);
+
+	assert_true(strncmp(json, "{", 1) == 0);
+	assert_non_null(strstr(json, "]}"));
+	return json;
+}
+
+static void *trace_thread(void *param)
+{
+	UNUSED_PARAMETER(param);
+
+	profile_start(outer_name);
+	for (int i = 0; i < TEST_CALLS; i++) {
+		profile_start(inner_name);
+		profile_end(inner_name);
+	}
+	profile_end(outer_name);
+	return NULL;
+}
+
+/* calls from several threads all end up in the trace, each thread on its
+ * own track named after its outermost call */
+static void trace_threads_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	pthread_t threads[TEST_THREADS];
+
+	profiler_trace_start();
+	assert_true(profiler_trace_active());
+
+	for (size_t i = 0; i < TEST_THREADS; i++)
+		assert_int_equal(pthread_create(&threads[i], NULL,
+						trace_thread, NULL),
+				 0);
+	for (size_t i = 0; i < TEST_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	profiler_trace_stop();
+	assert_false(profiler_trace_active());
+
+	/* nothing is recorded once stopped */
+	trace_thread(NULL);
+
+	char *json = dump_trace();
+	size_t calls = TEST_THREADS * (TEST_CALLS + 1);
+
+	assert_int_equal(count_str(json, "\"ph\":\"B\""), calls);
+	assert_int_equal(count_str(json, "\"ph\":\"E\""), calls);
+	assert_int_equal(count_str(json, "\"name\":\"inner\""),
+			 TEST_THREADS * TEST_CALLS * 2);
+	assert_int_equal(count_str(json, "\"args\":{\"name\":\"outer\"}"),
+			 TEST_THREADS);
+
+	bfree(json);
+}
+
+/* once a thread's ring is full the oldest events are dropped, along with
+ * the end events whose begin events went with them */
+static void trace_overflow_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	profiler_trace_start();
+
+	profile_start(outer_name);
+	for (int i = 0; i < 100000; i++) {
+		profile_start(inner_name);
+		profile_end(inner_name);
+	}
+	profile_end(outer_name);
+
+	profiler_trace_stop();
+
+	char *json = dump_trace();
+
+	/* 65536 of the 200002 events are kept, starting with an end event */
+	assert_int_equal(count_str(json, "\"ph\":\"B\""), 32767);
+	assert_int_equal(count_str(json, "\"ph\":\"E\""), 32767);
+	assert_int_equal(count_str(json, "\"name\":\"outer\",\"ph\""), 0);
+
+	bfree(json);
+}
+
+/* starting a new trace discards the previous one, and names are escaped */
+static void trace_restart_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	profiler_trace_start();
+	trace_thread(NULL);
+
+	profiler_trace_start();
+	profile_start(quoted_name);
+	profile_end(quoted_name);
+	profiler_trace_stop();
+
+	char *json = dump_trace();
+
+	assert_int_equal(count_str(json, "\"ph\":\"B\""), 1);
+	assert_int_equal(count_str(json, "\"name\":\"inner\""), 0);
+	assert_int_equal(count_str(json, "\"name\":\"say \\\"hi\\\"\\\\\""),
+			 2);
+
+	bfree(json);
+}
+
+static void run_trace_threads(void)
+{
+	pthread_t threads[TEST_THREADS];
+
+	for (size_t i = 0; i < TEST_THREADS; i++)
+		assert_int_equal(pthread_create(&threads[i], NULL,
+						trace_thread, NULL),
+				 0);
+	for (size_t i = 0; i < TEST_THREADS; i++)
+		pthread_join(threads[i], NULL);
+}
+
+/* the rings of threads that have exited are taken over by new threads once
+ * a later trace is started, instead of new rings being allocated */
+static void trace_exited_threads_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	profiler_trace_start();
+	run_trace_threads();
+	long allocs = bnum_allocs();
+
+	for (int i = 0; i < 3; i++) {
+		profiler_trace_start();
+		run_trace_threads();
+		assert_int_equal(bnum_allocs(), allocs);
+	}
+
+	profiler_trace_stop();
+
+	char *json = dump_trace();
+	assert_int_equal(count_str(json, "\"args\":{\"name\":\"outer\"}"),
+			 TEST_THREADS);
+	bfree(json);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(trace_threads_test),
+		cmocka_unit_test(trace_overflow_test),
+		cmocka_unit_test(trace_restart_test),
+		cmocka_unit_test(trace_exited_threads_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,329 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <string.h>
+#include <cmocka.h>
+
+#include <util/darray.h>
+#include <util/platform.h>
+
+#include "replay-store.h"
+
+#define SPILL_DIR "test_replay_store_spill"
+
+#define VIDEO_SIZE 1000
+#define AUDIO_SIZE 100
+#define KEYFRAME_INTERVAL 10
+
+/* packets reach the store with refcounted data, like those of an output */
+static void push_packet(replay_store_t *store, struct encoder_packet *src)
+{
+	struct encoder_packet packet;
+
+	PRAGMA_WARN_PUSH
+	PRAGMA_WARN_DEPRECATION
+	obs_duplicate_encoder_packet(&packet, src);
+	PRAGMA_WARN_POP
+
+	replay_store_push(store, &packet);
+	obs_encoder_packet_release(&packet);
+}
+
+/* video at 30 fps and one audio packet per frame, a keyframe every ten
+ * frames, each packet filled with a byte made from its frame and track */
+static void push_frame(replay_store_t *store, int64_t frame)
+{
+	uint8_t video_data[VIDEO_SIZE];
+	uint8_t audio_data[AUDIO_SIZE];
+
+	memset(video_data, (int)(frame & 0xFF), sizeof(video_data));
+	memset(audio_data, (int)((frame + 1) & 0xFF), sizeof(audio_data));
+
+	struct encoder_packet video = {
+		.type = OBS_ENCODER_VIDEO,
+		.keyframe = frame % KEYFRAME_INTERVAL == 0,
+		.data = video_data,
+		.size = sizeof(video_data),
+		.dts = frame,
+		.pts = frame,
+		.timebase_num = 1,
+		.timebase_den = 30,
+		.dts_usec = frame * 1000000 / 30,
+	};
+	struct encoder_packet audio = {
+		.type = OBS_ENCODER_AUDIO,
+		.data = audio_data,
+		.size = sizeof(audio_data),
+		.dts = frame * 1600,
+		.pts = frame * 1600,
+		.timebase_num = 1,
+		.timebase_den = 48000,
+		.dts_usec = frame * 1000000 / 30,
+	};
+
+	replay_store_purge(store, 0, INT64_MAX, &video);
+	push_packet(store, &video);
+	push_packet(store, &audio);
+}
+
+struct written_packet {
+	enum obs_encoder_type type;
+	int64_t dts;
+	int64_t dts_usec;
+	size_t size;
+	uint8_t byte;
+	bool data_valid;
+};
+
+static bool write_packet(void *param, struct encoder_packet *packet)
+{
+	DARRAY(struct written_packet) *written = param;
+	struct written_packet *wp = da_push_back_new(*written);
+
+	wp->type = packet->type;
+	wp->dts = packet->dts;
+	wp->dts_usec = packet->dts_usec;
+	wp->size = packet->size;
+	wp->data_valid = packet->data != NULL;
+
+	if (wp->data_valid)
+		wp->byte = packet->data[0];
+	for (size_t i = 1; wp->data_valid && i < packet->size; i++)
+		wp->data_valid = packet->data[i] == wp->byte;
+	return true;
+}
+
+/* writes the snapshot and checks every frame from first_frame on is there,
+ * in order and starting at zero */
+static void check_snapshot(replay_snapshot_t *snapshot, int64_t first_frame,
+			   int64_t frames)
+{
+	DARRAY(struct written_packet) written = {0};
+
+	assert_true(replay_snapshot_write(snapshot, write_packet, &written));
+	assert_int_equal(written.num, frames * 2);
+
+	for (int64_t i = 0; i < frames; i++) {
+		struct written_packet *video = &written.array[i * 2];
+		struct written_packet *audio = &written.array[i * 2 + 1];
+
+		assert_int_equal(video->type, OBS_ENCODER_VIDEO);
+		assert_int_equal(video->dts, i);
+		assert_int_equal(video->size, VIDEO_SIZE);
+		assert_true(video->data_valid);
+		assert_int_equal(video->byte, (first_frame + i) & 0xFF);
+
+		assert_int_equal(audio->type, OBS_ENCODER_AUDIO);
+		assert_int_equal(audio->dts, i * 1600);
+		assert_int_equal(audio->dts_usec, video->dts_usec);
+		assert_int_equal(audio->size, AUDIO_SIZE);
+		assert_true(audio->data_valid);
+		assert_int_equal(audio->byte, (first_frame + i + 1) & 0xFF);
+	}
+
+	da_free(written);
+}
+
+static bool wait_for_spill(replay_store_t *store, int64_t max_memory)
+{
+	for (int i = 0; i < 500; i++) {
+		if (replay_store_get_memory_size(store) <= max_memory)
+			return true;
+		os_sleep_ms(10);
+	}
+	return false;
+}
+
+static size_t count_spill_files(void)
+{
+	os_dir_t *dir = os_opendir(SPILL_DIR);
+	struct os_dirent *ent;
+	size_t count = 0;
+
+	if (!dir)
+		return 0;
+
+	while ((ent = os_readdir(dir)) != NULL) {
+		const char *ext = strrchr(ent->d_name, '.');
+		if (!ent->directory && ext && strcmp(ext, ".spill") == 0)
+			count++;
+	}
+
+	os_closedir(dir);
+	return count;
+}
+
+/* the spill thread can still hold the last segment it spilled for a moment */
+static bool wait_for_spill_files_removed(void)
+{
+	for (int i = 0; i < 500; i++) {
+		if (count_spill_files() == 0)
+			return true;
+		os_sleep_ms(10);
+	}
+	return false;
+}
+
+static void append_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	replay_store_t *store = replay_store_create("append");
+	assert_non_null(store);
+
+	for (int64_t frame = 0; frame < 25; frame++)
+		push_frame(store, frame);
+
+	assert_int_equal(replay_store_get_size(store),
+			 25 * (VIDEO_SIZE + AUDIO_SIZE));
+	assert_int_equal(replay_store_get_memory_size(store),
+			 replay_store_get_size(store));
+
+	/* packets pushed after the snapshot was taken aren't part of it */
+	replay_snapshot_t *snapshot = replay_store_snapshot(store);
+	push_frame(store, 25);
+	check_snapshot(snapshot, 0, 25);
+	replay_snapshot_destroy(snapshot);
+
+	replay_store_clear(store);
+	assert_int_equal(replay_store_get_size(store), 0);
+	replay_store_destroy(store);
+}
+
+static void purge_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	replay_store_t *store = replay_store_create("purge");
+	struct encoder_packet next = {.type = OBS_ENCODER_VIDEO,
+				      .size = VIDEO_SIZE};
+
+	for (int64_t frame = 0; frame < 50; frame++)
+		push_frame(store, frame);
+
+	/* purging goes by whole segments, up to the keyframe at frame 20 */
+	next.dts_usec = 50 * 1000000 / 30;
+	replay_store_purge(store, 0, 1000000, &next);
+	assert_int_equal(replay_store_get_size(store),
+			 30 * (VIDEO_SIZE + AUDIO_SIZE));
+
+	replay_snapshot_t *snapshot = replay_store_snapshot(store);
+	check_snapshot(snapshot, 20, 30);
+	replay_snapshot_destroy(snapshot);
+
+	/* by size, but the last two keyframes are always kept */
+	replay_store_purge(store, 1, INT64_MAX, &next);
+	assert_int_equal(replay_store_get_size(store),
+			 20 * (VIDEO_SIZE + AUDIO_SIZE));
+	replay_store_purge(store, 1, INT64_MAX, &next);
+	assert_int_equal(replay_store_get_size(store),
+			 20 * (VIDEO_SIZE + AUDIO_SIZE));
+
+	replay_store_destroy(store);
+}
+
+static void spill_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	const int64_t max_memory = 2 * KEYFRAME_INTERVAL *
+				   (VIDEO_SIZE + AUDIO_SIZE);
+	replay_store_t *store = replay_store_create("spill");
+
+	replay_store_set_memory_limit(store, max_memory, SPILL_DIR);
+
+	for (int64_t frame = 0; frame < 60; frame++)
+		push_frame(store, frame);
+
+	assert_true(wait_for_spill(store, max_memory));
+	assert_int_equal(replay_store_get_size(store),
+			 60 * (VIDEO_SIZE + AUDIO_SIZE));
+	assert_true(count_spill_files() > 0);
+
+	/* spilled packets are read back from their files */
+	replay_snapshot_t *snapshot = replay_store_snapshot(store);
+	check_snapshot(snapshot, 0, 60);
+	replay_snapshot_destroy(snapshot);
+
+	/* purged segments take their files with them */
+	replay_store_clear(store);
+	assert_true(wait_for_spill_files_removed());
+
+	replay_store_destroy(store);
+	os_rmdir(SPILL_DIR);
+}
+
+/* segments spilled while a snapshot of them is held are loaded from their
+ * files when it's written */
+static void snapshot_across_spill_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	const int64_t max_memory = KEYFRAME_INTERVAL *
+				   (VIDEO_SIZE + AUDIO_SIZE);
+	replay_store_t *store = replay_store_create("snapshot");
+
+	for (int64_t frame = 0; frame < 40; frame++)
+		push_frame(store, frame);
+
+	replay_snapshot_t *snapshot = replay_store_snapshot(store);
+
+	replay_store_set_memory_limit(store, max_memory, SPILL_DIR);
+	assert_true(wait_for_spill(store, max_memory));
+	assert_true(count_spill_files() > 0);
+
+	/* the files stay until the snapshot is done with them */
+	replay_store_clear(store);
+	assert_true(count_spill_files() > 0);
+
+	check_snapshot(snapshot, 0, 40);
+	replay_snapshot_destroy(snapshot);
+	assert_true(wait_for_spill_files_removed());
+
+	replay_store_destroy(store);
+	os_rmdir(SPILL_DIR);
+}
+
+static void write_file(const char *path)
+{
+	assert_true(os_quick_write_utf8_file(path, "x", 1, false));
+}
+
+static void stale_spill_files_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	replay_store_t *store = replay_store_create("stale");
+
+	/* left behind by a session that crashed, and files of other kinds */
+	os_mkdirs(SPILL_DIR);
+	write_file(SPILL_DIR "/replay-1a2b-1-0.spill");
+	write_file(SPILL_DIR "/replay-1a2b-1-1.spill");
+	write_file(SPILL_DIR "/replay.txt");
+	write_file(SPILL_DIR "/notes.spill");
+
+	replay_store_set_memory_limit(store, 1, SPILL_DIR);
+	assert_false(os_file_exists(SPILL_DIR "/replay-1a2b-1-0.spill"));
+	assert_false(os_file_exists(SPILL_DIR "/replay-1a2b-1-1.spill"));
+	assert_true(os_file_exists(SPILL_DIR "/replay.txt"));
+	assert_true(os_file_exists(SPILL_DIR "/notes.spill"));
+
+	replay_store_destroy(store);
+
+	os_unlink(SPILL_DIR "/replay.txt");
+	os_unlink(SPILL_DIR "/notes.spill");
+	os_rmdir(SPILL_DIR);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(append_test),
+		cmocka_unit_test(purge_test),
+		cmocka_unit_test(spill_test),
+		cmocka_unit_test(snapshot_across_spill_test),
+		cmocka_unit_test(stale_spill_files_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
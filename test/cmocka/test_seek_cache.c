@@ -0,0 +1,118 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <string.h>
+#include <cmocka.h>
+
+#include "seek-cache.h"
+
+#define FRAME_WIDTH 64
+#define FRAME_HEIGHT 64
+#define FRAME_SIZE (FRAME_WIDTH * FRAME_HEIGHT * 3 / 2)
+
+static void keyframe_index_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	struct mp_seek_cache sc;
+	int64_t keyframe = -1;
+
+	mp_seek_cache_init(&sc, 0);
+
+	/* a keyframe every 10 packets, with the first 50 read twice like a
+	 * loop back to the start would */
+	for (int64_t pts = 0; pts < 100; pts++)
+		mp_seek_cache_index_packet(&sc, pts, pts % 10 == 0);
+	for (int64_t pts = 0; pts < 50; pts++)
+		mp_seek_cache_index_packet(&sc, pts, pts % 10 == 0);
+	assert_int_equal(sc.keyframes.num, 10);
+
+	assert_true(mp_seek_cache_find_keyframe(&sc, 55, &keyframe));
+	assert_int_equal(keyframe, 50);
+	assert_true(mp_seek_cache_find_keyframe(&sc, 60, &keyframe));
+	assert_int_equal(keyframe, 60);
+	assert_true(mp_seek_cache_find_keyframe(&sc, 5, &keyframe));
+	assert_int_equal(keyframe, 0);
+	assert_false(mp_seek_cache_find_keyframe(&sc, -1, &keyframe));
+
+	/* past the indexed part of the file nothing is known, and packets read
+	 * from there would leave a gap in the index */
+	assert_false(mp_seek_cache_find_keyframe(&sc, 500, &keyframe));
+	mp_seek_cache_index_packet(&sc, 500, true);
+	assert_int_equal(sc.keyframes.num, 10);
+
+	/* back in the indexed part, indexing carries on */
+	assert_true(mp_seek_cache_find_keyframe(&sc, 95, &keyframe));
+	assert_int_equal(keyframe, 90);
+	for (int64_t pts = 90; pts < 120; pts++)
+		mp_seek_cache_index_packet(&sc, pts, pts % 10 == 0);
+	assert_true(mp_seek_cache_find_keyframe(&sc, 115, &keyframe));
+	assert_int_equal(keyframe, 110);
+
+	mp_seek_cache_free(&sc);
+}
+
+static void add_frame(struct mp_seek_cache *sc, uint8_t val)
+{
+	struct obs_source_frame frame = {0};
+
+	obs_source_frame_init(&frame, VIDEO_FORMAT_I420, FRAME_WIDTH,
+			      FRAME_HEIGHT);
+	memset(frame.data[0], val, FRAME_WIDTH * FRAME_HEIGHT);
+
+	mp_seek_cache_add_frame(sc, &frame, val * 100, 100);
+	obs_source_frame_free(&frame);
+}
+
+/* frames are found by any time they're shown at, and the least recently
+ * used ones go first once the budget is used up */
+static void frame_cache_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	struct mp_seek_cache sc;
+	struct mp_cached_frame *cached;
+
+	mp_seek_cache_init(&sc, FRAME_SIZE * 10);
+
+	for (uint8_t i = 0; i < 20; i++)
+		add_frame(&sc, i);
+
+	assert_int_equal(sc.frames.num, 10);
+	assert_true(sc.size <= sc.max_size);
+	assert_null(mp_seek_cache_get_frame(&sc, 950));
+
+	cached = mp_seek_cache_get_frame(&sc, 1050);
+	assert_non_null(cached);
+	assert_int_equal(cached->pts, 1000);
+	assert_int_equal(cached->frame.data[0][0], 10);
+	assert_int_equal(cached->frame.width, FRAME_WIDTH);
+
+	cached = mp_seek_cache_get_frame(&sc, 1999);
+	assert_non_null(cached);
+	assert_int_equal(cached->frame.data[0][0], 19);
+	assert_null(mp_seek_cache_get_frame(&sc, 2000));
+
+	/* 10 was just used, so 11 is the next one out */
+	mp_seek_cache_get_frame(&sc, 1000);
+	add_frame(&sc, 20);
+	assert_non_null(mp_seek_cache_get_frame(&sc, 1000));
+	assert_null(mp_seek_cache_get_frame(&sc, 1100));
+	assert_non_null(mp_seek_cache_get_frame(&sc, 2000));
+
+	/* a frame that's already cached isn't copied again */
+	add_frame(&sc, 20);
+	assert_int_equal(sc.frames.num, 10);
+
+	mp_seek_cache_free(&sc);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(keyframe_index_test),
+		cmocka_unit_test(frame_cache_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
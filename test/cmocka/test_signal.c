@@ -0,0 +1,228 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <util/bmem.h>
+#include <util/threading.h>
+#include <callback/signal.h>
+
+struct counter {
+	signal_handler_t *handler;
+	long calls;
+	bool remove;
+	bool disconnect;
+};
+
+static void count_callback(void *data, calldata_t *cd)
+{
+	struct counter *counter = data;
+	counter->calls++;
+
+	if (counter->remove)
+		signal_handler_remove_current();
+	if (counter->disconnect)
+		signal_handler_disconnect(counter->handler, "test",
+					  count_callback, counter);
+
+	UNUSED_PARAMETER(cd);
+}
+
+static void signal_id_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	signal_handler_t *handler = signal_handler_create();
+	struct counter counter = {handler};
+	calldata_t cd = {0};
+
+	assert_true(signal_handler_add(handler, "void first()"));
+	assert_true(signal_handler_add(handler, "void test(int value)"));
+	assert_false(signal_handler_add(handler, "void test(int value)"));
+
+	assert_int_equal(signal_handler_get_id(handler, "first"), 0);
+	assert_int_equal(signal_handler_get_id(handler, "test"), 1);
+	assert_int_equal(signal_handler_get_id(handler, "none"),
+			 SIGNAL_ID_INVALID);
+
+	signal_handler_connect(handler, "test", count_callback, &counter);
+	signal_handler_connect(handler, "test", count_callback, &counter);
+
+	signal_handler_signal(handler, "test", &cd);
+	signal_handler_signal_id(handler, 1, &cd);
+	signal_handler_signal_id(handler, 0, &cd);
+	signal_handler_signal_id(handler, 2, &cd);
+	assert_int_equal(counter.calls, 2);
+
+	signal_handler_disconnect(handler, "test", count_callback, &counter);
+	signal_handler_signal(handler, "test", &cd);
+	assert_int_equal(counter.calls, 2);
+
+	signal_handler_destroy(handler);
+}
+
+/* callbacks can remove and disconnect themselves and each other while the
+ * signal is being emitted */
+static void signal_remove_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	signal_handler_t *handler = signal_handler_create();
+	struct counter removed = {handler, .remove = true};
+	struct counter disconnected = {handler, .disconnect = true};
+	struct counter kept = {handler};
+	calldata_t cd = {0};
+
+	signal_handler_add(handler, "void test()");
+	signal_handler_connect(handler, "test", count_callback, &removed);
+	signal_handler_connect(handler, "test", count_callback, &disconnected);
+	signal_handler_connect(handler, "test", count_callback, &kept);
+
+	signal_handler_signal(handler, "test", &cd);
+	signal_handler_signal(handler, "test", &cd);
+
+	assert_int_equal(removed.calls, 1);
+	assert_int_equal(disconnected.calls, 1);
+	assert_int_equal(kept.calls, 2);
+
+	signal_handler_destroy(handler);
+}
+
+struct emit_thread {
+	signal_handler_t *handler;
+	volatile bool stop;
+};
+
+static void *emit_thread(void *data)
+{
+	struct emit_thread *et = data;
+	calldata_t cd = {0};
+
+	while (!os_atomic_load_bool(&et->stop))
+		signal_handler_signal_id(et->handler, 0, &cd);
+
+	return NULL;
+}
+
+static volatile long late_calls = 0;
+
+static void alive_callback(void *data, calldata_t *cd)
+{
+	volatile long *alive = data;
+	if (!os_atomic_load_long(alive))
+		os_atomic_inc_long(&late_calls);
+
+	UNUSED_PARAMETER(cd);
+}
+
+/* once disconnect returns the callback must not be called anymore, even
+ * though emission doesn't hold a lock while calling out */
+static void signal_disconnect_race_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	signal_handler_t *handler = signal_handler_create();
+	struct emit_thread et = {handler, false};
+	pthread_t thread;
+
+	signal_handler_add(handler, "void test()");
+	pthread_create(&thread, NULL, emit_thread, &et);
+
+	for (int i = 0; i < 10000; i++) {
+		volatile long *alive = bmalloc(sizeof(*alive));
+		*alive = 1;
+
+		signal_handler_connect(handler, "test", alive_callback,
+				       (void *)alive);
+		signal_handler_disconnect(handler, "test", alive_callback,
+					  (void *)alive);
+
+		os_atomic_set_long(alive, 0);
+		bfree((void *)alive);
+	}
+
+	os_atomic_set_bool(&et.stop, true);
+	pthread_join(thread, NULL);
+	signal_handler_destroy(handler);
+
+	assert_int_equal(late_calls, 0);
+}
+
+struct cross_emit {
+	signal_handler_t *handler;
+	struct cross_emit *other;
+	os_sem_t *inside;
+	long calls;
+};
+
+static void empty_callback(void *data, calldata_t *cd)
+{
+	UNUSED_PARAMETER(data);
+	UNUSED_PARAMETER(cd);
+}
+
+static void cross_callback(void *data, calldata_t *cd)
+{
+	struct cross_emit *ce = calldata_ptr(cd, "emit");
+
+	/* both threads are inside an emission before either disconnects */
+	os_sem_post(ce->other->inside);
+	os_sem_wait(ce->inside);
+
+	signal_handler_connect(ce->handler, "test", empty_callback, ce);
+	signal_handler_disconnect(ce->handler, "test", empty_callback, ce);
+	ce->calls++;
+
+	UNUSED_PARAMETER(data);
+}
+
+static void *cross_emit_thread(void *data)
+{
+	struct cross_emit *ce = data;
+	calldata_t cd = {0};
+
+	calldata_set_ptr(&cd, "emit", ce);
+	for (int i = 0; i < 1000; i++)
+		signal_handler_signal(ce->handler, "test", &cd);
+	calldata_free(&cd);
+
+	return NULL;
+}
+
+/* two threads emitting the same signal each disconnect from it in a
+ * callback, neither may wait for the other's emission to finish */
+static void signal_cross_disconnect_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	signal_handler_t *handler = signal_handler_create();
+	struct cross_emit ce[2] = {{handler, &ce[1]}, {handler, &ce[0]}};
+	pthread_t threads[2];
+
+	signal_handler_add(handler, "void test()");
+	signal_handler_connect(handler, "test", cross_callback, NULL);
+
+	for (size_t i = 0; i < 2; i++)
+		assert_int_equal(os_sem_init(&ce[i].inside, 0), 0);
+	for (size_t i = 0; i < 2; i++)
+		pthread_create(&threads[i], NULL, cross_emit_thread, &ce[i]);
+	for (size_t i = 0; i < 2; i++) {
+		pthread_join(threads[i], NULL);
+		os_sem_destroy(ce[i].inside);
+		assert_int_equal(ce[i].calls, 1000);
+	}
+
+	signal_handler_destroy(handler);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(signal_id_test),
+		cmocka_unit_test(signal_remove_test),
+		cmocka_unit_test(signal_disconnect_race_test),
+		cmocka_unit_test(signal_cross_disconnect_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
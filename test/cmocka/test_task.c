@@ -0,0 +1,192 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <util/task.h>
+
+#define NUM_QUEUES 8
+#define NUM_TASKS 1000
+
+struct queue_data {
+	os_task_queue_t *queue;
+	os_task_queue_t *other;
+	long next;
+	volatile long errors;
+};
+
+struct task_data {
+	struct queue_data *queue;
+	long idx;
+};
+
+static void ordered_task(void *param)
+{
+	struct task_data *task = param;
+	struct queue_data *data = task->queue;
+
+	if (task->idx != data->next++)
+		os_atomic_inc_long(&data->errors);
+	if (!os_task_queue_inside(data->queue) ||
+	    os_task_queue_inside(data->other))
+		os_atomic_inc_long(&data->errors);
+}
+
+/* tasks of each queue run in order and one at a time, even though all of
+ * the queues share the same threads */
+static void task_queue_order_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	struct queue_data queues[NUM_QUEUES] = {0};
+	struct task_data *tasks =
+		bzalloc(sizeof(*tasks) * NUM_QUEUES * NUM_TASKS);
+
+	for (size_t i = 0; i < NUM_QUEUES; i++) {
+		queues[i].queue = os_task_queue_create();
+		assert_non_null(queues[i].queue);
+	}
+	for (size_t i = 0; i < NUM_QUEUES; i++)
+		queues[i].other = queues[(i + 1) % NUM_QUEUES].queue;
+
+	os_task_queue_set_priority(queues[0].queue, OS_WORK_PRIORITY_HIGH);
+	os_task_queue_set_priority(queues[1].queue, OS_WORK_PRIORITY_LOW);
+
+	for (long j = 0; j < NUM_TASKS; j++) {
+		for (size_t i = 0; i < NUM_QUEUES; i++) {
+			struct task_data *task = &tasks[i * NUM_TASKS + j];
+			task->queue = &queues[i];
+			task->idx = j;
+			assert_true(os_task_queue_queue_task(
+				queues[i].queue, ordered_task, task));
+		}
+	}
+
+	for (size_t i = 0; i < NUM_QUEUES; i++) {
+		os_task_queue_wait(queues[i].queue);
+		assert_int_equal(queues[i].next, NUM_TASKS);
+		assert_int_equal(queues[i].errors, 0);
+		assert_false(os_task_queue_inside(queues[i].queue));
+	}
+
+	for (size_t i = 0; i < NUM_QUEUES; i++)
+		os_task_queue_destroy(queues[i].queue);
+	bfree(tasks);
+}
+
+static void sleep_task(void *param)
+{
+	os_sleep_ms(50);
+	UNUSED_PARAMETER(param);
+}
+
+static void empty_task(void *param)
+{
+	UNUSED_PARAMETER(param);
+}
+
+static void task_queue_wait_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	os_task_queue_t *queue = os_task_queue_create();
+
+	/* nothing was queued */
+	assert_false(os_task_queue_wait(queue));
+
+	/* empty_task is still queued behind sleep_task when waiting */
+	os_task_queue_queue_task(queue, sleep_task, NULL);
+	os_task_queue_queue_task(queue, empty_task, NULL);
+	assert_true(os_task_queue_wait(queue));
+
+	os_task_queue_destroy(queue);
+}
+
+static void wait_shared_task(void *param)
+{
+	struct queue_data *data = param;
+
+	if (!os_task_queue_wait(data->other))
+		os_atomic_inc_long(&data->errors);
+}
+
+/* more tasks than there are pool threads wait on another queue, which only
+ * works out if waiting tasks keep the pool going */
+static void task_queue_nested_wait_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	size_t count = (size_t)os_get_logical_cores() * 2 + 1;
+	struct queue_data *queues = bzalloc(sizeof(*queues) * count);
+	os_task_queue_t *shared = os_task_queue_create();
+
+	os_task_queue_queue_task(shared, sleep_task, NULL);
+
+	for (size_t i = 0; i < count; i++) {
+		queues[i].queue = os_task_queue_create();
+		queues[i].other = shared;
+		os_task_queue_queue_task(shared, empty_task, NULL);
+		os_task_queue_queue_task(queues[i].queue, wait_shared_task,
+					 &queues[i]);
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		os_task_queue_destroy(queues[i].queue);
+		assert_int_equal(queues[i].errors, 0);
+	}
+
+	os_task_queue_destroy(shared);
+	bfree(queues);
+}
+
+static void block_task(void *param)
+{
+	os_sem_wait(param);
+}
+
+/* more queues than there are pool threads block, which only works out if
+ * they have threads of their own */
+static void task_queue_dedicated_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	size_t count = (size_t)os_get_logical_cores() * 2 + 1;
+	os_task_queue_t **blocked = bzalloc(sizeof(*blocked) * count);
+	os_task_queue_t *shared = os_task_queue_create();
+	os_sem_t *sem;
+
+	assert_int_equal(os_sem_init(&sem, 0), 0);
+
+	for (size_t i = 0; i < count; i++) {
+		blocked[i] = os_task_queue_create_dedicated();
+		assert_non_null(blocked[i]);
+		os_task_queue_queue_task(blocked[i], block_task, sem);
+	}
+
+	os_task_queue_queue_task(shared, empty_task, NULL);
+	os_task_queue_wait(shared);
+
+	for (size_t i = 0; i < count; i++)
+		os_sem_post(sem);
+	for (size_t i = 0; i < count; i++)
+		os_task_queue_destroy(blocked[i]);
+
+	os_task_queue_destroy(shared);
+	os_sem_destroy(sem);
+	bfree(blocked);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(task_queue_order_test),
+		cmocka_unit_test(task_queue_wait_test),
+		cmocka_unit_test(task_queue_nested_wait_test),
+		cmocka_unit_test(task_queue_dedicated_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,281 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <string.h>
+#include <cmocka.h>
+
+#include <util/platform.h>
+#include <util/threading.h>
+#include <media-io/video-io.h>
+#include <media-io/video-frame.h>
+
+#define NUM_FRAMES 120
+
+struct test_input {
+	uint32_t sleep_ms;
+	uint64_t frame_time;
+	uint64_t first_ts;
+	uint8_t last_val;
+	long frames;
+	long repeats;
+	bool gap;
+	bool overwritten;
+};
+
+static void receive_frame(void *param, struct video_data *frame)
+{
+	struct test_input *input = param;
+	uint8_t val = frame->data[0][0];
+
+	/* raw encoders number frames by count, so the timestamps have to be
+	 * exactly one frame time apart, even for an input that falls behind */
+	if (!input->frames)
+		input->first_ts = frame->timestamp;
+	else if (frame->timestamp !=
+		 input->first_ts + input->frames * input->frame_time)
+		input->gap = true;
+
+	if (input->frames && val == input->last_val)
+		input->repeats++;
+	input->last_val = val;
+
+	if (input->sleep_ms)
+		os_sleep_ms(input->sleep_ms);
+
+	/* the frame must not be reused while the input still works on it */
+	if (frame->data[0][0] != val)
+		input->overwritten = true;
+
+	input->frames++;
+}
+
+static video_t *open_video(void)
+{
+	struct video_output_info info = {0};
+	video_t *video = NULL;
+
+	info.name = "test";
+	info.format = VIDEO_FORMAT_NV12;
+	info.width = 64;
+	info.height = 64;
+	info.fps_num = 60;
+	info.fps_den = 1;
+	info.cache_size = 6;
+	info.colorspace = VIDEO_CS_709;
+	info.range = VIDEO_RANGE_PARTIAL;
+
+	assert_int_equal(video_output_open(&video, &info),
+			 VIDEO_OUTPUT_SUCCESS);
+	return video;
+}
+
+static void output_frames(video_t *video, size_t count)
+{
+	uint64_t frame_time = video_output_get_frame_time(video);
+
+	for (size_t i = 1; i <= count; i++) {
+		struct video_frame frame;
+
+		if (video_output_lock_frame(video, &frame, 1,
+					    i * frame_time)) {
+			memset(frame.data[0], (uint8_t)i, 64);
+			video_output_unlock_frame(video);
+		}
+
+		os_sleep_ms(2);
+	}
+
+	/* let the inputs catch up */
+	os_sleep_ms(200);
+}
+
+static bool wait_for_frames(video_t *video, struct test_input *input,
+			    uint32_t frames)
+{
+	for (int i = 0; i < 1000; i++) {
+		if (video_output_get_input_total_frames(video, receive_frame,
+							input) == frames)
+			return true;
+		os_sleep_ms(10);
+	}
+	return false;
+}
+
+/* slow inputs get repeated frames, but only they do, and every input still
+ * gets every frame time */
+static void video_io_slow_input_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	video_t *video = open_video();
+	uint64_t frame_time = video_output_get_frame_time(video);
+	struct test_input fast = {.frame_time = frame_time};
+	struct test_input slow[3] = {0};
+	struct test_input half = {.frame_time = frame_time * 2, .sleep_ms = 10};
+
+	assert_true(video_output_connect(video, NULL, receive_frame, &fast));
+	for (size_t i = 0; i < 3; i++) {
+		slow[i].frame_time = frame_time;
+		slow[i].sleep_ms = 10;
+		assert_true(video_output_connect(video, NULL, receive_frame,
+						 &slow[i]));
+	}
+	assert_true(video_output_connect2(video, NULL, 2, receive_frame,
+					  &half));
+
+	output_frames(video, NUM_FRAMES);
+
+	assert_true(wait_for_frames(video, &fast, NUM_FRAMES));
+	assert_int_equal(video_output_get_input_skipped_frames(
+				 video, receive_frame, &fast),
+			 0);
+	assert_int_equal(fast.repeats, 0);
+	assert_false(fast.gap);
+	assert_false(fast.overwritten);
+
+	for (size_t i = 0; i < 3; i++) {
+		uint32_t skipped;
+
+		assert_true(wait_for_frames(video, &slow[i], NUM_FRAMES));
+		skipped = video_output_get_input_skipped_frames(
+			video, receive_frame, &slow[i]);
+
+		assert_true(skipped > 0);
+		assert_int_equal(slow[i].repeats, skipped);
+		assert_int_equal(video_output_get_input_queued_frames(
+					 video, receive_frame, &slow[i]),
+				 0);
+		assert_false(slow[i].gap);
+		assert_false(slow[i].overwritten);
+	}
+
+	assert_true(wait_for_frames(video, &half, NUM_FRAMES / 2));
+	assert_false(half.gap);
+	assert_false(half.overwritten);
+
+	video_output_disconnect(video, receive_frame, &fast);
+	for (size_t i = 0; i < 3; i++)
+		video_output_disconnect(video, receive_frame, &slow[i]);
+	video_output_disconnect(video, receive_frame, &half);
+	assert_int_equal(
+		video_output_get_input_total_frames(video, receive_frame, &fast),
+		0);
+
+	video_output_close(video);
+}
+
+struct query_input {
+	video_t *video;
+	os_event_t *in_callback;
+};
+
+static void query_self(void *param, struct video_data *frame)
+{
+	struct query_input *qi = param;
+
+	os_event_signal(qi->in_callback);
+	os_sleep_ms(20);
+	video_output_get_input_total_frames(qi->video, query_self, qi);
+
+	UNUSED_PARAMETER(frame);
+}
+
+/* a callback calling into video-io must not deadlock a disconnect */
+static void video_io_disconnect_in_callback_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	struct query_input qi = {0};
+	video_t *video = open_video();
+	qi.video = video;
+
+	assert_int_equal(os_event_init(&qi.in_callback, OS_EVENT_TYPE_AUTO),
+			 0);
+	assert_true(video_output_connect(video, NULL, query_self, &qi));
+
+	struct video_frame frame;
+	assert_true(video_output_lock_frame(video, &frame, 1, 1));
+	video_output_unlock_frame(video);
+
+	os_event_wait(qi.in_callback);
+	video_output_disconnect(video, query_self, &qi);
+	assert_false(video_output_active(video));
+
+	video_output_close(video);
+	os_event_destroy(qi.in_callback);
+}
+
+struct self_disconnect {
+	video_t *video;
+	volatile long frames;
+	uint32_t sleep_ms;
+};
+
+static void disconnect_self(void *param, struct video_data *frame)
+{
+	struct self_disconnect *sd = param;
+
+	if (os_atomic_inc_long(&sd->frames) == 3) {
+		video_output_disconnect(sd->video, disconnect_self, sd);
+		if (sd->sleep_ms)
+			os_sleep_ms(sd->sleep_ms);
+	}
+
+	UNUSED_PARAMETER(frame);
+}
+
+static void video_io_disconnect_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	struct self_disconnect sd = {0};
+	video_t *video = open_video();
+	sd.video = video;
+
+	assert_true(video_output_connect(video, NULL, disconnect_self, &sd));
+
+	output_frames(video, 10);
+
+	assert_int_equal(os_atomic_load_long(&sd.frames), 3);
+	assert_false(video_output_active(video));
+
+	video_output_close(video);
+}
+
+/* closing must wait for an input that is still finishing its callback */
+static void video_io_disconnect_close_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	struct self_disconnect sd = {.sleep_ms = 100};
+	video_t *video = open_video();
+	sd.video = video;
+
+	assert_true(video_output_connect(video, NULL, disconnect_self, &sd));
+
+	for (size_t i = 1; i <= 3; i++) {
+		struct video_frame frame;
+
+		if (video_output_lock_frame(video, &frame, 1, i))
+			video_output_unlock_frame(video);
+		os_sleep_ms(10);
+	}
+
+	while (os_atomic_load_long(&sd.frames) < 3)
+		os_sleep_ms(1);
+
+	video_output_close(video);
+	assert_int_equal(os_atomic_load_long(&sd.frames), 3);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(video_io_slow_input_test),
+		cmocka_unit_test(video_io_disconnect_test),
+		cmocka_unit_test(video_io_disconnect_in_callback_test),
+		cmocka_unit_test(video_io_disconnect_close_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,67 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <string.h>
+#include <cmocka.h>
+
+#include <util/bmem.h>
+#include <media-io/video-slices.h>
+
+static void fill_random(uint8_t *data, size_t size, uint32_t seed)
+{
+	for (size_t i = 0; i < size; i++) {
+		seed = seed * 1664525 + 1013904223;
+		data[i] = (uint8_t)(seed >> 24);
+	}
+}
+
+static void check_copy(video_slices_t *vs, uint32_t row_bytes, uint32_t rows,
+		       uint32_t src_linesize, uint32_t dst_linesize)
+{
+	uint8_t *src = bmalloc((size_t)src_linesize * rows);
+	uint8_t *dst = bzalloc((size_t)dst_linesize * rows);
+
+	fill_random(src, (size_t)src_linesize * rows, rows);
+
+	video_slices_add_copy(vs, dst, dst_linesize, src, src_linesize,
+			      row_bytes, rows);
+	video_slices_run(vs);
+
+	for (uint32_t y = 0; y < rows; y++) {
+		const uint8_t *dst_row = dst + (size_t)y * dst_linesize;
+		assert_memory_equal(dst_row, src + (size_t)y * src_linesize,
+				    row_bytes);
+		for (uint32_t x = row_bytes; x < dst_linesize; x++)
+			assert_int_equal(dst_row[x], 0);
+	}
+
+	bfree(src);
+	bfree(dst);
+}
+
+static void slices_copy_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	video_slices_t *vs = video_slices_create(4);
+	assert_non_null(vs);
+
+	/* before and after the pool is needed for the first time */
+	check_copy(vs, 7, 3, 16, 8);
+	check_copy(NULL, 1920, 1080, 2048, 1920);
+	check_copy(vs, 1920, 1080, 1920, 1920);
+	check_copy(vs, 1920, 1080, 2048, 1920);
+	check_copy(vs, 3840 * 4, 2160, 3840 * 4 + 256, 3840 * 4 + 64);
+	check_copy(vs, 7, 3, 16, 8);
+
+	video_slices_destroy(vs);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(slices_copy_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
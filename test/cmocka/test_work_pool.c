@@ -0,0 +1,145 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <cmocka.h>
+
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <util/work-pool.h>
+
+#define NUM_JOBS 1000
+
+struct job_data {
+	volatile long *counter;
+	long order;
+	volatile long done;
+};
+
+static void count_job(void *param)
+{
+	struct job_data *data = param;
+	data->order = os_atomic_inc_long(data->counter);
+	os_atomic_set_long(&data->done, 1);
+}
+
+static void work_pool_all_jobs_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	os_work_pool_t *pool = os_work_pool_create(4);
+	os_work_batch_t *batch = os_work_batch_create(NULL);
+	struct job_data *jobs = bzalloc(sizeof(*jobs) * NUM_JOBS);
+	volatile long counter = 0;
+
+	assert_non_null(pool);
+	assert_int_equal(os_work_pool_get_thread_count(pool), 4);
+
+	for (size_t i = 0; i < NUM_JOBS; i++) {
+		jobs[i].counter = &counter;
+		os_work_batch_add(batch, count_job, &jobs[i]);
+	}
+
+	/* batches can be run again */
+	for (int run = 1; run <= 3; run++) {
+		os_work_batch_run(pool, batch);
+		assert_int_equal(counter, NUM_JOBS * run);
+	}
+
+	bfree(jobs);
+	os_work_batch_destroy(batch);
+	os_work_pool_destroy(pool);
+}
+
+/* every job of a binary tree runs after both of its children */
+static void work_pool_dependency_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	os_work_pool_t *pool = os_work_pool_create(0);
+	os_work_batch_t *batch = os_work_batch_create(NULL);
+	struct job_data *jobs = bzalloc(sizeof(*jobs) * NUM_JOBS);
+	volatile long counter = 0;
+
+	for (size_t i = 0; i < NUM_JOBS; i++) {
+		jobs[i].counter = &counter;
+		os_work_batch_add(batch, count_job, &jobs[i]);
+	}
+
+	for (size_t i = 1; i < NUM_JOBS; i++)
+		os_work_batch_add_dependency(batch, (i - 1) / 2, i);
+
+	os_work_batch_run(pool, batch);
+
+	for (size_t i = 1; i < NUM_JOBS; i++)
+		assert_true(jobs[(i - 1) / 2].order > jobs[i].order);
+	assert_int_equal(jobs[0].order, NUM_JOBS);
+
+	bfree(jobs);
+	os_work_batch_destroy(batch);
+	os_work_pool_destroy(pool);
+}
+
+struct runner {
+	os_work_pool_t *pool;
+	os_work_batch_t *batch;
+	struct job_data jobs[64];
+	volatile long counter;
+};
+
+static void *run_batch_thread(void *param)
+{
+	struct runner *runner = param;
+
+	for (int i = 0; i < 200; i++)
+		os_work_batch_run(runner->pool, runner->batch);
+
+	return NULL;
+}
+
+/* the graphics and audio threads run their batches on the same pool */
+static void work_pool_concurrent_test(void **state)
+{
+	UNUSED_PARAMETER(state);
+
+	os_work_pool_t *pool = os_work_pool_create(2);
+	struct runner runners[2] = {0};
+	pthread_t threads[2];
+
+	for (size_t r = 0; r < 2; r++) {
+		runners[r].pool = pool;
+		runners[r].batch = os_work_batch_create(NULL);
+
+		for (size_t i = 0; i < 64; i++) {
+			runners[r].jobs[i].counter = &runners[r].counter;
+			os_work_batch_add(runners[r].batch, count_job,
+					  &runners[r].jobs[i]);
+			if (i)
+				os_work_batch_add_dependency(runners[r].batch,
+							     i, i - 1);
+		}
+
+		pthread_create(&threads[r], NULL, run_batch_thread,
+			       &runners[r]);
+	}
+
+	for (size_t r = 0; r < 2; r++) {
+		pthread_join(threads[r], NULL);
+		assert_int_equal(runners[r].counter, 64 * 200);
+		os_work_batch_destroy(runners[r].batch);
+	}
+
+	os_work_pool_destroy(pool);
+}
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(work_pool_all_jobs_test),
+		cmocka_unit_test(work_pool_dependency_test),
+		cmocka_unit_test(work_pool_concurrent_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -31,11 +31,14 @@ static void random_destroy(void *data)
 	}
 }
 
-static inline void fill_texture(uint32_t *pixels)
+static inline void fill_texture(struct obs_source_frame *frame)
 {
 	size_t x, y;
 
 	for (y = 0; y < 20; y++) {
+		uint32_t *pixels =
+			(uint32_t *)(frame->data[0] + y * frame->linesize[0]);
+
 		for (x = 0; x < 20; x++) {
 			uint32_t pixel = 0;
 			pixel |= (rand() % 256);
@@ -43,7 +46,7 @@ static inline void fill_texture(uint32_t *pixels)
 			pixel |= (rand() % 256) << 16;
 			//pixel |= (rand()%256) << 24;
 			//pixel |= 0xFFFFFFFF;
-			pixels[y * 20 + x] = pixel;
+			pixels[x] = pixel;
 		}
 	}
 }
@@ -51,23 +54,17 @@ static inline void fill_texture(uint32_t *pixels)
 static void *video_thread(void *data)
 {
 	struct random_tex *rt = data;
-	uint32_t pixels[20 * 20];
 	uint64_t cur_time = os_gettime_ns();
 
-	struct obs_source_frame frame = {
-		.data = {[0] = (uint8_t *)pixels},
-		.linesize = {[0] = 20 * 4},
-		.width = 20,
-		.height = 20,
-		.format = VIDEO_FORMAT_BGRX,
-	};
-
 	while (os_event_try(rt->stop_signal) == EAGAIN) {
-		fill_texture(pixels);
+		struct obs_source_frame *frame = obs_source_borrow_video_frame(
+			rt->source, VIDEO_FORMAT_BGRX, 20, 20);
 
-		frame.timestamp = cur_time;
-
-		obs_source_output_video(rt->source, &frame);
+		if (frame) {
+			fill_texture(frame);
+			frame->timestamp = cur_time;
+			obs_source_commit_video_frame(rt->source, frame);
+		}
 
 		os_sleepto_ns(cur_time += 250000000);
 	}